@@ -34,6 +34,8 @@
 
 #define KERNEL_SOCKET_PATH "flexnic_os"
 #define KERNEL_SOCKET_PATH_APPVM KERNEL_SOCKET_PATH "_appvm"
+/** Datagram socket for runtime budget control with text commands */
+#define KERNEL_SOCKET_PATH_BUDGET KERNEL_SOCKET_PATH "_budget"
 #define KERNEL_UXSOCK_MAXQ 8
 
 struct kernel_uxsock_request {
@@ -51,6 +53,9 @@ struct kernel_uxsock_response {
   uint32_t status;
   uint16_t flexnic_db_id;
   uint16_t flexnic_qs_num;
+  /* VM the context belongs to, with flexnic_db_id indexes the doorbell */
+  uint16_t flexnic_vm_id;
+  uint16_t _pad[3];
 
   struct {
     uint64_t rxq_off;
@@ -72,6 +77,7 @@ enum kernel_appout_type {
   KERNEL_APPOUT_ACCEPT_CONN,
   KERNEL_APPOUT_REQ_SCALE,
   KERNEL_APPOUT_FORK,
+  KERNEL_APPOUT_ACCEPT_CONNS,
 };
 
 /** Open a new connection */
@@ -117,6 +123,10 @@ struct kernel_appout_listen_move {
 } __attribute__((packed));
 
 #define KERNEL_APPOUT_LISTEN_REUSEPORT 0x1
+/** Deliver accepted connections to the context that posted the accept */
+#define KERNEL_APPOUT_LISTEN_STEER_CTX 0x2
+/** Complete SYNs into accepts posted for the flow's fast path core first */
+#define KERNEL_APPOUT_LISTEN_STEER_CORE 0x4
 /** Open listener */
 struct kernel_appout_listen_open {
   uint64_t opaque;
@@ -138,6 +148,19 @@ struct kernel_appout_accept_conn {
   uint16_t local_port;
 } __attribute__((packed));
 
+#define KERNEL_APPOUT_ACCEPT_BATCH 6
+#define KERNEL_APPOUT_ACCEPT_ANYCORE 0xffff
+/** Post up to KERNEL_APPOUT_ACCEPT_BATCH accepts on a listening socket */
+struct kernel_appout_accept_conns {
+  uint64_t listen_opaque;
+  uint64_t conn_opaques[KERNEL_APPOUT_ACCEPT_BATCH];
+  uint16_t local_port;
+  /* fast path core the posting context is paired with, or
+   * KERNEL_APPOUT_ACCEPT_ANYCORE */
+  uint16_t core;
+  uint8_t num;
+} __attribute__((packed));
+
 /** Handle a fork of the process */
 struct kernel_appout_fork {
   uint64_t pid;
@@ -160,6 +183,7 @@ struct kernel_appout {
     struct kernel_appout_listen_close listen_close;
     struct kernel_appout_listen_move  listen_move;
     struct kernel_appout_accept_conn  accept_conn;
+    struct kernel_appout_accept_conns accept_conns;
 
     struct kernel_appout_fork         fork;
 
@@ -212,6 +236,8 @@ struct kernel_appin_conn_opened {
   uint32_t in_local_ip;
   uint16_t local_port;
   uint16_t fn_core;
+  /* payload bytes per segment negotiated in the handshake */
+  uint16_t mss;
 } __attribute__((packed));
 
 /** New connection on listener received */
@@ -241,6 +267,8 @@ struct kernel_appin_accept_conn {
   uint32_t in_remote_ip;
   uint16_t remote_port;
   uint16_t fn_core;
+  /* payload bytes per segment negotiated in the handshake */
+  uint16_t mss;
 } __attribute__((packed));
 
 /** Common struct for events on app -> kernel queue */
@@ -250,11 +278,11 @@ struct kernel_appin {
     struct kernel_appin_conn_opened     conn_opened;
     struct kernel_appin_listen_newconn  listen_newconn;
     struct kernel_appin_accept_conn     accept_connection;
-    uint8_t raw[72];
+    uint8_t raw[74];
   } __attribute__((packed)) data;
   uint8_t type;
 } __attribute__((packed));
 
-STATIC_ASSERT(sizeof(struct kernel_appin) == 73, kernel_appin_size);
+STATIC_ASSERT(sizeof(struct kernel_appin) == 75, kernel_appin_size);
 
 #endif /* ndef KERNEL_APPIF_H_ */
@@ -192,6 +192,7 @@ struct tcp_hdr {
 #define TCP_OPT_END_OF_OPTIONS 0
 #define TCP_OPT_NO_OP 1
 #define TCP_OPT_MSS 2
+#define TCP_OPT_WINDOW_SCALE 3
 #define TCP_OPT_TIMESTAMP 8
 struct tcp_mss_opt {
   uint8_t kind;
@@ -199,6 +200,14 @@ struct tcp_mss_opt {
   beui16_t mss;
 } __attribute__((packed));
 
+/** Maximum window scale shift count (RFC 7323) */
+#define TCP_WSCALE_MAX 14
+struct tcp_ws_opt {
+  uint8_t kind;
+  uint8_t length;
+  uint8_t shift;
+} __attribute__((packed));
+
 
 struct tcp_timestamp_opt {
   uint8_t kind;
@@ -25,8 +25,10 @@
 #ifndef FLEXTCP_PLIF_H_
 #define FLEXTCP_PLIF_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <utils.h>
+#include <utils_doorbell.h>
 #include <stdatomic.h>
 #include <packet_defs.h>
 
@@ -44,6 +46,8 @@
 #define FLEXNIC_NAME_DMA_MEM "tas_memory"
 /** Name for flexnic internal shared memory region. */
 #define FLEXNIC_NAME_INTERNAL_MEM "tas_internal"
+/** Name for the doorbell shared memory region. */
+#define FLEXNIC_NAME_DOORBELLS "tas_doorbells"
 
 /** Size of the info shared memory region. */
 #define FLEXNIC_INFO_BYTES 0x1000
@@ -52,6 +56,8 @@
 #define FLEXNIC_FLAG_READY 1
 /** Indicates that huge pages should be used for the internal and dma memory */
 #define FLEXNIC_FLAG_HUGEPAGES 2
+/** Indicates that TAS cores sleep through the doorbell region */
+#define FLEXNIC_FLAG_DOORBELLS 4
 
 /** ID of the mem region to use for the slow path */
 #define SP_MEM_ID FLEXNIC_PL_VMST_NUM
@@ -87,6 +93,26 @@ struct flexnic_info {
   uint32_t qmq_num;
   /** Number of cores in flexnic emulator */
   uint32_t cores_num;
+  /** Number of flow states in internal memory */
+  uint32_t flowst_num;
+  /** Number of flow lookup table entries (power of two) */
+  uint32_t flowht_entries;
+  /** Number of per-core register blocks in internal memory */
+  uint32_t corest_num;
+  /** Offset of per-core register blocks in internal memory */
+  uint64_t corest_off;
+  /** Offset of flow states in internal memory */
+  uint64_t flowst_off;
+  /** Offset of flow lookup table in internal memory */
+  uint64_t flowht_off;
+  /** FLEXNIC_PL_VMST_NUM TAS was built with */
+  uint32_t vmst_num;
+  /** FLEXNIC_PL_APPCTX_NUM TAS was built with */
+  uint32_t appctx_num;
+  /** FLEXNIC_PL_APPST_CTX_NUM TAS was built with */
+  uint32_t appst_ctx_num;
+  /** FLEXNIC_PL_APPST_CTX_MCS TAS was built with */
+  uint32_t appst_ctx_mcs;
 } __attribute__((packed));
 
 
@@ -252,15 +278,43 @@ STATIC_ASSERT(sizeof(struct flextcp_pl_atx) == 16, atx_size);
 /******************************************************************************/
 /* Internal flexnic memory */
 
+/*
+ * VM and application context limits are fixed when building, unlike the flow
+ * and core counts below. They index per-core arrays the fast path touches on
+ * every iteration (budgets, counters, polled VMs and contexts, mbuf pools)
+ * and the per-core queue registers and doorbells, which are addressed as
+ * [vm][db] with a constant stride. Sizing these at runtime would add a load
+ * and a multiply to those accesses. FLEXNIC_PL_VMST_NUM is also the memory
+ * id of the slow path and sizes the telemetry region. They can be raised by
+ * defining them when building, e.g. EXTRA_CPPFLAGS=-DFLEXNIC_PL_VMST_NUM=16.
+ * TAS publishes the values in struct flexnic_info and libtas and the tools
+ * refuse to attach to a TAS built with different values.
+ */
+#ifndef FLEXNIC_PL_VMST_NUM
 #define FLEXNIC_PL_VMST_NUM         6
+#endif
 #define FLEXNIC_PL_APPST_NUM        8
+#ifndef FLEXNIC_PL_APPST_CTX_NUM
 #define FLEXNIC_PL_APPST_CTX_NUM   62
+#endif
+#ifndef FLEXNIC_PL_APPST_CTX_MCS
 #define FLEXNIC_PL_APPST_CTX_MCS   32
+#endif
+#ifndef FLEXNIC_PL_APPCTX_NUM
 #define FLEXNIC_PL_APPCTX_NUM      32
-#define FLEXNIC_PL_FLOWST_NUM     (128 * 1024)
-#define FLEXNIC_PL_FLOWHT_ENTRIES (FLEXNIC_PL_FLOWST_NUM * 2)
+#endif
 #define FLEXNIC_PL_FLOWHT_NBSZ      4
 
+/* vm ids are 16 bit in queue entries and flow state */
+STATIC_ASSERT(FLEXNIC_PL_VMST_NUM > 0 && FLEXNIC_PL_VMST_NUM < 0xffff,
+    vmst_num_range);
+STATIC_ASSERT(FLEXNIC_PL_APPCTX_NUM > 0 && FLEXNIC_PL_APPCTX_NUM <= 0xffff,
+    appctx_num_range);
+
+/** Default and maximum number of flow states, chosen at startup */
+#define FLEXNIC_PL_FLOWST_NUM_DEFAULT (128 * 1024)
+#define FLEXNIC_PL_FLOWST_NUM_MAX     (16 * 1024 * 1024)
+
 /** Application state */
 struct flextcp_pl_appst {
   /********************************************************/
@@ -317,16 +371,70 @@ struct flextcp_pl_tun {
 } __attribute__((packed));
 
 
-/** Flow state registers */
+/**
+ * Flow state registers.
+ *
+ * Split into three cache lines: a hot line with everything the fast path
+ * updates per segment, a cold line with connection setup state that is only
+ * written when the flow is installed, and a statistics line that the slow path
+ * polls for congestion control. The slow path must only read the statistics
+ * line of active flows so it does not steal the hot line from the fast path.
+ */
 struct flextcp_pl_flowst {
   /********************************************************/
-  /* read-only fields */
+  /* hot fields: read-write per segment by the fast path */
+
+  /** Base address of receive buffer (lower bits hold FLEXNIC_PL_FLOWST_*) */
+  uint64_t rx_base_sp;
+
+  /** spin lock */
+  volatile uint32_t lock;
+
+  /** Bytes available for received segments at next position */
+  uint32_t rx_avail;
+  /** Offset in buffer to place next segment */
+  uint32_t rx_next_pos;
+  /** Next sequence number expected */
+  uint32_t rx_next_seq;
+  /** Bytes available in remote end for received segments */
+  uint32_t rx_remote_avail;
+  /** Duplicate ack count */
+  uint32_t rx_dupack_cnt;
+
+#ifdef FLEXNIC_PL_OOO_RECV
+  /* Start of interval of out-of-order received data */
+  uint32_t rx_ooo_start;
+  /* Length of interval of out-of-order received data */
+  uint32_t rx_ooo_len;
+#else
+  uint32_t pad_ooo[2];
+#endif
+
+  /** Number of bytes available to be sent */
+  uint32_t tx_avail;
+  /** Number of bytes up to next pos in the buffer that were sent but not
+   * acknowledged yet. */
+  uint32_t tx_sent;
+  /** Offset in buffer for next segment to be sent */
+  uint32_t tx_next_pos;
+  /** Sequence number of next segment to be sent */
+  uint32_t tx_next_seq;
+  /** Timestamp to echo in next packet */
+  uint32_t tx_next_ts;
+
+  /** Sequence number of queue pointer bumps */
+  uint16_t bump_seq;
+  /** Flow group for this connection (rss bucket) */
+  uint16_t flow_group;
+
+  // 64
+
+  /********************************************************/
+  /* cold fields: read-only after the flow is installed */
 
   /** Opaque flow identifier from application */
   uint64_t opaque;
 
-  /** Base address of receive buffer */
-  uint64_t rx_base_sp;
   /** Base address of transmit buffer */
   uint64_t tx_base;
 
@@ -359,49 +467,17 @@ struct flextcp_pl_flowst {
   /** Id of VM this flow belongs to */
   uint16_t vm_id;
 
-  /** Flow group for this connection (rss bucket) */
-  uint16_t flow_group;
-  /** Sequence number of queue pointer bumps */
-  uint16_t bump_seq;
+  /** Maximum payload bytes per transmitted segment */
+  uint16_t tx_mss;
+  /** Window scale shift applied to advertised receive windows */
+  uint8_t rx_wscale;
+  /** Window scale shift applied to windows received from peer */
+  uint8_t tx_wscale;
 
-  // 56
+  // 128
 
   /********************************************************/
-  /* read-write fields */
-
-  /** spin lock */
-  volatile uint32_t lock;
-
-  /** Bytes available for received segments at next position */
-  uint32_t rx_avail;
-  // 64
-  /** Offset in buffer to place next segment */
-  uint32_t rx_next_pos;
-  /** Next sequence number expected */
-  uint32_t rx_next_seq;
-  /** Bytes available in remote end for received segments */
-  uint32_t rx_remote_avail;
-  /** Duplicate ack count */
-  uint32_t rx_dupack_cnt;
-
-#ifdef FLEXNIC_PL_OOO_RECV
-  /* Start of interval of out-of-order received data */
-  uint32_t rx_ooo_start;
-  /* Length of interval of out-of-order received data */
-  uint32_t rx_ooo_len;
-#endif
-
-  /** Number of bytes available to be sent */
-  uint32_t tx_avail;
-  /** Number of bytes up to next pos in the buffer that were sent but not
-   * acknowledged yet. */
-  uint32_t tx_sent;
-  /** Offset in buffer for next segment to be sent */
-  uint32_t tx_next_pos;
-  /** Sequence number of next segment to be sent */
-  uint32_t tx_next_seq;
-  /** Timestamp to echo in next packet */
-  uint32_t tx_next_ts;
+  /* congestion control and statistics, polled by the slow path */
 
   /** Congestion control rate [kbps] */
   uint32_t tx_rate;
@@ -416,9 +492,28 @@ struct flextcp_pl_flowst {
   /** RTT estimate */
   uint32_t rtt_est;
 
-// 128
+  /** Copy of tx_sent for the slow path */
+  uint32_t st_tx_sent;
+  /** Copy of tx_next_seq for the slow path */
+  uint32_t st_tx_next_seq;
+  /** Copy of tx_avail for the slow path */
+  uint32_t st_tx_avail;
+
+  /** NUMA node the flow buffers were allocated on */
+  uint16_t numa_node;
 } __attribute__((packed, aligned(64)));
 
+/** Offsets of the cache lines in struct flextcp_pl_flowst */
+#define FLEXNIC_PL_FLOWST_HOT_OFF   0
+#define FLEXNIC_PL_FLOWST_COLD_OFF  64
+#define FLEXNIC_PL_FLOWST_STATS_OFF 128
+
+STATIC_ASSERT(offsetof(struct flextcp_pl_flowst, opaque) ==
+    FLEXNIC_PL_FLOWST_COLD_OFF, flowst_hot_size);
+STATIC_ASSERT(offsetof(struct flextcp_pl_flowst, tx_rate) ==
+    FLEXNIC_PL_FLOWST_STATS_OFF, flowst_cold_size);
+STATIC_ASSERT(sizeof(struct flextcp_pl_flowst) == 192, flowst_size);
+
 #define FLEXNIC_PL_FLOWHTE_VALID  (1 << 31)
 #define FLEXNIC_PL_FLOWHTE_POSSHIFT 29
 
@@ -447,21 +542,32 @@ struct flextcp_pl_ovsctx {
   uint32_t tx_tail;
 } __attribute__((packed));
 
-/** Layout of internal pipeline memory */
-struct flextcp_pl_mem {
-  /* registers for application context queues */
-  struct flextcp_pl_appctx appctx[FLEXNIC_PL_APPST_CTX_MCS]
-      [FLEXNIC_PL_VMST_NUM][FLEXNIC_PL_APPCTX_NUM];
-
-  /* registers for flow state */
-  struct flextcp_pl_flowst flowst[FLEXNIC_PL_FLOWST_NUM];
+/** Layout of the doorbell shared memory region (see utils_doorbell.h) */
+struct flexnic_doorbells {
+  /** Fast path cores */
+  struct util_doorbell fp[FLEXNIC_PL_APPST_CTX_MCS];
+  /** Slow path */
+  struct util_doorbell sp;
+  /** Application contexts, indexed by VM and doorbell id */
+  struct util_doorbell app[FLEXNIC_PL_VMST_NUM][FLEXNIC_PL_APPCTX_NUM];
+};
 
-  /* flow lookup table */
-  struct flextcp_pl_flowhte flowht[FLEXNIC_PL_FLOWHT_ENTRIES];
+/** Registers owned by one fast path core, page aligned so that each block
+ *  can be placed on the NUMA node of its core. */
+struct flextcp_pl_corest {
+  /* registers for application context queues */
+  struct flextcp_pl_appctx appctx[FLEXNIC_PL_VMST_NUM][FLEXNIC_PL_APPCTX_NUM];
 
-  /* registers for kernel queues */
-  struct flextcp_pl_appctx kctx[FLEXNIC_PL_APPST_CTX_MCS];
+  /* registers for kernel queue */
+  struct flextcp_pl_appctx kctx;
+} __attribute__((packed, aligned(4096)));
 
+/**
+ * Fixed-size part of internal pipeline memory. The per-core registers, flow
+ * states, and flow lookup table are sized at startup and follow at the
+ * offsets in struct flexnic_info (see flexnic_info_layout()).
+ */
+struct flextcp_pl_mem {
   /* registers for application state */
   struct flextcp_pl_appst appst[FLEXNIC_PL_APPST_NUM];
 
@@ -474,6 +580,70 @@ struct flextcp_pl_mem {
   uint8_t flow_group_steering[FLEXNIC_PL_MAX_FLOWGROUPS];
 } __attribute__((packed));
 
+/**
+ * Lay out internal memory for the specified number of flows and fast path
+ * cores, and record the sizes and offsets in the info struct. The lookup
+ * table gets at least two entries per flow, rounded up to a power of two so
+ * it can be indexed with a mask. The build-time limits the layout depends on
+ * are recorded as well.
+ *
+ * @param info   Info struct to update
+ * @param flows  Number of flow states
+ * @param cores  Number of per-core register blocks
+ *
+ * @return Required size of internal memory in bytes
+ */
+static inline uint64_t flexnic_info_layout(struct flexnic_info *info,
+    uint32_t flows, uint32_t cores)
+{
+  uint64_t off;
+  uint32_t ht = FLEXNIC_PL_FLOWHT_NBSZ;
+
+  while (ht < 2 * (uint64_t) flows) {
+    ht <<= 1;
+  }
+
+  info->flowst_num = flows;
+  info->flowht_entries = ht;
+  info->corest_num = cores;
+  info->vmst_num = FLEXNIC_PL_VMST_NUM;
+  info->appctx_num = FLEXNIC_PL_APPCTX_NUM;
+  info->appst_ctx_num = FLEXNIC_PL_APPST_CTX_NUM;
+  info->appst_ctx_mcs = FLEXNIC_PL_APPST_CTX_MCS;
+
+  /* per-core blocks must stay page aligned */
+  off = (sizeof(struct flextcp_pl_mem) + 4095) & ~4095ULL;
+  info->corest_off = off;
+  off += (uint64_t) cores * sizeof(struct flextcp_pl_corest);
+
+  info->flowst_off = off;
+  off += (uint64_t) flows * sizeof(struct flextcp_pl_flowst);
+
+  info->flowht_off = off;
+  off += (uint64_t) ht * sizeof(struct flextcp_pl_flowhte);
+
+  return off;
+}
+
+/**
+ * Check that the build-time limits of the reader match the ones TAS was
+ * built with, as they determine the layout of shared memory.
+ *
+ * @return 0 if they match, -1 else
+ */
+static inline int flexnic_info_limits_check(
+    const volatile struct flexnic_info *info)
+{
+  if (info->vmst_num != FLEXNIC_PL_VMST_NUM ||
+      info->appctx_num != FLEXNIC_PL_APPCTX_NUM ||
+      info->appst_ctx_num != FLEXNIC_PL_APPST_CTX_NUM ||
+      info->appst_ctx_mcs != FLEXNIC_PL_APPST_CTX_MCS)
+  {
+    return -1;
+  }
+  return 0;
+}
+
 /** @} */
 
 #endif /* ndef FLEXTCP_PLIF_H_ */
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @brief Layout of the budget telemetry shared memory region.
+ * @file tas_telemetry.h
+ *
+ * With telemetry enabled (--bu-telemetry or the "telemetry" command on the
+ * budget control socket) the slow path collects per-core and per-VM budget
+ * statistics over windows of BUDGET_DEBUG_WINDOW_US and copies each
+ * completed window into the shm region FLEXNIC_NAME_TELEMETRY, which is a
+ * struct tas_telemetry.
+ *
+ * Readers map the region read-only and use the sequence counter: read seq,
+ * wait while it is odd (a window is being copied in), copy the data, and
+ * retry if seq changed in the meantime. Only entries for cores below
+ * num_cores and for the VMs in vm_ids[0..vm_count) are meaningful.
+ *
+ * Percentages are fixed point in tenths of a percent. Histogram bins are
+ * BUDGET_DEBUG_PERCENT_BIN_TENTHS wide. For non-negative stats bin i covers
+ * [i * width, (i + 1) * width) and the last bin everything above
+ * BUDGET_DEBUG_NONNEG_MAX_TENTHS. For signed stats bin 0 holds values below
+ * BUDGET_DEBUG_SIGNED_MIN_TENTHS, bin i covers
+ * [MIN + (i - 1) * width, MIN + i * width), and the last bin holds values
+ * above BUDGET_DEBUG_SIGNED_MAX_TENTHS.
+ *
+ * The accept statistics in the same region are counters since startup that
+ * the slow path updates as connections come in, with or without telemetry
+ * windows. They are not covered by the sequence counter.
+ */
+
+#ifndef TAS_TELEMETRY_H_
+#define TAS_TELEMETRY_H_
+
+#include <stdint.h>
+
+#include <tas_memif.h>
+
+#define FLEXNIC_NAME_TELEMETRY "tas_telemetry"
+
+#define TAS_TELEMETRY_MAGIC 0x74656c65
+#define TAS_TELEMETRY_VERSION 2
+
+#define BUDGET_DEBUG_WINDOW_US 1000000ULL
+#define BUDGET_DEBUG_PERCENT_SCALE 10
+#define BUDGET_DEBUG_PERCENT_BIN_TENTHS 5
+#define BUDGET_DEBUG_NONNEG_MAX_TENTHS (1000 * BUDGET_DEBUG_PERCENT_SCALE)
+#define BUDGET_DEBUG_SIGNED_MIN_TENTHS (-1000 * BUDGET_DEBUG_PERCENT_SCALE)
+#define BUDGET_DEBUG_SIGNED_MAX_TENTHS (100 * BUDGET_DEBUG_PERCENT_SCALE)
+#define BUDGET_DEBUG_NONNEG_REGULAR_BINS \
+  ((BUDGET_DEBUG_NONNEG_MAX_TENTHS / BUDGET_DEBUG_PERCENT_BIN_TENTHS) + 1)
+#define BUDGET_DEBUG_NONNEG_BIN_COUNT \
+  (BUDGET_DEBUG_NONNEG_REGULAR_BINS + 1)
+#define BUDGET_DEBUG_SIGNED_REGULAR_BINS \
+  (((BUDGET_DEBUG_SIGNED_MAX_TENTHS - BUDGET_DEBUG_SIGNED_MIN_TENTHS) / \
+      BUDGET_DEBUG_PERCENT_BIN_TENTHS) + 1)
+#define BUDGET_DEBUG_SIGNED_BIN_COUNT \
+  (BUDGET_DEBUG_SIGNED_REGULAR_BINS + 2)
+
+/** Count, sum, min and max of a value in cycles */
+struct budget_debug_u64_stats {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+/** Histogram of a non-negative percentage */
+struct budget_debug_pct_nonneg_stats {
+  uint64_t count;
+  int64_t sum_tenths;
+  int32_t min_tenths;
+  int32_t max_tenths;
+  uint32_t bins[BUDGET_DEBUG_NONNEG_BIN_COUNT];
+};
+
+/** Histogram of a percentage that can be negative */
+struct budget_debug_pct_signed_stats {
+  uint64_t count;
+  int64_t sum_tenths;
+  int32_t min_tenths;
+  int32_t max_tenths;
+  uint32_t bins[BUDGET_DEBUG_SIGNED_BIN_COUNT];
+};
+
+/** Per fast path core statistics, one sample per budget update */
+struct budget_debug_core_window {
+  uint64_t periods;
+  /* updates where the core was handed no budget */
+  uint64_t zero_dist_periods;
+  /* cycles charged to VM budgets */
+  struct budget_debug_u64_stats consumed;
+  /* cycles handed out in the previous update */
+  struct budget_debug_u64_stats distributed;
+  /* cycles spent on VMs without budget (work conserving) */
+  struct budget_debug_u64_stats work_conserving;
+  struct budget_debug_u64_stats total_consumed;
+  /* consumed / distributed */
+  struct budget_debug_pct_nonneg_stats utilization;
+  struct budget_debug_pct_nonneg_stats consumed_over_elapsed;
+  struct budget_debug_pct_nonneg_stats distributed_over_elapsed;
+  /* work_conserving / distributed */
+  struct budget_debug_pct_nonneg_stats work_conserving_utilization;
+  struct budget_debug_pct_nonneg_stats work_conserving_over_elapsed;
+};
+
+/** Per VM statistics on one core, one sample per budget update */
+struct budget_debug_vm_window {
+  struct budget_debug_u64_stats consumed;
+  struct budget_debug_u64_stats distributed;
+  struct budget_debug_u64_stats work_conserving;
+  /* consumed / distributed in the previous update */
+  struct budget_debug_pct_nonneg_stats distributed_used;
+  /* consumed / max budget */
+  struct budget_debug_pct_nonneg_stats cap_used;
+  struct budget_debug_pct_nonneg_stats work_conserving_used;
+  /* balance / max budget before and after the update */
+  struct budget_debug_pct_signed_stats budget_pre;
+  struct budget_debug_pct_signed_stats budget_post;
+};
+
+#define TAS_TELEMETRY_ACCEPT_BINS 20
+
+/** Accept statistics of all listeners */
+struct tas_telemetry_accept {
+  /* SYNs queued on listeners */
+  uint64_t syns;
+  /* SYNs that found no accept slot posted and had to wait for one */
+  uint64_t slot_waits;
+  /* accept slots posted by applications, and queue entries used for that */
+  uint64_t slots_posted;
+  uint64_t post_entries;
+  /* connections completed into accept slots */
+  uint64_t accepted;
+  /* time from queueing the SYN to completing the accept in us, bin i counts
+   * latencies below 2^i us and the last bin everything larger */
+  uint64_t latency_sum_us;
+  uint64_t latency_bins[TAS_TELEMETRY_ACCEPT_BINS];
+};
+
+/** Shared memory region FLEXNIC_NAME_TELEMETRY */
+struct tas_telemetry {
+  uint32_t magic;
+  uint32_t version;
+  /* odd while a window is being published */
+  volatile uint64_t seq;
+  /* number of windows published so far */
+  uint64_t windows;
+
+  /* covered time in us, as returned by util_timeout_time_us() */
+  uint64_t start_us;
+  uint64_t end_us;
+  /* budget updates in this window */
+  uint64_t intervals;
+  uint64_t max_budget;
+  struct budget_debug_u64_stats elapsed_cycles;
+
+  uint16_t num_cores;
+  uint16_t vm_count;
+  uint16_t vm_ids[FLEXNIC_PL_VMST_NUM];
+  /* slow path cycles charged to each VM since startup */
+  uint64_t vm_sp_cycles[FLEXNIC_PL_VMST_NUM];
+
+  struct budget_debug_core_window cores[FLEXNIC_PL_APPST_CTX_MCS];
+  struct budget_debug_vm_window
+      vms[FLEXNIC_PL_APPST_CTX_MCS][FLEXNIC_PL_VMST_NUM];
+
+  struct tas_telemetry_accept accept;
+};
+
+#endif /* ndef TAS_TELEMETRY_H_ */
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/**
+ * @brief Shared memory doorbells for waking up sleeping cores.
+ * @file utils_doorbell.h
+ *
+ * A doorbell is a word in shared memory that records whether its owner is
+ * sleeping, so that writers only need a system call when the owner actually
+ * went to sleep. The owner marks itself sleeping with util_doorbell_prepare(),
+ * then checks its queues once more and only then blocks. Writers first make
+ * their work visible and then call util_doorbell_ring(). Because both sides
+ * order their store before the following load, either the owner finds the new
+ * work or the writer finds the owner sleeping.
+ *
+ * Owners that block in epoll or poll use UTIL_DOORBELL_SLEEP_FD and writers
+ * wake them through their eventfd, owners that only wait for the doorbell use
+ * UTIL_DOORBELL_SLEEP_FUTEX and are woken with a futex wake on the state word.
+ * Only one writer sees the sleeping state, so one wakeup is sent per sleep.
+ */
+
+#ifndef UTILS_DOORBELL_H_
+#define UTILS_DOORBELL_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/** Owner is running (or about to check its queues) */
+#define UTIL_DOORBELL_AWAKE 0
+/** Owner sleeps on its eventfd */
+#define UTIL_DOORBELL_SLEEP_FD 1
+/** Owner sleeps on the doorbell futex */
+#define UTIL_DOORBELL_SLEEP_FUTEX 2
+
+/** Upper bound for the adaptive spin interval, as a multiple of the base */
+#define UTIL_DOORBELL_SPIN_MAX_FACTOR 8
+
+struct util_doorbell {
+  /** UTIL_DOORBELL_AWAKE or one of the sleep states */
+  volatile uint32_t state;
+  /** Set by the owner once it waits through this doorbell, writers fall back
+   *  to the eventfd heuristic otherwise */
+  volatile uint32_t armed;
+  uint8_t pad[56];
+} __attribute__((aligned(64)));
+
+/** Owner: mark as sleeping before polling one last time. */
+static inline void util_doorbell_prepare(struct util_doorbell *db,
+    uint32_t how)
+{
+  __atomic_exchange_n(&db->state, how, __ATOMIC_SEQ_CST);
+}
+
+/** Owner: mark as awake again, after sleeping or when more work showed up. */
+static inline void util_doorbell_cancel(struct util_doorbell *db)
+{
+  if (db->state != UTIL_DOORBELL_AWAKE)
+    __atomic_exchange_n(&db->state, UTIL_DOORBELL_AWAKE, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Owner: switch from eventfd to futex sleep. Returns 0 if a writer already
+ * rang the doorbell, in that case there is no need to sleep.
+ */
+static inline int util_doorbell_prepare_futex(struct util_doorbell *db)
+{
+  uint32_t exp = UTIL_DOORBELL_SLEEP_FD;
+
+  return __atomic_compare_exchange_n(&db->state, &exp,
+      UTIL_DOORBELL_SLEEP_FUTEX, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Owner: sleep until the doorbell is rung or the timeout (ms, < 0 for none)
+ * expires. Needs a successful util_doorbell_prepare_futex() first.
+ */
+static inline void util_doorbell_wait(struct util_doorbell *db,
+    int timeout_ms)
+{
+  struct timespec ts, *pts = NULL;
+
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    pts = &ts;
+  }
+
+  /* shared futex: the ringing side is another process */
+  while (db->state == UTIL_DOORBELL_SLEEP_FUTEX) {
+    if (syscall(SYS_futex, &db->state, FUTEX_WAIT, UTIL_DOORBELL_SLEEP_FUTEX,
+          pts, NULL, 0) != 0 && pts != NULL)
+    {
+      break;
+    }
+  }
+}
+
+/**
+ * Writer: ring the doorbell after making new work visible. Returns the
+ * previous state, the caller writes the owner's eventfd for
+ * UTIL_DOORBELL_SLEEP_FD, futex sleepers are woken here.
+ */
+static inline uint32_t util_doorbell_ring(struct util_doorbell *db)
+{
+  uint32_t prev;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (db->state == UTIL_DOORBELL_AWAKE)
+    return UTIL_DOORBELL_AWAKE;
+
+  prev = __atomic_exchange_n(&db->state, UTIL_DOORBELL_AWAKE,
+      __ATOMIC_SEQ_CST);
+  if (prev == UTIL_DOORBELL_SLEEP_FUTEX)
+    syscall(SYS_futex, &db->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+
+  return prev;
+}
+
+/**
+ * Adapt the spin interval before sleeping to how long the last sleep lasted.
+ * If the wakeup came before a full spin interval would have passed, spinning
+ * longer would have avoided the sleep, so the interval doubles (up to
+ * UTIL_DOORBELL_SPIN_MAX_FACTOR times the base). Long sleeps halve it again,
+ * but never below the base interval.
+ */
+static inline void util_doorbell_adapt(uint64_t *spin, uint64_t base,
+    uint64_t slept)
+{
+  uint64_t s = *spin;
+
+  if (slept < s) {
+    s *= 2;
+    if (s > base * UTIL_DOORBELL_SPIN_MAX_FACTOR)
+      s = base * UTIL_DOORBELL_SPIN_MAX_FACTOR;
+  } else if (slept / 4 >= s) {
+    s /= 2;
+  }
+
+  *spin = (s < base ? base : s);
+}
+
+#endif /* ndef UTILS_DOORBELL_H_ */
@@ -0,0 +1,579 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <utils.h>
+#include <tas_sockets.h>
+#include <tas_batch.h>
+#include <tas_ll.h>
+#include <utils_sync.h>
+
+#include "internal.h"
+
+struct batch_op {
+  struct tas_batch_sqe sqe;
+  /** socket the operation is pending on */
+  struct socket *s;
+  /** bytes of a send already queued */
+  size_t done;
+  struct batch_op *next;
+};
+
+struct tas_batch {
+  struct flextcp_context *ctx;
+  /** protects the completion queue, the free operations and the ready list,
+   * closing a socket from another thread completes its operations here.
+   * Taken after socket locks. */
+  volatile uint32_t sp_lock;
+  unsigned entries;
+  /** operations submitted and not reaped yet */
+  unsigned inflight;
+
+  /** submission queue, entries from sq_head to sq_tail are queued */
+  struct tas_batch_sqe *sq;
+  uint32_t sq_head;
+  uint32_t sq_tail;
+
+  /** completion queue, entries from cq_head to cq_tail are ready */
+  struct tas_batch_cqe *cq;
+  uint32_t cq_head;
+  uint32_t cq_tail;
+
+  struct batch_op *ops;
+  struct batch_op *ops_free;
+
+  /** sockets with events since they were last processed */
+  struct socket *ready_first;
+  struct socket *ready_last;
+};
+
+static void batch_sock_process(struct tas_batch *b, struct socket *s);
+
+static inline void batch_lock(struct tas_batch *b)
+{
+  if (!flextcp_sockets_single)
+    util_spin_lock(&b->sp_lock);
+}
+
+static inline void batch_unlock(struct tas_batch *b)
+{
+  if (!flextcp_sockets_single)
+    util_spin_unlock(&b->sp_lock);
+}
+
+/* locks and returns the first socket on the ready list and removes it from
+ * the list, NULL if the list is empty. The batch lock is taken after socket
+ * locks, so the socket lock is only tried here while the socket is known to
+ * be alive. */
+static struct socket *batch_ready_pop(struct tas_batch *b)
+{
+  struct socket *s;
+
+  while (1) {
+    batch_lock(b);
+    if ((s = b->ready_first) == NULL)
+      break;
+    if (socket_trylock(s)) {
+      b->ready_first = s->batch_next;
+      if (b->ready_last == s)
+        b->ready_last = NULL;
+      s->batch_next = NULL;
+      s->batch_ready = 0;
+      break;
+    }
+    batch_unlock(b);
+  }
+  batch_unlock(b);
+
+  return s;
+}
+
+int tas_batch_init(struct tas_batch **pb, unsigned entries)
+{
+  struct tas_batch *b;
+  unsigned i;
+
+  if (entries == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if ((b = calloc(1, sizeof(*b))) == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  b->sq = calloc(entries, sizeof(*b->sq));
+  b->cq = calloc(entries, sizeof(*b->cq));
+  b->ops = calloc(entries, sizeof(*b->ops));
+  if (b->sq == NULL || b->cq == NULL || b->ops == NULL) {
+    free(b->ops);
+    free(b->cq);
+    free(b->sq);
+    free(b);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (i = 0; i < entries; i++) {
+    b->ops[i].next = b->ops_free;
+    b->ops_free = &b->ops[i];
+  }
+
+  b->ctx = flextcp_sockctx_get();
+  b->entries = entries;
+  *pb = b;
+  return 0;
+}
+
+void tas_batch_destroy(struct tas_batch *b)
+{
+  struct socket *s;
+  unsigned i;
+
+  /* detach sockets on the ready list */
+  while ((s = batch_ready_pop(b)) != NULL) {
+    if (s->bops_first == NULL)
+      s->batch = NULL;
+    socket_unlock(s);
+  }
+
+  /* detach sockets that still have operations pending */
+  for (i = 0; i < b->entries; i++) {
+    while (1) {
+      batch_lock(b);
+      if ((s = b->ops[i].s) == NULL || socket_trylock(s))
+        break;
+      batch_unlock(b);
+    }
+    batch_unlock(b);
+    if (s == NULL)
+      continue;
+
+    if (s->batch == b) {
+      s->bops_first = s->bops_last = NULL;
+      s->batch = NULL;
+    }
+    socket_unlock(s);
+  }
+
+  free(b->ops);
+  free(b->cq);
+  free(b->sq);
+  free(b);
+}
+
+struct tas_batch_sqe *tas_batch_get_sqe(struct tas_batch *b)
+{
+  struct tas_batch_sqe *sqe;
+
+  /* every queued entry needs an operation and completion slot */
+  if (b->sq_tail - b->sq_head + b->inflight >= b->entries)
+    return NULL;
+
+  sqe = &b->sq[b->sq_tail++ % b->entries];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* called with batch lock held */
+static inline void batch_complete(struct tas_batch *b, uint64_t user_data,
+    ssize_t res)
+{
+  struct tas_batch_cqe *cqe;
+
+  assert(b->cq_tail - b->cq_head < b->entries);
+  cqe = &b->cq[b->cq_tail++ % b->entries];
+  cqe->user_data = user_data;
+  cqe->res = res;
+}
+
+/* called with batch lock held */
+static inline void batch_op_free(struct tas_batch *b, struct batch_op *op)
+{
+  op->s = NULL;
+  op->next = b->ops_free;
+  b->ops_free = op;
+}
+
+/* called with lock on s held, same as recv() on a non-blocking socket but
+ * without polling the context */
+static ssize_t batch_recv(struct tas_batch *b, struct socket *s,
+    struct batch_op *op)
+{
+  struct socket_conn *sc = &s->data.connection;
+  uint8_t *buf = op->sqe.buf;
+  size_t len = op->sqe.len, len_1, len_2;
+
+  if (s->type != SOCK_CONNECTION || sc->status != SOC_CONNECTED)
+    return -ENOTCONN;
+
+  if (len == 0)
+    return 0;
+
+  if (sc->rx_len_1 == 0) {
+    if ((sc->st_flags & CSTF_RXCLOSED) == CSTF_RXCLOSED)
+      return 0;
+
+    flextcp_epoll_clear(s, EPOLLIN);
+    return -EAGAIN;
+  }
+
+  /* copy to provided buffer */
+  len_1 = TAS_MIN(sc->rx_len_1, len);
+  memcpy(buf, sc->rx_buf_1, len_1);
+  if (len_1 == sc->rx_len_1) {
+    sc->rx_buf_1 = sc->rx_buf_2;
+    sc->rx_len_1 = sc->rx_len_2;
+    sc->rx_buf_2 = NULL;
+    sc->rx_len_2 = 0;
+  } else {
+    sc->rx_buf_1 = (uint8_t *) sc->rx_buf_1 + len_1;
+    sc->rx_len_1 -= len_1;
+  }
+
+  len_2 = TAS_MIN(sc->rx_len_1, len - len_1);
+  memcpy(buf + len_1, sc->rx_buf_1, len_2);
+  sc->rx_buf_1 = (uint8_t *) sc->rx_buf_1 + len_2;
+  sc->rx_len_1 -= len_2;
+
+  if (sc->rx_len_1 == 0 && !(sc->st_flags & CSTF_RXCLOSED))
+    flextcp_epoll_clear(s, EPOLLIN);
+
+  flextcp_connection_rx_done(b->ctx, &sc->c, len_1 + len_2);
+  return len_1 + len_2;
+}
+
+/* called with lock on s held, queues as much of the buffer as fits into the
+ * transmit buffer and completes once all of it is queued */
+static ssize_t batch_send(struct tas_batch *b, struct socket *s,
+    struct batch_op *op)
+{
+  struct socket_conn *sc = &s->data.connection;
+  const uint8_t *src;
+  size_t len_1, len_2;
+  void *dst_1, *dst_2;
+  ssize_t ret;
+
+  if (s->type != SOCK_CONNECTION || sc->status != SOC_CONNECTED ||
+      (sc->st_flags & CSTF_TXCLOSED) == CSTF_TXCLOSED)
+  {
+    return -ENOTCONN;
+  }
+
+  /* zero-copy reservation has to be committed first */
+  if (sc->tx_reserved != 0)
+    return -EBUSY;
+
+  while (op->done < op->sqe.len) {
+    ret = flextcp_connection_tx_alloc2(&sc->c, op->sqe.len - op->done, &dst_1,
+        &len_1, &dst_2);
+    if (ret < 0) {
+      fprintf(stderr, "batch_send: flextcp_connection_tx_alloc2 failed\n");
+      abort();
+    } else if (ret == 0) {
+      /* wait for the sendbuf event */
+      return -EAGAIN;
+    }
+    len_2 = ret - len_1;
+
+    src = (const uint8_t *) op->sqe.buf + op->done;
+    memcpy(dst_1, src, len_1);
+    memcpy(dst_2, src + len_1, len_2);
+
+    if (flextcp_connection_tx_send(b->ctx, &sc->c, ret) != 0) {
+      fprintf(stderr, "batch_send: flextcp_connection_tx_send failed\n");
+      abort();
+    }
+    op->done += ret;
+  }
+
+  return op->done;
+}
+
+/* called with lock on s held, returns the result or -EAGAIN if the operation
+ * has to wait for events on the socket */
+static ssize_t batch_op_try(struct tas_batch *b, struct socket *s,
+    struct batch_op *op)
+{
+  int fd;
+
+  switch (op->sqe.opcode) {
+    case TAS_BATCH_OP_SEND:
+      return batch_send(b, s, op);
+
+    case TAS_BATCH_OP_RECV:
+      return batch_recv(b, s, op);
+
+    case TAS_BATCH_OP_ACCEPT:
+      fd = flextcp_accept_try(b->ctx, s, op->sqe.len);
+      return (fd < 0 ? -errno : fd);
+
+    default:
+      return -EINVAL;
+  }
+}
+
+/* called with lock on s held, runs pending operations on the socket.
+ * Operations of the same type complete in submission order, but a blocked
+ * receive does not hold up sends and vice versa. */
+static void batch_sock_process(struct tas_batch *b, struct socket *s)
+{
+  struct batch_op *op, *next, *prev = NULL;
+  uint32_t blocked = 0;
+  ssize_t ret;
+
+  for (op = s->bops_first; op != NULL; op = next) {
+    next = op->next;
+
+    if (!(blocked & (1 << op->sqe.opcode))) {
+      ret = batch_op_try(b, s, op);
+      if (ret != -EAGAIN) {
+        if (prev != NULL)
+          prev->next = next;
+        else
+          s->bops_first = next;
+
+        batch_lock(b);
+        batch_complete(b, op->sqe.user_data, ret);
+        batch_op_free(b, op);
+        batch_unlock(b);
+        continue;
+      }
+      blocked |= 1 << op->sqe.opcode;
+    }
+    prev = op;
+  }
+
+  s->bops_last = prev;
+  if (s->bops_first == NULL) {
+    batch_lock(b);
+    if (!s->batch_ready)
+      s->batch = NULL;
+    batch_unlock(b);
+  }
+}
+
+/* completes an entry that did not leave an operation pending */
+static void batch_complete_now(struct tas_batch *b, uint64_t user_data,
+    ssize_t res)
+{
+  batch_lock(b);
+  batch_complete(b, user_data, res);
+  batch_unlock(b);
+}
+
+static void batch_exec(struct tas_batch *b, struct tas_batch_sqe *sqe)
+{
+  struct socket *s;
+  struct batch_op *op;
+
+  if (sqe->opcode == TAS_BATCH_OP_NOP) {
+    batch_complete_now(b, sqe->user_data, 0);
+    return;
+  } else if (sqe->opcode == TAS_BATCH_OP_CLOSE) {
+    batch_complete_now(b, sqe->user_data,
+        tas_close(sqe->fd) == 0 ? 0 : -errno);
+    return;
+  } else if (sqe->opcode != TAS_BATCH_OP_SEND &&
+      sqe->opcode != TAS_BATCH_OP_RECV && sqe->opcode != TAS_BATCH_OP_ACCEPT)
+  {
+    /* pending operations are tracked in a bitmap of opcodes */
+    batch_complete_now(b, sqe->user_data, -EINVAL);
+    return;
+  }
+
+  if (flextcp_fd_slookup(sqe->fd, &s) != 0) {
+    batch_complete_now(b, sqe->user_data, -EBADF);
+    return;
+  }
+
+  tas_sock_move(s);
+
+  /* operations on a socket can only be pending in one batch */
+  if (s->batch != NULL && s->batch != b) {
+    batch_complete_now(b, sqe->user_data, -EBUSY);
+    goto out;
+  }
+
+  batch_lock(b);
+  op = b->ops_free;
+  assert(op != NULL);
+  b->ops_free = op->next;
+  batch_unlock(b);
+
+  op->sqe = *sqe;
+  op->s = s;
+  op->done = 0;
+  op->next = NULL;
+
+  /* queue behind operations already pending, then run what can run */
+  if (s->bops_first == NULL)
+    s->bops_first = op;
+  else
+    s->bops_last->next = op;
+  s->bops_last = op;
+  s->batch = b;
+
+  batch_sock_process(b, s);
+
+out:
+  flextcp_fd_srelease(sqe->fd, s);
+}
+
+int tas_batch_submit(struct tas_batch *b)
+{
+  struct tas_batch_sqe *sqe;
+  int n = 0;
+
+  while (b->sq_head != b->sq_tail) {
+    sqe = &b->sq[b->sq_head++ % b->entries];
+    b->inflight++;
+    batch_exec(b, sqe);
+    n++;
+  }
+
+  return n;
+}
+
+static void batch_process_ready(struct tas_batch *b)
+{
+  struct socket *s;
+
+  /* processing does not poll the context, so no sockets are added */
+  while ((s = batch_ready_pop(b)) != NULL) {
+    if (s->bops_first != NULL)
+      batch_sock_process(b, s);
+    else
+      s->batch = NULL;
+    socket_unlock(s);
+  }
+}
+
+int tas_batch_reap(struct tas_batch *b, struct tas_batch_cqe *cqes,
+    unsigned max, int timeout_ms)
+{
+  uint64_t mtimeout = 0, cur_ms;
+  int block_ms;
+  unsigned n;
+
+  if (timeout_ms > 0)
+    mtimeout = get_msecs() + timeout_ms;
+
+  while (1) {
+    /* one poll hands events for all sockets to the batch */
+    flextcp_sockctx_poll(b->ctx);
+    batch_process_ready(b);
+
+    if (b->cq_head != b->cq_tail || timeout_ms == 0 || b->inflight == 0)
+      break;
+
+    block_ms = -1;
+    if (timeout_ms > 0) {
+      cur_ms = get_msecs();
+      if (cur_ms >= mtimeout)
+        break;
+      block_ms = mtimeout - cur_ms;
+    }
+
+    /* only blocks once the context has been idle for a while */
+    flextcp_context_wait(b->ctx, block_ms);
+  }
+
+  batch_lock(b);
+  for (n = 0; n < max && b->cq_head != b->cq_tail; n++) {
+    cqes[n] = b->cq[b->cq_head++ % b->entries];
+    b->inflight--;
+  }
+  batch_unlock(b);
+
+  return n;
+}
+
+void flextcp_batch_sockready(struct flextcp_context *ctx, struct socket *s)
+{
+  struct tas_batch *b = s->batch;
+
+  /* events are only expected on the context of the batch thread */
+  if (b->ctx != ctx)
+    return;
+
+  batch_lock(b);
+  if (s->batch_ready) {
+    batch_unlock(b);
+    return;
+  }
+
+  s->batch_ready = 1;
+  s->batch_next = NULL;
+  if (b->ready_last == NULL)
+    b->ready_first = s;
+  else
+    b->ready_last->batch_next = s;
+  b->ready_last = s;
+  batch_unlock(b);
+}
+
+/* called with lock on s held, possibly from a thread other than the one
+ * owning the batch */
+void flextcp_batch_sockclose(struct socket *s)
+{
+  struct tas_batch *b = s->batch;
+  struct batch_op *op, *next;
+  struct socket *p;
+
+  batch_lock(b);
+  for (op = s->bops_first; op != NULL; op = next) {
+    next = op->next;
+    batch_complete(b, op->sqe.user_data, -ECANCELED);
+    batch_op_free(b, op);
+  }
+  s->bops_first = s->bops_last = NULL;
+  s->batch = NULL;
+
+  if (!s->batch_ready) {
+    batch_unlock(b);
+    return;
+  }
+
+  /* remove from ready list */
+  if (b->ready_first == s) {
+    b->ready_first = s->batch_next;
+    p = NULL;
+  } else {
+    for (p = b->ready_first; p->batch_next != s; p = p->batch_next);
+    p->batch_next = s->batch_next;
+  }
+  if (b->ready_last == s)
+    b->ready_last = p;
+
+  s->batch_next = NULL;
+  s->batch_ready = 0;
+  batch_unlock(b);
+}
@@ -41,8 +41,8 @@ static inline void ev_listen_open(struct flextcp_context *ctx,
     struct flextcp_event *ev);
 static inline void ev_listen_newconn(struct flextcp_context *ctx,
     struct flextcp_event *ev);
-static inline void ev_listen_accept(struct flextcp_context *ctx,
-    struct flextcp_event *ev);
+static inline int ev_listen_accept(struct flextcp_context *ctx,
+    struct flextcp_event *evs, int num);
 static inline void ev_conn_open(struct flextcp_context *ctx,
     struct flextcp_event *ev);
 static inline void ev_conn_received(struct flextcp_context *ctx,
@@ -60,15 +60,19 @@ static inline void ev_conn_txclosed(struct flextcp_context *ctx,
 static inline void ev_conn_closed(struct flextcp_context *ctx,
     struct flextcp_event *ev);
 
+int flextcp_sockets_single = 0;
+struct sockets_context *flextcp_sockctx_single = NULL;
+
 static __thread struct sockets_context *local_context;
 static pthread_mutex_t context_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void flextcp_local_context_clear(void)
 {
   local_context = NULL;
+  flextcp_sockctx_single = NULL;
 }
 
-struct sockets_context *flextcp_sockctx_getfull(void)
+struct sockets_context *flextcp_sockctx_getfull_slow(void)
 {
   struct sockets_context *ctx = local_context;
   int ret;
@@ -89,17 +93,14 @@ struct sockets_context *flextcp_sockctx_getfull(void)
     }
 
     local_context = ctx;
+    if (flextcp_sockets_single)
+      flextcp_sockctx_single = ctx;
   }
 
   return ctx;
 
 }
 
-struct flextcp_context *flextcp_sockctx_get(void)
-{
-  return &flextcp_sockctx_getfull()->ctx;
-}
-
 int flextcp_sockctx_poll(struct flextcp_context *ctx)
 {
   struct flextcp_event evs[16];
@@ -121,7 +122,8 @@ int flextcp_sockctx_poll(struct flextcp_context *ctx)
         break;
 
       case FLEXTCP_EV_LISTEN_ACCEPT:
-        ev_listen_accept(ctx, &evs[i]);
+        /* consumes following accepts on the same listener too */
+        i += ev_listen_accept(ctx, &evs[i], num - i) - 1;
         break;
 
       case FLEXTCP_EV_CONN_OPEN:
@@ -206,44 +208,68 @@ static inline void ev_listen_newconn(struct flextcp_context *ctx,
 {
 }
 
-static inline void ev_listen_accept(struct flextcp_context *ctx,
-    struct flextcp_event *ev)
+static inline struct socket *ev_accept_socket(struct flextcp_event *ev)
 {
-  struct flextcp_connection *c;
-  struct socket *s, *sl;
+  struct flextcp_connection *c = ev->ev.listen_accept.conn;
 
-  c = ev->ev.listen_accept.conn;
-  s = (struct socket *)
+  return (struct socket *)
     ((uint8_t *) c - offsetof(struct socket, data.connection.c));
+}
+
+/* handles the run of accept events for the same listener at the start of
+ * evs with one listener lock and notification, returns the number handled */
+static inline int ev_listen_accept(struct flextcp_context *ctx,
+    struct flextcp_event *evs, int num)
+{
+  struct socket *s, *sl;
+  int i, ready = 0;
 
+  s = ev_accept_socket(&evs[0]);
   assert(s->type == SOCK_CONNECTION);
   sl = s->data.connection.listener;
   assert(sl != NULL);
 
   socket_lock(sl);
-  socket_lock(s);
 
-  /** Return so we don't duplicate connection acceptance */
-  if (s->data.connection.accepted == 1)
-  {
+  for (i = 0; i < num; i++) {
+    if (i > 0) {
+      if (evs[i].event_type != FLEXTCP_EV_LISTEN_ACCEPT)
+        break;
+      s = ev_accept_socket(&evs[i]);
+      if (s->data.connection.listener != sl)
+        break;
+    }
+
+    socket_lock(s);
+
+    /** Skip so we don't duplicate connection acceptance */
+    if (s->data.connection.accepted == 1)
+    {
+      socket_unlock(s);
+      continue;
+    }
+
+    assert(s->data.connection.status == SOC_CONNECTING);
+    /* failed slots are dropped by the next accept, they do not make the
+     * listener readable */
+    if (evs[i].ev.listen_accept.status == 0) {
+      s->data.connection.status = SOC_CONNECTED;
+      flextcp_epoll_set(s, EPOLLOUT);
+      ready = 1;
+    } else {
+      s->data.connection.status = SOC_FAILED;
+    }
+
     socket_unlock(s);
-    socket_unlock(sl);
-    return;
   }
 
-  assert(s->data.connection.status == SOC_CONNECTING);
-  flextcp_epoll_set(sl, EPOLLIN);
-
-  if (ev->ev.listen_accept.status == 0) {
-    s->data.connection.status = SOC_CONNECTED;
-    flextcp_epoll_set(s, EPOLLOUT);
-  } else {
-    s->data.connection.status = SOC_FAILED;
-    flextcp_epoll_set(s, EPOLLERR);
+  if (ready) {
+    flextcp_epoll_set(sl, EPOLLIN);
+    flextcp_batch_sockevent(ctx, sl);
   }
 
-  socket_unlock(s);
   socket_unlock(sl);
+  return i;
 }
 
 
@@ -347,6 +373,7 @@ static inline void ev_conn_received(struct flextcp_context *ctx,
   }
 
   flextcp_epoll_set(s, EPOLLIN);
+  flextcp_batch_sockevent(ctx, s);
 
 out:
   socket_unlock(s);
@@ -368,6 +395,7 @@ static inline void ev_conn_sendbuf(struct flextcp_context *ctx,
   assert(s->data.connection.status == SOC_CONNECTED);
 
   flextcp_epoll_set(s, EPOLLOUT);
+  flextcp_batch_sockevent(ctx, s);
 
   socket_unlock(s);
 }
@@ -410,6 +438,7 @@ static inline void ev_conn_rxclosed(struct flextcp_context *ctx,
 
   s->data.connection.st_flags |= CSTF_RXCLOSED;
   flextcp_epoll_set(s, EPOLLIN | EPOLLRDHUP);
+  flextcp_batch_sockevent(ctx, s);
 
   if (s->data.connection.status == SOC_CLOSED &&
       (s->data.connection.st_flags & CSTF_TXCLOSED_ACK))
@@ -466,5 +495,5 @@ static inline void ev_conn_closed(struct flextcp_context *ctx,
   assert(s->type == SOCK_CONNECTION);
   assert(s->data.connection.status == SOC_CLOSED);
 
-  free(s);
+  flextcp_fd_sfree(s);
 }
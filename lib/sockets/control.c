@@ -42,18 +42,22 @@
 #include "internal.h"
 
 static void conn_close(struct flextcp_context *ctx, struct socket *s);
+static void conn_tx_unreserve(struct socket *s);
 
 int tas_init(void)
 {
   int groupid;
   char *groupidstr;
   char *isolatedstr;
+  char *singlestr;
   int isolated;
 
 
   groupidstr = getenv("TAS_GROUP");
   isolatedstr = getenv("TAS_ISOLATED_VM");
   isolated = isolatedstr != NULL && strcmp(isolatedstr, "0") != 0;
+  singlestr = getenv("TAS_SINGLE_THREAD");
+  flextcp_sockets_single = singlestr != NULL && strcmp(singlestr, "0") != 0;
 
   if (flextcp_fd_init() != 0) {
     fprintf(stderr, "flextcp_fd_init failed\n");
@@ -113,6 +117,13 @@ int tas_socket(int domain, int type, int protocol)
     return -1;
   }
 
+  /* the fd comes close-on-exec from the pool */
+  if (!cloexec && flextcp_fd_cloexec(fd, 0) != 0) {
+    flextcp_fd_close(fd);
+    flextcp_fd_sfree(s);
+    return -1;
+  }
+
   s->type = SOCK_SOCKET;
   s->flags = 0;
   flextcp_epoll_sockinit(s);
@@ -155,6 +166,7 @@ int tas_close(int sockfd)
     /* destroy epoll */
     flextcp_epoll_destroy(ep);
   } else {
+    flextcp_fd_forget(sockfd);
     errno = EBADF;
     return -1;
   }
@@ -168,14 +180,18 @@ int tas_sock_close(struct socket *s)
 
   assert(s->refcnt == 0);
 
+  /* cancel pending batch operations */
+  if (s->batch != NULL)
+    flextcp_batch_sockclose(s);
+
   /* remove from epoll */
   flextcp_epoll_sockclose(s);
 
-  ctx = flextcp_sockctx_get();
   if (s->type == SOCK_CONNECTION) {
+    ctx = flextcp_sockctx_get();
     conn_close(ctx, s);
   } else if (s->type == SOCK_SOCKET) {
-    free(s);
+    flextcp_fd_sfree(s);
   } else {
     fprintf(stderr, "TODO: close for non-connections. (leak)\n");
   }
@@ -183,10 +199,27 @@ int tas_sock_close(struct socket *s)
   return 0;
 }
 
+/* called with lock on s held, drops an uncommitted zero-copy reservation */
+static void conn_tx_unreserve(struct socket *s)
+{
+  if (s->data.connection.tx_reserved == 0)
+    return;
+
+  if (flextcp_connection_tx_release(&s->data.connection.c,
+        s->data.connection.tx_reserved) != 0)
+  {
+    fprintf(stderr, "conn_tx_unreserve: flextcp_connection_tx_release "
+        "failed\n");
+    abort();
+  }
+  s->data.connection.tx_reserved = 0;
+}
+
 /* called with lock on s held, takes over ownership of s struct */
 static void conn_close(struct flextcp_context *ctx, struct socket *s)
 {
   s->data.connection.status = SOC_CLOSED;
+  conn_tx_unreserve(s);
 
   if ((s->data.connection.st_flags & CSTF_TXCLOSED_ACK) &&
       (s->data.connection.st_flags & CSTF_RXCLOSED))
@@ -259,6 +292,8 @@ int tas_shutdown(int sockfd, int how)
     goto out;
   }
 
+  conn_tx_unreserve(s);
+
   ctx = flextcp_sockctx_get();
   if (flextcp_connection_tx_close(ctx, &s->data.connection.c) != 0) {
     /* a bit fishy.... */
@@ -384,47 +419,72 @@ out:
   return ret;
 }
 
-/** Enqueue accept requests for backlog. Lock on s has to be held. */
-static int enqueue_accept(struct flextcp_context *ctx, struct socket *s)
+/** Enqueue accept requests for the slot ring a, posted to the kernel from ctx
+ * in batches of FLEXTCP_LISTEN_ACCEPT_BATCH. Lock on s has to be held. */
+static int enqueue_accept(struct flextcp_context *ctx, struct socket *s,
+    struct socket_accepts *a)
 {
   int newfd;
-  struct socket *ns;
+  struct socket *ns, *nss[FLEXTCP_LISTEN_ACCEPT_BATCH];
+  struct flextcp_connection *conns[FLEXTCP_LISTEN_ACCEPT_BATCH];
   struct socket_listen *l = &s->data.listener;
   struct socket_backlog *bl;
+  int i, n, posted;
 
   /* try to fill backlog */
-  while (l->backlog_num != l->backlog_len) {
-    /* allocate socket structure */
-    if ((newfd = flextcp_fd_salloc(&ns)) < 0) {
-      break;
+  while (a->backlog_num != a->backlog_len) {
+    for (n = 0; n < FLEXTCP_LISTEN_ACCEPT_BATCH &&
+        a->backlog_num + n != a->backlog_len; n++)
+    {
+      /* allocate socket structure */
+      if ((newfd = flextcp_fd_salloc(&ns)) < 0) {
+        break;
+      }
+
+      ns->type = SOCK_CONNECTION;
+      ns->flags = 0;
+      ns->data.connection.status = SOC_CONNECTING;
+      ns->data.connection.listener = s;
+      ns->data.connection.rx_len_1 = 0;
+      ns->data.connection.rx_len_2 = 0;
+      ns->data.connection.ctx = ctx;
+      ns->data.connection.accepted = 0;
+
+      bl = a->backlog +
+        ((a->backlog_next + a->backlog_num + n) % a->backlog_len);
+      bl->s = ns;
+      bl->fd = newfd;
+
+      nss[n] = ns;
+      conns[n] = &ns->data.connection.c;
     }
 
-    ns->type = SOCK_CONNECTION;
-    ns->flags = 0;
-    ns->data.connection.status = SOC_CONNECTING;
-    ns->data.connection.listener = s;
-    ns->data.connection.rx_len_1 = 0;
-    ns->data.connection.rx_len_2 = 0;
-    ns->data.connection.ctx = ctx;
-    ns->data.connection.accepted = 0;
-
-    bl = l->backlog + ((l->backlog_next + l->backlog_num) % l->backlog_len);
-    bl->s = ns;
-    bl->fd = newfd;
-
-    /* send accept request to kernel */
-    if (flextcp_listen_accept(ctx, &l->l, &ns->data.connection.c) != 0)
-    {
-      /* TODO: check error code... */
-      flextcp_fd_close(newfd);
+    if (n == 0) {
       break;
     }
 
-    socket_unlock(ns);
-    l->backlog_num = l->backlog_num + 1;
+    /* send accept requests to kernel */
+    posted = flextcp_listen_accept_n(ctx, &l->l, conns, n);
+    for (i = 0; i < n; i++) {
+      bl = a->backlog +
+        ((a->backlog_next + a->backlog_num + i) % a->backlog_len);
+      if (i < posted) {
+        socket_unlock(nss[i]);
+      } else {
+        /* the kernel queue is full, which is the only way posting fails.
+         * The slots are allocated again on the next accept. */
+        flextcp_fd_close(bl->fd);
+        flextcp_fd_sfree(nss[i]);
+      }
+    }
+
+    a->backlog_num = a->backlog_num + posted;
+    if (posted < n) {
+      break;
+    }
   }
 
-  if (l->backlog_num == 0) {
+  if (a->backlog_num == 0) {
     errno = ENOBUFS;
     return -1;
   }
@@ -464,6 +524,13 @@ int tas_listen(int sockfd, int backlog)
     flags |= FLEXTCP_LISTEN_REUSEPORT;
   }
 
+  /* pass on steering flags */
+  if ((s->flags & SOF_STEER_CORE) == SOF_STEER_CORE) {
+    flags |= FLEXTCP_LISTEN_STEER_CORE;
+  } else if ((s->flags & SOF_STEER_THREAD) == SOF_STEER_THREAD) {
+    flags |= FLEXTCP_LISTEN_STEER_CTX;
+  }
+
   /* make sure we have a reasonable backlog */
   if (backlog < 8) {
     backlog = 8;
@@ -486,10 +553,12 @@ int tas_listen(int sockfd, int backlog)
 
   s->type = SOCK_LISTENER;
   l = &s->data.listener;
-  l->backlog = bl;
-  l->backlog_len = backlog;
-  l->backlog_next = 0;
-  l->backlog_num = 0;
+  l->acc.backlog = bl;
+  l->acc.backlog_len = backlog;
+  l->acc.backlog_next = 0;
+  l->acc.backlog_num = 0;
+  l->acc.ctx = ctx;
+  l->acc.next = NULL;
   l->status = SOL_OPENING;
   l->ctx = ctx;
 
@@ -511,7 +580,7 @@ int tas_listen(int sockfd, int backlog)
   }
 
   /* enqueue accepts */
-  if (enqueue_accept(ctx, s)) {
+  if (enqueue_accept(ctx, s, &l->acc)) {
     goto err_close;
   }
 
@@ -527,124 +596,200 @@ err:
   return -1;
 }
 
-int tas_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
-    int flags)
+/* called with lock on listener s held, returns the accept slot ring of ctx
+ * on a steered listener, allocating and filling it on first use */
+static struct socket_accepts *accepts_get(struct flextcp_context *ctx,
+    struct socket *s)
 {
-  struct socket *s, *ns;
-  struct socket_listen *sl;
-  struct flextcp_context *ctx;
-  struct socket_backlog *bl;
-  int ret = 0, nonblock = 0, cloexec = 0, newfd, block;
+  struct socket_listen *sl = &s->data.listener;
+  struct socket_accepts *a;
 
-  if (flextcp_fd_slookup(sockfd, &s) != 0) {
-    errno = EBADF;
-    return -1;
+  for (a = &sl->acc; a != NULL; a = a->next) {
+    if (a->ctx == ctx)
+      return a;
   }
-  sl = &s->data.listener;
 
-  /* validate flags */
-  if ((flags & SOCK_NONBLOCK) == SOCK_NONBLOCK) {
-    nonblock = 1;
+  if ((a = calloc(1, sizeof(*a))) == NULL) {
+    return NULL;
   }
-  if ((flags & SOCK_CLOEXEC) == SOCK_CLOEXEC) {
-    cloexec = 1;
+  if ((a->backlog = calloc(sl->acc.backlog_len, sizeof(*a->backlog))) ==
+      NULL)
+  {
+    free(a);
+    return NULL;
+  }
+  a->backlog_len = sl->acc.backlog_len;
+  a->ctx = ctx;
+
+  /* slots are only returned once posted, so the ring can be linked even if
+   * posting fails now */
+  a->next = sl->acc.next;
+  sl->acc.next = a;
+  enqueue_accept(ctx, s, a);
+  return a;
+}
+
+/* called with lock on listener held, checks whether the next slot in ring a
+ * has completed. Slots the kernel could not accept into are dropped here. */
+static int accepts_ready(struct socket_accepts *a)
+{
+  struct socket_backlog *bl;
+  struct socket *ns;
+  int status;
+
+  while (a->backlog_num > 0) {
+    bl = a->backlog + a->backlog_next;
+    ns = bl->s;
+    socket_lock(ns);
+    status = ns->data.connection.status;
+    if (status != SOC_FAILED) {
+      socket_unlock(ns);
+      return status == SOC_CONNECTED;
+    }
+
+    a->backlog_next = (a->backlog_next + 1) % a->backlog_len;
+    --a->backlog_num;
+    flextcp_fd_close(bl->fd);
+    flextcp_fd_sfree(ns);
   }
+  return 0;
+}
 
-  flags &= ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
-  if (flags != 0) {
+/* called with lock on listener s held, accepts the next connection without
+ * blocking. Returns the new fd, or -1 with errno set to EAGAIN if no
+ * connection is ready yet. */
+int flextcp_accept_try(struct flextcp_context *ctx, struct socket *s,
+    int flags)
+{
+  struct socket *ns;
+  struct socket_listen *sl = &s->data.listener;
+  struct socket_accepts *a, *own;
+  struct socket_backlog *bl;
+  int newfd, steered;
+
+  /* validate flags */
+  if ((flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != 0) {
     errno = EINVAL;
-    ret = -1;
-    goto out;
+    return -1;
   }
 
   /* socket is not a listening socket */
   if (s->type != SOCK_LISTENER) {
     errno = EOPNOTSUPP;
-    ret = -1;
-    goto out;
+    return -1;
   }
 
-  ctx = flextcp_sockctx_get();
-  block = 0;
-  while (1) {
-    /* grab next pending accept */
-    if (sl->backlog_num == 0 && enqueue_accept(ctx, s)) {
-      errno = ENOBUFS;
-      ret = -1;
-      goto out;
-    }
-    bl = sl->backlog + sl->backlog_next;
-    ns = bl->s;
-    newfd = bl->fd;
-
-    socket_lock(ns);
-    if (ns->data.connection.status != SOC_CONNECTING) {
-      /* connection is ready */
-      break;
-    } else {
-      /* connection is still pending */
-      socket_unlock(ns);
-
-      if ((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK) {
-        /* if non-blocking, just return */
-        errno = EAGAIN;
-        ret = -1;
-        goto out;
-      } else {
-        /* if this is blocking, wait for a connection to complete */
-        socket_unlock(s);
+  /* on steered listeners every context accepts from its own slots */
+  steered = !!(s->flags & (SOF_STEER_THREAD | SOF_STEER_CORE));
+  if (!steered) {
+    own = &sl->acc;
+  } else if ((own = accepts_get(ctx, s)) == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
 
-        if (block)
-          flextcp_context_wait(ctx, -1);
-        flextcp_sockctx_poll(ctx);
-        block = 1;
+  /* grab next pending accept */
+  if (own->backlog_num == 0 && enqueue_accept(ctx, s, own) && !steered) {
+    errno = ENOBUFS;
+    return -1;
+  }
 
-        socket_lock(s);
+  a = own;
+  if (!accepts_ready(a)) {
+    /* take a connection from another thread's slots rather than leaving it
+     * waiting for that thread */
+    a = NULL;
+    if (steered) {
+      for (a = &sl->acc; a != NULL; a = a->next) {
+        if (a != own && accepts_ready(a))
+          break;
       }
     }
+
+    if (a == NULL) {
+      errno = EAGAIN;
+      return -1;
+    }
+    flextcp_sockctx_getfull()->stats.accept_steals++;
   }
 
+  bl = a->backlog + a->backlog_next;
+  ns = bl->s;
+  newfd = bl->fd;
+
   /* connection is opened now */
+  socket_lock(ns);
   assert(ns->data.connection.status == SOC_CONNECTED);
 
-  if (cloexec)
+  /* the fd comes close-on-exec from the pool */
+  if ((flags & SOCK_CLOEXEC) == 0 && flextcp_fd_cloexec(newfd, 0) != 0) {
+    socket_unlock(ns);
+    return -1;
+  }
+
+  if ((flags & SOCK_CLOEXEC) == SOCK_CLOEXEC)
     ns->flags |= SOF_CLOEXEC;
-  if (nonblock)
+  if ((flags & SOCK_NONBLOCK) == SOCK_NONBLOCK)
     ns->flags |= SOF_NONBLOCK;
 
   /* remove this connection from backlog now */
-  sl->backlog_next = (sl->backlog_next + 1) % sl->backlog_len;
-  --sl->backlog_num;
+  a->backlog_next = (a->backlog_next + 1) % a->backlog_len;
+  --a->backlog_num;
 
   flextcp_fd_srelease(newfd, ns);
 
-  /* refill backlog */
-  enqueue_accept(ctx, s);
+  /* refill backlog once a whole batch of accepts can be posted */
+  if (own->backlog_len - own->backlog_num >= FLEXTCP_LISTEN_ACCEPT_BATCH) {
+    enqueue_accept(ctx, s, own);
+  }
 
   /* clear epollin on listening socket if no more connections */
-  if (!sl->backlog_num) {
+  for (a = &sl->acc; a != NULL && !accepts_ready(a); a = a->next);
+  if (a == NULL) {
     flextcp_epoll_clear(s, EPOLLIN);
-  } else {
-    struct socket *next = sl->backlog[sl->backlog_next].s;
-    socket_lock(next);
-    if (next->data.connection.status == SOC_CONNECTING)
-      flextcp_epoll_clear(s, EPOLLIN);
-    socket_unlock(next);
+  }
+
+  return newfd;
+}
+
+int tas_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+    int flags)
+{
+  struct socket *s;
+  struct flextcp_context *ctx;
+  int ret, block;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  ctx = flextcp_sockctx_get();
+  block = 0;
+  while ((ret = flextcp_accept_try(ctx, s, flags)) < 0 && errno == EAGAIN &&
+      (s->flags & SOF_NONBLOCK) != SOF_NONBLOCK)
+  {
+    /* if this is blocking, wait for a connection to complete */
+    socket_unlock(s);
+
+    if (block)
+      flextcp_context_wait(ctx, -1);
+    flextcp_sockctx_poll(ctx);
+    block = 1;
+
+    socket_lock(s);
   }
 
   // fill in addr if given
-  if(addr != NULL) {
-    int r = tas_getpeername(newfd, addr, addrlen);
+  if (ret >= 0 && addr != NULL) {
+    int r = tas_getpeername(ret, addr, addrlen);
     assert(r == 0);
   }
 
-  ret = newfd;
-out:
   flextcp_fd_srelease(sockfd, s);
   return ret;
 }
 
-/** map: accept  -->  accept4 */
 int tas_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
   return tas_accept4(sockfd, addr, addrlen, 0);
@@ -716,6 +861,12 @@ int tas_fcntl(int sockfd, int cmd, ...)
         goto out;
       }
 
+      /* the kernel fd decides what happens on exec */
+      if (flextcp_fd_cloexec(sockfd, iarg & FD_CLOEXEC) != 0) {
+        ret = -1;
+        goto out;
+      }
+
       if ((iarg & FD_CLOEXEC) == FD_CLOEXEC)
         s->flags |= SOF_CLOEXEC;
       else
@@ -786,6 +937,14 @@ int tas_getsockopt(int sockfd, int level, int optname, void *optval,
   } else if (level == SOL_SOCKET && optname == SO_REUSEADDR) {
     /* reuseaddr is always on */
     res = 1;
+  } else if (level == SOL_SOCKET && optname == TAS_SO_STEER) {
+    if ((s->flags & SOF_STEER_CORE) == SOF_STEER_CORE) {
+      res = TAS_STEER_CORE;
+    } else if ((s->flags & SOF_STEER_THREAD) == SOF_STEER_THREAD) {
+      res = TAS_STEER_THREAD;
+    } else {
+      res = TAS_STEER_NONE;
+    }
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
     /* keepalive is always disabled */
     res = 0;
@@ -798,8 +957,14 @@ int tas_getsockopt(int sockfd, int level, int optname, void *optval,
     ret = -1;
     goto out;
   } else if (level == SOL_TCP && optname == TCP_MAXSEG) {
-    fprintf(stderr, "flextcp getsockopt: warning TCP_MAXSEG hardcoded\n");
-    res = 1460;
+    /* negotiated segment size once connected, the default before */
+    if (s->type == SOCK_CONNECTION &&
+        s->data.connection.status == SOC_CONNECTED)
+    {
+      res = s->data.connection.c.mss;
+    } else {
+      res = 536;
+    }
   } else if (level == SOL_TCP && optname == TCP_INFO) {
     fprintf(stderr, "flextcp getsockopt: warning TCP_INFO hardcoded\n");
     len = TAS_MIN(*optlen, sizeof(struct tcp_info));
@@ -875,6 +1040,25 @@ int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
     } else {
       s->flags &= ~SOF_REUSEPORT;
     }
+  } else if (level == SOL_SOCKET && optname == TAS_SO_STEER) {
+    /* steering is fixed once the listener is opened */
+    if (optlen != sizeof(int) || s->type != SOCK_SOCKET) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    res = *(int *) optval;
+    s->flags &= ~(SOF_STEER_THREAD | SOF_STEER_CORE);
+    if (res == TAS_STEER_THREAD) {
+      s->flags |= SOF_STEER_THREAD;
+    } else if (res == TAS_STEER_CORE) {
+      s->flags |= SOF_STEER_CORE;
+    } else if (res != TAS_STEER_NONE) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
   } else if (level == SOL_SOCKET && optname == SO_REUSEADDR) {
     /* ignore silently */
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
@@ -1032,11 +1216,20 @@ int tas_sock_move(struct socket *s)
   ret = s->data.connection.move_status;
   if (ret == 0) {
     s->data.connection.ctx = ctx;
+    flextcp_sockctx_getfull()->stats.conn_moves++;
   }
 
   return ret;
 }
 
+void tas_sock_stats(struct tas_sock_stats *st)
+{
+  struct sockets_context *sctx = flextcp_sockctx_getfull();
+
+  *st = sctx->stats;
+  memset(&sctx->stats, 0, sizeof(sctx->stats));
+}
+
 pid_t tas_fork(pid_t pid, pid_t parent_pid)
 {
   struct flextcp_context *ctx;
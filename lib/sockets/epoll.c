@@ -47,6 +47,18 @@ static inline void es_active_pushback(struct epoll_socket *es);
 static inline void es_remove_ep(struct epoll_socket *es);
 static inline void es_remove_sock(struct epoll_socket *es);
 
+static inline void ep_rdy_lock(struct epoll *ep)
+{
+  if (!flextcp_sockets_single)
+    util_spin_lock(&ep->rdy_lock);
+}
+
+static inline void ep_rdy_unlock(struct epoll *ep)
+{
+  if (!flextcp_sockets_single)
+    util_spin_unlock(&ep->rdy_lock);
+}
+
 int tas_epoll_create(int size)
 {
   if (size <= 0) {
@@ -122,9 +134,8 @@ int tas_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 
   /* validate events */
   if (op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD) {
-    em = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-    event->events &= (~EPOLLET);	// XXX: Mask edge-triggered
-    event->events &= (~EPOLLEXCLUSIVE); // XXX: Mask epoll exclusive
+    em = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLRDHUP | EPOLLET |
+      EPOLLEXCLUSIVE;
     if ((event->events & (~em)) != 0) {
       fprintf(stderr, "flextcp epoll_ctl: unsupported events: %x\n",
           (event->events & (~em)));
@@ -134,6 +145,15 @@ int tas_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
     }
   }
 
+  /* as in linux, EPOLLEXCLUSIVE can only be set when adding an fd */
+  if (op == EPOLL_CTL_MOD && ((event->events & EPOLLEXCLUSIVE) != 0 ||
+        (es != NULL && (es->mask & EPOLLEXCLUSIVE) != 0)))
+  {
+    errno = EINVAL;
+    ret = -1;
+    goto out_sock;
+  }
+
   /* execute operation */
   if (op == EPOLL_CTL_ADD) {
     ep->num_tas++;
@@ -176,13 +196,14 @@ int tas_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
       flextcp_listen_move(ctx, &s->data.listener.l);
     }
 
-    /* add to inactive queue */
+    /* add to inactive queue, and activate if events are already pending */
+    ep_rdy_lock(ep);
     es_add_inactive(es);
-
-    /* check if this epoll is already active */
-    if ((s->ep_events & es->mask) != 0) {
+    es->et_events = s->ep_events & es->mask;
+    if (es->et_events != 0) {
       es_activate(es);
     }
+    ep_rdy_unlock(ep);
   } else if (op == EPOLL_CTL_MOD) {
     /* modify fd in epoll */
 
@@ -193,10 +214,13 @@ int tas_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
       goto out_sock;
     }
 
+    ep_rdy_lock(ep);
     es->mask = event->events | EPOLLERR;
-    if ((s->ep_events & es->mask) != 0) {
+    es->et_events = s->ep_events & es->mask;
+    if (es->et_events != 0) {
       es_activate(es);
     }
+    ep_rdy_unlock(ep);
   } else if (op == EPOLL_CTL_DEL) {
     /* remove fd from epoll */
     ep->num_tas--;
@@ -209,7 +233,9 @@ int tas_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
     }
 
     es_remove_sock(es);
+    ep_rdy_lock(ep);
     es_remove_ep(es);
+    ep_rdy_unlock(ep);
     free(es);
   } else {
     /* unknown operation */
@@ -233,8 +259,7 @@ static unsigned ep_poll_tas(struct flextcp_context *ctx, int epfd,
     struct epoll *ep, struct epoll_event *events, int maxevents)
 {
   struct epoll_socket *es;
-  struct socket *s;
-  uint32_t i, num_active;
+  uint32_t i, num_active, evs;
   unsigned n = 0;
 
   /* make sure to poll for some events even if there is already enough on the
@@ -243,6 +268,11 @@ static unsigned ep_poll_tas(struct flextcp_context *ctx, int epfd,
   flextcp_sockctx_poll_n(ctx, maxevents);
   epoll_lock(ep);
 
+  /* event delivery puts sockets on the active list, so only sockets with
+   * events are visited here and their locks are not needed: a racing clear
+   * at worst reports an event that is already gone, and a racing set
+   * re-activates the socket after we release the list. */
+  ep_rdy_lock(ep);
   num_active = ep->num_active;
   for (i = 0; i < num_active && n < maxevents; i++) {
     es = ep->active_first;
@@ -253,19 +283,28 @@ static unsigned ep_poll_tas(struct flextcp_context *ctx, int epfd,
 
     util_prefetch0(es->ep_next);
 
-    /* check whether fd is actually active */
-    s = es->s;
-    socket_lock(s);
-    if ((s->ep_events & es->mask) != 0) {
-      events[n].events = s->ep_events & es->mask;
+    if ((es->mask & EPOLLET) != 0) {
+      /* edge-triggered: report events once, until the next one arrives */
+      evs = es->et_events;
+      es->et_events = 0;
+      es_deactivate(es);
+    } else {
+      /* level-triggered: stays active as long as events are pending */
+      evs = __atomic_load_n(&es->s->ep_events, __ATOMIC_RELAXED) & es->mask;
+      if (evs != 0) {
+        es_active_pushback(es);
+      } else {
+        es_deactivate(es);
+      }
+    }
+
+    if (evs != 0) {
+      events[n].events = evs;
       events[n].data = es->data;
       n++;
-      es_active_pushback(es);
-    } else {
-      es_deactivate(es);
     }
-    socket_unlock(s);
   }
+  ep_rdy_unlock(ep);
 
   return n;
 }
@@ -298,6 +337,7 @@ int tas_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
   }
 
   util_prefetch0(ep->active_first);
+  __atomic_fetch_add(&ep->waiters, 1, __ATOMIC_RELAXED);
 
   /* calculate timeout */
   if (timeout > 0) {
@@ -350,6 +390,7 @@ again:
         ret = tas_libc_poll(pfds, 2, mtimeout - cur_ms);
         if (ret < 0) {
           perror("tas_epoll_wait: poll failed");
+          __atomic_fetch_sub(&ep->waiters, 1, __ATOMIC_RELAXED);
           return -1;
         }
 
@@ -361,6 +402,7 @@ again:
   } while (n == 0 && timeout != 0 && (timeout == -1 || get_msecs() < mtimeout));
 
   ret = n;
+  __atomic_fetch_sub(&ep->waiters, 1, __ATOMIC_RELAXED);
   flextcp_fd_erelease(epfd, ep);
   EPOLL_DEBUG("        = %d\n", ret);
   return ret;
@@ -376,50 +418,104 @@ int tas_epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
 
 void flextcp_epoll_sockinit(struct socket *s)
 {
+  flextcp_sock_ready_update(s, s->ep_events, 0);
   s->ep_events = 0;
   s->eps = NULL;
-#if 0
-  s->eps_exc_first = NULL;
-  s->eps_exc_last = NULL;
-#endif
+  s->ep_exc_next = 0;
+}
+
+/* put es on its epoll's active list if it is interested in the events,
+ * returns 1 if it was */
+static inline int es_trigger(struct epoll_socket *es, uint32_t evts,
+    uint32_t newevs)
+{
+  struct epoll *ep = es->ep;
+
+  /* edge-triggered epolls see every event, level-triggered ones only
+   * events that were not pending yet */
+  if ((es->mask & EPOLLET) != 0) {
+    evts &= es->mask;
+  } else {
+    evts = newevs & es->mask;
+  }
+  if (evts == 0) {
+    return 0;
+  }
+
+  ep_rdy_lock(ep);
+  es->et_events |= evts;
+  es_activate(es);
+  ep_rdy_unlock(ep);
+  return 1;
 }
 
 void flextcp_epoll_set(struct socket *s, uint32_t evts)
 {
-  uint32_t newevs;
+  uint32_t oldevs, newevs;
   struct epoll_socket *es;
+  unsigned i, n_exc = 0, start, pass;
 
-  newevs = (~s->ep_events) & evts;
+  oldevs = s->ep_events;
+  newevs = (~oldevs) & evts;
 
   EPOLL_DEBUG("flextcp_epoll_set(%p, %x) ne=%x\n", s, evts, newevs);
-  if (newevs == 0) {
-    /* no new events */
-    return;
-  }
-  s->ep_events |= evts;
+  __atomic_store_n(&s->ep_events, oldevs | evts, __ATOMIC_RELEASE);
+  flextcp_sock_ready_update(s, oldevs, oldevs | evts);
 
   for (es = s->eps; es != NULL; es = es->so_next) {
-    if ((newevs & es->mask) == 0) {
+    if ((es->mask & EPOLLEXCLUSIVE) != 0) {
+      n_exc++;
       continue;
     }
+    es_trigger(es, evts, newevs);
+  }
 
-    es_activate(es);
+  if (n_exc == 0) {
+    return;
+  }
+
+  /* exclusive epolls get the event in turn, stopping at the first one with a
+   * thread waiting in it. The starting point rotates to spread events. */
+  start = s->ep_exc_next++ % n_exc;
+  for (pass = 0; pass < 2; pass++) {
+    i = 0;
+    for (es = s->eps; es != NULL; es = es->so_next) {
+      if ((es->mask & EPOLLEXCLUSIVE) == 0) {
+        continue;
+      }
+      if ((pass == 0) != (i++ >= start)) {
+        continue;
+      }
+
+      if (es_trigger(es, evts, newevs) &&
+          __atomic_load_n(&es->ep->waiters, __ATOMIC_RELAXED) != 0)
+      {
+        return;
+      }
+    }
   }
 }
 
 void flextcp_epoll_clear(struct socket *s, uint32_t evts)
 {
+  uint32_t oldevs = s->ep_events;
+
   EPOLL_DEBUG("flextcp_epoll_clear(%p, %x)\n", s, evts);
-  s->ep_events &= ~evts;
+  __atomic_store_n(&s->ep_events, oldevs & ~evts, __ATOMIC_RELAXED);
+  flextcp_sock_ready_update(s, oldevs, oldevs & ~evts);
 }
 
 void flextcp_epoll_sockclose(struct socket *s)
 {
   struct epoll_socket *es;
+  struct epoll *ep;
 
   while ((es = s->eps) != NULL) {
+    ep = es->ep;
     es_remove_sock(es);
+    ep_rdy_lock(ep);
     es_remove_ep(es);
+    ep_rdy_unlock(ep);
     free(es);
   }
 }
@@ -428,21 +524,37 @@ void flextcp_epoll_sockclose(struct socket *s)
 void flextcp_epoll_destroy(struct epoll *ep)
 {
   struct epoll_socket *es;
+  struct socket *s;
 
   assert(ep->refcnt == 0);
 
-  /* remove inactive epoll socket bindings */
-  while((es = ep->active_first) != NULL){
-    es = ep->active_first;
-    es_remove_sock(es);
-    es_remove_ep(es);
-    free(es);
-  }
+  /* remove active and inactive epoll socket bindings, sockets can still
+   * deliver events until the binding is off their list */
+  while (1) {
+    ep_rdy_lock(ep);
+    if ((es = ep->active_first) == NULL) {
+      es = ep->inactive;
+    }
+    if (es == NULL) {
+      ep_rdy_unlock(ep);
+      break;
+    }
+
+    /* the socket lock is ordered before the ready lock, so it is only tried
+     * while the binding is on our list. Closing the socket removes the
+     * binding with the socket lock held, so once we hold it es stays. */
+    s = es->s;
+    if (!socket_trylock(s)) {
+      ep_rdy_unlock(ep);
+      continue;
+    }
+    ep_rdy_unlock(ep);
 
-  /* remove active epoll socket bindings */
-  while((es = ep->inactive) != NULL){
     es_remove_sock(es);
+    ep_rdy_lock(ep);
     es_remove_ep(es);
+    ep_rdy_unlock(ep);
+    socket_unlock(s);
     free(es);
   }
 
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TAS_BATCH_H_
+#define TAS_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @file tas_batch.h
+ * @brief Batched socket operations on top of TAS sockets.
+ *
+ * Operations are queued as submission entries on a per-thread batch and
+ * handed to TAS together by tas_batch_submit(). Operations that cannot
+ * complete right away stay pending on their socket and are completed by the
+ * events of the thread's TAS context, so a single tas_batch_reap() call polls
+ * the context once and returns the completions of all sockets. Sockets used in
+ * a batch are opened and set up with the regular TAS sockets calls.
+ *
+ * @addtogroup libtas-sockets
+ * @{ */
+
+/** Operation codes for submission entries */
+enum tas_batch_op {
+  /** Does nothing, completes with 0 */
+  TAS_BATCH_OP_NOP = 0,
+  /** Sends the whole buffer, completes with len once it is queued */
+  TAS_BATCH_OP_SEND = 1,
+  /** Receives up to len bytes, completes with the bytes received or 0 on
+   * end of stream */
+  TAS_BATCH_OP_RECV = 2,
+  /** Accepts a connection on a listener, completes with the new fd */
+  TAS_BATCH_OP_ACCEPT = 3,
+  /** Closes the socket, pending operations on it complete with
+   * -ECANCELED */
+  TAS_BATCH_OP_CLOSE = 4,
+};
+
+/** Submission entry */
+struct tas_batch_sqe {
+  /** Operation code (enum tas_batch_op) */
+  uint8_t opcode;
+  uint8_t _pad[3];
+  /** Socket to operate on */
+  int fd;
+  /** Buffer for send and receive */
+  void *buf;
+  /** Buffer length for send and receive, SOCK_* flags for accept */
+  size_t len;
+  /** Opaque value passed back in the completion */
+  uint64_t user_data;
+};
+
+/** Completion entry */
+struct tas_batch_cqe {
+  /** user_data from the submission entry */
+  uint64_t user_data;
+  /** Result of the operation, negative errno value on failure */
+  ssize_t res;
+};
+
+struct tas_batch;
+
+/**
+ * Create a batch for the calling thread. At most entries operations can be
+ * queued, pending, or waiting to be reaped at a time.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int tas_batch_init(struct tas_batch **pb, unsigned entries);
+
+/**
+ * Destroy a batch created by this thread. Operations still pending are
+ * dropped.
+ */
+void tas_batch_destroy(struct tas_batch *b);
+
+/**
+ * Get the next free submission entry.
+ *
+ * @return Entry, or NULL if the batch is full.
+ */
+struct tas_batch_sqe *tas_batch_get_sqe(struct tas_batch *b);
+
+/**
+ * Execute the queued submission entries. Completions of operations that
+ * finish right away are available to the next tas_batch_reap() call.
+ *
+ * @return Number of entries submitted.
+ */
+int tas_batch_submit(struct tas_batch *b);
+
+/**
+ * Poll the TAS context and return up to max completions. Blocks for up to
+ * timeout_ms milliseconds (forever if -1) if no completions are available
+ * and operations are pending.
+ *
+ * @return Number of completions returned.
+ */
+int tas_batch_reap(struct tas_batch *b, struct tas_batch_cqe *cqes,
+    unsigned max, int timeout_ms);
+
+static inline void tas_batch_prep(struct tas_batch_sqe *sqe, uint8_t opcode,
+    int fd, void *buf, size_t len, uint64_t user_data)
+{
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = len;
+  sqe->user_data = user_data;
+}
+
+static inline void tas_batch_prep_send(struct tas_batch_sqe *sqe, int fd,
+    const void *buf, size_t len, uint64_t user_data)
+{
+  tas_batch_prep(sqe, TAS_BATCH_OP_SEND, fd, (void *) buf, len, user_data);
+}
+
+static inline void tas_batch_prep_recv(struct tas_batch_sqe *sqe, int fd,
+    void *buf, size_t len, uint64_t user_data)
+{
+  tas_batch_prep(sqe, TAS_BATCH_OP_RECV, fd, buf, len, user_data);
+}
+
+static inline void tas_batch_prep_accept(struct tas_batch_sqe *sqe, int fd,
+    int flags, uint64_t user_data)
+{
+  tas_batch_prep(sqe, TAS_BATCH_OP_ACCEPT, fd, NULL, flags, user_data);
+}
+
+static inline void tas_batch_prep_close(struct tas_batch_sqe *sqe, int fd,
+    uint64_t user_data)
+{
+  tas_batch_prep(sqe, TAS_BATCH_OP_CLOSE, fd, NULL, 0, user_data);
+}
+
+/** @} */
+
+#endif /* ndef TAS_BATCH_H_ */
@@ -26,10 +26,14 @@
 #define FLEXTCP_SOCKETS_H_
 
 #include <poll.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
 
+struct mmsghdr;
+struct timespec;
+
 /**
  * @file tas_sockets.h
  * @brief TAS sockets emulation.
@@ -72,6 +76,35 @@ int tas_getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 
 int tas_move_conn(int sockfd);
 
+/**
+ * Socket option (level SOL_SOCKET) selecting how a listener steers new
+ * connections to threads, one of the TAS_STEER_* values. Has to be set
+ * before listen().
+ */
+#define TAS_SO_STEER 0x54530001
+
+/** Accepted connections belong to the thread that posted the accept slot
+ * they completed into, and are moved when another thread uses them. */
+#define TAS_STEER_NONE 0
+/** Every thread posts its own accept slots and accept() returns connections
+ * from the calling thread's slots first, so they need no move. */
+#define TAS_STEER_THREAD 1
+/** As #TAS_STEER_THREAD, and handshakes complete into the slots of a thread
+ * paired with the fast path core handling the flow. */
+#define TAS_STEER_CORE 2
+
+/** Per thread counters of the sockets emulation */
+struct tas_sock_stats {
+  /** connections moved to the thread's context, a slow path round trip
+   * each */
+  uint64_t conn_moves;
+  /** connections accepted from slots posted by another thread */
+  uint64_t accept_steals;
+};
+
+/** Copy the calling thread's counters to st and reset them. */
+void tas_sock_stats(struct tas_sock_stats *st);
+
 
 ssize_t tas_read(int fd, void *buf, size_t count);
 
@@ -101,6 +134,66 @@ ssize_t tas_pwrite(int sockfd, const void *buf, size_t count, off_t offset);
 
 ssize_t tas_sendfile(int sockfd, int in_fd, off_t *offset, size_t len);
 
+/**
+ * Receive up to vlen messages from the socket, each waiting for data
+ * according to the socket mode. Supported flags are MSG_DONTWAIT, which
+ * does not wait even on a blocking socket, and MSG_WAITFORONE, after which
+ * only the first message waits. Other flags fail with EINVAL. The timeout
+ * is ignored.
+ *
+ * @return Number of messages received, -1 on failure with errno set.
+ */
+int tas_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+    int flags, struct timespec *timeout);
+
+/**
+ * Send up to vlen messages on the socket and push them to the fast path
+ * together. Each message waits for transmit buffer space according to the
+ * socket mode, sending stops at the first message that does not fit.
+ * Supported flags are MSG_DONTWAIT and MSG_NOSIGNAL, as SIGPIPE is never
+ * raised anyway. Other flags fail with EINVAL.
+ *
+ * @return Number of messages sent, -1 on failure with errno set.
+ */
+int tas_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+    int flags);
+
+/**
+ * Push data sent on all sockets of the calling thread to the fast path now,
+ * kicking each fast path core at most once, instead of on the next poll.
+ *
+ * @return 0 on success, -1 with errno set to EAGAIN if a queue to the fast
+ *   path was full and some data is left for later.
+ */
+int tas_flush(void);
+
+/**
+ * Reserve up to len bytes in the transmit buffer of the socket for the
+ * application to write into directly. Blocks like send() until space is
+ * available. The reservation may be shorter than len, also when the buffer
+ * wraps around.
+ *
+ * @return Number of bytes reserved, -1 on failure with errno set.
+ */
+ssize_t tas_zc_reserve(int sockfd, void **buf, size_t len);
+
+/**
+ * Same as tas_zc_reserve() but returns the reservation as up to *iovcnt
+ * buffers (two suffice to cover wrap around) for writev-style writes. On
+ * return *iovcnt holds the number of buffers used.
+ */
+ssize_t tas_zc_reservev(int sockfd, struct iovec *iov, int *iovcnt,
+    size_t len);
+
+/**
+ * Send the first len bytes reserved since the last commit and release the
+ * rest of the reservation. Regular sends on the socket fail with EBUSY while
+ * a reservation is outstanding.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int tas_zc_commit(int sockfd, size_t len);
+
 
 int tas_epoll_create(int size);
 
@@ -35,6 +35,7 @@
 #include <netinet/in.h>
 
 #include <tas_ll.h>
+#include <tas_sockets.h>
 #include <utils_sync.h>
 
 enum filehandle_type {
@@ -49,6 +50,10 @@ enum socket_flags {
   SOF_BOUND = 2,
   SOF_REUSEPORT = 4,
   SOF_CLOEXEC = 8,
+  /** listener steers connections to the accepting thread */
+  SOF_STEER_THREAD = 16,
+  /** ... and to the thread paired with the flow's fast path core */
+  SOF_STEER_CORE = 32,
 };
 
 enum conn_status {
@@ -80,6 +85,8 @@ struct socket_conn {
   void *rx_buf_2;
   size_t rx_len_1;
   size_t rx_len_2;
+  /** transmit buffer bytes reserved for zero-copy send, not committed yet */
+  size_t tx_reserved;
   struct flextcp_context *ctx;
   int move_status;
 
@@ -91,12 +98,22 @@ struct socket_backlog {
   int fd;
 };
 
-struct socket_listen {
-  struct flextcp_listener l;
+/** ring of accept slots posted on a listener */
+struct socket_accepts {
   struct socket_backlog *backlog;
   int backlog_len;
   int backlog_next;
   int backlog_num;
+  /** context the slots were posted from, for steered listeners */
+  struct flextcp_context *ctx;
+  /** slots of the next context, for steered listeners */
+  struct socket_accepts *next;
+};
+
+struct socket_listen {
+  struct flextcp_listener l;
+  /** accept slots, on steered listeners those of the listening thread */
+  struct socket_accepts acc;
   uint8_t status;
 
   struct flextcp_context *ctx;
@@ -116,14 +133,21 @@ struct socket {
 
   /** epoll events currently active on this socket */
   uint32_t ep_events;
-  /** epoll fds without EPOLLEXCLUSIVE */
+  /** bit in flextcp_sock_ready, the id stays with the memory of the socket */
+  uint32_t id;
+  /** epoll fds this socket is registered with */
   struct epoll_socket *eps;
-#if 0
-  /** first epoll fd with EPOLLEXCLUSIVE */
-  struct epoll_socket *eps_exc_first;
-  /** last epoll fd with EPOLLEXCLUSIVE */
-  struct epoll_socket *eps_exc_last;
-#endif
+  /** rotates events over epoll fds registered with EPOLLEXCLUSIVE */
+  uint16_t ep_exc_next;
+
+  /** batch with operations pending on this socket */
+  struct tas_batch *batch;
+  /** batch operations pending on this socket, in submission order */
+  struct batch_op *bops_first;
+  struct batch_op *bops_last;
+  /** next socket on the batch ready list */
+  struct socket *batch_next;
+  uint8_t batch_ready;
 };
 
 struct epoll {
@@ -135,6 +159,11 @@ struct epoll {
 
   int refcnt;
   volatile uint32_t sp_lock;
+  /** protects the active and inactive lists, event delivery takes it with
+   * the socket lock held */
+  volatile uint32_t rdy_lock;
+  /** threads currently in epoll_wait on this epoll */
+  uint32_t waiters;
 
   uint32_t num_linux;
   uint32_t num_tas;
@@ -154,31 +183,91 @@ struct epoll_socket {
 
   epoll_data_t data;
   uint32_t mask;
+  /** edge-triggered events not reported yet */
+  uint32_t et_events;
   uint8_t active;
 };
 
+struct poll_tas_fd {
+  struct socket *s;
+  nfds_t idx;
+  uint32_t id;
+  /** bit 0 set if waiting for reading, bit 1 for writing */
+  uint8_t classes;
+};
+
 struct sockets_context {
   struct flextcp_context ctx;
 
+  /** partition of the fd set last passed to tas_poll() into TAS and linux
+   * fds, reused while the set and the fd table do not change */
+  struct pollfd *poll_key;
+  nfds_t poll_nfds;
+  uint32_t poll_gen;
+  uint8_t poll_valid;
+  struct poll_tas_fd *poll_tas;
+  nfds_t poll_num_tas;
+  nfds_t *poll_linux_idx;
+  nfds_t poll_num_linux;
+  size_t poll_size;
+  /** ids of the TAS sockets in the set waiting for reading and writing,
+   * as bitmaps over the words of flextcp_sock_ready starting at
+   * poll_mask_first */
+  uint64_t (*poll_mask)[2];
+  size_t poll_mask_first;
+  size_t poll_mask_words;
+  size_t poll_mask_size;
+  /** set has sockets without readiness bit, they are always checked */
+  uint8_t poll_unmasked;
+
+  /** linux fds of the partitioned set, followed by the TAS wait fd */
   struct pollfd *pollfds_cache;
   size_t pollfds_cache_size;
 
   struct pollfd *selectfds_cache;
   size_t selectfds_cache_size;
+
+  /** counters for tas_sock_stats() */
+  struct tas_sock_stats stats;
 };
 
 int flextcp_fd_init(void);
 int flextcp_fd_salloc(struct socket **ps);
+void flextcp_fd_sfree(struct socket *s);
 int flextcp_fd_ealloc(struct epoll **pe, int fd);
 int flextcp_fd_slookup(int fd, struct socket **ps);
 int flextcp_fd_elookup(int fd, struct epoll **pe);
 void flextcp_fd_srelease(int fd, struct socket *s);
+/** socket for fd without locking it, NULL if fd is not a TAS socket */
+struct socket *flextcp_fd_speek(int fd);
+/** changes whenever a TAS fd is opened, closed, or dup'd */
+uint32_t flextcp_fd_generation(void);
 void flextcp_fd_erelease(int fd, struct epoll *ep);
 void flextcp_fd_close(int fd);
+/** set or clear FD_CLOEXEC on the kernel fd of a socket, socket fds start out
+ * with it set */
+int flextcp_fd_cloexec(int fd, int cloexec);
+/** called before the application closes a linux fd, in case it closes one of
+ * the fds reserved for sockets */
+void flextcp_fd_forget(int fd);
+
+/** sockets with ids from here on have no bits in flextcp_sock_ready */
+#define FLEXTCP_SOCK_IDS (1024 * 1024)
+/** epoll events that make a socket readable or writable for poll() */
+#define FLEXTCP_READY_IN (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLERR | EPOLLHUP)
+#define FLEXTCP_READY_OUT (EPOLLOUT | EPOLLERR | EPOLLHUP)
+/** two bits per socket id, set while the socket is readable or writable, so
+ * poll() can skip idle sockets without touching them */
+extern uint64_t flextcp_sock_ready[FLEXTCP_SOCK_IDS / 64][2];
+
+/** set by tas_init() if TAS_SINGLE_THREAD is set: the application uses
+ * sockets from one thread only, socket and epoll locks are skipped */
+extern int flextcp_sockets_single;
+/** context of the only thread in single threaded mode, NULL until used */
+extern struct sockets_context *flextcp_sockctx_single;
 
 void flextcp_local_context_clear(void);
-struct sockets_context *flextcp_sockctx_getfull(void);
-struct flextcp_context *flextcp_sockctx_get(void);
+struct sockets_context *flextcp_sockctx_getfull_slow(void);
 int flextcp_sockctx_poll(struct flextcp_context *ctx);
 int flextcp_sockctx_poll_n(struct flextcp_context *ctx, unsigned n);
 
@@ -192,6 +281,11 @@ void flextcp_epoll_destroy(struct epoll *ep);
 
 int tas_sock_close(struct socket *sock);
 int tas_sock_move(struct socket *s);
+int flextcp_accept_try(struct flextcp_context *ctx, struct socket *s,
+    int flags);
+
+void flextcp_batch_sockready(struct flextcp_context *ctx, struct socket *s);
+void flextcp_batch_sockclose(struct socket *s);
 
 pid_t tas_fork(pid_t pid, pid_t parent_pid);
 
@@ -205,25 +299,82 @@ int tas_libc_close(int fd);
 int tas_libc_dup(int oldfd);
 int tas_libc_dup2(int oldfd, int newfd);
 int tas_libc_dup3(int oldfd, int newfd, int flags);
+int tas_libc_fcntl(int fd, int cmd, int arg);
+
+static inline struct sockets_context *flextcp_sockctx_getfull(void)
+{
+  struct sockets_context *ctx = flextcp_sockctx_single;
+
+  if (ctx != NULL)
+    return ctx;
+  return flextcp_sockctx_getfull_slow();
+}
+
+static inline struct flextcp_context *flextcp_sockctx_get(void)
+{
+  return &flextcp_sockctx_getfull()->ctx;
+}
 
 static inline void socket_lock(struct socket *s)
 {
-  util_spin_lock(&s->sp_lock);
+  if (!flextcp_sockets_single)
+    util_spin_lock(&s->sp_lock);
 }
 
 static inline void socket_unlock(struct socket *s)
 {
-  util_spin_unlock(&s->sp_lock);
+  if (!flextcp_sockets_single)
+    util_spin_unlock(&s->sp_lock);
+}
+
+/* for taking the socket lock while holding a lock that is ordered after it,
+ * returns 1 if the lock was acquired */
+static inline int socket_trylock(struct socket *s)
+{
+  return flextcp_sockets_single || util_spin_trylock(&s->sp_lock);
+}
+
+/* called with lock on s held from event handlers, hands the socket to the
+ * batch with operations pending on it */
+static inline void flextcp_batch_sockevent(struct flextcp_context *ctx,
+    struct socket *s)
+{
+  if (s->bops_first != NULL)
+    flextcp_batch_sockready(ctx, s);
+}
+
+/* called with lock on s held when its epoll events change from oldevs to
+ * newevs */
+static inline void flextcp_sock_ready_update(struct socket *s,
+    uint32_t oldevs, uint32_t newevs)
+{
+  static const uint32_t classes[2] = { FLEXTCP_READY_IN, FLEXTCP_READY_OUT };
+  uint64_t *ready, bit;
+  unsigned i;
+
+  if (s->id >= FLEXTCP_SOCK_IDS)
+    return;
+
+  ready = flextcp_sock_ready[s->id / 64];
+  bit = 1ULL << (s->id % 64);
+  for (i = 0; i < 2; i++) {
+    if ((oldevs & classes[i]) != 0 && (newevs & classes[i]) == 0)
+      __atomic_fetch_and(&ready[i], ~bit, __ATOMIC_RELEASE);
+    else if ((oldevs & classes[i]) == 0 && (newevs & classes[i]) != 0)
+      __atomic_fetch_or(&ready[i], bit, __ATOMIC_RELEASE);
+  }
 }
 
 static inline void epoll_lock(struct epoll *ep)
 {
-  util_spin_lock(&ep->sp_lock);
+  if (!flextcp_sockets_single)
+    util_spin_lock(&ep->sp_lock);
 }
 
 static inline void epoll_unlock(struct epoll *ep)
 {
-  util_spin_unlock(&ep->sp_lock);
+  if (!flextcp_sockets_single)
+    util_spin_unlock(&ep->sp_lock);
 }
 
 static inline uint64_t get_msecs(void)
@@ -71,6 +71,8 @@ static ssize_t (*libc_recvfrom)(int sockfd, void *buf, size_t len, int flags,
     struct sockaddr *src_addr, socklen_t *addrlen) = NULL;
 static ssize_t (*libc_recvmsg)(int sockfd, struct msghdr *msg, int flags)
     = NULL;
+static int (*libc_recvmmsg)(int sockfd, struct mmsghdr *msgvec,
+    unsigned int vlen, int flags, struct timespec *timeout) = NULL;
 static ssize_t (*libc_readv)(int sockfd, const struct iovec *iov, int iovcnt)
     = NULL;
 static ssize_t (*libc_pread)(int sockfd, void *buf, size_t count, off_t offset)
@@ -82,6 +84,8 @@ static ssize_t (*libc_sendto)(int sockfd, const void *buf, size_t len,
     int flags, const struct sockaddr *dest_addr, socklen_t addrlen) = NULL;
 static ssize_t (*libc_sendmsg)(int sockfd, const struct msghdr *msg, int flags)
     = NULL;
+static int (*libc_sendmmsg)(int sockfd, struct mmsghdr *msgvec,
+    unsigned int vlen, int flags) = NULL;
 static ssize_t (*libc_writev)(int sockfd, const struct iovec *iov, int iovcnt)
     = NULL;
 static ssize_t (*libc_pwrite)(int sockfd, const void *buf, size_t count,
@@ -381,6 +385,19 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
   return ret;
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+    struct timespec *timeout)
+{
+  int ret;
+  ensure_init();
+  if ((ret = tas_recvmmsg(sockfd, msgvec, vlen, flags, timeout)) == -1 &&
+      errno == EBADF)
+  {
+    return libc_recvmmsg(sockfd, msgvec, vlen, flags, timeout);
+  }
+  return ret;
+}
+
 ssize_t readv(int sockfd, const struct iovec *iov, int iovcnt)
 {
   ssize_t ret;
@@ -444,6 +461,18 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
   return ret;
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+  int ret;
+  ensure_init();
+  if ((ret = tas_sendmmsg(sockfd, msgvec, vlen, flags)) == -1 &&
+      errno == EBADF)
+  {
+    return libc_sendmmsg(sockfd, msgvec, vlen, flags);
+  }
+  return ret;
+}
+
 ssize_t writev(int sockfd, const struct iovec *iov, int iovcnt)
 {
   ssize_t ret;
@@ -648,6 +677,10 @@ long syscall(long number, ...)
     case SYS_recvmsg:
       return recvmsg((int) arg1, (struct msghdr *) (uintptr_t) arg2,
           (int) arg3);
+    case SYS_recvmmsg:
+      return recvmmsg((int) arg1, (struct mmsghdr *) (uintptr_t) arg2,
+          (unsigned int) arg3, (int) arg4,
+          (struct timespec *) (uintptr_t) arg5);
     case SYS_readv:
       return readv((int) arg1, (struct iovec *) (uintptr_t) arg2,
           (int) arg3);
@@ -669,6 +702,9 @@ long syscall(long number, ...)
     case SYS_sendmsg:
       return sendmsg((int) arg1, (const struct msghdr *) (uintptr_t) arg2,
           (int) arg3);
+    case SYS_sendmmsg:
+      return sendmmsg((int) arg1, (struct mmsghdr *) (uintptr_t) arg2,
+          (unsigned int) arg3, (int) arg4);
     case SYS_writev:
       return writev((int) arg1, (const struct iovec *) (uintptr_t) arg2,
           (int) arg3);
@@ -759,12 +795,14 @@ static void init(void)
   libc_recv = bind_symbol("recv");
   libc_recvfrom = bind_symbol("recvfrom");
   libc_recvmsg = bind_symbol("recvmsg");
+  libc_recvmmsg = bind_symbol("recvmmsg");
   libc_readv = bind_symbol("readv");
   libc_pread = bind_symbol("pread");
   libc_write = bind_symbol("write");
   libc_send = bind_symbol("send");
   libc_sendto = bind_symbol("sendto");
   libc_sendmsg = bind_symbol("sendmsg");
+  libc_sendmmsg = bind_symbol("sendmmsg");
   libc_writev = bind_symbol("writev");
   libc_pwrite = bind_symbol("pwrite");
   libc_sendfile = bind_symbol("sendfile");
@@ -42,6 +42,7 @@ static int (*libc_close)(int fd);
 static int (*libc_dup)(int oldfd);
 static int (*libc_dup2)(int oldfd, int newfd);
 static int (*libc_dup3)(int oldfd, int newfd, int flags);
+static int (*libc_fcntl)(int fd, int cmd, ...);
 
 static inline void ensure_init(void);
 
@@ -96,6 +97,12 @@ int tas_libc_dup3(int oldfd, int newfd, int flags)
   return libc_dup3(oldfd, newfd, flags);
 }
 
+int tas_libc_fcntl(int fd, int cmd, int arg)
+{
+  ensure_init();
+  return libc_fcntl(fd, cmd, arg);
+}
+
 
 /******************************************************************************/
 /* Helper functions */
@@ -127,6 +134,7 @@ static void init(void)
   libc_dup = bind_symbol(handle, "dup");
   libc_dup2 = bind_symbol(handle, "dup2");
   libc_dup3 = bind_symbol(handle, "dup3");
+  libc_fcntl = bind_symbol(handle, "fcntl");
 }
 
 static inline void ensure_init(void)
@@ -22,23 +22,46 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <utils.h>
 #include <unistd.h>
-#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include "internal.h"
 #include <tas_sockets.h>
 
 #define MAXSOCK 1024 * 1024
 
+/* the fd table is split into chunks allocated when the first fd in them is
+ * used */
+#define FH_CHUNK_SHIFT 12
+#define FH_CHUNK_SIZE (1 << FH_CHUNK_SHIFT)
+#define FH_CHUNKS (MAXSOCK / FH_CHUNK_SIZE)
+
+/* spare fds kept reserved for new sockets, and how many to get at once. The
+ * pool also counts against RLIMIT_NOFILE, so it is kept to a small part of
+ * the limit. */
+#define FD_POOL_MAX 64
+#define FD_POOL_REFILL 8
+#define FD_POOL_LIMIT_SHARE 64
+
+/* sockets are allocated in slabs of this many */
+#define SOCK_SLAB_NUM 64
+
 enum fh_type {
   FH_UNUSED,
   FH_SOCKET,
   FH_EPOLL,
+  /** in the pool of reserved fds */
+  FH_RESERVED,
 };
 
 struct filehandle {
@@ -47,46 +70,275 @@ struct filehandle {
     struct epoll *e;
   } data;
   uint8_t type;
+  /** FD_CLOEXEC is set on the kernel fd, for socket and reserved fds */
+  uint8_t cloexec;
 };
 
-static struct filehandle fhs[MAXSOCK];
+static struct filehandle *fhs[FH_CHUNKS];
+static volatile uint32_t fhs_lock;
+/* incremented whenever an entry in fhs changes */
+static uint32_t fhs_gen;
+
+/* Socket fds are dups of one placeholder memfd, so the kernel does not hand
+ * out their numbers to other files. Closed socket fds go back to the pool.
+ * The memfd has an inode of its own, so a pooled fd replaced behind our back
+ * can be told apart from the placeholder. */
+static int fd_placeholder = -1;
+static dev_t fd_placeholder_dev;
+static ino_t fd_placeholder_ino;
+static int fd_pool[FD_POOL_MAX];
+static unsigned fd_pool_num;
+static unsigned fd_pool_cap = FD_POOL_MAX;
+static volatile uint32_t fd_pool_lock;
+
+/* free sockets, linked through their first bytes */
+static void *sock_free;
+static volatile uint32_t sock_free_lock;
+/* id for the first socket of the next slab */
+static uint32_t sock_next_id;
+
+uint64_t flextcp_sock_ready[FLEXTCP_SOCK_IDS / 64][2];
+
+static inline void fhs_changed(void)
+{
+  __atomic_fetch_add(&fhs_gen, 1, __ATOMIC_RELEASE);
+}
+
+/* returns the file handle for fd, or NULL if fd cannot be a TAS fd */
+static inline struct filehandle *fh_get(int fd)
+{
+  struct filehandle *chunk;
+
+  if ((unsigned) fd >= MAXSOCK)
+    return NULL;
+
+  chunk = __atomic_load_n(&fhs[fd >> FH_CHUNK_SHIFT], __ATOMIC_ACQUIRE);
+  if (chunk == NULL)
+    return NULL;
+  return &chunk[fd & (FH_CHUNK_SIZE - 1)];
+}
+
+/* same as fh_get() but allocates the chunk for fd if necessary */
+static struct filehandle *fh_get_alloc(int fd)
+{
+  struct filehandle *fh, *chunk;
+
+  if ((unsigned) fd >= MAXSOCK) {
+    errno = EMFILE;
+    return NULL;
+  }
+
+  if ((fh = fh_get(fd)) != NULL)
+    return fh;
+
+  util_spin_lock(&fhs_lock);
+  if ((chunk = fhs[fd >> FH_CHUNK_SHIFT]) == NULL) {
+    if ((chunk = calloc(FH_CHUNK_SIZE, sizeof(*chunk))) == NULL) {
+      util_spin_unlock(&fhs_lock);
+      errno = ENOMEM;
+      return NULL;
+    }
+    __atomic_store_n(&fhs[fd >> FH_CHUNK_SHIFT], chunk, __ATOMIC_RELEASE);
+  }
+  util_spin_unlock(&fhs_lock);
+
+  return &chunk[fd & (FH_CHUNK_SIZE - 1)];
+}
+
+/* refill the empty pool, called with fd_pool_lock held */
+static int fd_pool_refill(void)
+{
+  struct filehandle *fh;
+  struct stat st;
+  int fd, fds[FD_POOL_REFILL];
+  unsigned i, n, num = TAS_MIN(FD_POOL_REFILL, fd_pool_cap);
+
+  if (fd_placeholder < 0) {
+    if ((fd = memfd_create("tas_fd", MFD_CLOEXEC)) < 0)
+      return -1;
+    if (fstat(fd, &st) != 0) {
+      tas_libc_close(fd);
+      return -1;
+    }
+    fd_placeholder_dev = st.st_dev;
+    fd_placeholder_ino = st.st_ino;
+    fd_placeholder = fd;
+  }
+
+  /* pooled fds are close-on-exec until a socket without SOCK_CLOEXEC gets
+   * them */
+  for (n = 0; n < num; n++) {
+    if ((fd = tas_libc_fcntl(fd_placeholder, F_DUPFD_CLOEXEC, 0)) < 0)
+      break;
+    if ((fh = fh_get_alloc(fd)) == NULL) {
+      tas_libc_close(fd);
+      break;
+    }
+    fh->type = FH_RESERVED;
+    fh->cloexec = 1;
+    fds[n] = fd;
+  }
+
+  /* fill so the lowest fd is handed out first */
+  for (i = 0; i < n; i++)
+    fd_pool[i] = fds[n - 1 - i];
+  fd_pool_num = n;
+
+  return (n > 0 ? 0 : -1);
+}
+
+/* check that fd still refers to the placeholder, it could have been closed
+ * and reused without going through us, e.g. with a raw syscall */
+static int fd_is_placeholder(int fd)
+{
+  struct stat st;
+
+  return fstat(fd, &st) == 0 && st.st_dev == fd_placeholder_dev &&
+    st.st_ino == fd_placeholder_ino;
+}
+
+/* take an fd from the pool, refilling it if empty */
+static int fd_reserve(void)
+{
+  struct filehandle *fh;
+  int fd = -1, ok;
+
+  util_spin_lock(&fd_pool_lock);
+  do {
+    if (fd_pool_num == 0 && fd_pool_refill() != 0) {
+      fd = -1;
+      break;
+    }
+
+    /* skip fds the application closed or dup'd over in the meantime */
+    fd = fd_pool[--fd_pool_num];
+    fh = fh_get(fd);
+    ok = (fh->type == FH_RESERVED && fd_is_placeholder(fd));
+    if (fh->type == FH_RESERVED)
+      fh->type = FH_UNUSED;
+  } while (!ok);
+
+  util_spin_unlock(&fd_pool_lock);
+  return fd;
+}
+
+/* return a socket fd to the pool, or close it if the pool is full */
+static void fd_unreserve(int fd)
+{
+  struct filehandle *fh = fh_get(fd);
+
+  /* close-on-exec again before the pool hands the fd out */
+  if (!fh->cloexec) {
+    if (tas_libc_fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+      tas_libc_close(fd);
+      return;
+    }
+    fh->cloexec = 1;
+  }
+
+  util_spin_lock(&fd_pool_lock);
+  if (fd_pool_num < fd_pool_cap) {
+    fh->type = FH_RESERVED;
+    fd_pool[fd_pool_num++] = fd;
+    fd = -1;
+  }
+  util_spin_unlock(&fd_pool_lock);
+
+  if (fd >= 0)
+    tas_libc_close(fd);
+}
+
+void flextcp_fd_forget(int fd)
+{
+  struct filehandle *fh;
+
+  if ((fh = fh_get(fd)) != NULL && fh->type == FH_RESERVED)
+    fh->type = FH_UNUSED;
+}
+
+/* sockets are padded to cache lines so their locks do not share lines */
+#define SOCK_STRIDE ((sizeof(struct socket) + 63) & ~(size_t) 63)
+
+static struct socket *sock_alloc(void)
+{
+  uint8_t *slab;
+  void *s;
+  unsigned i;
+  uint32_t id;
+
+  util_spin_lock(&sock_free_lock);
+  if (sock_free == NULL) {
+    if (posix_memalign((void **) &slab, 64, SOCK_SLAB_NUM * SOCK_STRIDE) != 0)
+    {
+      util_spin_unlock(&sock_free_lock);
+      return NULL;
+    }
+
+    for (i = 0; i < SOCK_SLAB_NUM; i++) {
+      ((struct socket *) (slab + i * SOCK_STRIDE))->id = sock_next_id++;
+      *(void **) (slab + i * SOCK_STRIDE) = sock_free;
+      sock_free = slab + i * SOCK_STRIDE;
+    }
+  }
+
+  s = sock_free;
+  sock_free = *(void **) s;
+  util_spin_unlock(&sock_free_lock);
+
+  id = ((struct socket *) s)->id;
+  memset(s, 0, sizeof(struct socket));
+  ((struct socket *) s)->id = id;
+  return s;
+}
+
+void flextcp_fd_sfree(struct socket *s)
+{
+  flextcp_sock_ready_update(s, s->ep_events, 0);
+
+  util_spin_lock(&sock_free_lock);
+  *(void **) s = sock_free;
+  sock_free = s;
+  util_spin_unlock(&sock_free_lock);
+}
 
 int flextcp_fd_init(void)
 {
+  struct rlimit rl;
+
+  /* keep the pool to a small share of the fd limit */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+    fd_pool_cap = TAS_MAX(TAS_MIN(rl.rlim_cur / FD_POOL_LIMIT_SHARE,
+          FD_POOL_MAX), 1);
+  }
   return 0;
 }
 
 
 int flextcp_fd_salloc(struct socket **ps)
 {
+  struct filehandle *fh;
   struct socket *s;
   int fd;
 
-  if ((s = calloc(1, sizeof(*s))) == NULL) {
+  if ((s = sock_alloc()) == NULL) {
     errno = ENOMEM;
     return -1;
   }
 
-  /* get eventfd so we reserve the FD in the kernel to avoid overlap */
-  if ((fd = eventfd(0, 0)) < 0) {
-    free(s);
-    return -1;
-  }
-
-  /* no more file handles available */
-  if (fd >= MAXSOCK) {
-    free(s);
-    tas_libc_close(fd);
-    errno = EMFILE;
+  /* reserve the FD in the kernel to avoid overlap */
+  if ((fd = fd_reserve()) < 0) {
+    flextcp_fd_sfree(s);
     return -1;
   }
 
+  fh = fh_get(fd);
   s->type = SOCK_SOCKET;
   s->refcnt = 1;
   s->sp_lock = 1;
 
-  fhs[fd].data.s = s;
-  fhs[fd].type = FH_SOCKET;
+  fh->data.s = s;
+  fh->type = FH_SOCKET;
+  fhs_changed();
 
   *ps = s;
 
@@ -95,14 +347,15 @@ int flextcp_fd_salloc(struct socket **ps)
 
 int flextcp_fd_slookup(int fd, struct socket **ps)
 {
+  struct filehandle *fh;
   struct socket *s;
 
-  if (fd >= MAXSOCK || fhs[fd].type != FH_SOCKET) {
+  if ((fh = fh_get(fd)) == NULL || fh->type != FH_SOCKET) {
     errno = EBADF;
     return -1;
   }
 
-  s = fhs[fd].data.s;
+  s = fh->data.s;
   socket_lock(s);
   *ps = s;
   return 0;
@@ -110,15 +363,15 @@ int flextcp_fd_slookup(int fd, struct socket **ps)
 
 int flextcp_fd_ealloc(struct epoll **pe, int fd)
 {
+  struct filehandle *fh;
   struct epoll *e;
 
   /* no more file handles available */
-  if (fd >= MAXSOCK) {
-    errno = EMFILE;
+  if ((fh = fh_get_alloc(fd)) == NULL) {
     return -1;
   }
 
-  assert(fhs[fd].type == FH_UNUSED);
+  assert(fh->type == FH_UNUSED);
 
   if ((e = calloc(1, sizeof(*e))) == NULL) {
     errno = ENOMEM;
@@ -128,8 +381,9 @@ int flextcp_fd_ealloc(struct epoll **pe, int fd)
   e->refcnt = 1;
   e->sp_lock = 1;
 
-  fhs[fd].data.e = e;
-  fhs[fd].type = FH_EPOLL;
+  fh->data.e = e;
+  fh->type = FH_EPOLL;
+  fhs_changed();
 
   *pe = e;
 
@@ -138,19 +392,34 @@ int flextcp_fd_ealloc(struct epoll **pe, int fd)
 
 int flextcp_fd_elookup(int fd, struct epoll **pe)
 {
+  struct filehandle *fh;
   struct epoll *e;
 
-  if (fd >= MAXSOCK || fhs[fd].type != FH_EPOLL) {
+  if ((fh = fh_get(fd)) == NULL || fh->type != FH_EPOLL) {
     errno = EBADF;
     return -1;
   }
 
-  e = fhs[fd].data.e;
+  e = fh->data.e;
   epoll_lock(e);
   *pe = e;
   return 0;
 }
 
+struct socket *flextcp_fd_speek(int fd)
+{
+  struct filehandle *fh;
+
+  if ((fh = fh_get(fd)) == NULL || fh->type != FH_SOCKET)
+    return NULL;
+  return fh->data.s;
+}
+
+uint32_t flextcp_fd_generation(void)
+{
+  return __atomic_load_n(&fhs_gen, __ATOMIC_ACQUIRE);
+}
+
 void flextcp_fd_srelease(int fd, struct socket *s)
 {
   socket_unlock(s);
@@ -163,40 +432,65 @@ void flextcp_fd_erelease(int fd, struct epoll *e)
 
 void flextcp_fd_close(int fd)
 {
-  assert(fhs[fd].type == FH_SOCKET || fhs[fd].type == FH_EPOLL);
-  if (fhs[fd].type == FH_SOCKET) {
-    fhs[fd].data.s->refcnt--;
-    fhs[fd].data.s = NULL;
-  } else if (fhs[fd].type == FH_EPOLL) {
-    fhs[fd].data.e->refcnt--;
-    fhs[fd].data.e = NULL;
+  struct filehandle *fh = fh_get(fd);
+  uint8_t type;
+
+  assert(fh != NULL && (fh->type == FH_SOCKET || fh->type == FH_EPOLL));
+  type = fh->type;
+  if (type == FH_SOCKET) {
+    fh->data.s->refcnt--;
+    fh->data.s = NULL;
+  } else if (type == FH_EPOLL) {
+    fh->data.e->refcnt--;
+    fh->data.e = NULL;
   } else {
     fprintf(stderr, "flextcp_fd_close: trying to close non-opened tas fd\n");
     abort();
   }
 
-  fhs[fd].type = FH_UNUSED;
+  fh->type = FH_UNUSED;
+  fhs_changed();
   MEM_BARRIER();
-  tas_libc_close(fd);
+
+  /* socket fds only refer to the placeholder and go back to the pool */
+  if (type == FH_SOCKET)
+    fd_unreserve(fd);
+  else
+    tas_libc_close(fd);
+}
+
+int flextcp_fd_cloexec(int fd, int cloexec)
+{
+  struct filehandle *fh = fh_get(fd);
+
+  assert(fh != NULL && fh->type == FH_SOCKET);
+  if (fh->cloexec == !!cloexec)
+    return 0;
+
+  if (tas_libc_fcntl(fd, F_SETFD, cloexec ? FD_CLOEXEC : 0) != 0)
+    return -1;
+  fh->cloexec = !!cloexec;
+  return 0;
 }
 
 /* do the tas-internal part of duping oldfd to newfd, after the linux fds have
  * already been dup'd */
 static inline int internal_dup3(int oldfd, int newfd, int flags)
 {
+  struct filehandle *fh;
   struct socket *s;
   struct epoll *ep;
 
   /* TODO: check flags */
 
-  if (newfd >= MAXSOCK) {
+  if ((fh = fh_get_alloc(newfd)) == NULL) {
     fprintf(stderr, "tas_dup: failed because new fd is larger than MAXSOCK\n");
     abort();
   }
 
   /* close any previous socket or epoll at newfd */
-  if (fhs[newfd].type  == FH_SOCKET) {
-    s = fhs[newfd].data.s;
+  if (fh->type  == FH_SOCKET) {
+    s = fh->data.s;
 
     /* close socket */
     socket_lock(s);
@@ -206,10 +500,10 @@ static inline int internal_dup3(int oldfd, int newfd, int flags)
     else
       socket_unlock(s);
 
-    fhs[newfd].data.s = NULL;
-    fhs[newfd].type = FH_UNUSED;
-  } else if (fhs[newfd].type  == FH_EPOLL) {
-    ep = fhs[newfd].data.e;
+    fh->data.s = NULL;
+    fh->type = FH_UNUSED;
+  } else if (fh->type  == FH_EPOLL) {
+    ep = fh->data.e;
 
     /* close epoll */
     epoll_lock(ep);
@@ -219,28 +513,33 @@ static inline int internal_dup3(int oldfd, int newfd, int flags)
     else
       epoll_unlock(ep);
 
-    fhs[newfd].data.e = NULL;
-    fhs[newfd].type = FH_UNUSED;
+    fh->data.e = NULL;
+    fh->type = FH_UNUSED;
+  } else if (fh->type == FH_RESERVED) {
+    /* linux replaced a pooled fd, fd_reserve() will skip it */
+    fh->type = FH_UNUSED;
   }
 
   /* next dup the underlying TAS socket and epoll if necessary */
   if (flextcp_fd_slookup(oldfd, &s) == 0) {
     /* oldfd is a tas socket */
-    fhs[newfd].type = FH_SOCKET;
-    fhs[newfd].data.s = s;
+    fh->type = FH_SOCKET;
+    fh->data.s = s;
+    fh->cloexec = ((flags & O_CLOEXEC) == O_CLOEXEC);
 
     s->refcnt++;
 
     flextcp_fd_srelease(oldfd, s);
   } else if (flextcp_fd_elookup(oldfd, &ep) == 0) {
     /* oldfd is a tas epoll */
-    fhs[newfd].type = FH_EPOLL;
-    fhs[newfd].data.e = ep;
+    fh->type = FH_EPOLL;
+    fh->data.e = ep;
 
     ep->refcnt++;
 
     flextcp_fd_srelease(oldfd, s);
   }
+  fhs_changed();
 
   return newfd;
 }
@@ -26,8 +26,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/epoll.h>
 #include <poll.h>
+#include <utils.h>
 
 #include <tas_sockets.h>
 #include "internal.h"
@@ -36,10 +38,19 @@
 #define SELECT_POLLOUT_SET (POLLWRBAND | POLLWRNORM | POLLOUT | POLLERR)
 #define SELECT_POLLEX_SET (POLLPRI)
 
+/* poll events matching FLEXTCP_READY_IN and FLEXTCP_READY_OUT */
+#define POLL_READY_IN (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI | \
+    POLLRDHUP | POLLERR | POLLHUP)
+#define POLL_READY_OUT (POLLOUT | POLLWRNORM | POLLWRBAND | POLLERR | POLLHUP)
+
 static inline uint32_t events_epoll2poll(uint32_t epoll_event);
 static int pollfd_cache_alloc(struct sockets_context *ctx, size_t n);
-static int pollfd_cache_prepare(struct sockets_context *ctx, struct pollfd *fds,
-    nfds_t nfds, nfds_t num_linuxfds);
+static int poll_partition(struct sockets_context *ctx, struct pollfd *fds,
+    nfds_t nfds);
+static inline void poll_clear_tas(struct sockets_context *ctx,
+    struct pollfd *fds);
+static inline int poll_scan_tas(struct sockets_context *ctx,
+    struct pollfd *fds);
 static int selectfd_cache_alloc(struct sockets_context *ctx, size_t n);
 
 
@@ -48,7 +59,8 @@ int tas_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 {
   struct sockets_context *ctx;
   struct pollfd *p;
-  int fd, fd_r, fd_w, fd_e, ret, t;
+  int fd, ret, t, w;
+  unsigned long m_r, m_w, m_e, m, bit;
   nfds_t i, n = 0;
 
   ctx = flextcp_sockctx_getfull();
@@ -58,26 +70,29 @@ int tas_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
     return -1;
   }
 
-  for (fd = 0; fd < nfds; fd++) {
-    p = &ctx->selectfds_cache[n];
+  /* go through the sets a word at a time, skipping empty parts */
+  for (w = 0; w < (nfds + NFDBITS - 1) / NFDBITS; w++) {
+    m_r = (readfds != NULL ? __FDS_BITS(readfds)[w] : 0);
+    m_w = (writefds != NULL ? __FDS_BITS(writefds)[w] : 0);
+    m_e = (exceptfds != NULL ? __FDS_BITS(exceptfds)[w] : 0);
 
-    fd_r = readfds != NULL && FD_ISSET(fd, readfds);
-    fd_w = writefds != NULL && FD_ISSET(fd, writefds);
-    fd_e = exceptfds != NULL && FD_ISSET(fd, exceptfds);
+    for (m = m_r | m_w | m_e; m != 0; m &= m - 1) {
+      fd = w * NFDBITS + __builtin_ctzl(m);
+      if (fd >= nfds)
+        break;
+      bit = m & -m;
 
-    if (fd_r || fd_w || fd_e) {
+      p = &ctx->selectfds_cache[n++];
       p->fd = fd;
       p->revents = 0;
       p->events = 0;
-      n++;
+      if ((m_r & bit) != 0)
+        p->events |= SELECT_POLLIN_SET;
+      if ((m_w & bit) != 0)
+        p->events |= SELECT_POLLOUT_SET;
+      if ((m_e & bit) != 0)
+        p->events |= SELECT_POLLEX_SET;
     }
-
-    if (fd_r)
-      p->events |= SELECT_POLLIN_SET;
-    if (fd_w)
-      p->events |= SELECT_POLLOUT_SET;
-    if (fd_e)
-      p->events |= SELECT_POLLEX_SET;
   }
 
   if (timeout == NULL) {
@@ -131,16 +146,26 @@ int tas_pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
 int tas_poll(struct pollfd *fds, nfds_t nfds, int timeout)
 {
   struct sockets_context *ctx;
-  struct socket *s;
-  struct pollfd *p;
   nfds_t nfds_linux, nfds_tas, i;
-  uint32_t s_events;
-  int ret, active_fds, mixed_events = 0, j, block_ms;
+  int ret, active_fds, mixed_events = 0, block_ms;
   uint64_t mtimeout = 0, cur_ts;
-  int first = 1;
 
   ctx = flextcp_sockctx_getfull();
 
+  if (poll_partition(ctx, fds, nfds) != 0)
+    return -1;
+  nfds_tas = ctx->poll_num_tas;
+  nfds_linux = ctx->poll_num_linux;
+
+  if (nfds_tas == 0) {
+    /* only linux, this is the easy case -> just call into linux */
+    return tas_libc_poll(fds, nfds, timeout);
+  }
+
+  for (i = 0; i < nfds_linux; i++)
+    fds[ctx->poll_linux_idx[i]].revents = 0;
+  poll_clear_tas(ctx, fds);
+
   if (timeout != 0 && timeout != -1)
     mtimeout = get_msecs() + timeout;
 
@@ -148,39 +173,27 @@ int tas_poll(struct pollfd *fds, nfds_t nfds, int timeout)
 again:
     flextcp_sockctx_poll_n(&ctx->ctx, nfds);
 
-    nfds_linux = nfds_tas = 0;
-    active_fds = 0;
-    /* first process any tas fds */
-    for (i = 0; i < nfds; i++) {
-      p = &fds[i];
-
-      if (flextcp_fd_slookup(p->fd, &s) != 0) {
-        /* this is a linux fd */
-        p->revents = 0;
-        nfds_linux++;
-        continue;
-      }
-      nfds_tas++;
-
-      s_events = s->ep_events;
-      flextcp_fd_srelease(p->fd, s);
-
-      if ((p->events & ~(POLLIN | POLLPRI | POLLOUT | POLLRDHUP | POLLERR |
-              POLLHUP | POLLRDNORM | POLLWRNORM | POLLNVAL | POLLRDBAND |
-              POLLWRBAND | POLLERR)) != 0) {
-        errno = EINVAL;
-        fprintf(stderr, "tas_pselect: unsupported fd flags (%x)\n", p->events);
+    /* the cached sockets are only valid as long as no TAS fds are closed or
+     * dup'd, which can happen while we block */
+    if (flextcp_fd_generation() != ctx->poll_gen) {
+      if (poll_partition(ctx, fds, nfds) != 0)
         return -1;
-      }
-
-      p->revents = p->events & events_epoll2poll(s_events);
-      if (p->revents != 0)
-        active_fds++;
+      nfds_tas = ctx->poll_num_tas;
+      nfds_linux = ctx->poll_num_linux;
+
+      /* linux fds moved in the cache, poll them again */
+      for (i = 0; i < nfds_linux; i++)
+        fds[ctx->poll_linux_idx[i]].revents = 0;
+      poll_clear_tas(ctx, fds);
+      mixed_events = 0;
     }
 
+    /* first process any tas fds */
+    active_fds = poll_scan_tas(ctx, fds);
+
     /* if we have TAS fds, calculate how long we can block for */
     block_ms = 0;
-    if (nfds_tas > 0 && active_fds == 0 && mixed_events == 0 && timeout != 0) {
+    if (active_fds == 0 && mixed_events == 0 && timeout != 0) {
       if (timeout == -1) {
         block_ms = -1;
       } else {
@@ -192,23 +205,9 @@ again:
     }
 
     /* now look at linux fds */
-    if (nfds_linux > 0 && nfds_tas == 0) {
-      /* only linux, this is the easy case -> just call into linux */
-      return tas_libc_poll(fds, nfds, timeout);
-    } else if (nfds_linux > 0 && mixed_events == 0) {
-      /* mixed tas and linux, this is annoying as we need to separate out linux
-       * fds */
-
-      /* the first iteration, we first need to copy only the linux fds into the
-       * pollfd_cache */
-      if (first) {
-        if (pollfd_cache_prepare(ctx, fds, nfds, nfds_linux) != 0) {
-          errno = ENOMEM;
-          return -1;
-        }
-        first = 0;
-      }
-
+    if (nfds_linux > 0 && mixed_events == 0) {
+      /* mixed tas and linux, the linux fds are already separated out into
+       * the pollfd_cache */
       if (block_ms == 0 || flextcp_context_canwait(&ctx->ctx) != 0) {
         /* we're not blocking */
         ret = tas_libc_poll(ctx->pollfds_cache, nfds_linux, 0);
@@ -239,7 +238,7 @@ again:
           mixed_events = ret;
         }
       }
-    } else if (nfds_tas > 0 && nfds_linux == 0 && block_ms != 0) {
+    } else if (nfds_linux == 0 && block_ms != 0) {
       /* just tas fds, can block if needed */
       flextcp_context_wait(&ctx->ctx, block_ms);
     }
@@ -248,26 +247,10 @@ again:
 
   /* copy events from linux fds over */
   if (mixed_events > 0) {
-    for (j = 0, i = 0; i < nfds; i++) {
-      p = &fds[i];
-
-      if (flextcp_fd_slookup(p->fd, &s) == 0) {
-        /* this is a tas fd */
-        flextcp_fd_srelease(p->fd, s);
-        continue;
-      }
-
-      if (p->fd != ctx->pollfds_cache[j].fd) {
-        fprintf(stderr, "tas_poll: fds in poll cache changed? something is "
-            "wrong\n");
-        abort();
-      }
-
-      p->revents = ctx->pollfds_cache[j].revents;
-      j++;
-    }
+    for (i = 0; i < nfds_linux; i++)
+      fds[ctx->poll_linux_idx[i]].revents = ctx->pollfds_cache[i].revents;
   }
- 
+
   return active_fds + mixed_events;
 }
 
@@ -329,44 +312,248 @@ static int pollfd_cache_alloc(struct sockets_context *ctx, size_t n)
   return 0;
 }
 
-/* copy subset of linux fds from fds to pollfd cache. check that number matches
- * num_linuxfds_confirm. also adds TAS wait fd as last entry. */
-static int pollfd_cache_prepare(struct sockets_context *ctx, struct pollfd *fds,
-    nfds_t nfds, nfds_t num_linuxfds_confirm)
+/* make sure the partition arrays can hold at least n entries */
+static int poll_partition_alloc(struct sockets_context *ctx, size_t n)
+{
+  void *key, *tas, *lidx;
+  size_t cnt = ctx->poll_size;
+
+  if (cnt >= n) {
+    return 0;
+  }
+
+  /* set initial size to 16 */
+  if (cnt == 0)
+    cnt = 16;
+
+  /* double size till we have enough to keep it a power of 2 */
+  while (cnt < n)
+    cnt *= 2;
+
+  key = realloc(ctx->poll_key, cnt * sizeof(*ctx->poll_key));
+  if (key != NULL)
+    ctx->poll_key = key;
+  tas = realloc(ctx->poll_tas, cnt * sizeof(*ctx->poll_tas));
+  if (tas != NULL)
+    ctx->poll_tas = tas;
+  lidx = realloc(ctx->poll_linux_idx, cnt * sizeof(*ctx->poll_linux_idx));
+  if (lidx != NULL)
+    ctx->poll_linux_idx = lidx;
+
+  if (key == NULL || tas == NULL || lidx == NULL) {
+    perror("poll_partition_alloc: alloc failed");
+    return -1;
+  }
+
+  ctx->poll_size = cnt;
+  return 0;
+}
+
+/* set ctx->poll_mask to the readiness bits of the TAS sockets in the
+ * partition, whose ids are between id_min and id_max */
+static int poll_mask_build(struct sockets_context *ctx, uint32_t id_min,
+    uint32_t id_max)
+{
+  void *ptr;
+  size_t words, cnt = ctx->poll_mask_size;
+  nfds_t i;
+  uint32_t id;
+  uint8_t classes;
+
+  if (id_min > id_max) {
+    ctx->poll_mask_first = ctx->poll_mask_words = 0;
+    return 0;
+  }
+
+  words = id_max / 64 - id_min / 64 + 1;
+  if (cnt < words) {
+    /* set initial size to 16 */
+    if (cnt == 0)
+      cnt = 16;
+
+    /* double size till we have enough to keep it a power of 2 */
+    while (cnt < words)
+      cnt *= 2;
+
+    if ((ptr = realloc(ctx->poll_mask, cnt * sizeof(*ctx->poll_mask))) == NULL)
+    {
+      perror("poll_mask_build: alloc failed");
+      return -1;
+    }
+    ctx->poll_mask = ptr;
+    ctx->poll_mask_size = cnt;
+  }
+
+  ctx->poll_mask_first = id_min / 64;
+  ctx->poll_mask_words = words;
+  memset(ctx->poll_mask, 0, words * sizeof(*ctx->poll_mask));
+  for (i = 0; i < ctx->poll_num_tas; i++) {
+    id = ctx->poll_tas[i].id;
+    classes = ctx->poll_tas[i].classes;
+    if (id >= FLEXTCP_SOCK_IDS)
+      continue;
+
+    if ((classes & 1) != 0)
+      ctx->poll_mask[id / 64 - ctx->poll_mask_first][0] |= 1ULL << (id % 64);
+    if ((classes & 2) != 0)
+      ctx->poll_mask[id / 64 - ctx->poll_mask_first][1] |= 1ULL << (id % 64);
+  }
+  return 0;
+}
+
+/* Split fds into TAS and linux fds, copying the linux fds to the pollfd cache
+ * followed by the TAS wait fd. The result is kept for the next call and only
+ * recomputed if the fds or requested events differ, or if TAS fds were
+ * opened, closed, or dup'd since, so the sockets found can be used without
+ * looking them up again. */
+static int poll_partition(struct sockets_context *ctx, struct pollfd *fds,
+    nfds_t nfds)
 {
   struct socket *s;
   struct pollfd *p;
-  nfds_t i, num_linux = 0;
+  nfds_t i;
+  uint32_t gen, id_min, id_max;
 
-  if (pollfd_cache_alloc(ctx, num_linuxfds_confirm + 1) != 0)
+  gen = flextcp_fd_generation();
+  if (ctx->poll_valid && ctx->poll_nfds == nfds && ctx->poll_gen == gen) {
+    for (i = 0; i < nfds; i++) {
+      if (fds[i].fd != ctx->poll_key[i].fd ||
+          fds[i].events != ctx->poll_key[i].events)
+        break;
+    }
+    if (i == nfds)
+      return 0;
+  }
+
+  ctx->poll_valid = 0;
+  if (poll_partition_alloc(ctx, nfds) != 0 ||
+      pollfd_cache_alloc(ctx, nfds + 1) != 0)
+  {
+    errno = ENOMEM;
     return -1;
+  }
 
-  /* copy linux fds to pollfds_cache */
+  ctx->poll_num_tas = ctx->poll_num_linux = 0;
+  id_min = UINT32_MAX;
+  id_max = 0;
+  ctx->poll_unmasked = 0;
   for (i = 0; i < nfds; i++) {
     p = &fds[i];
+    ctx->poll_key[i].fd = p->fd;
+    ctx->poll_key[i].events = p->events;
 
-    if (flextcp_fd_slookup(p->fd, &s) == 0) {
-      /* this is a tas fd */
-      flextcp_fd_srelease(p->fd, s);
+    if ((s = flextcp_fd_speek(p->fd)) == NULL) {
+      /* this is a linux fd */
+      ctx->pollfds_cache[ctx->poll_num_linux] = *p;
+      ctx->poll_linux_idx[ctx->poll_num_linux++] = i;
       continue;
     }
 
-    if (num_linux >= num_linuxfds_confirm) {
-      fprintf(stderr, "pollfd_cache_prepare: number of linux fds changed?\n");
+    if ((p->events & ~(POLLIN | POLLPRI | POLLOUT | POLLRDHUP | POLLERR |
+            POLLHUP | POLLRDNORM | POLLWRNORM | POLLNVAL | POLLRDBAND |
+            POLLWRBAND | POLLERR)) != 0) {
+      errno = EINVAL;
+      fprintf(stderr, "tas_pselect: unsupported fd flags (%x)\n", p->events);
       return -1;
     }
 
-    ctx->pollfds_cache[num_linux] = *p;
-    num_linux++;
+    ctx->poll_tas[ctx->poll_num_tas].s = s;
+    ctx->poll_tas[ctx->poll_num_tas].id = s->id;
+    ctx->poll_tas[ctx->poll_num_tas].classes =
+      ((p->events & POLL_READY_IN) != 0) |
+      ((p->events & POLL_READY_OUT) != 0) << 1;
+    ctx->poll_tas[ctx->poll_num_tas++].idx = i;
+
+    if (s->id >= FLEXTCP_SOCK_IDS) {
+      ctx->poll_unmasked = 1;
+    } else {
+      id_min = TAS_MIN(id_min, s->id);
+      id_max = TAS_MAX(id_max, s->id);
+    }
   }
 
-  ctx->pollfds_cache[num_linux].fd = flextcp_context_waitfd(&ctx->ctx);
-  ctx->pollfds_cache[num_linux].events = POLLIN;
-  ctx->pollfds_cache[num_linux].revents= 0;
+  if (poll_mask_build(ctx, id_min, id_max) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  p = &ctx->pollfds_cache[ctx->poll_num_linux];
+  p->fd = flextcp_context_waitfd(&ctx->ctx);
+  p->events = POLLIN;
+  p->revents = 0;
 
+  ctx->poll_nfds = nfds;
+  ctx->poll_gen = gen;
+  ctx->poll_valid = 1;
   return 0;
 }
 
+static inline void poll_clear_tas(struct sockets_context *ctx,
+    struct pollfd *fds)
+{
+  nfds_t i;
+
+  for (i = 0; i < ctx->poll_num_tas; i++)
+    fds[ctx->poll_tas[i].idx].revents = 0;
+}
+
+/* returns 1 unless the readiness bits show t has no events it waits for */
+static inline int poll_tas_ready(const struct poll_tas_fd *t)
+{
+  uint64_t *ready, bit;
+
+  if (t->id >= FLEXTCP_SOCK_IDS)
+    return 1;
+
+  ready = flextcp_sock_ready[t->id / 64];
+  bit = 1ULL << (t->id % 64);
+  return ((t->classes & 1) != 0 &&
+      (__atomic_load_n(&ready[0], __ATOMIC_ACQUIRE) & bit) != 0) ||
+    ((t->classes & 2) != 0 &&
+      (__atomic_load_n(&ready[1], __ATOMIC_ACQUIRE) & bit) != 0);
+}
+
+/* Fill in revents for the TAS fds from the event state the event handlers
+ * keep on the sockets. The readiness bits of the sockets in the set are
+ * checked a word at a time first, and only sockets with a bit set for the
+ * events they wait for are looked at. This reads the state without taking
+ * the socket locks, a concurrent change is picked up on the next scan. Until
+ * a scan finds an active fd, revents of all TAS fds stay 0 from
+ * poll_clear_tas(). */
+static inline int poll_scan_tas(struct sockets_context *ctx,
+    struct pollfd *fds)
+{
+  struct poll_tas_fd *t = ctx->poll_tas;
+  uint64_t (*ready)[2] = flextcp_sock_ready + ctx->poll_mask_first;
+  uint64_t (*mask)[2] = ctx->poll_mask;
+  struct pollfd *p;
+  nfds_t i, n = ctx->poll_num_tas;
+  size_t w;
+  uint64_t pending = 0;
+  uint32_t s_events;
+  int active_fds = 0;
+
+  for (w = 0; w < ctx->poll_mask_words; w++) {
+    pending |= (__atomic_load_n(&ready[w][0], __ATOMIC_RELAXED) &
+        mask[w][0]) |
+      (__atomic_load_n(&ready[w][1], __ATOMIC_RELAXED) & mask[w][1]);
+  }
+  if (pending == 0 && !ctx->poll_unmasked)
+    return 0;
+
+  for (i = 0; i < n; i++) {
+    if (!poll_tas_ready(&t[i]))
+      continue;
+
+    p = &fds[t[i].idx];
+    s_events = __atomic_load_n(&t[i].s->ep_events, __ATOMIC_RELAXED);
+    p->revents = p->events & events_epoll2poll(s_events);
+    active_fds += (p->revents != 0);
+  }
+
+  return active_fds;
+}
+
 /* make sure that ctx->selectfds_cache can hold at least n entries */
 static int selectfd_cache_alloc(struct sockets_context *ctx, size_t n)
 {
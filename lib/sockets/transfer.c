@@ -22,12 +22,16 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <utils.h>
 #include <utils_circ.h>
@@ -37,22 +41,16 @@
 #include "internal.h"
 #include "../tas/internal.h"
 
-ssize_t tas_recvmsg(int sockfd, struct msghdr *msg, int flags)
+/* receive into msg, called with lock on s held. With MSG_DONTWAIT in flags
+ * this polls once as for non-blocking sockets. */
+static ssize_t recvmsg_locked(struct socket *s, struct msghdr *msg, int flags)
 {
-  struct socket *s;
   struct flextcp_context *ctx;
   ssize_t ret = 0;
   size_t len, i, off;
   struct iovec *iov;
   int block;
 
-  if (flextcp_fd_slookup(sockfd, &s) != 0) {
-    errno = EBADF;
-    return -1;
-  }
-
-  tas_sock_move(s);
-
   /* not a connection, or not connected */
   if (s->type != SOCK_CONNECTION ||
       s->data.connection.status != SOC_CONNECTED)
@@ -91,7 +89,8 @@ ssize_t tas_recvmsg(int sockfd, struct msghdr *msg, int flags)
     socket_lock(s);
 
     /* if non-blocking and nothing then we abort now */
-    if ((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK &&
+    if (((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK ||
+          (flags & MSG_DONTWAIT) != 0) &&
         s->data.connection.rx_len_1 == 0 &&
         !(s->data.connection.st_flags & CSTF_RXCLOSED))
     {
@@ -132,6 +131,21 @@ ssize_t tas_recvmsg(int sockfd, struct msghdr *msg, int flags)
     flextcp_connection_rx_done(ctx, &s->data.connection.c, ret);
   }
 out:
+  return ret;
+}
+
+ssize_t tas_recvmsg(int sockfd, struct msghdr *msg, int flags)
+{
+  struct socket *s;
+  ssize_t ret;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  tas_sock_move(s);
+  ret = recvmsg_locked(s, msg, 0);
   flextcp_fd_srelease(sockfd, s);
   return ret;
 }
@@ -226,23 +240,17 @@ out:
 
 #include <unistd.h>
 
-ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
+/* send msg, called with lock on s held. With MSG_DONTWAIT in flags this
+ * polls once as for non-blocking sockets. */
+static ssize_t sendmsg_locked(struct socket *s, const struct msghdr *msg,
+    int flags)
 {
-
-  struct socket *s;
   struct flextcp_context *ctx;
   ssize_t ret = 0;
   size_t len, i, l, len_1, len_2, off;
   struct iovec *iov;
   void *dst_1, *dst_2;
-  int block;
-
-  if (flextcp_fd_slookup(sockfd, &s) != 0) {
-    errno = EBADF;
-    return -1;
-  }
-
-  tas_sock_move(s);
+  int block, nonblock;
 
   /* not a connection, or not connected */
   if (s->type != SOCK_CONNECTION ||
@@ -254,6 +262,13 @@ ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
     goto out;
   }
 
+  /* zero-copy reservation has to be committed first */
+  if (s->data.connection.tx_reserved != 0) {
+    errno = EBUSY;
+    ret = -1;
+    goto out;
+  }
+
   /* return 0 if 0 length */
   len = 0;
   iov = msg->msg_iov;
@@ -265,10 +280,12 @@ ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
   }
 
   ctx = flextcp_sockctx_get();
+  nonblock = (s->flags & SOF_NONBLOCK) == SOF_NONBLOCK ||
+    (flags & MSG_DONTWAIT) != 0;
 
   /* make sure there is space in the transmit queue if the socket is
    * non-blocking */
-  if ((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK &&
+  if (nonblock &&
       flextcp_connection_tx_possible(ctx, &s->data.connection.c) != 0)
   {
     errno = EAGAIN;
@@ -301,7 +318,7 @@ ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
     if (ret < 0) {
       fprintf(stderr, "sendmsg: flextcp_connection_tx_alloc failed\n");
       abort();
-    } else if (ret == 0 && (s->flags & SOF_NONBLOCK) == SOF_NONBLOCK) {
+    } else if (ret == 0 && nonblock) {
       errno = EAGAIN;
       ret = -1;
       goto out;
@@ -335,6 +352,21 @@ ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
   }
 
 out:
+  return ret;
+}
+
+ssize_t tas_sendmsg(int sockfd, const struct msghdr *msg, int flags)
+{
+  struct socket *s;
+  ssize_t ret;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  tas_sock_move(s);
+  ret = sendmsg_locked(s, msg, 0);
   flextcp_fd_srelease(sockfd, s);
   return ret;
 }
@@ -366,6 +398,13 @@ static inline ssize_t send_simple(int sockfd, const void *buf, size_t len,
     goto out;
   }
 
+  /* zero-copy reservation has to be committed first */
+  if (s->data.connection.tx_reserved != 0) {
+    errno = EBUSY;
+    ret = -1;
+    goto out;
+  }
+
   /* return 0 if 0 length */
   if (len == 0) {
     goto out;
@@ -524,21 +563,470 @@ ssize_t tas_pwrite(int sockfd, const void *buf, size_t len, off_t offset)
   return send_simple(sockfd, buf, len, 0);
 }
 
-ssize_t tas_sendfile(int sockfd, int in_fd, off_t *offset, size_t len)
+static inline size_t msg_len(const struct msghdr *msg)
+{
+  size_t i, len = 0;
+
+  for (i = 0; i < msg->msg_iovlen; i++)
+    len += msg->msg_iov[i].iov_len;
+  return len;
+}
+
+int tas_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+    int flags, struct timespec *timeout)
+{
+  struct socket *s;
+  ssize_t ret = 0;
+  unsigned int i;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if ((flags & ~(MSG_DONTWAIT | MSG_WAITFORONE)) != 0) {
+    flextcp_fd_srelease(sockfd, s);
+    errno = EINVAL;
+    return -1;
+  }
+
+  tas_sock_move(s);
+
+  for (i = 0; i < vlen; i++) {
+    ret = recvmsg_locked(s, &msgvec[i].msg_hdr, flags);
+    if (ret <= 0)
+      break;
+    msgvec[i].msg_len = ret;
+
+    /* once one message is in, the rest only takes what is there */
+    if ((flags & MSG_WAITFORONE) != 0)
+      flags |= MSG_DONTWAIT;
+  }
+
+  flextcp_fd_srelease(sockfd, s);
+
+  if (i > 0)
+    return i;
+  return ret;
+}
+
+int tas_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+    int flags)
+{
+  struct socket *s;
+  ssize_t ret = 0;
+  unsigned int i;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  /* TAS sockets never raise SIGPIPE, so MSG_NOSIGNAL needs nothing */
+  if ((flags & ~(MSG_DONTWAIT | MSG_NOSIGNAL)) != 0) {
+    flextcp_fd_srelease(sockfd, s);
+    errno = EINVAL;
+    return -1;
+  }
+
+  tas_sock_move(s);
+
+  /* stop after a message that did not fit completely */
+  for (i = 0; i < vlen; i++) {
+    ret = sendmsg_locked(s, &msgvec[i].msg_hdr, flags);
+    if (ret < 0)
+      break;
+    msgvec[i].msg_len = ret;
+    if ((size_t) ret < msg_len(&msgvec[i].msg_hdr)) {
+      i++;
+      break;
+    }
+  }
+
+  flextcp_fd_srelease(sockfd, s);
+
+  if (i == 0)
+    return ret;
+
+  /* push all messages to the fast path with one kick per core */
+  flextcp_context_flush(flextcp_sockctx_get());
+  return i;
+}
+
+int tas_flush(void)
+{
+  if (flextcp_context_flush(flextcp_sockctx_get()) != 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return 0;
+}
+
+ssize_t tas_zc_reservev(int sockfd, struct iovec *iov, int *iovcnt,
+    size_t len)
+{
+  struct socket *s;
+  struct flextcp_context *ctx;
+  ssize_t ret = 0;
+  size_t len_1, len_2;
+  void *dst_1, *dst_2;
+  int block, iovmax = *iovcnt;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  tas_sock_move(s);
+
+  /* not a connection, or not connected */
+  if (s->type != SOCK_CONNECTION ||
+      s->data.connection.status != SOC_CONNECTED ||
+      (s->data.connection.st_flags & CSTF_TXCLOSED) == CSTF_TXCLOSED)
+  {
+    errno = ENOTCONN;
+    ret = -1;
+    goto out;
+  }
+
+  if (iovmax < 1) {
+    errno = EINVAL;
+    ret = -1;
+    goto out;
+  }
+
+  /* return 0 if 0 length */
+  if (len == 0) {
+    *iovcnt = 0;
+    goto out;
+  }
+
+  ctx = flextcp_sockctx_get();
+
+  /* make sure there is space in the transmit queue if the socket is
+   * non-blocking */
+  if ((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK &&
+      flextcp_connection_tx_possible(ctx, &s->data.connection.c) != 0)
+  {
+    errno = EAGAIN;
+    ret = -1;
+    goto out;
+  }
+
+  /* allocate transmit buffer, behind any earlier reservation */
+  ret = flextcp_connection_tx_alloc2(&s->data.connection.c, len, &dst_1, &len_1,
+      &dst_2);
+  if (ret < 0) {
+    fprintf(stderr, "tas_zc_reservev: flextcp_connection_tx_alloc failed\n");
+    abort();
+  }
+
+  /* if tx buffer allocation failed, either block or poll context at least once
+   * to handle busy loops on non-blocking sockets. */
+  block = 0;
+  while (ret == 0) {
+    socket_unlock(s);
+    if (block)
+      flextcp_context_wait(ctx, -1);
+    block = 1;
+
+    flextcp_sockctx_poll(ctx);
+    socket_lock(s);
+
+    ret = flextcp_connection_tx_alloc2(&s->data.connection.c, len, &dst_1,
+        &len_1, &dst_2);
+    if (ret < 0) {
+      fprintf(stderr, "tas_zc_reservev: flextcp_connection_tx_alloc failed\n");
+      abort();
+    } else if (ret == 0 && (s->flags & SOF_NONBLOCK) == SOF_NONBLOCK) {
+      errno = EAGAIN;
+      ret = -1;
+      goto out;
+    }
+  }
+  len_2 = ret - len_1;
+
+  iov[0].iov_base = dst_1;
+  iov[0].iov_len = len_1;
+  *iovcnt = 1;
+  if (len_2 > 0) {
+    if (iovmax < 2) {
+      /* caller only takes one piece, give back the wrapped part */
+      flextcp_connection_tx_release(&s->data.connection.c, len_2);
+      ret = len_1;
+    } else {
+      iov[1].iov_base = dst_2;
+      iov[1].iov_len = len_2;
+      *iovcnt = 2;
+    }
+  }
+
+  s->data.connection.tx_reserved += ret;
+
+out:
+  flextcp_fd_srelease(sockfd, s);
+  return ret;
+}
+
+ssize_t tas_zc_reserve(int sockfd, void **buf, size_t len)
+{
+  struct iovec iov;
+  int iovcnt = 1;
+  ssize_t ret;
+
+  ret = tas_zc_reservev(sockfd, &iov, &iovcnt, len);
+  if (ret > 0) {
+    *buf = iov.iov_base;
+  }
+  return ret;
+}
+
+int tas_zc_commit(int sockfd, size_t len)
 {
   struct socket *s;
+  struct flextcp_context *ctx;
+  size_t reserved;
+  int ret = 0;
 
   if (flextcp_fd_slookup(sockfd, &s) != 0) {
     errno = EBADF;
     return -1;
   }
 
-  if (flextcp_fd_slookup(in_fd, &s) != 0) {
+  if (s->type != SOCK_CONNECTION) {
+    errno = ENOTCONN;
+    ret = -1;
+    goto out;
+  }
+
+  reserved = s->data.connection.tx_reserved;
+  if (len > reserved) {
+    errno = EINVAL;
+    ret = -1;
+    goto out;
+  }
+
+  /* give back the part of the reservation that is not sent */
+  if (len < reserved &&
+      flextcp_connection_tx_release(&s->data.connection.c, reserved - len) != 0)
+  {
+    fprintf(stderr, "tas_zc_commit: flextcp_connection_tx_release failed\n");
+    abort();
+  }
+  s->data.connection.tx_reserved = 0;
+
+  if (len == 0) {
+    goto out;
+  }
+
+  ctx = flextcp_sockctx_get();
+  if (flextcp_connection_tx_send(ctx, &s->data.connection.c, len) != 0) {
+    fprintf(stderr, "tas_zc_commit: flextcp_connection_tx_send failed\n");
+    abort();
+  }
+
+out:
+  flextcp_fd_srelease(sockfd, s);
+  return ret;
+}
+
+/* reads up to len bytes at off, returns fewer only at the end of the file or
+ * on an error after some bytes were read, -1 if nothing could be read */
+static ssize_t sendfile_pread(int fd, void *buf, size_t len, off_t off)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < len) {
+    ret = pread(fd, (uint8_t *) buf + done, len - done, off + done);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret < 0) {
+      return (done > 0 ? (ssize_t) done : -1);
+    } else if (ret == 0) {
+      break;
+    }
+    done += ret;
+  }
+
+  return done;
+}
+
+/* reads len bytes of in_fd at off into the transmit buffer and sends them,
+ * called with lock on s held. Blocks until everything is sent unless the
+ * socket is non-blocking, then returns after the transmit buffer is full.
+ * Returns early if the file was truncated in the meantime. */
+static ssize_t sendfile_copy(struct flextcp_context *ctx, struct socket *s,
+    int in_fd, off_t off, size_t len)
+{
+  ssize_t ret, n, n_2;
+  size_t done = 0, len_1, len_2;
+  void *dst_1, *dst_2;
+  int block = 0;
+
+  while (done < len) {
+    ret = flextcp_connection_tx_alloc2(&s->data.connection.c, len - done,
+        &dst_1, &len_1, &dst_2);
+    if (ret < 0) {
+      fprintf(stderr, "sendfile: flextcp_connection_tx_alloc failed\n");
+      abort();
+    }
+
+    if (ret == 0) {
+      /* non-blocking sockets return what was sent, after polling the context
+       * at least once to handle busy loops of sendfile */
+      if ((s->flags & SOF_NONBLOCK) == SOF_NONBLOCK && (done > 0 || block)) {
+        if (done > 0)
+          break;
+        errno = EAGAIN;
+        return -1;
+      }
+
+      socket_unlock(s);
+      if (block)
+        flextcp_context_wait(ctx, -1);
+      block = 1;
+
+      flextcp_sockctx_poll(ctx);
+      socket_lock(s);
+
+      if (s->data.connection.status != SOC_CONNECTED ||
+          (s->data.connection.st_flags & CSTF_TXCLOSED) == CSTF_TXCLOSED)
+      {
+        if (done > 0)
+          break;
+        errno = ENOTCONN;
+        return -1;
+      }
+      continue;
+    }
+    len_2 = ret - len_1;
+
+    /* single copy from the page cache into the TX buffer */
+    n = sendfile_pread(in_fd, dst_1, len_1, off + done);
+    if (n == (ssize_t) len_1 && len_2 > 0 &&
+        (n_2 = sendfile_pread(in_fd, dst_2, len_2, off + done + len_1)) > 0)
+    {
+      n += n_2;
+    }
+
+    /* give back what could not be read */
+    if (n < ret &&
+        flextcp_connection_tx_release(&s->data.connection.c,
+          ret - (n > 0 ? n : 0)) != 0)
+    {
+      fprintf(stderr, "sendfile: flextcp_connection_tx_release failed\n");
+      abort();
+    }
+    if (n < 0) {
+      if (done > 0)
+        break;
+      return -1;
+    }
+
+    if (n > 0 &&
+        flextcp_connection_tx_send(ctx, &s->data.connection.c, n) != 0)
+    {
+      fprintf(stderr, "sendfile: flextcp_connection_tx_send failed\n");
+      abort();
+    }
+    done += n;
+    block = 0;
+
+    /* file shrunk since it was checked */
+    if (n < ret)
+      break;
+  }
+
+  return done;
+}
+
+ssize_t tas_sendfile(int sockfd, int in_fd, off_t *offset, size_t len)
+{
+  struct socket *s;
+  struct flextcp_context *ctx;
+  struct stat st;
+  ssize_t ret = 0, n;
+  off_t off;
+
+  if (flextcp_fd_slookup(sockfd, &s) != 0) {
     errno = EBADF;
     return -1;
   }
 
-  assert(!"NYI");
-  errno = ENOTSUP;
-  return -1;
+  tas_sock_move(s);
+
+  /* not a connection, or not connected */
+  if (s->type != SOCK_CONNECTION ||
+      s->data.connection.status != SOC_CONNECTED ||
+      (s->data.connection.st_flags & CSTF_TXCLOSED) == CSTF_TXCLOSED)
+  {
+    errno = ENOTCONN;
+    ret = -1;
+    goto out;
+  }
+
+  /* zero-copy reservation has to be committed first */
+  if (s->data.connection.tx_reserved != 0) {
+    errno = EBUSY;
+    ret = -1;
+    goto out;
+  }
+
+  /* source has to be a regular file, only peek at TAS sockets here as in_fd
+   * may be sockfd itself or another thread's sendfile socket */
+  if (flextcp_fd_speek(in_fd) != NULL) {
+    errno = EINVAL;
+    ret = -1;
+    goto out;
+  }
+  if (fstat(in_fd, &st) != 0) {
+    ret = -1;
+    goto out;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    errno = EINVAL;
+    ret = -1;
+    goto out;
+  }
+
+  if (offset != NULL) {
+    off = *offset;
+  } else if ((off = lseek(in_fd, 0, SEEK_CUR)) < 0) {
+    ret = -1;
+    goto out;
+  }
+
+  /* nothing to send past the end of the file */
+  if (off >= st.st_size || len == 0) {
+    goto out;
+  }
+  len = TAS_MIN(len, (size_t) (st.st_size - off));
+
+  ctx = flextcp_sockctx_get();
+
+  /* the range is read front to back, so let the kernel read ahead */
+  posix_fadvise(in_fd, off, len, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(in_fd, off, len, POSIX_FADV_WILLNEED);
+
+  /* the file is read with pread into the transmit buffer, so a concurrent
+   * truncate only makes the send short */
+  n = sendfile_copy(ctx, s, in_fd, off, len);
+  if (n < 0) {
+    ret = -1;
+    goto out;
+  }
+
+  /* the data is queued, so the count is returned even if the file position
+   * cannot be updated */
+  ret = n;
+  if (offset != NULL) {
+    *offset = off + n;
+  } else {
+    lseek(in_fd, off + n, SEEK_SET);
+  }
+
+out:
+  flextcp_fd_srelease(sockfd, s);
+  return ret;
 }
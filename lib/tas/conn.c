@@ -48,7 +48,9 @@ int flextcp_listen_open(struct flextcp_context *ctx,
 
   memset(lst, 0, sizeof(*lst));
 
-  if ((flags & ~(FLEXTCP_LISTEN_REUSEPORT)) != 0) {
+  if ((flags & ~(FLEXTCP_LISTEN_REUSEPORT | FLEXTCP_LISTEN_STEER_CTX |
+          FLEXTCP_LISTEN_STEER_CORE)) != 0)
+  {
     fprintf(stderr, "flextcp_listen_open: unknown flags (%x)\n", flags);
     return -1;
   }
@@ -56,6 +58,12 @@ int flextcp_listen_open(struct flextcp_context *ctx,
   if ((flags & FLEXTCP_LISTEN_REUSEPORT) == FLEXTCP_LISTEN_REUSEPORT) {
     f |= KERNEL_APPOUT_LISTEN_REUSEPORT;
   }
+  if ((flags & FLEXTCP_LISTEN_STEER_CTX) == FLEXTCP_LISTEN_STEER_CTX) {
+    f |= KERNEL_APPOUT_LISTEN_STEER_CTX;
+  }
+  if ((flags & FLEXTCP_LISTEN_STEER_CORE) == FLEXTCP_LISTEN_STEER_CORE) {
+    f |= KERNEL_APPOUT_LISTEN_STEER_CTX | KERNEL_APPOUT_LISTEN_STEER_CORE;
+  }
 
   kin += pos;
 
@@ -120,6 +128,54 @@ int flextcp_listen_accept(struct flextcp_context *ctx,
   return 0;
 }
 
+STATIC_ASSERT(FLEXTCP_LISTEN_ACCEPT_BATCH == KERNEL_APPOUT_ACCEPT_BATCH,
+    accept_batch);
+
+int flextcp_listen_accept_n(struct flextcp_context *ctx,
+    struct flextcp_listener *lst, struct flextcp_connection **conns,
+    unsigned num)
+{
+  uint32_t pos = ctx->kin_head;
+  struct kernel_appout *kin;
+  unsigned i, j, n;
+
+  for (i = 0; i < num; i += n) {
+    kin = (struct kernel_appout *) ctx->kin_base + pos;
+    if (kin->type != KERNEL_APPOUT_INVALID) {
+      break;
+    }
+
+    n = num - i;
+    if (n > KERNEL_APPOUT_ACCEPT_BATCH) {
+      n = KERNEL_APPOUT_ACCEPT_BATCH;
+    }
+    for (j = 0; j < n; j++) {
+      connection_init(conns[i + j]);
+      conns[i + j]->status = CONN_ACCEPT_REQUESTED;
+      conns[i + j]->local_port = lst->local_port;
+      kin->data.accept_conns.conn_opaques[j] = OPAQUE(conns[i + j]);
+    }
+
+    kin->data.accept_conns.listen_opaque = OPAQUE(lst);
+    kin->data.accept_conns.local_port = lst->local_port;
+    kin->data.accept_conns.core = ctx->core;
+    kin->data.accept_conns.num = n;
+    MEM_BARRIER();
+    kin->type = KERNEL_APPOUT_ACCEPT_CONNS;
+
+    pos = pos + 1;
+    if (pos >= ctx->kin_len) {
+      pos = 0;
+    }
+  }
+  ctx->kin_head = pos;
+
+  if (i > 0) {
+    flextcp_kernel_kick();
+  }
+  return i;
+}
+
 int flextcp_connection_open(struct flextcp_context *ctx,
     struct flextcp_connection *conn, uint32_t dst_ip, uint16_t dst_port)
 {
@@ -314,6 +370,16 @@ ssize_t flextcp_connection_tx_alloc2(struct flextcp_connection *conn, size_t len
   return len;
 }
 
+int flextcp_connection_tx_release(struct flextcp_connection *conn, size_t len)
+{
+  if (conn_tx_sendbytes(conn) < len) {
+    return -1;
+  }
+
+  conn->txb_allocated -= len;
+  return 0;
+}
+
 int flextcp_connection_tx_send(struct flextcp_context *ctx,
     struct flextcp_connection *conn, size_t len)
 {
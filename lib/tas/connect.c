@@ -98,6 +98,14 @@ int flexnic_driver_connect(struct flexnic_info **p_info, void **p_mem_start,
     goto error_unmap_info;
   }
 
+  /* shared memory layout depends on build-time limits */
+  if (flexnic_info_limits_check(fi) != 0) {
+    fprintf(stderr, "flexnic_driver_connect: TAS built with different limits "
+        "(vms=%u app ctxs=%u), rebuild with the same FLEXNIC_PL_* values\n",
+        fi->vmst_num, fi->appctx_num);
+    goto error_unmap_info;
+  }
+
   /* open and map dma shm region */
   if ((fi->flags & FLEXNIC_FLAG_HUGEPAGES) == FLEXNIC_FLAG_HUGEPAGES) {
     m = map_region_huge(FLEXNIC_NAME_DMA_MEM, fi->dma_mem_size, 
@@ -147,6 +155,31 @@ int flexnic_driver_internal(void **int_mem_start)
   return 0;
 }
 
+int flexnic_driver_doorbells(struct flexnic_doorbells **db)
+{
+  void *m;
+
+  if (info == NULL) {
+    fprintf(stderr, "flexnic_driver_doorbells: driver not connected\n");
+    return -1;
+  }
+
+  if ((info->flags & FLEXNIC_FLAG_DOORBELLS) != FLEXNIC_FLAG_DOORBELLS) {
+    fprintf(stderr, "flexnic_driver_doorbells: doorbells disabled\n");
+    return -1;
+  }
+
+  m = map_region(FLEXNIC_NAME_DOORBELLS, sizeof(struct flexnic_doorbells), -1,
+      0);
+  if (m == NULL) {
+    perror("flexnic_driver_doorbells: map_region failed");
+    return -1;
+  }
+
+  *db = m;
+  return 0;
+}
+
 
 static int flexnic_driver_connect_sing(struct flexnic_info **p_info, void **p_mem_start,
     int shmfd, int vmid)
@@ -168,6 +201,14 @@ static int flexnic_driver_connect_sing(struct flexnic_info **p_info, void **p_me
     goto error_unmap_info;
   }
 
+  /* shared memory layout depends on build-time limits */
+  if (flexnic_info_limits_check(fi) != 0) {
+    fprintf(stderr, "flexnic_driver_connect: TAS built with different limits "
+        "(vms=%u app ctxs=%u), rebuild with the same FLEXNIC_PL_* values\n",
+        fi->vmst_num, fi->appctx_num);
+    goto error_unmap_info;
+  }
+
   /* open and map dma shm region */
   if ((fi->flags & FLEXNIC_FLAG_HUGEPAGES) == FLEXNIC_FLAG_HUGEPAGES) {
     char name[40];
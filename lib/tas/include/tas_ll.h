@@ -40,6 +40,8 @@
 #define FLEXTCP_MAX_CONTEXTS 32
 #define FLEXTCP_MAX_FTCPCORES 16
 
+struct util_doorbell;
+
 /**
  * A flextcp context is per-thread state for the stack. (opaque)
  * This includes:
@@ -78,12 +80,20 @@ struct flextcp_context {
   uint32_t flags;
   uint16_t db_id;
   uint16_t ctx_id;
+  /* fast path core this context is paired with for steered listeners,
+   * ctx_id modulo the number of cores unless set by the application */
+  uint16_t core;
 
   uint16_t num_queues;
   uint16_t next_queue;
 
   /* waiting */
   uint64_t last_inev_ts;
+  /* cycles to poll before blocking (0 until first used) */
+  uint64_t spin_cycles;
+  uint64_t sleep_ts;
+  /* doorbell in shared memory, NULL if the eventfd is kicked directly */
+  struct util_doorbell *db;
   int evfd;
 };
 
@@ -136,6 +146,8 @@ struct flextcp_connection {
   struct flextcp_connection *bump_next;
   struct flextcp_connection *bump_prev;
   uint16_t fn_core;
+  /** payload bytes per segment negotiated in the handshake */
+  uint16_t mss;
 
   uint8_t bump_pending;
   uint8_t status;
@@ -237,6 +249,14 @@ struct flextcp_event {
 };
 
 #define FLEXTCP_LISTEN_REUSEPORT 0x1
+/** Accepted connections are delivered to the context that posted the accept
+ * with flextcp_listen_accept_n(), instead of the application's first
+ * context. */
+#define FLEXTCP_LISTEN_STEER_CTX 0x2
+/** Handshakes are completed into accepts posted by a context paired with the
+ * fast path core handling the flow if there is one (see
+ * flextcp_context::core). Implies #FLEXTCP_LISTEN_STEER_CTX. */
+#define FLEXTCP_LISTEN_STEER_CORE 0x4
 
 /**
  * Initializes global flextcp state, must only be called once.
@@ -256,6 +276,16 @@ int flextcp_init_isolated(void);
 int flextcp_context_create(struct flextcp_context *ctx,
     uint8_t *presp, ssize_t *presp_sz);
 
+/**
+ * Push pending connection updates (sends and receive buffer frees) to the
+ * fast path now instead of on the next poll. Each fast path core is kicked at
+ * most once for all connections.
+ *
+ * @return 0 if all updates were pushed, -1 if some are left because a queue
+ *   to the fast path is full.
+ */
+int flextcp_context_flush(struct flextcp_context *ctx);
+
 /**
  * Poll events from a flextcp socket.
  */
@@ -309,6 +339,17 @@ int flextcp_listen_open(struct flextcp_context *ctx,
 int flextcp_listen_accept(struct flextcp_context *ctx,
     struct flextcp_listener *lst, struct flextcp_connection *conn);
 
+/** Connection handles flextcp_listen_accept_n() posts per kernel queue
+ * entry. */
+#define FLEXTCP_LISTEN_ACCEPT_BATCH 6
+
+/** Accept connections on a listening socket (asynchronous) with num
+ * connection handles at once. The handles are posted with one kernel queue
+ * entry per #FLEXTCP_LISTEN_ACCEPT_BATCH and one notification. Returns the
+ * number of handles posted, fewer than num if the kernel queue is full. */
+int flextcp_listen_accept_n(struct flextcp_context *ctx,
+    struct flextcp_listener *lst, struct flextcp_connection **conns,
+    unsigned num);
 
 /** Open a connection (asynchronous). */
 int flextcp_connection_open(struct flextcp_context *ctx,
@@ -334,6 +375,10 @@ ssize_t flextcp_connection_tx_alloc(struct flextcp_connection *conn, size_t len,
 ssize_t flextcp_connection_tx_alloc2(struct flextcp_connection *conn, size_t len,
     void **buf_1, size_t *len_1, void **buf_2);
 
+/** Return the last `len' allocated bytes in the transmit buffer that will not
+ * be sent. */
+int flextcp_connection_tx_release(struct flextcp_connection *conn, size_t len);
+
 /** Send previously allocated bytes in transmit buffer */
 int flextcp_connection_tx_send(struct flextcp_context *ctx,
         struct flextcp_connection *conn, size_t len);
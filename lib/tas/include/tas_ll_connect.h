@@ -40,4 +40,7 @@ int flexnic_driver_connect_mult(struct flexnic_info **p_info, void **p_mem_start
 /** Connect to flexnic internal memory. */
 int flexnic_driver_internal(void **int_mem_start);
 
+/** Map the doorbell region, only available with FLEXNIC_FLAG_DOORBELLS. */
+int flexnic_driver_doorbells(struct flexnic_doorbells **db);
+
 #endif /* ndef FLEXNIC_DRIVER_H_ */
@@ -43,6 +43,7 @@ void *flexnic_mem = NULL;
 int flexnic_shmfd = -1;
 struct flexnic_info *flexnic_info = NULL;
 int flexnic_evfd[FLEXTCP_MAX_FTCPCORES];
+struct flexnic_doorbells *flexnic_db = NULL;
 
 static inline int event_kappin_conn_opened(
     struct kernel_appin_conn_opened *inev, struct flextcp_event *outev,
@@ -90,6 +91,13 @@ int flextcp_init(int groupid)
     return -1;
   }
 
+  if ((flexnic_info->flags & FLEXNIC_FLAG_DOORBELLS) != 0 &&
+      flexnic_driver_doorbells(&flexnic_db) != 0)
+  {
+    fprintf(stderr, "flextcp_init: mapping doorbells failed\n");
+    return -1;
+  }
+
   return 0;
 }
 
@@ -108,6 +116,13 @@ int flextcp_init_isolated(void)
     return -1;
   }
 
+  if ((flexnic_info->flags & FLEXNIC_FLAG_DOORBELLS) != 0 &&
+      flexnic_driver_doorbells(&flexnic_db) != 0)
+  {
+    fprintf(stderr, "flextcp_init_isolated: mapping doorbells failed\n");
+    return -1;
+  }
+
   return 0;
 }
 
@@ -132,7 +147,12 @@ int flextcp_context_create(struct flextcp_context *ctx,
     return -1;
   }
 
-  return flextcp_kernel_newctx(ctx, presp, presp_sz);
+  if (flextcp_kernel_newctx(ctx, presp, presp_sz) != 0) {
+    return -1;
+  }
+
+  ctx->core = ctx->ctx_id % ctx->num_queues;
+  return 0;
 }
 
 #include <pthread.h>
@@ -526,24 +546,38 @@ int flextcp_context_tx_alloc(struct flextcp_context *ctx,
 
 static void flextcp_flexnic_kick(struct flextcp_context *ctx, int core)
 {
-  uint64_t now = util_rdtsc();
+  uint64_t now;
+  int r;
 
   if (flexnic_info->poll_cycle_tas == UINT64_MAX) {
     /* blocking for TAS disabled */
     return;
   }
 
+  /* only kick if the core is actually asleep */
+  if (flexnic_db != NULL && flexnic_db->fp[core].armed) {
+    if (util_doorbell_ring(&flexnic_db->fp[core]) == UTIL_DOORBELL_SLEEP_FD) {
+      uint64_t val = 1;
+      r = write(flexnic_evfd[core], &val, sizeof(uint64_t));
+      assert(r == sizeof(uint64_t));
+    }
+    return;
+  }
+
+  now = util_rdtsc();
+
   if(now - ctx->queues[core].last_ts > flexnic_info->poll_cycle_tas) {
     // Kick
     uint64_t val = 1;
-    int r = write(flexnic_evfd[core], &val, sizeof(uint64_t));
+    r = write(flexnic_evfd[core], &val, sizeof(uint64_t));
     assert(r == sizeof(uint64_t));
   }
 
   ctx->queues[core].last_ts = now;
 }
 
-void flextcp_context_tx_done(struct flextcp_context *ctx, uint16_t core)
+/* make the queue entry visible to the core without kicking it */
+static inline void context_tx_push(struct flextcp_context *ctx, uint16_t core)
 {
   ctx->queues[core].txq_tail += sizeof(struct flextcp_pl_atx);
   if (ctx->queues[core].txq_tail >= ctx->txq_len) {
@@ -551,10 +585,20 @@ void flextcp_context_tx_done(struct flextcp_context *ctx, uint16_t core)
   }
 
   ctx->queues[core].txq_avail -= sizeof(struct flextcp_pl_atx);
+}
 
+void flextcp_context_tx_done(struct flextcp_context *ctx, uint16_t core)
+{
+  context_tx_push(ctx, core);
   flextcp_flexnic_kick(ctx, core);
 }
 
+int flextcp_context_flush(struct flextcp_context *ctx)
+{
+  conns_bump(ctx);
+  return (ctx->bump_pending_first == NULL ? 0 : -1);
+}
+
 static inline int event_kappin_conn_opened(
     struct kernel_appin_conn_opened *inev, struct flextcp_event *outev,
     unsigned avail)
@@ -589,6 +633,7 @@ static inline int event_kappin_conn_opened(
   conn->flow_id = inev->flow_id;
   conn->tunnel_id = inev->tunnel_id;
   conn->fn_core = inev->fn_core;
+  conn->mss = inev->mss;
 
   conn->rxb_base = (uint8_t *) flexnic_mem + inev->rx_off;
   conn->rxb_len = inev->rx_len;
@@ -668,6 +713,7 @@ static inline int event_kappin_accept_conn(
   conn->flow_id = inev->flow_id;
   conn->tunnel_id = inev->tunnel_id;
   conn->fn_core = inev->fn_core;
+  conn->mss = inev->mss;
 
   conn->rxb_base = (uint8_t *) flexnic_mem + inev->rx_off;
   conn->rxb_len = inev->rx_len;
@@ -932,10 +978,17 @@ static void txq_probe(struct flextcp_context *ctx, unsigned n)
   }
 }
 
+/* Push updates for all connections with pending bumps. Each fast path core
+ * is kicked once after all of its entries are queued, rather than once per
+ * connection. */
 static void conns_bump(struct flextcp_context *ctx)
 {
   struct flextcp_connection *c;
   struct flextcp_pl_atx *atx;
+  /* fast path cores to kick, FLEXNIC_PL_APPST_CTX_MCS may be raised with -D */
+  uint64_t kick[(FLEXNIC_PL_APPST_CTX_MCS + 63) / 64] = { 0 };
+  uint64_t word;
+  unsigned i;
   uint8_t flags;
 
   while ((c = ctx->bump_pending_first) != NULL) {
@@ -959,7 +1012,8 @@ static void conns_bump(struct flextcp_context *ctx)
     MEM_BARRIER();
     atx->type = FLEXTCP_PL_ATX_CONNUPDATE;
 
-    flextcp_context_tx_done(ctx, c->fn_core);
+    context_tx_push(ctx, c->fn_core);
+    kick[c->fn_core / 64] |= 1ULL << (c->fn_core % 64);
 
     c->rxb_bump = c->txb_bump = 0;
     c->bump_pending = 0;
@@ -969,6 +1023,12 @@ static void conns_bump(struct flextcp_context *ctx)
     }
     ctx->bump_pending_first = c->bump_next;
   }
+
+  for (i = 0; i < sizeof(kick) / sizeof(kick[0]); i++) {
+    for (word = kick[i]; word != 0; word &= word - 1) {
+      flextcp_flexnic_kick(ctx, i * 64 + __builtin_ctzll(word));
+    }
+  }
 }
 
 int flextcp_context_waitfd(struct flextcp_context *ctx)
@@ -978,6 +1038,8 @@ int flextcp_context_waitfd(struct flextcp_context *ctx)
 
 int flextcp_context_canwait(struct flextcp_context *ctx)
 {
+  uint64_t now;
+
   /* At a high level this code implements a state machine that ensures that at
    * least POLL_CYCLE time has elapsed between two unsuccessfull poll calls.
    * This is a bit messier because we don't want to move any of the timestamp
@@ -993,6 +1055,9 @@ int flextcp_context_canwait(struct flextcp_context *ctx)
 
   /* if there were events found in the last poll, it's back to square one. */
   if ((ctx->flags & CTX_FLAG_POLL_EVENTS) != 0) {
+    if ((ctx->flags & CTX_FLAG_LASTWAIT) != 0 && ctx->db != NULL) {
+      util_doorbell_cancel(ctx->db);
+    }
     ctx->flags &= ~(CTX_FLAG_POLL_EVENTS | CTX_FLAG_WANTWAIT |
         CTX_FLAG_LASTWAIT);
 
@@ -1001,13 +1066,24 @@ int flextcp_context_canwait(struct flextcp_context *ctx)
 
   /* from here on we know that there are no events */
 
+  /* the grace period adapts to how long we end up sleeping, see waitclear */
+  if (ctx->spin_cycles < flexnic_info->poll_cycle_app) {
+    ctx->spin_cycles = flexnic_info->poll_cycle_app;
+  }
+
   if ((ctx->flags & CTX_FLAG_WANTWAIT) != 0) {
     /* in want wait state: just wait for grace period to be over */
-    if ((util_rdtsc() - ctx->last_inev_ts) > flexnic_info->poll_cycle_app) {
+    now = util_rdtsc();
+    if ((now - ctx->last_inev_ts) > ctx->spin_cycles) {
       /* past grace period, move on to lastwait. clear polled flag, to make sure
-       * it gets polled again before we clear lastwait. */
+       * it gets polled again before we clear lastwait. The doorbell is marked
+       * before that last poll, so that notifications from here on kick us. */
       ctx->flags &= ~(CTX_FLAG_POLL_CALLED | CTX_FLAG_WANTWAIT);
       ctx->flags |= CTX_FLAG_LASTWAIT;
+      ctx->sleep_ts = now;
+      if (ctx->db != NULL) {
+        util_doorbell_prepare(ctx->db, UTIL_DOORBELL_SLEEP_FD);
+      }
     }
   } else if ((ctx->flags & CTX_FLAG_LASTWAIT) != 0) {
     /* in last wait state */
@@ -1038,6 +1114,16 @@ void flextcp_context_waitclear(struct flextcp_context *ctx)
     abort();
   }
 
+  if (ctx->db != NULL) {
+    util_doorbell_cancel(ctx->db);
+  }
+
+  /* poll longer next time if we were woken up quickly */
+  if ((ctx->flags & CTX_FLAG_LASTWAIT) != 0) {
+    util_doorbell_adapt(&ctx->spin_cycles, flexnic_info->poll_cycle_app,
+        util_rdtsc() - ctx->sleep_ts);
+  }
+
   ctx->flags &= ~(CTX_FLAG_WANTWAIT | CTX_FLAG_LASTWAIT | CTX_FLAG_POLL_CALLED);
 }
 
@@ -1050,6 +1136,16 @@ int flextcp_context_wait(struct flextcp_context *ctx, int timeout_ms)
     return -1;
   }
 
+  /* with a doorbell there is no need for the eventfd, sleep on the futex
+   * unless we have been rung already */
+  if (ctx->db != NULL) {
+    if (util_doorbell_prepare_futex(ctx->db)) {
+      util_doorbell_wait(ctx->db, timeout_ms);
+    }
+    flextcp_context_waitclear(ctx);
+    return 0;
+  }
+
   pfd.fd = ctx->evfd;
   pfd.events = POLLIN;
   pfd.revents = 0;
@@ -63,6 +63,7 @@ extern void *flexnic_mem;
 extern int flexnic_shmfd;
 extern struct flexnic_info *flexnic_info;
 extern int flexnic_evfd[FLEXTCP_MAX_FTCPCORES];
+extern struct flexnic_doorbells *flexnic_db;
 
 int flextcp_kernel_connect(int *shmfd, int groupid);
 int flextcp_kernel_connect_isolated(int *shmfd);
@@ -42,8 +42,19 @@ static int flextcp_kernel_connect_path(int *shmfd, const char *path,
 void flextcp_kernel_kick(void)
 {
   static uint64_t __thread last_ts = 0;
-  uint64_t now = util_rdtsc();
+  uint64_t now;
+
+  /* only kick if the slow path is actually asleep */
+  if (flexnic_db != NULL && flexnic_db->sp.armed) {
+    if (util_doorbell_ring(&flexnic_db->sp) == UTIL_DOORBELL_SLEEP_FD) {
+      uint64_t val = 1;
+      int r = write(kernel_evfd, &val, sizeof(uint64_t));
+      assert(r == sizeof(uint64_t));
+    }
+    return;
+  }
 
+  now = util_rdtsc();
   if(now - last_ts > flexnic_info->poll_cycle_tas) {
     // Kick kernel
     assert(kernel_evfd != 0);
@@ -253,6 +264,11 @@ int flextcp_kernel_newctx(struct flextcp_context *ctx,
   ctx->kout_head = 0;
 
   ctx->db_id = resp->flexnic_db_id;
+  if (flexnic_db != NULL) {
+    /* from here on TAS only kicks us while we are asleep */
+    ctx->db = &flexnic_db->app[resp->flexnic_vm_id][ctx->db_id];
+    ctx->db->armed = 1;
+  }
   ctx->num_queues = resp->flexnic_qs_num;
   ctx->next_queue = 0;
 
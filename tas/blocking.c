@@ -31,22 +31,34 @@
 
 extern int kernel_notifyfd;
 
-static void notify_core(int cfd, uint64_t *last_ts, uint64_t tsc,
-    uint64_t delta)
+static void notify_fd(int cfd)
 {
-  uint64_t val;
+  uint64_t val = 1;
 
+  if (write(cfd, &val, sizeof(uint64_t)) != sizeof(uint64_t)) {
+    perror("notify_core: write failed");
+    abort();
+  }
+}
+
+static void notify_core(struct util_doorbell *db, int cfd, uint64_t *last_ts,
+    uint64_t tsc, uint64_t delta)
+{
   /* blocking is disabled */
   if (delta == UINT64_MAX) {
     return;
   }
 
-  if(tsc - *last_ts > delta) {
-    val = 1;
-    if (write(cfd, &val, sizeof(uint64_t)) != sizeof(uint64_t)) {
-      perror("notify_core: write failed");
-      abort();
+  /* the doorbell tells us whether the core is actually asleep */
+  if (db->armed) {
+    if (util_doorbell_ring(db) == UTIL_DOORBELL_SLEEP_FD) {
+      notify_fd(cfd);
     }
+    return;
+  }
+
+  if(tsc - *last_ts > delta) {
+    notify_fd(cfd);
   }
 
   *last_ts = tsc;
@@ -54,27 +66,48 @@ static void notify_core(int cfd, uint64_t *last_ts, uint64_t tsc,
 
 void notify_fastpath_core(unsigned core)
 {
-  notify_core(fp_state->kctx[core].evfd, &fp_state->kctx[core].last_ts,
+  struct flextcp_pl_appctx *kctx = &fp_cores[core].kctx;
+
+  notify_core(&tas_doorbells->fp[core], kctx->evfd, &kctx->last_ts,
       util_rdtsc(), tas_info->poll_cycle_tas);
 }
 
-void notify_app_core(int appfd, uint64_t *last_ts)
+void notify_app_core(uint16_t vmid, uint16_t dbid, int appfd,
+    uint64_t *last_ts)
 {
-  notify_core(appfd, last_ts, util_rdtsc(), tas_info->poll_cycle_app);
+  notify_core(&tas_doorbells->app[vmid][dbid], appfd, last_ts, util_rdtsc(),
+      tas_info->poll_cycle_app);
 }
 
-void notify_appctx(struct flextcp_pl_appctx *ctx, uint64_t tsc)
+void notify_appctx(struct flextcp_pl_appctx *ctx, uint16_t vmid,
+    uint16_t dbid, uint64_t tsc)
 {
-  notify_core(ctx->evfd, &ctx->last_ts, tsc, tas_info->poll_cycle_app);
+  notify_core(&tas_doorbells->app[vmid][dbid], ctx->evfd, &ctx->last_ts, tsc,
+      tas_info->poll_cycle_app);
 }
 
 void notify_slowpath_core(void)
 {
   static uint64_t __thread last_ts = 0;
-  notify_core(kernel_notifyfd, &last_ts, util_rdtsc(),
+  notify_core(&tas_doorbells->sp, kernel_notifyfd, &last_ts, util_rdtsc(),
       tas_info->poll_cycle_tas);
 }
 
+void notify_canblock_init(struct notify_blockstate *nbs,
+    struct util_doorbell *db)
+{
+  nbs->last_active_ts = 0;
+  nbs->spin_cycles = tas_info->poll_cycle_tas;
+  nbs->block_ts = 0;
+  nbs->db = db;
+  nbs->can_block = nbs->second_bar = 0;
+
+  if (db != NULL) {
+    util_doorbell_cancel(db);
+    db->armed = 1;
+  }
+}
+
 int notify_canblock(struct notify_blockstate *nbs, int had_data, uint64_t tsc)
 {
   if (tas_info->poll_cycle_tas == UINT64_MAX) {
@@ -83,18 +116,26 @@ int notify_canblock(struct notify_blockstate *nbs, int had_data, uint64_t tsc)
 
   if (had_data) {
     /* not idle this round, reset everything */
+    if (nbs->second_bar && nbs->db != NULL) {
+      util_doorbell_cancel(nbs->db);
+    }
     nbs->can_block = nbs->second_bar = 0;
     nbs->last_active_ts = tsc;
   } else if (nbs->second_bar) {
     /* we can block now, reset afterwards */
     nbs->can_block = nbs->second_bar = 0;
     nbs->last_active_ts = tsc;
+    nbs->block_ts = tsc;
     return 1;
   } else if (nbs->can_block &&
-      tsc - nbs->last_active_ts > tas_info->poll_cycle_tas)
+      tsc - nbs->last_active_ts > nbs->spin_cycles)
   {
-    /* we've reached the poll cycle interval, so just poll once more */
+    /* we've reached the poll cycle interval, so just poll once more, with the
+     * doorbell marked so writers from here on wake us up */
     nbs->second_bar = 1;
+    if (nbs->db != NULL) {
+      util_doorbell_prepare(nbs->db, UTIL_DOORBELL_SLEEP_FD);
+    }
   } else {
     /* waiting for poll cycle interval */
     nbs->can_block = 1;
@@ -105,5 +146,19 @@ int notify_canblock(struct notify_blockstate *nbs, int had_data, uint64_t tsc)
 
 void notify_canblock_reset(struct notify_blockstate *nbs)
 {
+  uint64_t tsc;
+
+  if (nbs->db != NULL) {
+    util_doorbell_cancel(nbs->db);
+  }
+
+  if (nbs->block_ts != 0) {
+    tsc = util_rdtsc();
+    util_doorbell_adapt(&nbs->spin_cycles, tas_info->poll_cycle_tas,
+        tsc - nbs->block_ts);
+    nbs->block_ts = 0;
+    nbs->last_active_ts = tsc;
+  }
+
   nbs->can_block = nbs->second_bar = 0;
 }
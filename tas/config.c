@@ -33,9 +33,11 @@
 #include <utils.h>
 
 #include <config.h>
+#include <tas_memif.h>
 
+/* values start above the characters getopt_long() can return */
 enum cfg_params {
-  CP_VM_SHM_LEN,
+  CP_VM_SHM_LEN = 256,
   CP_DATA_MEM_OFF,
   CP_NIC_RX_LEN,
   CP_NIC_TX_LEN,
@@ -70,21 +72,37 @@ enum cfg_params {
   CP_CC_TIMELY_MINRATE,
   CP_IP_ROUTE,
   CP_IP_ADDR,
+  CP_IP_MTU,
   CP_FP_CORES_MAX,
+  CP_FP_FLOWS,
   CP_FP_NO_INTS,
+  CP_FP_NO_DOORBELLS,
   CP_FP_NO_XSUMOFFLOAD,
   CP_FP_NO_AUTOSCALE,
   CP_FP_NO_RSS,
   CP_FP_NO_HUGEPAGES,
+  CP_FP_NO_NUMA,
+  CP_FP_QMAN,
+  CP_FP_VM_QUANTUM,
+  CP_FP_VM_WEIGHT,
+  CP_FP_VM_MBUFS,
   CP_FP_NO_GRE,
   CP_FP_VLAN_STRIP,
   CP_FP_POLL_INTERVAL_TAS,
   CP_FP_POLL_INTERVAL_APP,
+  CP_FP_ADAPTIVE_POLL,
+  CP_FP_BACKOFF_LATENCY,
+  CP_FP_SLEEP_LATENCY,
   CP_BU_MAX_BUDGET,
   CP_BU_BUDGET_BOOST,
   CP_BU_USE_RATIO,
   CP_BU_ECN_THRESH,
   CP_BU_UPDATE_FREQ,
+  CP_BU_VM_WEIGHT,
+  CP_BU_VM_SHARE,
+  CP_BU_VM_SLO,
+  CP_BU_SLO_GAIN,
+  CP_BU_TELEMETRY,
   CP_KNI_NAME,
   CP_READY_FD,
   CP_DPDK_EXTRA,
@@ -197,12 +215,21 @@ static struct option opts[] = {
     { .name = "ip-addr",
       .has_arg = required_argument,
       .val = CP_IP_ADDR },
+    { .name = "ip-mtu",
+      .has_arg = required_argument,
+      .val = CP_IP_MTU },
     { .name = "fp-cores-max",
       .has_arg = required_argument,
       .val = CP_FP_CORES_MAX },
+    { .name = "fp-flows",
+      .has_arg = required_argument,
+      .val = CP_FP_FLOWS },
     { .name = "fp-no-ints",
       .has_arg = no_argument,
       .val = CP_FP_NO_INTS },
+    { .name = "fp-no-doorbells",
+      .has_arg = no_argument,
+      .val = CP_FP_NO_DOORBELLS },
     { .name = "fp-no-xsumoffload",
       .has_arg = no_argument,
       .val = CP_FP_NO_XSUMOFFLOAD },
@@ -215,6 +242,21 @@ static struct option opts[] = {
     { .name = "fp-no-hugepages",
       .has_arg = no_argument,
       .val = CP_FP_NO_HUGEPAGES },
+    { .name = "fp-no-numa",
+      .has_arg = no_argument,
+      .val = CP_FP_NO_NUMA },
+    { .name = "fp-qman",
+      .has_arg = required_argument,
+      .val = CP_FP_QMAN },
+    { .name = "fp-vm-quantum",
+      .has_arg = required_argument,
+      .val = CP_FP_VM_QUANTUM },
+    { .name = "fp-vm-weight",
+      .has_arg = required_argument,
+      .val = CP_FP_VM_WEIGHT },
+    { .name = "fp-vm-mbufs",
+      .has_arg = required_argument,
+      .val = CP_FP_VM_MBUFS },
     { .name = "fp-vlan-strip",
       .has_arg = no_argument,
       .val = CP_FP_VLAN_STRIP },
@@ -224,6 +266,15 @@ static struct option opts[] = {
     { .name = "fp-poll-interval-app",
       .has_arg = required_argument,
       .val = CP_FP_POLL_INTERVAL_APP },
+    { .name = "fp-adaptive-poll",
+      .has_arg = no_argument,
+      .val = CP_FP_ADAPTIVE_POLL },
+    { .name = "fp-backoff-latency",
+      .has_arg = required_argument,
+      .val = CP_FP_BACKOFF_LATENCY },
+    { .name = "fp-sleep-latency",
+      .has_arg = required_argument,
+      .val = CP_FP_SLEEP_LATENCY },
     { .name = "bu-max-budget",
       .has_arg = required_argument,
       .val = CP_BU_MAX_BUDGET },
@@ -239,6 +290,21 @@ static struct option opts[] = {
     { .name = "bu-boost",
       .has_arg = required_argument,
       .val = CP_BU_BUDGET_BOOST },
+    { .name = "bu-vm-weight",
+      .has_arg = required_argument,
+      .val = CP_BU_VM_WEIGHT },
+    { .name = "bu-vm-share",
+      .has_arg = required_argument,
+      .val = CP_BU_VM_SHARE },
+    { .name = "bu-vm-slo",
+      .has_arg = required_argument,
+      .val = CP_BU_VM_SLO },
+    { .name = "bu-slo-gain",
+      .has_arg = required_argument,
+      .val = CP_BU_SLO_GAIN },
+    { .name = "bu-telemetry",
+      .has_arg = required_argument,
+      .val = CP_BU_TELEMETRY },
     { .name = "kni-name",
       .has_arg = required_argument,
       .val = CP_KNI_NAME },
@@ -263,12 +329,16 @@ static inline int parse_double(const char *s, double *pd);
 static inline int parse_cidr(char *s, uint32_t *ip, uint8_t *prefix);
 static inline int parse_route(char *s, struct configuration *c);
 static inline int parse_arg_append(char *s, struct configuration *c);
+static inline int parse_vm_weight(char *s, struct configuration *c);
+static inline int parse_vm_mbufs(char *s, struct configuration *c);
+static inline int parse_vm_values(char *s, uint32_t *vmid, double *vals,
+    unsigned n);
 
 int config_parse(struct configuration *c, int argc, char *argv[])
 {
-  int ret, done = 0;
-  double d;
-  uint32_t i;
+  int ret, mode, done = 0;
+  double d, vals[2];
+  uint32_t i, vmid;
 
   if (config_defaults(c, argv[0]) != 0) {
     fprintf(stderr, "config_parse: config defaults failed\n");
@@ -500,17 +570,36 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_IP_MTU:
+        if (parse_int32(optarg, &c->ip_mtu) != 0 || c->ip_mtu < 576 ||
+            c->ip_mtu > 9600)
+        {
+          fprintf(stderr, "ip mtu parsing failed\n");
+          goto failed;
+        }
+        break;
       case CP_FP_CORES_MAX:
         if (parse_int32(optarg, &c->fp_cores_max) != 0) {
           fprintf(stderr, "fp cores max parsing failed\n");
           goto failed;
         }
         break;
+      case CP_FP_FLOWS:
+        if (parse_int32(optarg, &c->fp_flows) != 0 || c->fp_flows == 0 ||
+            c->fp_flows > FLEXNIC_PL_FLOWST_NUM_MAX)
+        {
+          fprintf(stderr, "fp flows parsing failed\n");
+          goto failed;
+        }
+        break;
       case CP_FP_NO_INTS:
         c->fp_interrupts = 0;
         c->fp_poll_interval_tas = UINT32_MAX;
         c->fp_poll_interval_app = UINT32_MAX;
         break;
+      case CP_FP_NO_DOORBELLS:
+        c->fp_doorbells = 0;
+        break;
       case CP_FP_NO_XSUMOFFLOAD:
         c->fp_xsumoffload = 0;
         break;
@@ -523,6 +612,35 @@ int config_parse(struct configuration *c, int argc, char *argv[])
       case CP_FP_NO_HUGEPAGES:
         c->fp_hugepages = 0;
         break;
+      case CP_FP_NO_NUMA:
+        c->fp_numa = 0;
+        break;
+      case CP_FP_QMAN:
+        if (!strcmp(optarg, "skiplist")) {
+          c->fp_qman = CONFIG_QMAN_SKIPLIST;
+        } else if (!strcmp(optarg, "wheel")) {
+          c->fp_qman = CONFIG_QMAN_WHEEL;
+        } else {
+          fprintf(stderr, "fp qman parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_VM_QUANTUM:
+        if (parse_int32(optarg, &c->fp_vm_quantum) != 0) {
+          fprintf(stderr, "fp vm quantum parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_VM_WEIGHT:
+        if (parse_vm_weight(optarg, c) != 0) {
+          goto failed;
+        }
+        break;
+      case CP_FP_VM_MBUFS:
+        if (parse_vm_mbufs(optarg, c) != 0) {
+          goto failed;
+        }
+        break;
       case CP_FP_VLAN_STRIP:
         c->fp_vlan_strip = 1;
         break;
@@ -537,6 +655,21 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_FP_ADAPTIVE_POLL:
+        c->fp_adaptive_poll = 1;
+        break;
+      case CP_FP_BACKOFF_LATENCY:
+        if (parse_int32(optarg, &c->fp_backoff_latency) != 0) {
+          fprintf(stderr, "fp back-off latency parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_SLEEP_LATENCY:
+        if (parse_int32(optarg, &c->fp_sleep_latency) != 0) {
+          fprintf(stderr, "fp sleep latency parsing failed\n");
+          goto failed;
+        }
+        break;
        break;
       case CP_BU_MAX_BUDGET:
         if (parse_int64(optarg, &c->bu_max_budget) != 0) {
@@ -569,6 +702,52 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_BU_VM_WEIGHT:
+        if (parse_vm_values(optarg, &vmid, vals, 1) != 0 || vals[0] <= 0) {
+          fprintf(stderr, "budget vm weight failed parsing\n");
+          goto failed;
+        }
+        c->bu_vm_weights[vmid] = vals[0];
+        break;
+      case CP_BU_VM_SHARE:
+        if (parse_vm_values(optarg, &vmid, vals, 2) != 0 || vals[0] < 0 ||
+            vals[0] > vals[1] || vals[1] > 1) {
+          fprintf(stderr, "budget vm share failed parsing\n");
+          goto failed;
+        }
+        d = vals[0];
+        for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+          if (i != vmid)
+            d += c->bu_vm_min_share[i];
+        }
+        if (d > 1 + 1e-9) {
+          fprintf(stderr, "budget vm minimum shares add up to more than 1\n");
+          goto failed;
+        }
+        c->bu_vm_min_share[vmid] = vals[0];
+        c->bu_vm_max_share[vmid] = vals[1];
+        break;
+      case CP_BU_VM_SLO:
+        if (parse_vm_values(optarg, &vmid, vals, 1) != 0 || vals[0] < 0) {
+          fprintf(stderr, "budget vm slo failed parsing\n");
+          goto failed;
+        }
+        c->bu_vm_slo_delay[vmid] = vals[0];
+        break;
+      case CP_BU_SLO_GAIN:
+        if (parse_double(optarg, &c->bu_slo_gain) != 0 ||
+            c->bu_slo_gain < 1) {
+          fprintf(stderr, "budget slo gain failed parsing\n");
+          goto failed;
+        }
+        break;
+      case CP_BU_TELEMETRY:
+        if ((mode = config_parse_telemetry(optarg)) < 0) {
+          fprintf(stderr, "budget telemetry failed parsing\n");
+          goto failed;
+        }
+        c->bu_telemetry = mode;
+        break;
       case CP_KNI_NAME:
         if (!(c->kni_name = strdup(optarg))) {
           fprintf(stderr, "strdup kni name failed\n");
@@ -618,9 +797,24 @@ failed:
   return -1;
 }
 
+int config_parse_telemetry(const char *s)
+{
+  if (!strcmp(s, "off")) {
+    return CONFIG_BU_TELEMETRY_OFF;
+  } else if (!strcmp(s, "shm")) {
+    return CONFIG_BU_TELEMETRY_SHM;
+  } else if (!strcmp(s, "print")) {
+    return CONFIG_BU_TELEMETRY_PRINT;
+  }
+  return -1;
+}
+
 static int config_defaults(struct configuration *c, char *progname)
 {
+  unsigned i;
+
   c->ip = 0;
+  c->ip_mtu = 1500;
   c->vm_shm_len = 1 * 1024 * 1024 * 1024;
   /* Set the data mem off to the end of the channel used by the proxy */
   c->data_mem_off = 0x4000;
@@ -656,19 +850,39 @@ static int config_defaults(struct configuration *c, char *progname)
   c->cc_timely_min_rtt = 11;
   c->cc_timely_min_rate = 10000;
   c->fp_cores_max = 1;
+  c->fp_flows = FLEXNIC_PL_FLOWST_NUM_DEFAULT;
   c->fp_interrupts = 1;
+  c->fp_doorbells = 1;
   c->fp_xsumoffload = 1;
   c->fp_autoscale = 1;
   c->fp_rss = 1;
   c->fp_hugepages = 1;
+  c->fp_numa = 1;
+  c->fp_qman = CONFIG_QMAN_SKIPLIST;
+  c->fp_vm_quantum = 0;
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    c->fp_vm_weights[i] = 1;
+    c->fp_vm_mbufs[i] = 0;
+  }
   c->fp_vlan_strip = 0;
   c->fp_poll_interval_tas = 10000;
   c->fp_poll_interval_app = 10000;
+  c->fp_adaptive_poll = 0;
+  c->fp_backoff_latency = 5;
+  c->fp_sleep_latency = 100;
   c->bu_max_budget = 210000;
   c->bu_update_freq = 100;
   c->bu_use_ratio = 0.9;
   c->bu_ecn_thresh = 0.1;
   c->bu_boost = 0.94;
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    c->bu_vm_weights[i] = 1;
+    c->bu_vm_min_share[i] = 0;
+    c->bu_vm_max_share[i] = 1;
+    c->bu_vm_slo_delay[i] = 0;
+  }
+  c->bu_slo_gain = 1.1;
+  c->bu_telemetry = CONFIG_BU_TELEMETRY_OFF;
   c->kni_name = NULL;
   c->ready_fd = -1;
   c->quiet = 0;
@@ -755,6 +969,8 @@ static void print_usage(struct configuration *c, char *progname)
       "IP protocol parameters:\n"
       "  --ip-route=DEST[/PREFIX],NEXTHOP  Add route\n"
       "  --ip-addr=ADDR[/PREFIXLEN]        Set local IP address\n"
+      "  --ip-mtu=MTU                      Link MTU "
+          "[default: %"PRIu32"]\n"
       "\n"
       "ARP protocol parameters:\n"
       "  --arp-timeout=TIMEOUT       ARP request timeout (us) "
@@ -765,8 +981,12 @@ static void print_usage(struct configuration *c, char *progname)
       "Fast path:\n"
       "  --fp-cores-max=CORES        Max cores used for fast path "
           "[default: %"PRIu32"]\n"
+      "  --fp-flows=FLOWS            Max number of flows "
+          "[default: %"PRIu32"]\n"
       "  --fp-no-ints                Disable Interrupts "
           "[default: enabled]\n"
+      "  --fp-no-doorbells           Wake up cores through eventfds only "
+          "[default: doorbells]\n"
       "  --fp-no-xsumoffload         Disable TX Checksum offload "
           "[default: enabled]\n"
       "  --fp-no-autoscale           Disable autoscaling "
@@ -775,10 +995,27 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: enabled]\n"
       "  --fp-no-hugepages           Disable hugepages for SHM "
           "[default: enabled]\n"
+      "  --fp-no-numa                Disable NUMA-aware placement of fast path "
+          "state [default: enabled]\n"
+      "  --fp-qman=ALGORITHM         Scheduler for rate-limited flows "
+          "[default: skiplist]\n"
+      "     Options: skiplist, wheel\n"
+      "  --fp-vm-quantum=BYTES       DRR quantum per VM turn, 0 for round "
+          "robin [default: %"PRIu32"]\n"
+      "  --fp-vm-weight=VM,WEIGHT    DRR weight for a VM "
+          "[default: 1]\n"
+      "  --fp-vm-mbufs=[VM,]NUM      Transmit buffers per VM and core, 0 "
+          "for shared [default: 0]\n"
       "  --fp-poll-interval-tas      TAS polling interval before blocking "
           "in us [default: %"PRIu32"]\n"
       "  --fp-poll-interval-app      App polling interval before blocking "
           "in us [default: %"PRIu32"]\n"
+      "  --fp-adaptive-poll          Switch between polling, back-off and "
+          "sleeping by load [default: disabled]\n"
+      "  --fp-backoff-latency=US     Max latency added by polling back-off "
+          "[default: %"PRIu32"]\n"
+      "  --fp-sleep-latency=US       Min gap between work items to sleep "
+          "[default: %"PRIu32"]\n"
       "  --dpdk-extra=ARG            Add extra DPDK argument\n"
       "\n"
       "Budget:\n"
@@ -792,6 +1029,16 @@ static void print_usage(struct configuration *c, char *progname)
           "[default: %"PRIu64"]\n"
       "  --bu-boost                  Boost for VM budget "
           "[default: %lf]\n"
+      "  --bu-vm-weight=VM,WEIGHT    Budget weight for a VM "
+          "[default: 1]\n"
+      "  --bu-vm-share=VM,MIN,MAX    Min/max fraction of budget for a VM "
+          "[default: 0,1]\n"
+      "  --bu-vm-slo=VM,DELAY        Target tx queueing delay (us) for a VM "
+          "[default: disabled]\n"
+      "  --bu-slo-gain=FACTOR        Weight increase per update on SLO miss "
+          "[default: %lf]\n"
+      "  --bu-telemetry=MODE         Budget statistics: off, shm, print "
+          "[default: off]\n"
       "\n"
       "Host kernel interface:\n"
       "  --kni-name=NAME             Network interface name to expose "
@@ -814,10 +1061,12 @@ static void print_usage(struct configuration *c, char *progname)
       c->cc_timely_step, c->cc_timely_init,
       (double) c->cc_timely_alpha / UINT32_MAX,
       (double) c->cc_timely_beta / UINT32_MAX, c->cc_timely_min_rtt,
-      c->cc_timely_min_rate, c->arp_to, c->arp_to_max,
-      c->fp_cores_max, c->fp_poll_interval_tas, c->fp_poll_interval_app,
+      c->cc_timely_min_rate, c->ip_mtu, c->arp_to, c->arp_to_max,
+      c->fp_cores_max, c->fp_flows, c->fp_vm_quantum,
+      c->fp_poll_interval_tas, c->fp_poll_interval_app,
+      c->fp_backoff_latency, c->fp_sleep_latency,
       c->bu_max_budget, c->bu_use_ratio, c->bu_ecn_thresh,
-      c->bu_update_freq, c->bu_boost);
+      c->bu_update_freq, c->bu_boost, c->bu_slo_gain);
 }
 
 static inline int parse_int64(const char *s, uint64_t *pi)
@@ -937,3 +1186,94 @@ static inline int parse_arg_append(char *s, struct configuration *c)
 
   return 0;
 }
+
+static inline int parse_vm_weight(char *s, struct configuration *c)
+{
+  char *comma;
+  uint32_t vm, weight;
+
+  /* split vm id from weight */
+  if ((comma = strchr(s, ',')) == NULL) {
+    fprintf(stderr, "parse_vm_weight: no comma found (%s)\n", s);
+    return -1;
+  }
+  *comma = 0;
+
+  if (parse_int32(s, &vm) != 0 || vm >= FLEXNIC_PL_VMST_NUM) {
+    fprintf(stderr, "parse_vm_weight: invalid vm id (%s)\n", s);
+    return -1;
+  }
+
+  if (parse_int32(comma + 1, &weight) != 0 || weight == 0) {
+    fprintf(stderr, "parse_vm_weight: invalid weight (%s)\n", comma + 1);
+    return -1;
+  }
+
+  c->fp_vm_weights[vm] = weight;
+  return 0;
+}
+
+static inline int parse_vm_mbufs(char *s, struct configuration *c)
+{
+  char *comma;
+  uint32_t vm, num;
+
+  /* without a vm id the quota applies to all vms */
+  if ((comma = strchr(s, ',')) == NULL) {
+    if (parse_int32(s, &num) != 0) {
+      fprintf(stderr, "parse_vm_mbufs: invalid buffer count (%s)\n", s);
+      return -1;
+    }
+    for (vm = 0; vm < FLEXNIC_PL_VMST_NUM; vm++) {
+      c->fp_vm_mbufs[vm] = num;
+    }
+    return 0;
+  }
+  *comma = 0;
+
+  if (parse_int32(s, &vm) != 0 || vm >= FLEXNIC_PL_VMST_NUM) {
+    fprintf(stderr, "parse_vm_mbufs: invalid vm id (%s)\n", s);
+    return -1;
+  }
+
+  if (parse_int32(comma + 1, &num) != 0) {
+    fprintf(stderr, "parse_vm_mbufs: invalid buffer count (%s)\n", comma + 1);
+    return -1;
+  }
+
+  c->fp_vm_mbufs[vm] = num;
+  return 0;
+}
+
+static inline int parse_vm_values(char *s, uint32_t *vmid, double *vals,
+    unsigned n)
+{
+  char *comma;
+  unsigned i;
+
+  /* vm id followed by n comma separated values */
+  if ((comma = strchr(s, ',')) == NULL) {
+    fprintf(stderr, "parse_vm_values: no comma found (%s)\n", s);
+    return -1;
+  }
+  *comma = 0;
+
+  if (parse_int32(s, vmid) != 0 || *vmid >= FLEXNIC_PL_VMST_NUM) {
+    fprintf(stderr, "parse_vm_values: invalid vm id (%s)\n", s);
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    s = comma + 1;
+    if ((comma = strchr(s, ',')) != NULL) {
+      *comma = 0;
+    }
+
+    if ((comma == NULL) != (i == n - 1) || parse_double(s, &vals[i]) != 0) {
+      fprintf(stderr, "parse_vm_values: invalid value (%s)\n", s);
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -137,7 +137,7 @@ void inline fast_appctx_poll_pf_all(struct dataplane_context *ctx)
 static void inline fast_appctx_poll_pf(struct dataplane_context *ctx, uint32_t cid, 
     uint16_t vmid)
 {
-  struct flextcp_pl_appctx *actx = &fp_state->appctx[ctx->id][vmid][cid];
+  struct flextcp_pl_appctx *actx = &fp_cores[ctx->id].appctx[vmid][cid];
   rte_prefetch0(dma_pointer(actx->tx_base + actx->tx_head, 1, vmid));
 }
 
@@ -211,7 +211,7 @@ int fast_appctx_poll_fetch_active(struct dataplane_context *ctx, uint16_t max,
   do {
     act_vm = &ctx->polled_vms[vmid];
 
-    if (ctx->budgets[vmid].budget > 0)
+    if (vm_budget_balance(&ctx->budgets[vmid]) > 0)
     {
       fast_appctx_poll_fetch_active_vm(ctx, act_vm, &k, max, total, 
           n_rem, rem_ctxs, aqes, true);
@@ -340,7 +340,7 @@ int fast_appctx_poll_fetch_all(struct dataplane_context *ctx, uint16_t max,
     vm_idx = ctx->poll_next_vm;
     vmid = tas_registered_vm_ids[vm_idx];
 
-    if (ctx->budgets[vmid].budget > 0)
+    if (vm_budget_balance(&ctx->budgets[vmid]) > 0)
     {
       fast_appctx_poll_fetch_all_vm(ctx, vmid, &k, max, total, aqes, true);
     } else 
@@ -370,7 +370,8 @@ int fast_appctx_poll_fetch_all(struct dataplane_context *ctx, uint16_t max,
 static int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t actx_id,
     uint16_t vm_id, void **pqe, bool spend_budget)
 {
-  struct flextcp_pl_appctx *actx = &fp_state->appctx[ctx->id][vm_id][actx_id];
+  struct flextcp_pl_appctx *actx =
+      &fp_cores[ctx->id].appctx[vm_id][actx_id];
   struct flextcp_pl_atx *atx;
   uint8_t type;
   uint32_t flow_id  = -1;
@@ -396,14 +397,15 @@ static int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t actx_i
 
   /* update RX/TX queue pointers for connection */
   flow_id = atx->msg.connupdate.flow_id;
-  if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
+  if (flow_id >= fp_flowst_num) {
     fprintf(stderr, "fast_appctx_poll: invalid flow id=%u\n", flow_id);
     abort();
   }
 
-  void *fs = &fp_state->flowst[flow_id];
-  rte_prefetch0(fs);
-  rte_prefetch0(fs + 64);
+  void *fs = &fp_flowst[flow_id];
+  rte_prefetch0(fs + FLEXNIC_PL_FLOWST_HOT_OFF);
+  rte_prefetch0(fs + FLEXNIC_PL_FLOWST_COLD_OFF);
+  rte_prefetch0(fs + FLEXNIC_PL_FLOWST_STATS_OFF);
  
   actx->tx_head += sizeof(*atx);
   if (actx->tx_head >= actx->tx_len)
@@ -412,11 +414,9 @@ static int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t actx_i
   if (spend_budget) {
     ctx->vm_counters[vm_id] += atx->msg.connupdate.tx_bump;
     ctx->counters_total += atx->msg.connupdate.tx_bump;
-#ifdef BUDGET_DEBUG_STATS
-  } else {
-    ctx->budget_debug_work_conserving_vm[vm_id] += atx->msg.connupdate.tx_bump;
-    ctx->budget_debug_work_conserving_total += atx->msg.connupdate.tx_bump;
-#endif
+  } else if (UNLIKELY(config.bu_telemetry)) {
+    ctx->wc_counters[vm_id] += atx->msg.connupdate.tx_bump;
+    ctx->wc_counters_total += atx->msg.connupdate.tx_bump;
   }
 
   return 0;
@@ -477,7 +477,7 @@ int fast_actx_rxq_alloc(struct dataplane_context *ctx,
 static int fast_actx_rxq_probe(struct dataplane_context *ctx, uint32_t cid,
     uint16_t vmid)
 {
-  struct flextcp_pl_appctx *actx = &fp_state->appctx[ctx->id][vmid][cid];
+  struct flextcp_pl_appctx *actx = &fp_cores[ctx->id].appctx[vmid][cid];
   struct flextcp_pl_arx *parx;
   uint32_t pos, i;
 
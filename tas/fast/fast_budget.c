@@ -0,0 +1,139 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <tas.h>
+#include <tas_memif.h>
+
+#include "internal.h"
+#include "fastemu.h"
+
+/** Fraction bits of the per-VM share of a phase */
+#define BUDGET_SHARE_SHIFT 16
+
+/* Split cycles between the registered VMs in proportion to counters and add
+ * each VM's part to its consumed (or, with wc set, wc_consumed) counter.
+ * Counters are reset. The rounding remainder goes to the charged VMs in turn
+ * so no cycles are lost and no VM pays for it every time. */
+static inline void budget_apportion(struct dataplane_context *ctx,
+    int *counters, uint32_t total, uint64_t cycles, uint16_t vm_count,
+    int wc)
+{
+  int vmid;
+  uint16_t vm_idx, charged_num = 0;
+  uint8_t charged[FLEXNIC_PL_VMST_NUM];
+  uint32_t counter;
+  uint64_t inv, share, vm_cycles, rest = cycles;
+#ifndef NDEBUG
+  uint32_t counters_sum = 0;
+#endif
+
+  /* counter / total as 32.32 fixed point is counter * inv, at most 2^32 */
+  inv = (UINT64_C(1) << 32) / total;
+  for (vm_idx = 0; vm_idx < vm_count; vm_idx++)
+  {
+    vmid = tas_registered_vm_ids[vm_idx];
+    counter = counters[vmid];
+    if (counter == 0)
+      continue;
+
+#ifndef NDEBUG
+    counters_sum += counter;
+#endif
+    share = (counter * inv) >> (32 - BUDGET_SHARE_SHIFT);
+    vm_cycles = (cycles * share) >> BUDGET_SHARE_SHIFT;
+    if (vm_cycles > rest)
+      vm_cycles = rest;
+    rest -= vm_cycles;
+
+    if (wc)
+      ctx->budgets[vmid].wc_consumed += vm_cycles;
+    else
+      ctx->budgets[vmid].consumed += vm_cycles;
+    counters[vmid] = 0;
+    charged[charged_num++] = vmid;
+  }
+
+  if (charged_num > 0 && rest > 0)
+  {
+    vmid = charged[ctx->budget_rest_next++ % charged_num];
+    if (wc)
+      ctx->budgets[vmid].wc_consumed += rest;
+    else
+      ctx->budgets[vmid].consumed += rest;
+  }
+
+  assert(counters_sum == total);
+}
+
+static void budget_counters_clear(int *counters, int *total)
+{
+  int vmid;
+
+  for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++)
+  {
+    counters[vmid] = 0;
+  }
+  *total = 0;
+}
+
+/* Charge the cycles of one loop phase to the VMs that had work in it, in
+ * proportion to the phase counters. Only this core writes the consumed
+ * counters, the slow path derives balances from snapshots of them. Cycles of
+ * phases where only VMs without budget had work are tracked separately for
+ * telemetry. */
+void fast_budget_spend(struct dataplane_context *ctx, uint64_t cycles)
+{
+  uint16_t vm_count;
+
+  if (ctx->counters_total == 0 && ctx->wc_counters_total == 0)
+    return;
+
+  vm_count = tas_registered_vm_count_get();
+  if (vm_count == 0)
+  {
+    budget_counters_clear(ctx->vm_counters, &ctx->counters_total);
+    budget_counters_clear(ctx->wc_counters, &ctx->wc_counters_total);
+    return;
+  }
+
+  if (ctx->counters_total != 0)
+  {
+    budget_apportion(ctx, ctx->vm_counters, ctx->counters_total, cycles,
+        vm_count, 0);
+    ctx->counters_total = 0;
+
+    /* budgeted work pays for the whole phase */
+    if (ctx->wc_counters_total != 0)
+      budget_counters_clear(ctx->wc_counters, &ctx->wc_counters_total);
+  }
+  else
+  {
+    budget_apportion(ctx, ctx->wc_counters, ctx->wc_counters_total, cycles,
+        vm_count, 1);
+    ctx->wc_counters_total = 0;
+  }
+}
@@ -35,7 +35,6 @@
 #include "fastemu.h"
 #include "tcp_common.h"
 
-#define TCP_MSS 1400
 #define TCP_MAX_RTT 100000
 
 // #define PL_DEBUG_ARX
@@ -97,6 +96,7 @@ static void flow_tx_ack_gre(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, struct tcp_timestamp_opt *ts_opt,
     int oob);
 static void flow_reset_retransmit(struct flextcp_pl_flowst *fs);
+static inline void flow_stats_tx(struct flextcp_pl_flowst *fs);
 
 static inline void tcp_checksums(struct network_buf_handle *nbh,
     struct pkt_tcp *p, beui32_t ip_s, beui32_t ip_d, uint16_t l3_paylen);
@@ -109,7 +109,9 @@ void fast_flows_qman_pf(struct dataplane_context *ctx, uint32_t *queues,
   uint16_t i;
 
   for (i = 0; i < n; i++) {
-    rte_prefetch0(&fp_state->flowst[queues[i]]);
+    rte_prefetch0(&fp_flowst[queues[i]]);
+    rte_prefetch0((uint8_t *) &fp_flowst[queues[i]] +
+        FLEXNIC_PL_FLOWST_COLD_OFF);
   }
 }
 
@@ -121,7 +123,7 @@ void fast_flows_qman_pfbufs(struct dataplane_context *ctx, uint32_t *queues,
   void *p;
 
   for (i = 0; i < n; i++) {
-    fs = &fp_state->flowst[queues[i]];
+    fs = &fp_flowst[queues[i]];
     p = dma_pointer(fs->tx_base + fs->tx_next_pos, 1, fs->vm_id);
     rte_prefetch0(p);
     rte_prefetch0(p + 64);
@@ -133,7 +135,7 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t vm_id, uint32_t queu
     struct network_buf_handle *nbh, uint32_t ts)
 {
   uint32_t flow_id = queue;
-  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+  struct flextcp_pl_flowst *fs = &fp_flowst[flow_id];
   uint32_t avail, len, tx_pos, tx_seq, ack, rx_wnd;
   uint16_t new_core;
   uint8_t fin;
@@ -199,7 +201,7 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t vm_id, uint32_t queu
     ret = -1;
     goto unlock;
   }
-  len = TAS_MIN(avail, TCP_MSS);
+  len = TAS_MIN(avail, fs->tx_mss);
 
   /* state snapshot for creating segment */
   tx_seq = fs->tx_next_seq;
@@ -215,6 +217,7 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t vm_id, uint32_t queu
   }
   fs->tx_sent += len;
   fs->tx_avail -= len;
+  flow_stats_tx(fs);
 
   fin = (fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) == FLEXNIC_PL_FLOWST_TXFIN &&
     !fs->tx_avail;
@@ -244,7 +247,7 @@ int fast_flows_qman_fwd(struct dataplane_context *ctx,
     struct flextcp_pl_flowst *fs)
 {
   unsigned avail;
-  uint16_t flow_id = fs - fp_state->flowst;
+  uint32_t flow_id = fs - fp_flowst;
   uint16_t vm_id = fs->vm_id;
 
   /*fprintf(stderr, "fast_flows_qman_fwd: fs=%p\n", fs);*/
@@ -254,7 +257,7 @@ int fast_flows_qman_fwd(struct dataplane_context *ctx,
   avail = tcp_txavail(fs, NULL);
 
   /* re-arm queue manager */
-  if (tas_qman_set(&ctx->qman, vm_id, flow_id, fs->tx_rate, avail, TCP_MSS,
+  if (tas_qman_set(&ctx->qman, vm_id, flow_id, fs->tx_rate, avail, fs->tx_mss,
         QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
   {
     fprintf(stderr, "fast_flows_qman_fwd: qman_set failed, UNEXPECTED\n");
@@ -361,7 +364,7 @@ int fast_flows_packet(struct dataplane_context *ctx,
   uint32_t rx_bump = 0, tx_bump = 0, rx_pos, rtt;
   int no_permanent_sp = 0;
   uint16_t tcp_extra_hlen, trim_start, trim_end;
-  uint16_t flow_id = fs - fp_state->flowst;
+  uint32_t flow_id = fs - fp_flowst;
   int trigger_ack = 0, fin_bump = 0;
 
   tcp_extra_hlen = (TCPH_HDRLEN(&p->tcp) - 5) * 4;
@@ -381,14 +384,12 @@ int fast_flows_packet(struct dataplane_context *ctx,
   if (spend_budget) {
     ctx->vm_counters[fs->vm_id] += payload_bytes;
     ctx->counters_total += payload_bytes;
-#ifdef BUDGET_DEBUG_STATS
-  } else {
-    ctx->budget_debug_work_conserving_vm[fs->vm_id] += payload_bytes;
-    ctx->budget_debug_work_conserving_total += payload_bytes;
-#endif
+  } else if (UNLIKELY(config.bu_telemetry)) {
+    ctx->wc_counters[fs->vm_id] += payload_bytes;
+    ctx->wc_counters_total += payload_bytes;
   }
 
-  if (spend_budget && ctx->budgets[fs->vm_id].budget <= 0) {
+  if (spend_budget && vm_budget_balance(&ctx->budgets[fs->vm_id]) <= 0) {
     return 0;
   }
 
@@ -492,6 +493,7 @@ int fast_flows_packet(struct dataplane_context *ctx,
       abort();
 #endif
     }
+    flow_stats_tx(fs);
 
     /* duplicate ack */
     if (UNLIKELY(tx_bump != 0)) {
@@ -587,7 +589,7 @@ int fast_flows_packet(struct dataplane_context *ctx,
     }
   }
 
-  fs->rx_remote_avail = f_beui16(p->tcp.wnd);
+  fs->rx_remote_avail = (uint32_t) f_beui16(p->tcp.wnd) << fs->tx_wscale;
 
   /* make sure we don't receive anymore payload after FIN */
   if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN) == FLEXNIC_PL_FLOWST_RXFIN &&
@@ -708,7 +710,7 @@ unlock:
   if (new_avail > old_avail) {
     /* update qman queue */
     if (tas_qman_set(&ctx->qman, fs->vm_id, flow_id, fs->tx_rate, new_avail,
-        TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
+        fs->tx_mss, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
     {
       fprintf(stderr, "fast_flows_packet: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -747,7 +749,7 @@ int fast_flows_packet_gre(struct dataplane_context *ctx,
   uint32_t rx_bump = 0, tx_bump = 0, rx_pos, rtt;
   int no_permanent_sp = 0;
   uint16_t tcp_extra_hlen, trim_start, trim_end;
-  uint16_t flow_id = fs - fp_state->flowst;
+  uint32_t flow_id = fs - fp_flowst;
   int trigger_ack = 0, fin_bump = 0;
 
   tcp_extra_hlen = (TCPH_HDRLEN(&p->tcp) - 5) * 4;
@@ -767,14 +769,12 @@ int fast_flows_packet_gre(struct dataplane_context *ctx,
   if (spend_budget) {
     ctx->vm_counters[fs->vm_id] += payload_bytes;
     ctx->counters_total += payload_bytes;
-#ifdef BUDGET_DEBUG_STATS
-  } else {
-    ctx->budget_debug_work_conserving_vm[fs->vm_id] += payload_bytes;
-    ctx->budget_debug_work_conserving_total += payload_bytes;
-#endif
+  } else if (UNLIKELY(config.bu_telemetry)) {
+    ctx->wc_counters[fs->vm_id] += payload_bytes;
+    ctx->wc_counters_total += payload_bytes;
   }
 
-  if (spend_budget && ctx->budgets[fs->vm_id].budget <= 0) {
+  if (spend_budget && vm_budget_balance(&ctx->budgets[fs->vm_id]) <= 0) {
     return 0;
   }
 
@@ -882,6 +882,7 @@ int fast_flows_packet_gre(struct dataplane_context *ctx,
       abort();
 #endif
     }
+    flow_stats_tx(fs);
 
     /* duplicate ack */
     if (UNLIKELY(tx_bump != 0)) {
@@ -977,7 +978,7 @@ int fast_flows_packet_gre(struct dataplane_context *ctx,
     }
   }
 
-  fs->rx_remote_avail = f_beui16(p->tcp.wnd);
+  fs->rx_remote_avail = (uint32_t) f_beui16(p->tcp.wnd) << fs->tx_wscale;
 
   /* make sure we don't receive anymore payload after FIN */
   if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN) == FLEXNIC_PL_FLOWST_RXFIN &&
@@ -1101,7 +1102,7 @@ unlock:
   if (new_avail > old_avail) {
     /* update qman queue */
     if (tas_qman_set(&ctx->qman, fs->vm_id, flow_id, fs->tx_rate, new_avail,
-        TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
+        fs->tx_mss, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
     {
       fprintf(stderr, "fast_flows_packet_gre: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -1132,7 +1133,7 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
     uint16_t bump_seq, uint32_t rx_bump, uint32_t tx_bump, uint8_t flags,
     struct network_buf_handle *nbh, uint32_t ts)
 {
-  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+  struct flextcp_pl_flowst *fs = &fp_flowst[flow_id];
   uint32_t rx_avail_prev, old_avail, new_avail, tx_avail;
   int ret = -1;
 
@@ -1224,7 +1225,7 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
   /* update queue manager queue */
   if (old_avail < new_avail) {
     if (tas_qman_set(&ctx->qman, fs->vm_id, flow_id, fs->tx_rate, new_avail,
-        TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
+        fs->tx_mss, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -1233,6 +1234,7 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
 
   /* update flow state */
   fs->tx_avail = tx_avail;
+  flow_stats_tx(fs);
   rx_avail_prev = fs->rx_avail;
   fs->rx_avail += rx_bump;
 
@@ -1258,7 +1260,7 @@ unlock:
 void fast_flows_winretransmit(struct dataplane_context *ctx, uint32_t flow_id,
     struct network_buf_handle *nbh, uint32_t ts)
 {
-  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+  struct flextcp_pl_flowst *fs = &fp_flowst[flow_id];
 
   fs_lock(fs);
   ctx->counters_total += 1;
@@ -1277,7 +1279,7 @@ void fast_flows_winretransmit(struct dataplane_context *ctx, uint32_t flow_id,
 /* start retransmitting */
 void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
 {
-  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+  struct flextcp_pl_flowst *fs = &fp_flowst[flow_id];
   uint32_t old_avail, new_avail = -1;
 
   fs_lock(fs);
@@ -1327,7 +1329,7 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   /* update queue manager */
   if (new_avail > old_avail) {
     if (tas_qman_set(&ctx->qman, fs->vm_id, flow_id, fs->tx_rate, new_avail,
-          TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
+          fs->tx_mss, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -1391,7 +1393,7 @@ static inline int flow_should_signal_ece(struct dataplane_context *ctx,
   }
 
   double threshold = (double) config.bu_max_budget * config.bu_ecn_thresh;
-  return (double) ctx->budgets[vm_id].budget < threshold;
+  return (double) vm_budget_balance(&ctx->budgets[vm_id]) < threshold;
 }
 
 #if VIRTUOSO_GRE == 0
@@ -1442,7 +1444,7 @@ static void flow_tx_segment(struct dataplane_context *ctx,
   p->tcp.seqno = t_beui32(seq);
   p->tcp.ackno = t_beui32(ack);
   TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, flags);
-  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd));
+  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd >> fs->rx_wscale));
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
@@ -1548,7 +1550,7 @@ static void flow_tx_segment_gre(struct dataplane_context *ctx,
   p->tcp.seqno = t_beui32(seq);
   p->tcp.ackno = t_beui32(ack);
   TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, flags);
-  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd));
+  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd >> fs->rx_wscale));
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
@@ -1622,7 +1624,7 @@ static void flow_tx_ack(struct dataplane_context *ctx,
   port = p->tcp.src;
   p->tcp.src = p->tcp.dest;
   p->tcp.dest = port;
-  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd));
+  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd >> fs->rx_wscale));
 
   hdrlen = sizeof(*p) + (TCPH_HDRLEN(&p->tcp) - 5) * 4;
   mark_ece = ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_ECN) == FLEXNIC_PL_FLOWST_ECN) &&
@@ -1711,7 +1713,7 @@ static void flow_tx_ack_gre(struct dataplane_context *ctx,
   port = p->tcp.src;
   p->tcp.src = p->tcp.dest;
   p->tcp.dest = port;
-  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd));
+  p->tcp.wnd = t_beui16(TAS_MIN(0xFFFF, rxwnd >> fs->rx_wscale));
 
   hdrlen = sizeof(*p) + (TCPH_HDRLEN(&p->tcp) - 5) * 4;
   mark_ece = ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_ECN) == FLEXNIC_PL_FLOWST_ECN) &&
@@ -1783,6 +1785,7 @@ static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
   }
   fs->tx_avail += fs->tx_sent;
   fs->tx_sent = 0;
+  flow_stats_tx(fs);
 
   /* cut rate by half if first drop in control interval */
   if (fs->cnt_tx_drops == 0) {
@@ -1792,6 +1795,15 @@ static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
   fs->cnt_tx_drops++;
 }
 
+/* Mirror tx state into the stats line, so the slow path can poll it without
+ * pulling the hot line away from the fast path. */
+static inline void flow_stats_tx(struct flextcp_pl_flowst *fs)
+{
+  fs->st_tx_sent = fs->tx_sent;
+  fs->st_tx_next_seq = fs->tx_next_seq;
+  fs->st_tx_avail = fs->tx_avail;
+}
+
 static inline void tcp_checksums(struct network_buf_handle *nbh,
     struct pkt_tcp *p, beui32_t ip_s, beui32_t ip_d, uint16_t l3_paylen)
 {
@@ -1871,8 +1883,8 @@ void fast_flows_packet_fss(struct dataplane_context *ctx,
     key.remote_port = p->tcp.src;
     h = flow_hash(&key);
 
-    rte_prefetch0(&fp_state->flowht[h % FLEXNIC_PL_FLOWHT_ENTRIES]);
-    rte_prefetch0(&fp_state->flowht[(h + 3) % FLEXNIC_PL_FLOWHT_ENTRIES]);
+    rte_prefetch0(&fp_flowht[h & fp_flowht_mask]);
+    rte_prefetch0(&fp_flowht[(h + 3) & fp_flowht_mask]);
     hashes[i] = h;
   }
 
@@ -1881,8 +1893,8 @@ void fast_flows_packet_fss(struct dataplane_context *ctx,
   for (i = 0; i < n; i++) {
     h = hashes[i];
     for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
+      k = (h + j) & fp_flowht_mask;
+      e = &fp_flowht[k];
 
       ffid = e->flow_id;
       MEM_BARRIER();
@@ -1893,7 +1905,8 @@ void fast_flows_packet_fss(struct dataplane_context *ctx,
         continue;
       }
 
-      rte_prefetch0(&fp_state->flowst[fid]);
+      rte_prefetch0((uint8_t *) &fp_flowst[fid] +
+          FLEXNIC_PL_FLOWST_COLD_OFF);
     }
   }
 
@@ -1904,8 +1917,8 @@ void fast_flows_packet_fss(struct dataplane_context *ctx,
     h = hashes[i];
 
     for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
+      k = (h + j) & fp_flowht_mask;
+      e = &fp_flowht[k];
 
       ffid = e->flow_id;
       MEM_BARRIER();
@@ -1917,14 +1930,15 @@ void fast_flows_packet_fss(struct dataplane_context *ctx,
       }
 
       MEM_BARRIER();
-      fs = &fp_state->flowst[fid];
+      fs = &fp_flowst[fid];
       if ((fs->out_local_ip.x == p->ip.dest.x) &
           (fs->out_remote_ip.x == p->ip.src.x) &
           (fs->local_port.x == p->tcp.dest.x) &
           (fs->remote_port.x == p->tcp.src.x))
       {
-        rte_prefetch0((uint8_t *) fs + 64);
-        fss[i] = &fp_state->flowst[fid];
+        rte_prefetch0((uint8_t *) fs + FLEXNIC_PL_FLOWST_HOT_OFF);
+        rte_prefetch0((uint8_t *) fs + FLEXNIC_PL_FLOWST_STATS_OFF);
+        fss[i] = &fp_flowst[fid];
         break;
       }
     }
@@ -1951,8 +1965,8 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
     key.remote_port = p->tcp.src;
     h = flow_hash_gre(&key);
 
-    rte_prefetch0(&fp_state->flowht[h % FLEXNIC_PL_FLOWHT_ENTRIES]);
-    rte_prefetch0(&fp_state->flowht[(h + 3) % FLEXNIC_PL_FLOWHT_ENTRIES]);
+    rte_prefetch0(&fp_flowht[h & fp_flowht_mask]);
+    rte_prefetch0(&fp_flowht[(h + 3) & fp_flowht_mask]);
     hashes[i] = h;
   }
 
@@ -1962,8 +1976,8 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
     h = hashes[i];
 
     for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
+      k = (h + j) & fp_flowht_mask;
+      e = &fp_flowht[k];
 
       ffid = e->flow_id;
       MEM_BARRIER();
@@ -1974,7 +1988,8 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
         continue;
       }
 
-      rte_prefetch0(&fp_state->flowst[fid]);
+      rte_prefetch0((uint8_t *) &fp_flowst[fid] +
+          FLEXNIC_PL_FLOWST_COLD_OFF);
     }
   }
 
@@ -1985,8 +2000,8 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
     h = hashes[i];
 
     for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
+      k = (h + j) & fp_flowht_mask;
+      e = &fp_flowht[k];
 
       ffid = e->flow_id;
       MEM_BARRIER();
@@ -1998,7 +2013,7 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
       }
 
       MEM_BARRIER();
-      fs = &fp_state->flowst[fid];
+      fs = &fp_flowst[fid];
       if ((fs->out_local_ip.x == p->out_ip.dest.x) &
           (fs->out_remote_ip.x == p->out_ip.src.x) &
           (fs->in_local_ip.x == p->in_ip.dest.x) &
@@ -2007,8 +2022,9 @@ void fast_flows_packet_fss_gre(struct dataplane_context *ctx,
           (fs->local_port.x == p->tcp.dest.x) &
           (fs->remote_port.x == p->tcp.src.x))
       {
-        rte_prefetch0((uint8_t *) fs + 64);
-        fss[i] = &fp_state->flowst[fid];
+        rte_prefetch0((uint8_t *) fs + FLEXNIC_PL_FLOWST_HOT_OFF);
+        rte_prefetch0((uint8_t *) fs + FLEXNIC_PL_FLOWST_STATS_OFF);
+        fss[i] = &fp_flowst[fid];
         break;
       }
     }
@@ -48,7 +48,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
   uint32_t flow_id, len;
   int ret = -1;
 
-  kctx = &fp_state->kctx[ctx->id];
+  kctx = &fp_cores[ctx->id].kctx;
 
 
   /* stop if context is not in use */
@@ -85,7 +85,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
     tx_send(ctx, nbh, 0, len);
   } else if (ktx->type == FLEXTCP_PL_KTX_CONNRETRAN) {
     flow_id = ktx->msg.connretran.flow_id;
-    if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
+    if (flow_id >= fp_flowst_num) {
       fprintf(stderr, "fast_kernel_qman: invalid flow id=%u\n", flow_id);
       abort();
     }
@@ -94,7 +94,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
     ret = 1;
   } else if (ktx->type == FLEXTCP_PL_KTX_WINRETRAN) {
       flow_id = ktx->msg.connretran.flow_id;
-    if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
+    if (flow_id >= fp_flowst_num) {
       fprintf(stderr, "fast_kernel_qman: invalid flow id=%u\n", flow_id);
       abort();
     }
@@ -119,7 +119,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
 void fast_kernel_packet(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, void *fsp)
 {
-  struct flextcp_pl_appctx *kctx = &fp_state->kctx[ctx->id];
+  struct flextcp_pl_appctx *kctx = &fp_cores[ctx->id].kctx;
   struct flextcp_pl_krx *krx;
   uint16_t len;
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+
+#include <tas.h>
+#include <tas_memif.h>
+
+#include "internal.h"
+#include "fastemu.h"
+
+/* Adaptive polling: each core measures how much work (received packets,
+ * scheduled segments, queue entries) it finds per POLLMODE_WINDOW_US and
+ * derives the expected gap between work items. Dense work is busy polled,
+ * sparser work is polled with an exponential pause back-off bounded by the
+ * back-off latency target, and only work sparser than the sleep latency
+ * target lets the core block on interrupts. The average rises quickly and
+ * decays slowly, so bursts switch back to polling right away while sleeping
+ * needs a sustained quiet period. Going back towards polling also requires
+ * the gap to drop to half the threshold, to avoid flapping at the edges. */
+
+void fast_pollmode_init(struct dataplane_pollmode *pm, uint64_t tsc,
+    uint64_t window_cycles, uint64_t backoff_max, uint64_t sleep_gap)
+{
+  pm->window_cycles = (window_cycles > 0 ? window_cycles : 1);
+  pm->backoff_max = backoff_max;
+  pm->sleep_gap = sleep_gap;
+  pm->win_start = tsc;
+  pm->win_work = 0;
+  pm->rate = 0;
+  pm->backoff = 0;
+  pm->mode = POLLMODE_SLEEP;
+}
+
+static uint8_t pollmode_target(struct dataplane_pollmode *pm, uint64_t gap)
+{
+  uint64_t busy_th = pm->backoff_max, sleep_th = pm->sleep_gap;
+
+  if (pm->mode >= POLLMODE_BACKOFF)
+    busy_th /= 2;
+  if (pm->mode == POLLMODE_SLEEP)
+    sleep_th /= 2;
+
+  if (gap < busy_th)
+    return POLLMODE_BUSY;
+  else if (gap <= sleep_th)
+    return POLLMODE_BACKOFF;
+  else
+    return POLLMODE_SLEEP;
+}
+
+void fast_pollmode_update(struct dataplane_pollmode *pm, unsigned work,
+    uint64_t tsc)
+{
+  uint64_t elapsed, sample, gap;
+
+  pm->win_work += work;
+  elapsed = tsc - pm->win_start;
+  if (elapsed < pm->window_cycles)
+    return;
+
+  /* windows stretched by sleeping or long iterations count proportionally */
+  sample = (pm->win_work << POLLMODE_RATE_SHIFT) * pm->window_cycles /
+    elapsed;
+  if (sample > pm->rate)
+    pm->rate += (sample - pm->rate + 1) / 2;
+  else
+    pm->rate -= (pm->rate - sample + 7) / 8;
+
+  pm->win_start = tsc;
+  pm->win_work = 0;
+
+  gap = (pm->rate == 0 ? UINT64_MAX :
+      (pm->window_cycles << POLLMODE_RATE_SHIFT) / pm->rate);
+  pm->mode = pollmode_target(pm, gap);
+}
+
+uint64_t fast_pollmode_backoff(struct dataplane_pollmode *pm, int idle)
+{
+  if (!idle || pm->mode == POLLMODE_BUSY) {
+    pm->backoff = 0;
+    return 0;
+  }
+
+  if (pm->backoff == 0)
+    pm->backoff = POLLMODE_BACKOFF_MIN;
+  else
+    pm->backoff *= 2;
+
+  if (pm->backoff > pm->backoff_max)
+    pm->backoff = pm->backoff_max;
+
+  return pm->backoff;
+}
@@ -30,6 +30,7 @@
 #include <rte_config.h>
 #include <rte_malloc.h>
 #include <rte_cycles.h>
+#include <rte_pause.h>
 
 #include <tas.h>
 #include <tas_memif.h>
@@ -80,6 +81,7 @@
 #endif
 
 static void dataplane_block(struct dataplane_context *ctx, uint32_t ts);
+static void dataplane_backoff(struct dataplane_context *ctx, int idle);
 static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
                         uint64_t tsc) __attribute__((noinline));
 static unsigned poll_queues(struct dataplane_context *ctx, uint32_t ts) __attribute__((noinline));
@@ -101,22 +103,10 @@ static inline void tx_flush(struct dataplane_context *ctx);
 static inline void tx_send(struct dataplane_context *ctx,
                            struct network_buf_handle *nbh, uint16_t off, uint16_t len);
 
-static void spend_budget(struct dataplane_context *ctx, 
-    uint64_t cycles);
-
 static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc) __attribute__((noinline));
 
 int dataplane_init(void)
 {
-  if (FLEXNIC_INTERNAL_MEM_SIZE < sizeof(struct flextcp_pl_mem))
-  {
-    fprintf(stderr, "dataplane_init: internal flexnic memory size not "
-                    "sufficient (got %x, need %zx)\n",
-            FLEXNIC_INTERNAL_MEM_SIZE,
-            sizeof(struct flextcp_pl_mem));
-    return -1;
-  }
-
   if (fp_cores_max > FLEXNIC_PL_APPST_CTX_MCS)
   {
     fprintf(stderr, "dataplane_init: more cores than FLEXNIC_PL_APPST_CTX_MCS "
@@ -124,13 +114,6 @@ int dataplane_init(void)
             FLEXNIC_PL_APPST_CTX_MCS);
     return -1;
   }
-  if (FLEXNIC_PL_FLOWST_NUM > FLEXNIC_NUM_QMQUEUES)
-  {
-    fprintf(stderr, "dataplane_init: more flow states than queue manager queues"
-                    "(%u > %u)\n",
-            FLEXNIC_PL_FLOWST_NUM, FLEXNIC_NUM_QMQUEUES);
-    return -1;
-  }
 
   return 0;
 }
@@ -138,13 +121,16 @@ int dataplane_init(void)
 int dataplane_context_init(struct dataplane_context *ctx)
 {
   int i, j;
+  uint64_t hz_us;
   char name[32];
   struct polled_vm *p_vm;
   struct polled_context *p_ctx;
 
+  ctx->numa_node = rte_socket_id();
+
   /* initialize forwarding queue */
   sprintf(name, "qman_fwd_ring_%u", ctx->id);
-  if ((ctx->qman_fwd_ring = rte_ring_create(name, 32 * 1024, rte_socket_id(),
+  if ((ctx->qman_fwd_ring = rte_ring_create(name, 32 * 1024, ctx->numa_node,
                                             RING_F_SC_DEQ)) == NULL)
   {
     fprintf(stderr, "initializing rte_ring_create\n");
@@ -164,14 +150,22 @@ int dataplane_context_init(struct dataplane_context *ctx)
     return -1;
   }
 
+  hz_us = rte_get_tsc_hz() / 1000000;
+  fast_pollmode_init(&ctx->pollmode, rte_get_tsc_cycles(),
+      POLLMODE_WINDOW_US * hz_us, config.fp_backoff_latency * hz_us,
+      config.fp_sleep_latency * hz_us);
+
   for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++)
   {
     /* Initialize budget for each VM */
     ctx->budgets[i].vmid = i;
-    ctx->budgets[i].budget = config.bu_max_budget;
+    ctx->budgets[i].granted = config.bu_max_budget;
+    ctx->budgets[i].consumed = 0;
+    ctx->budgets[i].wc_consumed = 0;
 
     /* Set phase counters to 0 */
     ctx->vm_counters[i] = 0;
+    ctx->wc_counters[i] = 0;
     
     /* Initialized polled apps and polled vms*/
     p_vm = &ctx->polled_vms[i];
@@ -184,6 +178,7 @@ int dataplane_context_init(struct dataplane_context *ctx)
   }
   
   ctx->counters_total = 0;
+  ctx->wc_counters_total = 0;
   ctx->poll_rounds = 0;
   ctx->poll_next_vm = 0;
   ctx->act_head = IDXLIST_INVAL;
@@ -195,7 +190,7 @@ int dataplane_context_init(struct dataplane_context *ctx)
   int r = rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, ctx->evfd, &ctx->ev);
   assert(r == 0);
 
-  fp_state->kctx[ctx->id].evfd = ctx->evfd;
+  fp_cores[ctx->id].kctx.evfd = ctx->evfd;
 
   return 0;
 }
@@ -230,9 +225,10 @@ void dataplane_loop(struct dataplane_context *ctx)
   struct notify_blockstate nbs;
   uint32_t ts;
   uint64_t cyc, prev_cyc, s_cycs, e_cycs;
-  int was_idle = 1;
+  int was_idle = 1, can_sleep = 1;
 
-  notify_canblock_reset(&nbs);
+  notify_canblock_init(&nbs,
+      config.fp_doorbells ? &tas_doorbells->fp[ctx->id] : NULL);
   while (!exited)
   {
     unsigned n = 0;
@@ -250,7 +246,7 @@ void dataplane_loop(struct dataplane_context *ctx)
     s_cycs = util_rdtsc();
     n += poll_rx(ctx, ts, cyc);
     e_cycs = util_rdtsc();
-    spend_budget(ctx, e_cycs - s_cycs);
+    fast_budget_spend(ctx, e_cycs - s_cycs);
 
     STATS_TS(rx);
     tx_flush(ctx);
@@ -262,7 +258,7 @@ void dataplane_loop(struct dataplane_context *ctx)
     s_cycs = util_rdtsc();
     n += poll_qman(ctx, ts);
     e_cycs = util_rdtsc();
-    spend_budget(ctx, e_cycs - s_cycs);
+    fast_budget_spend(ctx, e_cycs - s_cycs);
    
     STATS_TS(qm);
     STATS_TSADD(ctx, cyc_qm, qm - rx);
@@ -270,7 +266,7 @@ void dataplane_loop(struct dataplane_context *ctx)
     s_cycs = util_rdtsc();
     n += poll_queues(ctx, ts);
     e_cycs = util_rdtsc();
-    spend_budget(ctx, e_cycs - s_cycs);
+    fast_budget_spend(ctx, e_cycs - s_cycs);
   
     STATS_TS(qs);
     STATS_TSADD(ctx, cyc_qs, qs - qm);
@@ -278,7 +274,7 @@ void dataplane_loop(struct dataplane_context *ctx)
     s_cycs = util_rdtsc();
     n += poll_kernel(ctx, ts);
     e_cycs = util_rdtsc();
-    spend_budget(ctx, e_cycs - s_cycs);
+    fast_budget_spend(ctx, e_cycs - s_cycs);
 
     /* flush transmit buffer */
     tx_flush(ctx);
@@ -287,7 +283,15 @@ void dataplane_loop(struct dataplane_context *ctx)
       poll_scale(ctx);
 
     was_idle = (n == 0);
-    if (config.fp_interrupts && notify_canblock(&nbs, !was_idle, cyc))
+    if (config.fp_adaptive_poll)
+    {
+      fast_pollmode_update(&ctx->pollmode, n, cyc);
+      dataplane_backoff(ctx, was_idle);
+      can_sleep = (ctx->pollmode.mode == POLLMODE_SLEEP);
+    }
+
+    if (config.fp_interrupts &&
+        notify_canblock(&nbs, !was_idle || !can_sleep, cyc))
     {
       dataplane_block(ctx, ts);
       notify_canblock_reset(&nbs);
@@ -295,6 +299,20 @@ void dataplane_loop(struct dataplane_context *ctx)
   }
 }
 
+/* pause on idle iterations, as long as the polling mode asks for it */
+static void dataplane_backoff(struct dataplane_context *ctx, int idle)
+{
+  uint64_t pause, end;
+
+  pause = fast_pollmode_backoff(&ctx->pollmode, idle);
+  if (pause == 0)
+    return;
+
+  end = rte_get_tsc_cycles() + pause;
+  while (rte_get_tsc_cycles() < end)
+    rte_pause();
+}
+
 static void dataplane_block(struct dataplane_context *ctx, uint32_t ts)
 {
   uint32_t max_timeout;
@@ -351,7 +369,8 @@ void dataplane_dump_stats(void)
                     "qm=(%" PRIu64 ",%" PRIu64 ",%" PRIu64 ")  "
                     "rx=(%" PRIu64 ",%" PRIu64 ",%" PRIu64 ")  "
                     "qs=(%" PRIu64 ",%" PRIu64 ",%" PRIu64 ")  "
-                    "cyc=(%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ")\n",
+                    "cyc=(%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ")  "
+                    "numa_remote=%" PRIu64 "\n",
             i,
             read_stat(&ctx->stat_qm_poll), read_stat(&ctx->stat_qm_empty),
             read_stat(&ctx->stat_qm_total),
@@ -360,7 +379,8 @@ void dataplane_dump_stats(void)
             read_stat(&ctx->stat_qs_poll), read_stat(&ctx->stat_qs_empty),
             read_stat(&ctx->stat_qs_total),
             read_stat(&ctx->stat_cyc_db), read_stat(&ctx->stat_cyc_qm),
-            read_stat(&ctx->stat_cyc_rx), read_stat(&ctx->stat_cyc_qs));
+            read_stat(&ctx->stat_cyc_rx), read_stat(&ctx->stat_cyc_qs),
+            read_stat(&ctx->stat_numa_remote));
   }
 }
 #endif
@@ -447,7 +467,12 @@ static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
     }
 
     fs = fss[i];
-    if (ctx->budgets[fs->vm_id].budget > 0) {
+#ifdef DATAPLANE_STATS
+    if (fs->numa_node != ctx->numa_node) {
+      STATS_ADD(ctx, numa_remote, 1);
+    }
+#endif
+    if (vm_budget_balance(&ctx->budgets[fs->vm_id]) > 0) {
       rx_spend_budget[i] = 1;
       batch_has_budgeted_vm = 1;
     }
@@ -457,6 +482,8 @@ static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
     for (i = 0; i < n; i++)
     {
       if (fss[i] != NULL && rx_spend_budget[i] == 0) {
+        fs = fss[i];
+        ctx->vm_rx_drops[fs->vm_id]++;
         rx_drop[i] = 1;
         fss[i] = NULL;
       }
@@ -669,6 +696,28 @@ static unsigned poll_kernel(struct dataplane_context *ctx, uint32_t ts)
   return total;
 }
 
+/* Send a segment of a VM with a buffer quota, with a buffer from the VM's
+ * own pool. If the pool is empty the chunk goes back to the queue manager,
+ * unbilled, until the NIC returns some of the VM's buffers. */
+static inline void qman_quota_segment(struct dataplane_context *ctx,
+    unsigned vm_id, unsigned flow_id, uint16_t bytes, uint32_t ts)
+{
+  struct network_buf_handle *nbh;
+
+  if (network_buf_alloc_vm(&ctx->net, vm_id, 1, &nbh) != 1) {
+    ctx->vm_buf_backpressure[vm_id]++;
+    if (tas_qman_requeue(ctx, vm_id, flow_id, bytes) != 0)
+    {
+      fprintf(stderr, "qman_quota_segment: qman_set failed, UNEXPECTED\n");
+      abort();
+    }
+    return;
+  }
+
+  if (fast_flows_qman(ctx, vm_id, flow_id, nbh, ts) != 0)
+    network_free(1, &nbh);
+}
+
 static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
 {
   unsigned fq_ids[BATCH_SIZE];
@@ -721,6 +770,11 @@ static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
 
   for (i = 0; i < ret; i++)
   {
+    if (ctx->net.vm_pools[vq_ids[i]] != NULL) {
+      qman_quota_segment(ctx, vq_ids[i], fq_ids[i], q_bytes[i], ts);
+      continue;
+    }
+
     use = fast_flows_qman(ctx, vq_ids[i], fq_ids[i], handles[off], ts);
     if (use == 0)
       off++;
@@ -891,7 +945,7 @@ static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc)
   for (i = 0; i < ctx->arx_num; i++)
   {
     vmid = ctx->arx_vm[i];
-    actx = &fp_state->appctx[ctx->id][vmid][ctx->arx_ctx[i]];
+    actx = &fp_cores[ctx->id].appctx[vmid][ctx->arx_ctx[i]];
     if (fast_actx_rxq_alloc(ctx, actx, &parx[i], vmid) != 0)
     {
       /* TODO: how do we handle this? */
@@ -913,98 +967,9 @@ static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc)
   for (i = 0; i < ctx->arx_num; i++)
   {
     vmid = ctx->arx_vm[i];
-    actx = &fp_state->appctx[ctx->id][vmid][ctx->arx_ctx[i]];
-    notify_appctx(actx, tsc);
+    actx = &fp_cores[ctx->id].appctx[vmid][ctx->arx_ctx[i]];
+    notify_appctx(actx, vmid, ctx->arx_ctx[i], tsc);
   }
 
   ctx->arx_num = 0;
 }
-
-static void spend_budget(struct dataplane_context *ctx, uint64_t cycles)
-{
-  int vmid;
-  uint16_t vm_count, vm_idx;
-  double counter, ratio;
-  uint64_t vm_cycles;
-  double counters_sum = 0;
-#ifdef BUDGET_DEBUG_STATS
-  double wc_counter, wc_ratio;
-  double wc_counters_sum = 0;
-#endif
-
-#ifdef BUDGET_DEBUG_STATS
-  if (ctx->counters_total == 0 && ctx->budget_debug_work_conserving_total != 0)
-  {
-    vm_count = tas_registered_vm_count_get();
-    if (vm_count == 0)
-    {
-      for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++)
-      {
-        ctx->budget_debug_work_conserving_vm[vmid] = 0;
-      }
-      ctx->budget_debug_work_conserving_total = 0;
-      return;
-    }
-
-    for (vm_idx = 0; vm_idx < vm_count; vm_idx++)
-    {
-      vmid = tas_registered_vm_ids[vm_idx];
-      wc_counter = ctx->budget_debug_work_conserving_vm[vmid];
-      wc_counters_sum += wc_counter;
-      wc_ratio = wc_counter / ctx->budget_debug_work_conserving_total;
-      vm_cycles = cycles * wc_ratio;
-      __sync_fetch_and_add(&ctx->budget_debug_work_conserving_cycles[vmid],
-          vm_cycles);
-      ctx->budget_debug_work_conserving_vm[vmid] = 0;
-    }
-
-    ctx->budget_debug_work_conserving_total = 0;
-    return;
-  }
-#endif
-
-  if (ctx->counters_total == 0)
-    return;
-
-  vm_count = tas_registered_vm_count_get();
-  if (vm_count == 0)
-  {
-    for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++)
-    {
-      ctx->vm_counters[vmid] = 0;
-    }
-    ctx->counters_total = 0;
-    return;
-  }
-
-  for (vm_idx = 0; vm_idx < vm_count; vm_idx++)
-  {
-    vmid = tas_registered_vm_ids[vm_idx];
-    counter = ctx->vm_counters[vmid];
-    counters_sum += counter;
-    ratio = counter / ctx->counters_total;
-    assert(counter <= ctx->counters_total);
-    assert(ratio >= 0 && ratio <= 1);
-    vm_cycles = cycles * ratio;
-    __sync_fetch_and_sub(&ctx->budgets[vmid].budget, vm_cycles);
-#ifdef BUDGET_DEBUG_STATS
-    __sync_fetch_and_add(&ctx->budget_debug_consumed_total, vm_cycles);
-    __sync_fetch_and_add(&ctx->budget_debug_consumed_vm[vmid], vm_cycles);
-#endif
-    ctx->vm_counters[vmid] = 0;
-  }
-
-  assert(counters_sum == ctx->counters_total);
-  ctx->counters_total = 0;
-#ifdef BUDGET_DEBUG_STATS
-  if (ctx->budget_debug_work_conserving_total != 0)
-  {
-    for (vm_idx = 0; vm_idx < vm_count; vm_idx++)
-    {
-      vmid = tas_registered_vm_ids[vm_idx];
-      ctx->budget_debug_work_conserving_vm[vmid] = 0;
-    }
-    ctx->budget_debug_work_conserving_total = 0;
-  }
-#endif
-}
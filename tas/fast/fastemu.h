@@ -100,6 +100,16 @@ void fast_flows_winretransmit(struct dataplane_context *ctx, uint32_t flow_id,
     struct network_buf_handle *nbh, uint32_t ts);
 void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id);
 
+/* fast_budget.c */
+void fast_budget_spend(struct dataplane_context *ctx, uint64_t cycles);
+
+/* fast_pollmode.c */
+void fast_pollmode_init(struct dataplane_pollmode *pm, uint64_t tsc,
+    uint64_t window_cycles, uint64_t backoff_max, uint64_t sleep_gap);
+void fast_pollmode_update(struct dataplane_pollmode *pm, unsigned work,
+    uint64_t tsc);
+uint64_t fast_pollmode_backoff(struct dataplane_pollmode *pm, int idle);
+
 /* fastemu.c */
 uint8_t bufcache_prealloc(struct dataplane_context *ctx, uint16_t num,
                                 struct network_buf_handle ***handles);
@@ -77,8 +77,11 @@ int tas_qman_poll(struct dataplane_context *ctx, unsigned num, unsigned *vm_id,
     unsigned *q_ids, uint16_t *q_bytes);
 int tas_qman_set(struct qman_thread *t, uint32_t vm_id, uint32_t flow_id, uint32_t rate,
     uint32_t avail, uint16_t max_chunk, uint8_t flags);
+int tas_qman_requeue(struct dataplane_context *ctx, uint32_t vm_id,
+    uint32_t flow_id, uint16_t bytes);
 uint32_t tas_qman_timestamp(uint64_t tsc);
 uint32_t tas_qman_next_ts(struct qman_thread *t, uint32_t cur_ts);
+int tas_qman_vm_weight(struct qman_thread *t, uint32_t vm_id, uint32_t weight);
 /** Helper functions for unit tests */
 uint32_t qman_vm_get_avail(struct dataplane_context *ctx, uint32_t vm_id);
 void qman_free_vm_cont(struct dataplane_context *ctx);
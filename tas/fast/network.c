@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <rte_config.h>
 #include <rte_memcpy.h>
@@ -46,7 +47,6 @@
 #define MAX_PATTERN_IN_FLOW 10
 #define MAX_ACTIONS_IN_FLOW 10
 #define PERTHREAD_MBUFS 2048
-#define MBUF_SIZE (BUFFER_SIZE + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
 #define RX_DESCRIPTORS 256
 #define TX_DESCRIPTORS 128
 
@@ -89,7 +89,8 @@ uint16_t rss_reta_size;
 static struct rte_eth_rss_reta_entry64 *rss_reta = NULL;
 static uint16_t *rss_core_buckets = NULL;
 
-static struct rte_mempool *mempool_alloc(void);
+static struct rte_mempool *mempool_alloc(unsigned socket, unsigned num);
+static inline uint32_t mbuf_size(void);
 static int reta_setup(void);
 static int reta_mlx5_resize(void);
 static rte_spinlock_t initlock = RTE_SPINLOCK_INITIALIZER;
@@ -104,7 +105,7 @@ int network_init(unsigned n_threads)
 {
   uint8_t count;
   int ret;
-  uint16_t p;
+  uint16_t p, mtu;
 
   num_threads = n_threads;
 
@@ -170,6 +171,14 @@ int network_init(unsigned n_threads)
   if (!config.fp_interrupts)
     port_conf.intr_conf.rxq = 0;
 
+#if RTE_VERSION < RTE_VERSION_NUM(21, 11, 0, 0)
+  /* older releases need jumbo frames enabled explicitly */
+  if (config.ip_mtu > 1500) {
+    port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+    port_conf.rxmode.max_rx_pkt_len = config.ip_mtu + sizeof(struct eth_hdr);
+  }
+#endif
+
   /* initialize port */
   ret = rte_eth_dev_configure(net_port_id, n_threads, n_threads, &port_conf);
   if (ret < 0) {
@@ -177,6 +186,19 @@ int network_init(unsigned n_threads)
     goto error_exit;
   }
 
+  /* drivers without mtu_set (net_ring, some vdevs) are fine as long as the
+   * device already runs at the requested mtu */
+  ret = rte_eth_dev_set_mtu(net_port_id, config.ip_mtu);
+  if (ret == -ENOTSUP && rte_eth_dev_get_mtu(net_port_id, &mtu) == 0 &&
+      mtu == config.ip_mtu)
+  {
+    ret = 0;
+  }
+  if (ret != 0) {
+    fprintf(stderr, "network_init: setting mtu %u failed\n", config.ip_mtu);
+    goto error_exit;
+  }
+
   /* workaround for mlx5. */
   if (config.fp_autoscale) {
     if (reta_mlx5_resize() != 0) {
@@ -235,17 +257,37 @@ int network_thread_init(struct dataplane_context *ctx)
 
   struct network_thread *t = &ctx->net;
   int ret;
+  unsigned vmid;
+
+  for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++) {
+    t->vm_pools[vmid] = NULL;
+  }
 
   /* allocate mempool */
-  if ((t->pool = mempool_alloc()) == NULL) {
+  if ((t->pool = mempool_alloc(ctx->numa_node, PERTHREAD_MBUFS)) == NULL) {
     goto error_mpool;
   }
 
+  /* VMs with a buffer quota transmit from their own pools, so that a
+   * backlogged VM cannot drain the pool used for receiving */
+  for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++) {
+    if (config.fp_vm_mbufs[vmid] == 0)
+      continue;
+
+    if ((t->vm_pools[vmid] = mempool_alloc(ctx->numa_node,
+            config.fp_vm_mbufs[vmid])) == NULL)
+    {
+      fprintf(stderr, "network_thread_init: allocating pool for vm %u "
+          "failed\n", vmid);
+      goto error_vm_pools;
+    }
+  }
+
   /* initialize tx queue */
   t->queue_id = ctx->id;
   rte_spinlock_lock(&initlock);
   ret = rte_eth_tx_queue_setup(net_port_id, t->queue_id, TX_DESCRIPTORS, 
-          rte_socket_id(), &eth_devinfo.default_txconf);
+          ctx->numa_node, &eth_devinfo.default_txconf);
   rte_spinlock_unlock(&initlock);
   if (ret != 0) {
     fprintf(stderr, "network_thread_init: rte_eth_tx_queue_setup failed\n");
@@ -260,7 +302,7 @@ int network_thread_init(struct dataplane_context *ctx)
   t->queue_id = ctx->id;
   rte_spinlock_lock(&initlock);
     ret = rte_eth_rx_queue_setup(net_port_id, t->queue_id, RX_DESCRIPTORS, 
-            rte_socket_id(), &eth_devinfo.default_rxconf, t->pool);
+            ctx->numa_node, &eth_devinfo.default_rxconf, t->pool);
   rte_spinlock_unlock(&initlock);
   
   if (ret != 0) {
@@ -331,9 +373,16 @@ error_int_queue:
 error_rx_queue:
   /* TODO: destroy tx queue */
 error_tx_queue:
-  /* TODO: free mempool */
+error_vm_pools:
+  for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++) {
+    if (t->vm_pools[vmid] != NULL) {
+      rte_mempool_free(t->vm_pools[vmid]);
+      t->vm_pools[vmid] = NULL;
+    }
+  }
+  rte_mempool_free(t->pool);
+  t->pool = NULL;
 error_mpool:
-  rte_free(t);
   return -1;
 }
 
@@ -346,19 +395,32 @@ int network_rx_interrupt_ctl(struct network_thread *t, int turnon)
   }
 }
 
-static struct rte_mempool *mempool_alloc(void)
+/* allocate mbuf pool for one fast path core on that core's NUMA node */
+static struct rte_mempool *mempool_alloc(unsigned socket, unsigned num)
 {
   static unsigned pool_id = 0;
   unsigned n;
   char name[32];
   n = __sync_fetch_and_add(&pool_id, 1);
   snprintf(name, 32, "mbuf_pool_%u\n", n);
-  return rte_mempool_create(name, PERTHREAD_MBUFS, MBUF_SIZE, 32,
+  return rte_mempool_create(name, num, mbuf_size(), 32,
           sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init, NULL,
-          rte_pktmbuf_init, NULL, rte_socket_id(), 0);
+          rte_pktmbuf_init, NULL, socket, 0);
 
 }
 
+/* mbuf element size: large enough for a full frame (incl. VLAN tag) */
+static inline uint32_t mbuf_size(void)
+{
+  uint32_t buf_size = BUFFER_SIZE;
+  uint32_t frame_len = config.ip_mtu + sizeof(struct eth_hdr) + 4;
+
+  if (frame_len > buf_size) {
+    buf_size = (frame_len + 63) & ~63;
+  }
+  return buf_size + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM;
+}
+
 static inline uint16_t core_min(uint16_t num)
 {
   uint16_t i, i_min = 0, v_min = UINT8_MAX;
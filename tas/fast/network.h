@@ -122,19 +122,19 @@ static inline int network_send(struct network_thread *t, unsigned num,
 }
 
 
-static inline int network_buf_alloc(struct network_thread *t, unsigned num,
+static inline int network_pool_alloc(struct rte_mempool *pool, unsigned num,
     struct network_buf_handle **bhs)
 {
   struct rte_mbuf **mbs = (struct rte_mbuf **) bhs;
   unsigned i;
 
   /* try bulk alloc first. if it fails try individual mbufs */
-  if (rte_pktmbuf_alloc_bulk(t->pool, mbs, num) == 0) {
+  if (rte_pktmbuf_alloc_bulk(pool, mbs, num) == 0) {
     return num;
   }
 
   for (i = 0; i < num; i++) {
-    if ((mbs[i] = rte_pktmbuf_alloc(t->pool)) == NULL) {
+    if ((mbs[i] = rte_pktmbuf_alloc(pool)) == NULL) {
       break;
     }
   }
@@ -142,6 +142,19 @@ static inline int network_buf_alloc(struct network_thread *t, unsigned num,
   return i;
 }
 
+static inline int network_buf_alloc(struct network_thread *t, unsigned num,
+    struct network_buf_handle **bhs)
+{
+  return network_pool_alloc(t->pool, num, bhs);
+}
+
+/** allocate transmit buffers from the pool of a VM with a buffer quota */
+static inline int network_buf_alloc_vm(struct network_thread *t, uint16_t vmid,
+    unsigned num, struct network_buf_handle **bhs)
+{
+  return network_pool_alloc(t->vm_pools[vmid], num, bhs);
+}
+
 static inline void network_free(unsigned num, struct network_buf_handle **bufs)
 {
   unsigned i;
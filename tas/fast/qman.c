@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <rte_config.h>
@@ -46,6 +47,8 @@
 
 #define FLAG_INSKIPLIST 1
 #define FLAG_INNOLIMITL 2
+#define FLAG_INWHEEL 4
+#define FLAG_QUEUED (FLAG_INSKIPLIST | FLAG_INNOLIMITL | FLAG_INWHEEL)
 
 /** Skiplist: bits per level */
 #define SKIPLIST_BITS 3
@@ -54,6 +57,10 @@
 #define TIMESTAMP_BITS 32
 #define TIMESTAMP_MASK 0xFFFFFFFF
 
+/** Timing wheel: slot number mask and number of bitmap words */
+#define WHEEL_SLOT_MASK (QMAN_WHEEL_SLOTS - 1)
+#define WHEEL_BMP_WORDS (QMAN_WHEEL_SLOTS / 64)
+
 /** Queue container for a virtual machine */
 struct vm_qman {
   /** VM queue */
@@ -76,6 +83,15 @@ struct flow_qman {
   uint32_t nolimit_tail_idx;
   /** Whether to poll nolimit queue first */
   bool nolimit_first;
+  /** Timing wheel: idx of head and tail of each slot list */
+  uint32_t *wheel_head;
+  uint32_t *wheel_tail;
+  /** Timing wheel: bitmap of non-empty slots */
+  uint64_t wheel_bmp[WHEEL_BMP_WORDS];
+  /** Timing wheel: virtual timestamp of the current slot */
+  uint32_t wheel_ts;
+  /** Timing wheel: number of queued flows */
+  uint32_t wheel_cnt;
 };
 
 /** Queue state for a virtual machine */
@@ -90,8 +106,10 @@ struct vm_queue {
   uint32_t avail;
   /** Flags: FLAG_INNOLIMITL */
   uint16_t flags;
-  /* Bytes sent in this round for this VM. Reset every round. */
-  uint16_t bytes;
+  /** DRR: bytes this VM may still send in its turn, negative if overdrawn */
+  int32_t deficit;
+  /** DRR: bytes added per turn, quantum times weight */
+  uint32_t quantum;
   /** Real timestamp */
   uint32_t ts_real;
   /** Virtual timestamp */
@@ -105,11 +123,13 @@ struct skiplist_fstate {
   uint8_t rate_limited;
   /** The original number of packets requested. Probably batch size */
   unsigned int orig_num;
+  /** Stop polling flows of this VM once this many bytes are scheduled */
+  int byte_limit;
 };
 
 /** Queue state for flow */
 struct flow_queue {
-  /** Next pointers for levels in skip list */
+  /** Next pointers for levels in skip list, [0] also links wheel slots */
   uint32_t next_idxs[QMAN_SKIPLIST_LEVELS];
   /** Time stamp */
   uint32_t next_ts;
@@ -119,7 +139,7 @@ struct flow_queue {
   uint32_t avail;
   /** Maximum chunk size when de-queueing */
   uint16_t max_chunk;
-  /** Flags: FLAG_INSKIPLIST, FLAG_INNOLIMITL */
+  /** Flags: FLAG_INSKIPLIST, FLAG_INNOLIMITL, FLAG_INWHEEL */
   uint16_t flags;
 } __attribute__((packed));
 STATIC_ASSERT((sizeof(struct flow_queue) == 32), queue_size);
@@ -139,15 +159,17 @@ static inline int vm_qman_set(struct qman_thread *t, uint32_t vm_id, uint32_t fl
     uint32_t rate, uint32_t avail, uint16_t max_chunk, uint8_t flags);
 static inline void vm_queue_fire(struct vm_qman *vqman, struct vm_queue *q,
     uint32_t idx, uint16_t *q_bytes, int bytes_sum,
-    unsigned start, unsigned end);
+    unsigned start, unsigned end, int front);
 /** Actually update queue state for app queue */
 static inline void vm_set_impl(struct vm_qman *vqman, uint32_t v_idx,
     uint32_t f_idx, uint32_t avail, uint8_t flags);
 static inline void vm_queue_activate(struct vm_qman *vqman,
     struct vm_queue *q, uint32_t idx);
+static inline void vm_queue_activate_front(struct vm_qman *vqman,
+    struct vm_queue *q, uint32_t idx);
 
 /** Qman management functions for flows */
-static inline int flowcont_init(struct vm_queue *vq);
+static inline int flowcont_init(struct qman_thread *t, struct vm_queue *vq);
 static inline int flow_qman_poll(struct qman_thread *t, 
     struct vm_queue *vqueue, struct flow_qman *fqman, 
     struct skiplist_fstate *skpl_state, unsigned num, unsigned *q_ids,
@@ -164,7 +186,7 @@ static inline void flow_queue_activate_nolimit(struct flow_qman *fqman,
     struct flow_queue *q, uint32_t idx);
 static inline unsigned flow_poll_nolimit(struct qman_thread *t, 
     struct vm_queue *vqueue, struct flow_qman *fqman, 
-    uint32_t cur_ts, unsigned num, unsigned *q_ids, 
+    uint32_t cur_ts, int byte_limit, unsigned num, unsigned *q_ids, 
     uint16_t *q_bytes, uint32_t *vm_ids, int *bytes_sum);
 /** Add queue to the flow skip list list */
 static inline void flow_queue_activate_skiplist(struct qman_thread *t,
@@ -177,6 +199,23 @@ static inline unsigned flow_poll_skiplist(struct qman_thread *t,
     uint16_t *q_bytes, uint32_t *vm_ids, int *bytes_sum);
 static inline uint8_t flow_queue_level(struct qman_thread *t, 
     struct flow_qman *fqman);
+/** Add queue to the flow timing wheel */
+static inline void flow_queue_activate_wheel(struct vm_queue *vq,
+    struct flow_qman *fqman, struct flow_queue *q, uint32_t idx);
+static inline unsigned flow_poll_wheel(struct qman_thread *t,
+    struct vm_queue *vqueue, struct flow_qman *fqman,
+    struct skiplist_fstate *skpl_state,
+    unsigned num, unsigned *q_ids,
+    uint16_t *q_bytes, uint32_t *vm_ids, int *bytes_sum);
+static inline uint32_t flow_wheel_next(struct flow_qman *fqman, uint32_t cur,
+    uint32_t d, uint32_t dist);
+static inline uint32_t flow_wheel_next_ts(struct vm_queue *vq,
+    struct flow_qman *fqman);
+static inline unsigned flow_poll_limited(struct qman_thread *t,
+    struct vm_queue *vqueue, struct flow_qman *fqman,
+    struct skiplist_fstate *skpl_state,
+    unsigned num, unsigned *q_ids,
+    uint16_t *q_bytes, uint32_t *vm_ids, int *bytes_sum);
 static inline void flow_queue_fire(struct qman_thread *t, 
     struct vm_queue *vqueue, struct flow_qman *fqman,
     struct flow_queue *q, uint32_t idx, unsigned *q_id, 
@@ -193,6 +232,8 @@ int tas_qman_thread_init(struct dataplane_context *ctx)
 {
   struct qman_thread *t = &ctx->qman;
 
+  t->wheel = (config.fp_qman == CONFIG_QMAN_WHEEL);
+  t->vm_quantum = config.fp_vm_quantum;
   if (vmcont_init(t) != 0)
   {
     fprintf(stderr, "qman_thread_init: app_cont init failed\n");
@@ -223,13 +264,70 @@ int tas_qman_set(struct qman_thread *t, uint32_t vm_id, uint32_t flow_id, uint32
   return ret;
 }
 
+/* Return a chunk tas_qman_poll handed out but that could not be sent, and
+ * take back what was billed to the VM for it: budget counters, DRR deficit
+ * and the flow's rate limit delay. */
+int tas_qman_requeue(struct dataplane_context *ctx, uint32_t vm_id,
+    uint32_t flow_id, uint16_t bytes)
+{
+  struct qman_thread *t = &ctx->qman;
+  struct vm_queue *vq;
+  struct flow_queue *q;
+
+  if (vm_id >= FLEXNIC_PL_VMST_NUM || flow_id >= fp_flowst_num)
+  {
+    fprintf(stderr, "tas_qman_requeue: invalid vm %u or flow %u\n", vm_id,
+        flow_id);
+    return -1;
+  }
+
+  vq = &t->vqman->queues[vm_id];
+  if (t->vm_quantum > 0)
+  {
+    vq->deficit += bytes;
+  }
+
+  q = &vq->fqman->queues[flow_id];
+  if (q->rate > 0)
+  {
+    q->next_ts -= ((uint64_t) bytes * 8 * 1000000) / q->rate;
+  }
+
+  if (ctx->vm_counters[vm_id] >= bytes)
+  {
+    ctx->vm_counters[vm_id] -= bytes;
+    ctx->counters_total -= bytes;
+  }
+  else if (ctx->wc_counters[vm_id] >= bytes)
+  {
+    ctx->wc_counters[vm_id] -= bytes;
+    ctx->wc_counters_total -= bytes;
+  }
+  ctx->budgets[vm_id].tx_bytes -= bytes;
+
+  return vm_qman_set(&ctx->qman, vm_id, flow_id, 0, bytes, 0, QMAN_ADD_AVAIL);
+}
+
+int tas_qman_vm_weight(struct qman_thread *t, uint32_t vm_id, uint32_t weight)
+{
+  if (vm_id >= FLEXNIC_PL_VMST_NUM)
+  {
+    fprintf(stderr, "tas_qman_vm_weight: invalid vm id: %u >= %u\n", vm_id,
+        FLEXNIC_PL_VMST_NUM);
+    return -1;
+  }
+
+  t->vqman->queues[vm_id].quantum = t->vm_quantum * weight;
+  return 0;
+}
+
 // TODO: Fix this for multiple VM case. Currently just looking at first VM
 uint32_t tas_qman_next_ts(struct qman_thread *t, uint32_t cur_ts)
 {
   struct vm_queue *vq;
   struct flow_qman *fqman;
   uint32_t ts = timestamp();
-  uint32_t ret_ts;
+  uint32_t ret_ts, next_ts;
   struct vm_qman *vqman = t->vqman;
 
   if (vqman->head_idx == IDXLIST_INVAL)
@@ -248,25 +346,37 @@ uint32_t tas_qman_next_ts(struct qman_thread *t, uint32_t cur_ts)
   }
 
   ret_ts = vq->ts_virtual + (ts - vq->ts_real);
-  uint32_t idx = fqman->head_idx[0];
-  if (idx != IDXLIST_INVAL)
+  if (t->wheel)
   {
-    struct flow_queue *q = &fqman->queues[idx];
-
-    if (timestamp_lessthaneq(vq, q->next_ts, ret_ts))
+    if (fqman->wheel_cnt == 0)
     {
-      // Fired in the past - immediate timeout
-      return 0;
+      // Wheel empty - no timeout
+      return -1;
     }
-    else
+
+    next_ts = flow_wheel_next_ts(vq, fqman);
+  }
+  else
+  {
+    uint32_t idx = fqman->head_idx[0];
+    if (idx == IDXLIST_INVAL)
     {
-      // Timeout in the future - return difference
-      return rel_time(ret_ts, q->next_ts) / 1000;
+      // List empty - no timeout
+      return -1;
     }
+    next_ts = fqman->queues[idx].next_ts;
   }
 
-  // List empty - no timeout
-  return -1;
+  if (timestamp_lessthaneq(vq, next_ts, ret_ts))
+  {
+    // Fired in the past - immediate timeout
+    return 0;
+  }
+  else
+  {
+    // Timeout in the future - return difference
+    return rel_time(ret_ts, next_ts) / 1000;
+  }
 }
 
 uint32_t tas_qman_timestamp(uint64_t cycles)
@@ -373,7 +483,9 @@ int vmcont_init(struct qman_thread *t)
     vq->id = i;
     vq->ts_virtual = 0;
     vq->ts_real = timestamp();
-    ret = flowcont_init(vq);
+    vq->deficit = 0;
+    vq->quantum = t->vm_quantum * config.fp_vm_weights[i];
+    ret = flowcont_init(t, vq);
 
     if (ret != 0)
     {
@@ -390,7 +502,7 @@ static inline int vm_qman_poll(struct dataplane_context *ctx,
     unsigned *vm_ids, unsigned *q_ids, uint16_t *q_bytes)
 {
   uint32_t idx;
-  int cnt, temp_cnt, x, bytes_sum;
+  int cnt, temp_cnt, x, bytes_sum, front;
   struct qman_thread *t = &ctx->qman;
   struct vm_budget *budgets = ctx->budgets;
   struct vm_qman *vqman = t->vqman;
@@ -414,25 +526,58 @@ static inline int vm_qman_poll(struct dataplane_context *ctx,
     if (vq->next_idx == IDXLIST_INVAL)
       vqman->tail_idx = IDXLIST_INVAL;
 
-    if (budgets[idx].budget > 0)
+    if (vm_budget_balance(&budgets[idx]) > 0)
     {
       fqman = vq->fqman;
       skpl_state->rate_limited = 0;
       skpl_state->orig_num = num; 
+      skpl_state->byte_limit = INT_MAX;
+      if (t->vm_quantum > 0)
+      {
+        /* DRR: a new turn starts once the previous one is used up */
+        if (vq->deficit <= 0)
+          vq->deficit += vq->quantum;
+        if (vq->deficit <= 0)
+        {
+          /* still paying off overdraft from large segments */
+          vm_queue_activate(vqman, vq, idx);
+          continue;
+        }
+        skpl_state->byte_limit = vq->deficit;
+      }
+
       bytes_sum = 0;
       x = flow_qman_poll(t, vq, fqman, skpl_state, num - cnt, 
           q_ids + cnt, q_bytes + cnt, vm_ids + cnt, &bytes_sum);
       cnt += x;
 
+      front = 0;
+      if (t->vm_quantum > 0)
+      {
+        vq->deficit -= bytes_sum;
+        if (vq->deficit > 0 && cnt >= num)
+        {
+          /* batch full: finish this turn first in the next poll */
+          front = 1;
+        }
+        else if (vq->deficit > 0)
+        {
+          /* nothing else ready: unused quantum is not carried over */
+          vq->deficit = 0;
+        }
+      }
+
       if (vq->avail > 0)
       {
-        vm_queue_fire(vqman, vq, idx, q_bytes, bytes_sum, cnt - x, cnt);
+        vm_queue_fire(vqman, vq, idx, q_bytes, bytes_sum, cnt - x, cnt,
+            front);
         if (skpl_state->rate_limited && rvq == NULL)
           rvq = vq;
       }
 
       ctx->vm_counters[idx] += bytes_sum;
       ctx->counters_total += bytes_sum;
+      budgets[idx].tx_bytes += bytes_sum;
 
     } else
     {
@@ -456,6 +601,7 @@ static inline int vm_qman_poll(struct dataplane_context *ctx,
     {
       fqman = vq->fqman;
       skpl_state->rate_limited = 0;
+      skpl_state->byte_limit = INT_MAX;
       bytes_sum = 0;
       x = flow_qman_poll(t, vq, fqman, skpl_state,
           num - cnt, q_ids + cnt, q_bytes + cnt, vm_ids + cnt, 
@@ -463,12 +609,13 @@ static inline int vm_qman_poll(struct dataplane_context *ctx,
       cnt += x;
       if (vq->avail > 0)
       {
-        vm_queue_fire(vqman, vq, vq->id, q_bytes, bytes_sum, cnt - x, cnt);
+        vm_queue_fire(vqman, vq, vq->id, q_bytes, bytes_sum, cnt - x, cnt, 0);
+      }
+      budgets[vq->id].tx_bytes += bytes_sum;
+      if (UNLIKELY(config.bu_telemetry)) {
+        ctx->wc_counters[vq->id] += bytes_sum;
+        ctx->wc_counters_total += bytes_sum;
       }
-#ifdef BUDGET_DEBUG_STATS
-      ctx->budget_debug_work_conserving_vm[vq->id] += bytes_sum;
-      ctx->budget_debug_work_conserving_total += bytes_sum;
-#endif
     } else
     {
       vm_queue_activate(vqman, vq, vq->id);
@@ -502,13 +649,15 @@ static inline int vm_qman_set(struct qman_thread *t,
 
 static inline void vm_queue_fire(struct vm_qman *vqman, struct vm_queue *q,
     uint32_t idx, uint16_t *q_bytes, int bytes_sum, 
-    unsigned start, unsigned end)
+    unsigned start, unsigned end, int front)
 {
   assert(q->avail > 0);
 
   q->avail -= bytes_sum;
 
-  if (q->avail > 0) {
+  if (q->avail > 0 && front) {
+    vm_queue_activate_front(vqman, q, idx);
+  } else if (q->avail > 0) {
     vm_queue_activate(vqman, q, idx);
   }
 
@@ -563,20 +712,39 @@ static inline void vm_queue_activate(struct vm_qman *vqman,
   vqman->tail_idx = idx;
 }
 
+static inline void vm_queue_activate_front(struct vm_qman *vqman,
+    struct vm_queue *q, uint32_t idx)
+{
+  assert((q->flags & FLAG_INNOLIMITL) == 0);
+
+  q->flags |= FLAG_INNOLIMITL;
+  q->next_idx = vqman->head_idx;
+  vqman->head_idx = idx;
+  if (vqman->tail_idx == IDXLIST_INVAL)
+  {
+    vqman->tail_idx = idx;
+  }
+}
+
 /*****************************************************************************/
 
 /*****************************************************************************/
 /* Manages flow queues */
 
-int flowcont_init(struct vm_queue *vq) 
+int flowcont_init(struct qman_thread *t, struct vm_queue *vq) 
 {
   unsigned i;
   struct flow_qman *fqman;
 
-  vq->fqman = malloc(sizeof(struct flow_qman));
+  vq->fqman = calloc(1, sizeof(struct flow_qman));
   fqman = vq->fqman;
+  if (fqman == NULL)
+  {
+    fprintf(stderr, "flowcont_init: fqman malloc failed\n");
+    return -1;
+  }
 
-  fqman->queues = calloc(1, sizeof(*fqman->queues) * FLEXNIC_NUM_QMFLOWQUEUES);
+  fqman->queues = calloc(1, sizeof(*fqman->queues) * fp_flowst_num);
   if (fqman->queues == NULL)
   {
     fprintf(stderr, "flowcont_init: queues malloc failed\n");
@@ -589,6 +757,23 @@ int flowcont_init(struct vm_queue *vq)
   }
   fqman->nolimit_head_idx = fqman->nolimit_tail_idx = IDXLIST_INVAL;
 
+  if (t->wheel)
+  {
+    fqman->wheel_head = malloc(sizeof(uint32_t) * QMAN_WHEEL_SLOTS);
+    fqman->wheel_tail = malloc(sizeof(uint32_t) * QMAN_WHEEL_SLOTS);
+    if (fqman->wheel_head == NULL || fqman->wheel_tail == NULL)
+    {
+      fprintf(stderr, "flowcont_init: wheel malloc failed\n");
+      return -1;
+    }
+
+    for (i = 0; i < QMAN_WHEEL_SLOTS; i++)
+    {
+      fqman->wheel_head[i] = fqman->wheel_tail[i] = IDXLIST_INVAL;
+    }
+    fqman->wheel_ts = vq->ts_virtual & ~((1U << QMAN_WHEEL_SHIFT) - 1);
+  }
+
   return 0;
 }
 
@@ -601,15 +786,16 @@ static inline int flow_qman_poll(struct qman_thread *t, struct vm_queue *vqueue,
   unsigned x, y;
   /* poll nolimit list and skiplist alternating the order between */
   if (fqman->nolimit_first) {
-    x = flow_poll_nolimit(t, vqueue, fqman, skpl_state->cur_ts, 
-        num, q_ids, q_bytes, vm_ids, bytes_sum);
-    y = flow_poll_skiplist(t, vqueue, fqman, skpl_state,
+    x = flow_poll_nolimit(t, vqueue, fqman, skpl_state->cur_ts,
+        skpl_state->byte_limit, num, q_ids, q_bytes, vm_ids, bytes_sum);
+    y = flow_poll_limited(t, vqueue, fqman, skpl_state,
         num - x, q_ids + x, q_bytes + x, vm_ids + x, bytes_sum);
   } else {
-    x = flow_poll_skiplist(t, vqueue, fqman, skpl_state,
+    x = flow_poll_limited(t, vqueue, fqman, skpl_state,
         num, q_ids, q_bytes, vm_ids, bytes_sum);
-    y = flow_poll_nolimit(t, vqueue, fqman, skpl_state->cur_ts, 
-        num - x, q_ids + x, q_bytes + x, vm_ids + x, bytes_sum);
+    y = flow_poll_nolimit(t, vqueue, fqman, skpl_state->cur_ts,
+        skpl_state->byte_limit, num - x, q_ids + x, q_bytes + x, vm_ids + x,
+        bytes_sum);
   }
   fqman->nolimit_first = !fqman->nolimit_first;
 
@@ -631,9 +817,9 @@ int flow_qman_set(struct qman_thread *t, struct vm_queue *vq,
   dprintf("flow_qman_set: id=%u rate=%u avail=%u max_chunk=%u\n",
       id, rate, avail, max_chunk);
 
-  if (id >= FLEXNIC_NUM_QMFLOWQUEUES) {
+  if (id >= fp_flowst_num) {
     fprintf(stderr, "flow_qman_set: invalid queue id: %u >= %u\n", id,
-        FLEXNIC_NUM_QMFLOWQUEUES);
+        fp_flowst_num);
     return -1;
   }
 
@@ -669,8 +855,7 @@ static void inline flow_set_impl(struct qman_thread *t,
   dprintf("flow_set_impl: t=%p q=%p idx=%u avail=%u rate=%u qflags=%x flags=%x\n", 
       t, q, idx, q->avail, q->rate, q->flags, flags);
 
-  if (new_avail && q->avail > 0
-      && ((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0)) {
+  if (new_avail && q->avail > 0 && ((q->flags & FLAG_QUEUED) == 0)) {
     flow_queue_activate(t, vq, fqman, q, idx);
   }
 }
@@ -681,7 +866,7 @@ static inline void flow_queue_activate_nolimit(struct flow_qman *fqman,
 {
   struct flow_queue *q_tail;
 
-  assert((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0);
+  assert((q->flags & FLAG_QUEUED) == 0);
 
   dprintf("flow_queue_activate_nolimit: q=%p avail=%u rate=%u flags=%x\n",
       q, q->avail, q->rate, q->flags);
@@ -702,14 +887,15 @@ static inline void flow_queue_activate_nolimit(struct flow_qman *fqman,
 /** Poll no-limit queues for flows */
 static inline unsigned flow_poll_nolimit(struct qman_thread *t, 
     struct vm_queue *vqueue, struct flow_qman *fqman, 
-    uint32_t cur_ts, unsigned num, unsigned *q_ids, 
+    uint32_t cur_ts, int byte_limit, unsigned num, unsigned *q_ids, 
     uint16_t *q_bytes, uint32_t *vm_ids, int *bytes_sum)
 {
   unsigned cnt;
   struct flow_queue *q;
   uint32_t idx;
 
-  for (cnt = 0; cnt < num && fqman->nolimit_head_idx != IDXLIST_INVAL;) {
+  for (cnt = 0; cnt < num && *bytes_sum < byte_limit &&
+      fqman->nolimit_head_idx != IDXLIST_INVAL;) {
     idx = fqman->nolimit_head_idx;
     q = fqman->queues + idx;
 
@@ -740,7 +926,7 @@ static inline void flow_queue_activate_skiplist(struct qman_thread *t,
   uint32_t preds[QMAN_SKIPLIST_LEVELS];
   uint32_t pred, idx, ts, max_ts;
 
-  assert((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0);
+  assert((q->flags & FLAG_QUEUED) == 0);
 
   dprintf("flow_queue_activate_skiplist: t=%p q=%p idx=%u avail=%u "
       "rate=%u flags=%x ts_virt=%u next_ts=%u\n", 
@@ -812,7 +998,7 @@ static inline unsigned flow_poll_skiplist(struct qman_thread *t,
   /* maximum virtual time stamp that can be reached */
   max_vts = vqueue->ts_virtual + (skpl_state->cur_ts - vqueue->ts_real);
 
-  for (cnt = 0; cnt < num;) {
+  for (cnt = 0; cnt < num && *bytes_sum < skpl_state->byte_limit;) {
     idx = fqman->head_idx[0];
     q = &fqman->queues[idx];
 
@@ -925,11 +1111,258 @@ static inline void flow_queue_activate(struct qman_thread *t, struct vm_queue *v
 {
   if (q->rate == 0) {
     flow_queue_activate_nolimit(fqman, q, idx);
+  } else if (t->wheel) {
+    flow_queue_activate_wheel(vq, fqman, q, idx);
   } else {
     flow_queue_activate_skiplist(t, vq, fqman, q, idx);
   }
 }
 
+/** Poll rate-limited flows with the configured scheduler */
+static inline unsigned flow_poll_limited(struct qman_thread *t,
+    struct vm_queue *vqueue, struct flow_qman *fqman,
+    struct skiplist_fstate *skpl_state, unsigned num,
+    unsigned *q_ids, uint16_t *q_bytes, uint32_t *vm_ids,
+    int *bytes_sum)
+{
+  if (t->wheel) {
+    return flow_poll_wheel(t, vqueue, fqman, skpl_state, num, q_ids,
+        q_bytes, vm_ids, bytes_sum);
+  } else {
+    return flow_poll_skiplist(t, vqueue, fqman, skpl_state, num, q_ids,
+        q_bytes, vm_ids, bytes_sum);
+  }
+}
+
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* Timing wheel for rate-limited flows
+ *
+ * Flows are hashed into slots of 2^QMAN_WHEEL_SHIFT ns by their next
+ * timestamp. Insert appends to the slot list, polling walks the bitmap of
+ * non-empty slots from the current slot up to the maximal virtual timestamp
+ * and extracts each slot as a whole. Flows more than one rotation ahead stay
+ * in their slot until they are due. */
+
+/** Add queue to the flows timing wheel */
+static inline void flow_queue_activate_wheel(struct vm_queue *vq,
+    struct flow_qman *fqman, struct flow_queue *q, uint32_t q_idx)
+{
+  uint32_t ts, max_ts, slot;
+
+  assert((q->flags & FLAG_QUEUED) == 0);
+
+  dprintf("flow_queue_activate_wheel: q=%p idx=%u avail=%u rate=%u "
+      "ts_virt=%u next_ts=%u\n", q, q_idx, q->avail, q->rate,
+      vq->ts_virtual, q->next_ts);
+
+  /* same bounds as for the skiplist, and never behind the current slot */
+  ts = q->next_ts;
+  max_ts = flow_queue_new_ts(vq, q, q->max_chunk);
+  if (timestamp_lessthaneq(vq, ts, vq->ts_virtual)) {
+    ts = vq->ts_virtual;
+  } else if (!timestamp_lessthaneq(vq, ts, max_ts)) {
+    ts = max_ts;
+  }
+  if (timestamp_lessthaneq(vq, ts, fqman->wheel_ts)) {
+    ts = fqman->wheel_ts;
+  }
+  q->next_ts = ts;
+
+  slot = (ts >> QMAN_WHEEL_SHIFT) & WHEEL_SLOT_MASK;
+  q->next_idxs[0] = IDXLIST_INVAL;
+  if (fqman->wheel_tail[slot] == IDXLIST_INVAL) {
+    fqman->wheel_head[slot] = q_idx;
+    fqman->wheel_bmp[slot / 64] |= 1ULL << (slot % 64);
+  } else {
+    fqman->queues[fqman->wheel_tail[slot]].next_idxs[0] = q_idx;
+  }
+  fqman->wheel_tail[slot] = q_idx;
+
+  q->flags |= FLAG_INWHEEL;
+  fqman->wheel_cnt++;
+}
+
+/** Distance of the first non-empty slot at least d slots after slot number
+ * cur, or a value larger than dist if there is none up to dist. */
+static inline uint32_t flow_wheel_next(struct flow_qman *fqman, uint32_t cur,
+    uint32_t d, uint32_t dist)
+{
+  uint32_t pos;
+  uint64_t w;
+
+  while (d <= dist) {
+    pos = (cur + d) & WHEEL_SLOT_MASK;
+    w = fqman->wheel_bmp[pos / 64] >> (pos % 64);
+    if (w != 0) {
+      return d + __builtin_ctzll(w);
+    }
+    d += 64 - (pos % 64);
+  }
+  return d;
+}
+
+/** Earliest next timestamp of a flow in the wheel, which must not be empty.
+ * Slots are visited in order, the first slot with a flow due in the current
+ * rotation holds the earliest flow. Flows of later rotations only matter if
+ * there is none. */
+static inline uint32_t flow_wheel_next_ts(struct vm_queue *vq,
+    struct flow_qman *fqman)
+{
+  uint32_t cur, d, slot, idx, ts = 0, later_ts = 0, found = 0, later = 0;
+  const int64_t rotation = (int64_t) QMAN_WHEEL_SLOTS << QMAN_WHEEL_SHIFT;
+  struct flow_queue *q;
+
+  cur = fqman->wheel_ts >> QMAN_WHEEL_SHIFT;
+  for (d = flow_wheel_next(fqman, cur, 0, QMAN_WHEEL_SLOTS - 1);
+      d < QMAN_WHEEL_SLOTS;
+      d = flow_wheel_next(fqman, cur, d + 1, QMAN_WHEEL_SLOTS - 1))
+  {
+    slot = (cur + d) & WHEEL_SLOT_MASK;
+    for (idx = fqman->wheel_head[slot]; idx != IDXLIST_INVAL;
+        idx = q->next_idxs[0])
+    {
+      q = &fqman->queues[idx];
+      if (rel_time(fqman->wheel_ts, q->next_ts) < rotation) {
+        if (!found || timestamp_lessthaneq(vq, q->next_ts, ts)) {
+          ts = q->next_ts;
+          found = 1;
+        }
+      } else if (!later || timestamp_lessthaneq(vq, q->next_ts, later_ts)) {
+        later_ts = q->next_ts;
+        later = 1;
+      }
+    }
+
+    if (found) {
+      return ts;
+    }
+  }
+
+  assert(later);
+  return later_ts;
+}
+
+/** Poll timing wheel for flows */
+static inline unsigned flow_poll_wheel(struct qman_thread *t,
+    struct vm_queue *vqueue, struct flow_qman *fqman,
+    struct skiplist_fstate *skpl_state, unsigned num,
+    unsigned *q_ids, uint16_t *q_bytes, uint32_t *vm_ids,
+    int *bytes_sum)
+{
+  unsigned cnt = 0, fired;
+  uint32_t max_vts, cur, dist, d, slot, idx, next_idx, tail, keep_head,
+           keep_tail;
+  struct flow_queue *q;
+
+  /* maximum virtual time stamp that can be reached */
+  max_vts = vqueue->ts_virtual + (skpl_state->cur_ts - vqueue->ts_real);
+
+  /* slots to visit, at most one full rotation */
+  cur = fqman->wheel_ts >> QMAN_WHEEL_SHIFT;
+  dist = ((max_vts >> QMAN_WHEEL_SHIFT) - cur) &
+    (TIMESTAMP_MASK >> QMAN_WHEEL_SHIFT);
+  if (dist >= QMAN_WHEEL_SLOTS) {
+    dist = QMAN_WHEEL_SLOTS - 1;
+  }
+
+  d = 0;
+  while (cnt < num && *bytes_sum < skpl_state->byte_limit &&
+      fqman->wheel_cnt > 0) {
+    d = flow_wheel_next(fqman, cur, d, dist);
+    if (d > dist) {
+      break;
+    }
+
+    /* take the whole slot list */
+    slot = (cur + d) & WHEEL_SLOT_MASK;
+    idx = fqman->wheel_head[slot];
+    tail = fqman->wheel_tail[slot];
+    fqman->wheel_head[slot] = fqman->wheel_tail[slot] = IDXLIST_INVAL;
+    fqman->wheel_bmp[slot / 64] &= ~(1ULL << (slot % 64));
+
+    keep_head = keep_tail = IDXLIST_INVAL;
+    fired = 0;
+    for (; idx != IDXLIST_INVAL && cnt < num &&
+        *bytes_sum < skpl_state->byte_limit; idx = next_idx) {
+      q = &fqman->queues[idx];
+      next_idx = q->next_idxs[0];
+
+      if (!timestamp_lessthaneq(vqueue, q->next_ts, max_vts)) {
+        /* not due yet, belongs to a later rotation: keep in slot */
+        q->next_idxs[0] = IDXLIST_INVAL;
+        if (keep_tail == IDXLIST_INVAL) {
+          keep_head = idx;
+        } else {
+          fqman->queues[keep_tail].next_idxs[0] = idx;
+        }
+        keep_tail = idx;
+        continue;
+      }
+
+      assert((q->flags & FLAG_INWHEEL) != 0);
+      q->flags &= ~FLAG_INWHEEL;
+      fqman->wheel_cnt--;
+
+      /* advance virtual timestamp, flows within a slot are not ordered */
+      if (timestamp_lessthaneq(vqueue, vqueue->ts_virtual, q->next_ts)) {
+        vqueue->ts_virtual = q->next_ts;
+      }
+
+      dprintf("flow_poll_wheel: t=%p q=%p idx=%u avail=%u rate=%u flags=%x\n",
+          t, q, idx, q->avail, q->rate, q->flags);
+
+      if (q->avail > 0) {
+        flow_queue_fire(t, vqueue, fqman, q, idx, q_ids + cnt,
+            q_bytes + cnt, vm_ids + cnt, bytes_sum);
+        cnt++;
+        fired = 1;
+      }
+    }
+
+    /* batch or byte limit reached: rest of the slot list is kept as is */
+    if (idx != IDXLIST_INVAL) {
+      if (keep_tail == IDXLIST_INVAL) {
+        keep_head = idx;
+      } else {
+        fqman->queues[keep_tail].next_idxs[0] = idx;
+      }
+      keep_tail = tail;
+    }
+
+    /* kept flows go back in front of flows re-added while firing */
+    if (keep_head != IDXLIST_INVAL) {
+      fqman->queues[keep_tail].next_idxs[0] = fqman->wheel_head[slot];
+      if (fqman->wheel_head[slot] == IDXLIST_INVAL) {
+        fqman->wheel_tail[slot] = keep_tail;
+      }
+      fqman->wheel_head[slot] = keep_head;
+      fqman->wheel_bmp[slot / 64] |= 1ULL << (slot % 64);
+    }
+
+    /* revisit slot only if flows fired, they may have been re-added here */
+    if (!fired) {
+      d++;
+    }
+  }
+
+  if (cnt < num && *bytes_sum < skpl_state->byte_limit) {
+    /* caught up to max_vts */
+    if (fqman->wheel_cnt > 0) {
+      skpl_state->rate_limited = 1;
+    }
+    vqueue->ts_virtual = max_vts;
+    fqman->wheel_ts = max_vts & ~((1U << QMAN_WHEEL_SHIFT) - 1);
+  } else {
+    /* stopped early: continue from this slot next time */
+    fqman->wheel_ts = (cur + (d <= dist ? d : dist)) << QMAN_WHEEL_SHIFT;
+  }
+
+  vqueue->ts_real = skpl_state->cur_ts;
+  return cnt;
+}
+
 /*****************************************************************************/
 
 /*****************************************************************************/
@@ -948,6 +1381,8 @@ void qman_free_vm_cont(struct dataplane_context *ctx)
   {
     vq = &vqman->queues[i];
     fqman = vq->fqman;
+    free(fqman->wheel_head);
+    free(fqman->wheel_tail);
     free(fqman->queues);
     free(fqman);
   }
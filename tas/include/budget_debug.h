@@ -29,25 +29,7 @@
 #include <stdio.h>
 
 #include <tas_memif.h>
-#include <virtuoso.h>
-
-#ifdef BUDGET_DEBUG_STATS
-
-#define BUDGET_DEBUG_WINDOW_US 1000000ULL
-#define BUDGET_DEBUG_PERCENT_SCALE 10
-#define BUDGET_DEBUG_PERCENT_BIN_TENTHS 5
-#define BUDGET_DEBUG_NONNEG_MAX_TENTHS (1000 * BUDGET_DEBUG_PERCENT_SCALE)
-#define BUDGET_DEBUG_SIGNED_MIN_TENTHS (-1000 * BUDGET_DEBUG_PERCENT_SCALE)
-#define BUDGET_DEBUG_SIGNED_MAX_TENTHS (100 * BUDGET_DEBUG_PERCENT_SCALE)
-#define BUDGET_DEBUG_NONNEG_REGULAR_BINS \
-  ((BUDGET_DEBUG_NONNEG_MAX_TENTHS / BUDGET_DEBUG_PERCENT_BIN_TENTHS) + 1)
-#define BUDGET_DEBUG_NONNEG_BIN_COUNT \
-  (BUDGET_DEBUG_NONNEG_REGULAR_BINS + 1)
-#define BUDGET_DEBUG_SIGNED_REGULAR_BINS \
-  (((BUDGET_DEBUG_SIGNED_MAX_TENTHS - BUDGET_DEBUG_SIGNED_MIN_TENTHS) / \
-      BUDGET_DEBUG_PERCENT_BIN_TENTHS) + 1)
-#define BUDGET_DEBUG_SIGNED_BIN_COUNT \
-  (BUDGET_DEBUG_SIGNED_REGULAR_BINS + 2)
+#include <tas_telemetry.h>
 
 struct budget_debug_fast_snapshot {
   uint64_t consumed_total;
@@ -55,54 +37,6 @@ struct budget_debug_fast_snapshot {
   uint64_t work_conserving_vm[FLEXNIC_PL_VMST_NUM];
 };
 
-struct budget_debug_u64_stats {
-  uint64_t count;
-  uint64_t sum;
-  uint64_t min;
-  uint64_t max;
-};
-
-struct budget_debug_pct_nonneg_stats {
-  uint64_t count;
-  int64_t sum_tenths;
-  int32_t min_tenths;
-  int32_t max_tenths;
-  uint32_t bins[BUDGET_DEBUG_NONNEG_BIN_COUNT];
-};
-
-struct budget_debug_pct_signed_stats {
-  uint64_t count;
-  int64_t sum_tenths;
-  int32_t min_tenths;
-  int32_t max_tenths;
-  uint32_t bins[BUDGET_DEBUG_SIGNED_BIN_COUNT];
-};
-
-struct budget_debug_core_window {
-  uint64_t periods;
-  uint64_t zero_dist_periods;
-  struct budget_debug_u64_stats consumed;
-  struct budget_debug_u64_stats distributed;
-  struct budget_debug_u64_stats work_conserving;
-  struct budget_debug_u64_stats total_consumed;
-  struct budget_debug_pct_nonneg_stats utilization;
-  struct budget_debug_pct_nonneg_stats consumed_over_elapsed;
-  struct budget_debug_pct_nonneg_stats distributed_over_elapsed;
-  struct budget_debug_pct_nonneg_stats work_conserving_utilization;
-  struct budget_debug_pct_nonneg_stats work_conserving_over_elapsed;
-};
-
-struct budget_debug_vm_window {
-  struct budget_debug_u64_stats consumed;
-  struct budget_debug_u64_stats distributed;
-  struct budget_debug_u64_stats work_conserving;
-  struct budget_debug_pct_nonneg_stats distributed_used;
-  struct budget_debug_pct_nonneg_stats cap_used;
-  struct budget_debug_pct_nonneg_stats work_conserving_used;
-  struct budget_debug_pct_signed_stats budget_pre;
-  struct budget_debug_pct_signed_stats budget_post;
-};
-
 struct budget_debug_window {
   uint64_t start_us;
   uint64_t completed_intervals;
@@ -130,10 +64,18 @@ void budget_debug_record_vm_distribution(struct budget_debug_window *window,
     uint64_t max_budget);
 void budget_debug_publish_core_distribution(struct budget_debug_window *window,
     uint16_t core_id);
-void budget_debug_window_maybe_print(struct budget_debug_window *window,
+/* Whether the current window is complete and should be reported */
+int budget_debug_window_done(const struct budget_debug_window *window,
+    uint64_t now_us);
+void budget_debug_window_print(const struct budget_debug_window *window,
     FILE *out, uint64_t now_us, uint16_t num_cores, const uint16_t *vm_ids,
     uint16_t vm_count);
-
-#endif /* BUDGET_DEBUG_STATS */
+void budget_debug_window_publish(const struct budget_debug_window *window,
+    struct tas_telemetry *telemetry, uint64_t now_us, uint16_t num_cores,
+    const uint16_t *vm_ids, uint16_t vm_count, uint64_t max_budget,
+    const uint64_t *vm_sp_cycles);
+/* Start a new window, also used to discard a partial one */
+void budget_debug_window_reset(struct budget_debug_window *window,
+    uint64_t now_us);
 
 #endif /* ndef BUDGET_DEBUG_H_ */
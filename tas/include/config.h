@@ -27,6 +27,8 @@
 
 #include <stdint.h>
 
+#include <tas_memif.h>
+
 
 /** Supported congestion control algorithms. */
 enum config_cc_algorithm {
@@ -40,6 +42,24 @@ enum config_cc_algorithm {
   CONFIG_CC_CONST_RATE,
 };
 
+/** Supported fast path flow schedulers for rate-limited flows. */
+enum config_qman_algorithm {
+  /** Skiplist ordered by next transmit time */
+  CONFIG_QMAN_SKIPLIST,
+  /** Timing wheel with fixed-size time slots */
+  CONFIG_QMAN_WHEEL,
+};
+
+/** Budget telemetry modes. */
+enum config_bu_telemetry {
+  /** No statistics collected */
+  CONFIG_BU_TELEMETRY_OFF,
+  /** Publish statistics to the telemetry shm region */
+  CONFIG_BU_TELEMETRY_SHM,
+  /** Publish and also print them to stderr */
+  CONFIG_BU_TELEMETRY_PRINT,
+};
+
 /** Struct containing the parsed configuration parameters */
 struct configuration {
   /** shared memory size for one vm */
@@ -74,6 +94,8 @@ struct configuration {
   uint32_t ip;
   /** IP prefix length for this host */
   uint8_t ip_prefix;
+  /** Link MTU [bytes] */
+  uint32_t ip_mtu;
   /** List of routes */
   struct config_route *routes;
   /** Initial ARP timeout in [us] */
@@ -120,8 +142,12 @@ struct configuration {
   uint32_t cc_timely_min_rate;
   /** FP: maximal number of cores used */
   uint32_t fp_cores_max;
+  /** FP: number of flow states allocated at startup */
+  uint32_t fp_flows;
   /** FP: interrupts (blocking) enabled */
   uint32_t fp_interrupts;
+  /** FP: sleeping cores are woken through shared memory doorbells */
+  uint32_t fp_doorbells;
   /** FP: tcp checksum offload enabled */
   uint32_t fp_xsumoffload;
   /** FP: auto scaling enabled */
@@ -130,12 +156,28 @@ struct configuration {
   uint32_t fp_rss;
   /** FP: use huge pages for internal and buffer memory */
   uint32_t fp_hugepages;
+  /** FP: place per-core state and buffers on the core's NUMA node */
+  uint32_t fp_numa;
+  /** FP: scheduler used for rate-limited flows */
+  enum config_qman_algorithm fp_qman;
+  /** FP: DRR quantum in bytes per VM turn, 0 for plain round robin */
+  uint32_t fp_vm_quantum;
+  /** FP: DRR weight for each VM, multiplies the quantum */
+  uint32_t fp_vm_weights[FLEXNIC_PL_VMST_NUM];
+  /** FP: transmit buffers per VM and core, 0 to use the shared pool */
+  uint32_t fp_vm_mbufs[FLEXNIC_PL_VMST_NUM];
   /** FP: enable vlan stripping */
   uint32_t fp_vlan_strip;
   /** FP: polling interval for TAS */
   uint32_t fp_poll_interval_tas;
   /** FP: polling interval for app */
   uint32_t fp_poll_interval_app;
+  /** FP: adapt polling to the load of each core */
+  uint32_t fp_adaptive_poll;
+  /** FP: max latency in us added by the polling back-off */
+  uint32_t fp_backoff_latency;
+  /** FP: gap between work items in us above which cores may sleep */
+  uint32_t fp_sleep_latency;
   /** Max budget for a vm */
   uint64_t bu_max_budget;
   /** Budget update frequency in microseconds */
@@ -146,6 +188,18 @@ struct configuration {
   double bu_use_ratio;
   /** Relative budget threshold below which transmitted packets set TCP ECE; 0 disables */
   double bu_ecn_thresh;
+  /** Budget weight for each VM */
+  double bu_vm_weights[FLEXNIC_PL_VMST_NUM];
+  /** Minimum fraction of the total budget for each VM */
+  double bu_vm_min_share[FLEXNIC_PL_VMST_NUM];
+  /** Maximum fraction of the total budget for each VM */
+  double bu_vm_max_share[FLEXNIC_PL_VMST_NUM];
+  /** Target transmit queueing delay in us for each VM, 0 disables feedback */
+  uint32_t bu_vm_slo_delay[FLEXNIC_PL_VMST_NUM];
+  /** Weight multiplier per update while a VM misses its delay target */
+  double bu_slo_gain;
+  /** Budget telemetry mode, can be changed at runtime */
+  volatile enum config_bu_telemetry bu_telemetry;
   /** SP: kni interface name */
   char *kni_name;
   /** Ready signal fd */
@@ -181,4 +235,7 @@ struct config_route {
  */
 int config_parse(struct configuration *c, int argc, char *argv[]);
 
+/** Parse a budget telemetry mode name, returns the mode or -1 */
+int config_parse_telemetry(const char *s);
+
 #endif /* ndef CONFIG_H_ */
@@ -48,17 +48,27 @@
 
 struct network_thread {
   struct rte_mempool *pool;
+  /* transmit buffers of VMs with a quota, NULL for VMs using pool */
+  struct rte_mempool *vm_pools[FLEXNIC_PL_VMST_NUM];
   uint16_t queue_id;
 };
 
 /** Skiplist: #levels */
 #define QMAN_SKIPLIST_LEVELS 4
+/** Timing wheel: log2 of slot width in ns */
+#define QMAN_WHEEL_SHIFT 10
+/** Timing wheel: #slots, must be a power of two and multiple of 64 */
+#define QMAN_WHEEL_SLOTS 4096
 
 struct qman_thread {
   /* modified by owner thread */
   /************************************/
   struct vm_qman *vqman;
   struct utils_rng rng;
+  /** Use timing wheel instead of skiplist for rate-limited flows */
+  uint8_t wheel;
+  /** DRR quantum across VMs in bytes, 0 for plain round robin */
+  uint32_t vm_quantum;
 };
 
 struct polled_context {
@@ -83,12 +93,60 @@ struct polled_vm {
   struct polled_context ctxs[FLEXNIC_PL_APPST_CTX_NUM];
 };
 
+/* Budget of a VM on one core. The balance is granted - consumed; each
+ * counter has a single writer so neither side needs atomic updates. The
+ * counters the slow path writes and the ones the core writes are on separate
+ * cache lines, so grants do not invalidate the line the core updates on every
+ * iteration. */
 struct vm_budget {
+  /* cycles granted so far, only written by the slow path */
+  volatile int64_t granted;
   uint16_t vmid;
-  volatile int64_t budget;
+
+  /* cycles charged so far, only written by the owning core */
+  volatile int64_t consumed __attribute__((aligned(64)));
+  /* cycles spent while out of budget, only counted with telemetry on */
+  volatile uint64_t wc_consumed;
   volatile uint64_t cycles_poll;
   volatile uint64_t cycles_tx;
   volatile uint64_t cycles_rx;
+  /* bytes scheduled for transmission, only grows */
+  volatile uint64_t tx_bytes;
+} __attribute__((aligned(64)));
+
+static inline int64_t vm_budget_balance(const struct vm_budget *b)
+{
+  return b->granted - b->consumed;
+}
+
+/* Polling modes of a core with adaptive polling (see fast_pollmode.c) */
+/** Spin without pausing */
+#define POLLMODE_BUSY 0
+/** Pause with exponential back-off while idle */
+#define POLLMODE_BACKOFF 1
+/** Back off and block on interrupts after the poll interval */
+#define POLLMODE_SLEEP 2
+
+/** Length of the windows the work rate is measured over */
+#define POLLMODE_WINDOW_US 10
+/** Fraction bits of the work rate */
+#define POLLMODE_RATE_SHIFT 8
+/** First pause of the back-off, in cycles */
+#define POLLMODE_BACKOFF_MIN 128
+
+struct dataplane_pollmode {
+  /* configured window and thresholds in cycles */
+  uint64_t window_cycles;
+  uint64_t backoff_max;
+  uint64_t sleep_gap;
+  /* current measurement window */
+  uint64_t win_start;
+  uint64_t win_work;
+  /* work items per window, averaged, with POLLMODE_RATE_SHIFT fraction bits */
+  uint64_t rate;
+  /* current back-off pause in cycles, 0 if not backing off */
+  uint64_t backoff;
+  uint8_t mode;
 };
 
 struct dataplane_batch_stats {
@@ -105,6 +163,7 @@ struct dataplane_context {
   struct qman_thread qman;
   struct rte_ring *qman_fwd_ring;
   uint16_t id;
+  uint16_t numa_node;
   int evfd;
   struct rte_epoll_event ev;
 
@@ -133,6 +192,11 @@ struct dataplane_context {
   /* group resource budget */
   int counters_total;
   int vm_counters[FLEXNIC_PL_VMST_NUM];
+  /* same for work done without budget, only with telemetry on */
+  int wc_counters_total;
+  int wc_counters[FLEXNIC_PL_VMST_NUM];
+  /* next charged VM to get the rounding remainder of a phase */
+  uint16_t budget_rest_next;
   struct vm_budget budgets[FLEXNIC_PL_VMST_NUM];
 
   /********************************************************/
@@ -141,8 +205,18 @@ struct dataplane_context {
   uint16_t bufcache_num;
   uint16_t bufcache_head;
 
+  /********************************************************/
+  /* per VM buffer counters, read by the slow path */
+  /* segments deferred because the VM's buffer pool was empty */
+  uint64_t vm_buf_backpressure[FLEXNIC_PL_VMST_NUM];
+  /* received packets dropped because other VMs had budget */
+  uint64_t vm_rx_drops[FLEXNIC_PL_VMST_NUM];
+
   uint64_t loadmon_cyc_busy;
 
+  /* adaptive polling state */
+  struct dataplane_pollmode pollmode;
+
   uint64_t kernel_drop;
 #ifdef BATCH_SIZE_STATS
   uint64_t stat_batch_rx_polls;
@@ -152,13 +226,6 @@ struct dataplane_context {
   uint64_t stat_batch_qs_polls;
   uint64_t stat_batch_qs_total;
 #endif
-#ifdef BUDGET_DEBUG_STATS
-  volatile uint64_t budget_debug_consumed_total;
-  volatile uint64_t budget_debug_consumed_vm[FLEXNIC_PL_VMST_NUM];
-  int budget_debug_work_conserving_total;
-  int budget_debug_work_conserving_vm[FLEXNIC_PL_VMST_NUM];
-  volatile uint64_t budget_debug_work_conserving_cycles[FLEXNIC_PL_VMST_NUM];
-#endif
 #ifdef DATAPLANE_STATS
   /********************************************************/
   /* Stats */
@@ -178,6 +245,8 @@ struct dataplane_context {
   uint64_t stat_cyc_qm;
   uint64_t stat_cyc_rx;
   uint64_t stat_cyc_qs;
+
+  uint64_t stat_numa_remote;
 #endif
 };
 
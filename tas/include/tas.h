@@ -41,7 +41,15 @@ extern struct configuration config;
 extern void **vm_shm;
 extern int *vm_shm_fd;
 extern struct flextcp_pl_mem *fp_state;
+/* runtime-sized parts of internal memory, see flexnic_info_layout() */
+extern struct flextcp_pl_corest *fp_cores;
+extern struct flextcp_pl_flowst *fp_flowst;
+extern struct flextcp_pl_flowhte *fp_flowht;
+extern uint32_t fp_flowst_num;
+extern uint32_t fp_flowht_mask;
 extern struct flexnic_info *tas_info;
+extern struct tas_telemetry *tas_telemetry;
+extern struct flexnic_doorbells *tas_doorbells;
 extern _Atomic uint16_t tas_registered_vm_count;
 extern uint16_t tas_registered_vm_ids[FLEXNIC_PL_VMST_NUM];
 extern _Atomic uint16_t tas_registered_ctx_counts[FLEXNIC_PL_VMST_NUM];
@@ -62,6 +70,15 @@ int shm_init(unsigned num);
 void shm_cleanup(void);
 void shm_set_ready(void);
 
+/** Number of NUMA nodes shared memory is placed on (1 if disabled). */
+unsigned shm_numa_nodes(void);
+/** Record NUMA node of fast path core and move its registers there. */
+int shm_numa_core(unsigned core, int node);
+/** NUMA node of fast path core, or -1 if not known. */
+int shm_numa_core_node(unsigned core);
+/** Prefer NUMA node for all whole pages in the specified range. */
+int shm_numa_place(void *addr, size_t len, int node);
+
 int network_init(unsigned num_threads);
 void network_cleanup(void);
 
@@ -71,14 +88,24 @@ void *util_create_shmsiszed(const char *name, size_t size,
 
 struct notify_blockstate {
   uint64_t last_active_ts;
+  /* cycles to poll before blocking, adapts to how long sleeps last */
+  uint64_t spin_cycles;
+  /* when the core went to sleep, 0 while it is not blocked */
+  uint64_t block_ts;
+  /* doorbell of this core, NULL if doorbells are disabled */
+  struct util_doorbell *db;
   int can_block;
   int second_bar;
 };
 
 void notify_fastpath_core(unsigned core);
-void notify_appctx(struct flextcp_pl_appctx *ctx, uint64_t tsc);
-void notify_app_core(int appfd, uint64_t *last_tsc);
+void notify_appctx(struct flextcp_pl_appctx *ctx, uint16_t vmid,
+    uint16_t dbid, uint64_t tsc);
+void notify_app_core(uint16_t vmid, uint16_t dbid, int appfd,
+    uint64_t *last_tsc);
 void notify_slowpath_core(void);
+void notify_canblock_init(struct notify_blockstate *nbs,
+    struct util_doorbell *db);
 int notify_canblock(struct notify_blockstate *nbs, int had_data, uint64_t tsc);
 void notify_canblock_reset(struct notify_blockstate *nbs);
 void tas_register_vm(uint16_t vmid);
@@ -101,11 +128,6 @@ static inline uint16_t tas_registered_ctx_count_get(uint16_t vmid)
       memory_order_acquire);
 }
 
-/* should become config options */
-#define FLEXNIC_INTERNAL_MEM_SIZE (1024 * 1024 * 32)
-
-#define FLEXNIC_NUM_QMFLOWQUEUES (128 * 1024)
 #define FLEXNIC_NUM_QMAPPQUEUES (FLEXNIC_PL_APPST_NUM)
-#define FLEXNIC_NUM_QMQUEUES (FLEXNIC_NUM_QMAPPQUEUES * FLEXNIC_NUM_QMFLOWQUEUES)
 
 #endif /* ndef TAS_H_ */
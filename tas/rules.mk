@@ -4,7 +4,7 @@ objs_top := tas.o config.o shm.o blocking.o
 objs_sp := kernel.o budget.o budget_debug.o packetmem.o appif.o appif_connect.o appif_ctx.o \
  nicif.o cc.o tcp.o arp.o routing.o kni.o
 objs_fp := fastemu.o network.o qman.o trace.o \
- fast_kernel.o fast_appctx.o fast_flows.o
+ fast_kernel.o fast_appctx.o fast_flows.o fast_budget.o fast_pollmode.o
 
 TAS_OBJS := $(addprefix $(d)/, \
   $(objs_top) \
@@ -20,7 +20,7 @@ $(TAS_OBJS): CPPFLAGS += $(TAS_CPPFLAGS)
 $(TAS_OBJS): CFLAGS += $(TAS_CFLAGS)
 
 $(exec): LDFLAGS += $(DPDK_LDFLAGS)
-$(exec): LDLIBS += $(DPDK_LDLIBS) 
+$(exec): LDLIBS += $(DPDK_LDLIBS) -lnuma
 $(exec): $(TAS_OBJS) $(LIB_UTILS_OBJS) $(LIB_TAS_OBJS)
 
 DEPS += $(TAS_OBJS:.o=.d)
@@ -33,20 +33,41 @@
 #include <errno.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <numaif.h>
 
 #include <utils.h>
 #include <rte_config.h>
+#include <rte_lcore.h>
 #include <rte_malloc.h>
 #include <rte_cycles.h>
 
 #include <tas.h>
 #include <utils_shm.h>
 #include <tas_memif.h>
+#include <tas_telemetry.h>
 
 void **vm_shm = NULL;
 int *vm_shm_fd = NULL;
 struct flextcp_pl_mem *fp_state = NULL;
+struct flextcp_pl_corest *fp_cores = NULL;
+struct flextcp_pl_flowst *fp_flowst = NULL;
+struct flextcp_pl_flowhte *fp_flowht = NULL;
+uint32_t fp_flowst_num = 0;
+uint32_t fp_flowht_mask = 0;
 struct flexnic_info *tas_info = NULL;
+struct tas_telemetry *tas_telemetry = NULL;
+struct flexnic_doorbells *tas_doorbells = NULL;
+
+#define SHM_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* sizes and offsets of internal memory, copied to tas_info in shm_init */
+static struct flexnic_info mem_layout;
+static size_t internal_mem_size;
+
+/* number of NUMA nodes memory is spread across (1 if disabled) */
+static unsigned numa_nodes = 1;
+/* NUMA node of each fast path core, -1 if not known */
+static int *core_nodes = NULL;
 
 /* convert microseconds to cycles */
 static uint64_t us_to_cycles(uint32_t us);
@@ -85,13 +106,19 @@ int shm_preinit(void)
     }
   }
 
+  /* size internal memory for configured flows and cores */
+  internal_mem_size = flexnic_info_layout(&mem_layout, config.fp_flows,
+      config.fp_cores_max);
+  internal_mem_size = (internal_mem_size + SHM_HUGEPAGE_SIZE - 1) &
+      ~(SHM_HUGEPAGE_SIZE - 1);
+
   /* create shm for internal memory */
   if (config.fp_hugepages) {
     fp_state = util_create_shmsiszed_huge(FLEXNIC_NAME_INTERNAL_MEM,
-        FLEXNIC_INTERNAL_MEM_SIZE, NULL, NULL, FLEXNIC_HUGE_PREFIX);
+        internal_mem_size, NULL, NULL, FLEXNIC_HUGE_PREFIX);
   } else {
     fp_state = util_create_shmsiszed(FLEXNIC_NAME_INTERNAL_MEM,
-        FLEXNIC_INTERNAL_MEM_SIZE, NULL, NULL);
+        internal_mem_size, NULL, NULL);
   }
   if (fp_state == NULL) {
     fprintf(stderr, "mapping flexnic internal memory failed\n");
@@ -99,13 +126,33 @@ int shm_preinit(void)
     return -1;
   }
 
+  fp_cores = (void *) ((uint8_t *) fp_state + mem_layout.corest_off);
+  fp_flowst = (void *) ((uint8_t *) fp_state + mem_layout.flowst_off);
+  fp_flowht = (void *) ((uint8_t *) fp_state + mem_layout.flowht_off);
+  fp_flowst_num = mem_layout.flowst_num;
+  fp_flowht_mask = mem_layout.flowht_entries - 1;
+
   return 0;
 }
 
 int shm_init(unsigned num)
 {
+  unsigned i;
+
   umask(0);
 
+  if ((core_nodes = malloc(num * sizeof(*core_nodes))) == NULL) {
+    fprintf(stderr, "shm_init: allocating core nodes failed\n");
+    return -1;
+  }
+  for (i = 0; i < num; i++) {
+    core_nodes[i] = -1;
+  }
+
+  if (config.fp_numa) {
+    numa_nodes = rte_socket_count();
+  }
+
   /* create shm for tas_info */
   tas_info = util_create_shmsiszed(FLEXNIC_NAME_INFO, FLEXNIC_INFO_BYTES,
       NULL, NULL);
@@ -115,19 +162,51 @@ int shm_init(unsigned num)
     return -1;
   }
 
+  /* create shm for budget telemetry, only written to when enabled */
+  tas_telemetry = util_create_shmsiszed(FLEXNIC_NAME_TELEMETRY,
+      sizeof(*tas_telemetry), NULL, NULL);
+  if (tas_telemetry == NULL) {
+    fprintf(stderr, "mapping budget telemetry failed\n");
+    shm_cleanup();
+    return -1;
+  }
+  tas_telemetry->magic = TAS_TELEMETRY_MAGIC;
+  tas_telemetry->version = TAS_TELEMETRY_VERSION;
+
+  /* create shm for doorbells, mapped by applications if enabled */
+  tas_doorbells = util_create_shmsiszed(FLEXNIC_NAME_DOORBELLS,
+      sizeof(*tas_doorbells), NULL, NULL);
+  if (tas_doorbells == NULL) {
+    fprintf(stderr, "mapping doorbells failed\n");
+    shm_cleanup();
+    return -1;
+  }
+
   tas_info->dma_mem_size = config.vm_shm_len;
   tas_info->dma_mem_off = 0;
-  tas_info->internal_mem_size = FLEXNIC_INTERNAL_MEM_SIZE;
-  tas_info->qmq_num = FLEXNIC_NUM_QMQUEUES;
+  tas_info->internal_mem_size = internal_mem_size;
+  tas_info->qmq_num = FLEXNIC_NUM_QMAPPQUEUES * fp_flowst_num;
   tas_info->cores_num = num;
   tas_info->mac_address = 0;
   tas_info->poll_cycle_app = us_to_cycles(config.fp_poll_interval_app);
   tas_info->poll_cycle_tas = us_to_cycles(config.fp_poll_interval_tas);
   tas_info->nic_rx_len = config.nic_rx_len;
   tas_info->nic_tx_len = config.nic_tx_len;
+  tas_info->flowst_num = mem_layout.flowst_num;
+  tas_info->flowht_entries = mem_layout.flowht_entries;
+  tas_info->corest_num = mem_layout.corest_num;
+  tas_info->corest_off = mem_layout.corest_off;
+  tas_info->flowst_off = mem_layout.flowst_off;
+  tas_info->flowht_off = mem_layout.flowht_off;
+  tas_info->vmst_num = mem_layout.vmst_num;
+  tas_info->appctx_num = mem_layout.appctx_num;
+  tas_info->appst_ctx_num = mem_layout.appst_ctx_num;
+  tas_info->appst_ctx_mcs = mem_layout.appst_ctx_mcs;
 
   if (config.fp_hugepages)
     tas_info->flags |= FLEXNIC_FLAG_HUGEPAGES;
+  if (config.fp_doorbells)
+    tas_info->flags |= FLEXNIC_FLAG_DOORBELLS;
 
   return 0;
 }
@@ -140,10 +219,10 @@ void shm_cleanup(void)
   /* cleanup internal memory region */
   if (fp_state != NULL) {
     if (config.fp_hugepages) {
-      util_destroy_shm_huge(FLEXNIC_NAME_INTERNAL_MEM, FLEXNIC_INTERNAL_MEM_SIZE,
+      util_destroy_shm_huge(FLEXNIC_NAME_INTERNAL_MEM, internal_mem_size,
           fp_state, FLEXNIC_HUGE_PREFIX);
     } else {
-      util_destroy_shm(FLEXNIC_NAME_INTERNAL_MEM, FLEXNIC_INTERNAL_MEM_SIZE,
+      util_destroy_shm(FLEXNIC_NAME_INTERNAL_MEM, internal_mem_size,
           fp_state);
     }
   }
@@ -159,10 +238,25 @@ void shm_cleanup(void)
     }
   }
 
+  free(core_nodes);
+  core_nodes = NULL;
+
   /* cleanup tas_info memory region */
   if (tas_info != NULL) {
     util_destroy_shm(FLEXNIC_NAME_INFO, FLEXNIC_INFO_BYTES, tas_info);
   }
+
+  /* cleanup telemetry memory region */
+  if (tas_telemetry != NULL) {
+    util_destroy_shm(FLEXNIC_NAME_TELEMETRY, sizeof(*tas_telemetry),
+        tas_telemetry);
+  }
+
+  /* cleanup doorbell memory region */
+  if (tas_doorbells != NULL) {
+    util_destroy_shm(FLEXNIC_NAME_DOORBELLS, sizeof(*tas_doorbells),
+        tas_doorbells);
+  }
 }
 
 void shm_set_ready(void)
@@ -170,6 +264,55 @@ void shm_set_ready(void)
   tas_info->flags |= FLEXNIC_FLAG_READY;
 }
 
+unsigned shm_numa_nodes(void)
+{
+  return numa_nodes;
+}
+
+int shm_numa_core(unsigned core, int node)
+{
+  core_nodes[core] = node;
+
+  /* registers polled by this core */
+  return shm_numa_place(&fp_cores[core], sizeof(fp_cores[core]), node);
+}
+
+int shm_numa_core_node(unsigned core)
+{
+  if (core_nodes == NULL || core >= tas_info->cores_num) {
+    return -1;
+  }
+  return core_nodes[core];
+}
+
+int shm_numa_place(void *addr, size_t len, int node)
+{
+  uintptr_t pg, start, end;
+  unsigned long mask;
+
+  if (numa_nodes <= 1 || node < 0 || node >= numa_nodes) {
+    return 0;
+  }
+
+  /* only whole pages can be placed */
+  pg = (config.fp_hugepages ? SHM_HUGEPAGE_SIZE : sysconf(_SC_PAGESIZE));
+  start = ((uintptr_t) addr + pg - 1) & ~(pg - 1);
+  end = ((uintptr_t) addr + len) & ~(pg - 1);
+  if (end <= start) {
+    return 0;
+  }
+
+  mask = 1UL << node;
+  if (mbind((void *) start, end - start, MPOL_PREFERRED, &mask,
+        sizeof(mask) * 8, MPOL_MF_MOVE) != 0)
+  {
+    perror("shm_numa_place: mbind failed");
+    return -1;
+  }
+
+  return 0;
+}
+
 static uint64_t us_to_cycles(uint32_t us)
 {
   if (us == UINT32_MAX) {
@@ -54,6 +54,7 @@
 #include <sys/eventfd.h>
 
 #include <tas.h>
+#include <utils.h>
 #include "internal.h"
 #include "appif.h"
 #include <kernel_appif.h>
@@ -154,8 +155,8 @@ unsigned appif_poll(void)
   ssize_t ret;
   uint16_t i;
   uint64_t rxq_offs[tas_info->cores_num], txq_offs[tas_info->cores_num];
-  uint64_t cnt = 1;
-  unsigned n = 0;
+  uint64_t cnt = 1, s_cycs;
+  unsigned n = 0, m;
 
   /* add new applications to list */
   while ((p = nbqueue_deq(&ux_to_poll)) != NULL) {
@@ -194,7 +195,12 @@ unsigned appif_poll(void)
       if (ctx->ready == 0) {
         continue;
       }
-      n += appif_ctx_poll(app, ctx);
+      s_cycs = util_rdtsc();
+      m = appif_ctx_poll(app, ctx);
+      if (m > 0) {
+        budget_sp_charge(app->vm_id, util_rdtsc() - s_cycs);
+        n += m;
+      }
     }
   }
 
@@ -738,6 +744,7 @@ static void uxsocket_notify(void)
 static void uxsocket_error(struct application *app)
 {
   struct app_context *ctx, *prev_ctx;
+  struct pending_open *po;
   epoll_ctl(epfd, EPOLL_CTL_DEL, app->fd, NULL);
   close(app->fd);
   free(app->resp);
@@ -748,6 +755,10 @@ static void uxsocket_error(struct application *app)
   {
     prev_ctx = ctx;
     ctx = ctx->next;
+    while ((po = prev_ctx->open_head) != NULL) {
+      prev_ctx->open_head = po->next;
+      free(po);
+    }
     free(prev_ctx);
   }
 }
@@ -762,6 +773,7 @@ static void uxsocket_receive(struct application *app)
   size_t kin_qsize, kout_qsize, ctx_sz;
   struct epoll_event ev;
   struct appif_event *aev;
+  struct util_doorbell *db;
   uint16_t i;
   int evfd = 0;
 
@@ -827,14 +839,14 @@ static void uxsocket_receive(struct application *app)
 
   /* allocate packet memory for flexnic queues */
   for (i = 0; i < tas_info->cores_num; i++) {
-    if (packetmem_alloc(app->req.rxq_len, &off_rxq,
-        &ctx->handles[i].rxq, app->vm_id) != 0)
+    if (packetmem_alloc_node(app->req.rxq_len, &off_rxq,
+        &ctx->handles[i].rxq, app->vm_id, shm_numa_core_node(i)) != 0)
     {
       fprintf(stderr, "uxsocket_receive: packetmem_alloc rxq failed\n");
       goto error_pktmem;
     }
-    if (packetmem_alloc(app->req.txq_len, &off_txq,
-        &ctx->handles[i].txq, app->vm_id) != 0)
+    if (packetmem_alloc_node(app->req.txq_len, &off_txq,
+        &ctx->handles[i].txq, app->vm_id, shm_numa_core_node(i)) != 0)
     {
       fprintf(stderr, "uxsocket_receive: packetmem_alloc txq failed\n");
       packetmem_free(ctx->handles[i].rxq, app->vm_id);
@@ -869,6 +881,7 @@ static void uxsocket_receive(struct application *app)
   memset(ctx->kout_base, 0, kout_qsize);
 
   ctx->ready = 0;
+  ctx->open_head = ctx->open_tail = NULL;
   assert(evfd != 0);	// XXX: Will be 0 if request was broken up
   ctx->evfd = evfd;
 
@@ -884,6 +897,11 @@ static void uxsocket_receive(struct application *app)
     app->forked_ctxs = f_ctx;
   }
 
+  /* doorbell stays unarmed until the application maps it */
+  db = &tas_doorbells->app[app->vm_id][ctx->doorbell->id];
+  db->armed = 0;
+  util_doorbell_cancel(db);
+
   /* initialize response */
   app->resp->app_out_off = off_in;
   app->resp->app_out_len = kin_qsize;
@@ -891,6 +909,7 @@ static void uxsocket_receive(struct application *app)
   app->resp->app_in_len = kout_qsize;
   app->resp->flexnic_db_id = ctx->doorbell->id;
   app->resp->flexnic_qs_num = tas_info->cores_num;
+  app->resp->flexnic_vm_id = app->vm_id;
   app->resp->status = 0;
   fprintf(stderr, "Creating new context: db_id=%d\n", ctx->doorbell->id);
 
@@ -37,6 +37,18 @@ struct app_doorbell {
   struct app_doorbell *next;
 };
 
+/** Maximum number of connection opens parked per context, further requests
+ * stay in the context queue until the VM has budget again */
+#define APPIF_PARKED_OPENS_MAX 128
+
+/** Connection open request parked while the VM was over budget */
+struct pending_open {
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint16_t remote_port;
+  struct pending_open *next;
+};
+
 struct app_context {
   struct application *app;
   struct packetmem_handle *kin_handle;
@@ -55,6 +67,11 @@ struct app_context {
   uint64_t last_ts;
   struct app_context *next;
 
+  /* connection opens waiting for budget, in request order */
+  struct pending_open *open_head;
+  struct pending_open *open_tail;
+  uint32_t open_num;
+
   struct {
     struct packetmem_handle *rxq;
     struct packetmem_handle *txq;
@@ -32,11 +32,19 @@
 #include <unistd.h>
 
 #include <tas.h>
+#include <tas_telemetry.h>
 #include "internal.h"
 #include "appif.h"
 
 static int kin_conn_open(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int conn_open(struct application *app, struct app_context *ctx,
+    uint64_t opaque, uint32_t remote_ip, uint16_t remote_port,
+    volatile struct kernel_appin *kout);
+static int conn_open_park(struct app_context *ctx,
+    volatile struct kernel_appout *kin);
+static int conn_open_pending(struct application *app,
+    struct app_context *ctx, volatile struct kernel_appin *kout);
 static int kin_conn_move(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 static int kin_conn_close(struct application *app, struct app_context *ctx,
@@ -47,6 +55,8 @@ static int kin_listen_move(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 static int kin_accept_conn(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int kin_accept_conns(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 static int kin_fork(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 static int kin_req_scale(struct application *app, struct app_context *ctx,
@@ -55,7 +65,8 @@ static int kin_req_scale(struct application *app, struct app_context *ctx,
 static void appif_ctx_kick(struct app_context *ctx)
 {
   assert(ctx->evfd != 0);
-  notify_app_core(ctx->evfd, &ctx->last_ts);
+  notify_app_core(ctx->app->vm_id, ctx->doorbell->id, ctx->evfd,
+      &ctx->last_ts);
 }
 
 void appif_conn_opened(struct connection *c, int status)
@@ -91,6 +102,7 @@ void appif_conn_opened(struct connection *c, int status)
     kout->data.conn_opened.tunnel_id = c->tunnel_id;
     kout->data.conn_opened.flow_id = c->flow_id;
     kout->data.conn_opened.fn_core = c->fn_core;
+    kout->data.conn_opened.mss = c->tx_mss;
   } else {
     /* remove from app connection list */
     if (app->conns == c) {
@@ -223,58 +235,68 @@ void appif_listen_newconn_gre(struct listener *l,
   ctx->kout_pos = kout_pos;
 }
 
-void appif_accept_conn(struct connection *c, int status)
+static void accept_conn_notify(struct app_context *ctx, struct connection *c,
+    int status)
 {
-  struct forked_context *f_ctx;
-  struct app_context *ctx = c->ctx;
   struct application *app = ctx->app;
+  volatile struct kernel_appin *kout = ctx->kout_base;
+  uint32_t kout_pos = ctx->kout_pos;
 
-  for (f_ctx = app->forked_ctxs; f_ctx != NULL; f_ctx = f_ctx->next)
-  {
-    ctx = f_ctx->ctx;
+  kout += kout_pos;
 
-    volatile struct kernel_appin *kout = ctx->kout_base;
-    uint32_t kout_pos = ctx->kout_pos;
+  /* make sure we have room for a response */
+  if (kout->type != KERNEL_APPIN_INVALID) {
+    fprintf(stderr, "appif_accept_conn: No space in kout queue (TODO)\n");
+    return;
+  }
 
-    kout += kout_pos;
+  kout->data.accept_connection.opaque = c->opaque;
+  kout->data.accept_connection.status = status;
+  if (status == 0) {
+    kout->data.accept_connection.rx_off = c->rx_buf - (uint8_t *) vm_shm[app->vm_id];
+    kout->data.accept_connection.tx_off = c->tx_buf - (uint8_t *) vm_shm[app->vm_id];
+    kout->data.accept_connection.rx_len = c->rx_len;
+    kout->data.accept_connection.tx_len = c->tx_len;
+
+    kout->data.accept_connection.seq_rx = c->remote_seq;
+    kout->data.accept_connection.seq_tx = c->local_seq;
+    kout->data.accept_connection.tunnel_id = c->tunnel_id;
+    kout->data.accept_connection.out_local_ip = config.ip;
+    kout->data.accept_connection.out_remote_ip = c->out_remote_ip;
+    kout->data.accept_connection.in_local_ip = c->in_local_ip;
+    kout->data.accept_connection.in_remote_ip = c->in_remote_ip;
+    kout->data.accept_connection.remote_port = c->remote_port;
+    kout->data.accept_connection.flow_id = c->flow_id;
+    kout->data.accept_connection.fn_core = c->fn_core;
+    kout->data.accept_connection.mss = c->tx_mss;
+  } else {
+    tcp_destroy(c);
+  }
 
-    /* make sure we have room for a response */
-    if (kout->type != KERNEL_APPIN_INVALID) {
-      fprintf(stderr, "appif_accept_conn: No space in kout queue (TODO)\n");
-      return;
-    }
+  MEM_BARRIER();
+  kout->type = KERNEL_APPIN_ACCEPTED_CONN;
+  appif_ctx_kick(ctx);
 
-    kout->data.accept_connection.opaque = c->opaque;
-    kout->data.accept_connection.status = status;
-    if (status == 0) {
-      kout->data.accept_connection.rx_off = c->rx_buf - (uint8_t *) vm_shm[app->vm_id];
-      kout->data.accept_connection.tx_off = c->tx_buf - (uint8_t *) vm_shm[app->vm_id];
-      kout->data.accept_connection.rx_len = c->rx_len;
-      kout->data.accept_connection.tx_len = c->tx_len;
-
-      kout->data.accept_connection.seq_rx = c->remote_seq;
-      kout->data.accept_connection.seq_tx = c->local_seq;
-      kout->data.accept_connection.tunnel_id = c->tunnel_id;
-      kout->data.accept_connection.out_local_ip = config.ip;
-      kout->data.accept_connection.out_remote_ip = c->out_remote_ip;
-      kout->data.accept_connection.in_local_ip = c->in_local_ip;
-      kout->data.accept_connection.in_remote_ip = c->in_remote_ip;
-      kout->data.accept_connection.remote_port = c->remote_port;
-      kout->data.accept_connection.flow_id = c->flow_id;
-      kout->data.accept_connection.fn_core = c->fn_core;
-    } else {
-      tcp_destroy(c);
-    }
+  kout_pos++;
+  if (kout_pos >= ctx->kout_len) {
+    kout_pos = 0;
+  }
+  ctx->kout_pos = kout_pos;
+}
 
-    MEM_BARRIER();
-    kout->type = KERNEL_APPIN_ACCEPTED_CONN;
-    appif_ctx_kick(ctx);
+void appif_accept_conn(struct connection *c, int status)
+{
+  struct forked_context *f_ctx;
+  struct app_context *ctx = c->ctx;
+  struct application *app = ctx->app;
 
-    kout_pos++;
-    if (kout_pos >= ctx->kout_len) {
-      kout_pos = 0;
+  if ((c->accept_steer & KERNEL_APPOUT_LISTEN_STEER_CTX) != 0) {
+    /* steered listeners deliver to the context that posted the accept */
+    accept_conn_notify(ctx, c, status);
+  } else {
+    for (f_ctx = app->forked_ctxs; f_ctx != NULL; f_ctx = f_ctx->next) {
+      accept_conn_notify(f_ctx->ctx, c, status);
     }
-    ctx->kout_pos = kout_pos;
   }
 
   c->app_next = app->conns;
@@ -299,6 +321,19 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
     return 0;
   }
 
+  /* parked connection opens go first once the VM has budget again */
+  if (ctx->open_head != NULL && budget_vm_admit(app->vm_id)) {
+    kout_inc = conn_open_pending(app, ctx, kout);
+    if (kout_inc > 0) {
+      kout_pos += kout_inc;
+      if (kout_pos >= ctx->kout_len) {
+        kout_pos = 0;
+      }
+      ctx->kout_pos = kout_pos;
+    }
+    return 1;
+  }
+
   type = kin->type;
   MEM_BARRIER();
 
@@ -308,7 +343,17 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
       return 0;
 
     case KERNEL_APPOUT_CONN_OPEN:
-      /* connection request */
+      /* connection request, parked while the VM is over budget or earlier
+       * opens are still parked, so the rest of the queue keeps moving. Once
+       * too many are parked the request stays queued instead. */
+      if (ctx->open_head != NULL || !budget_vm_admit(app->vm_id)) {
+        if (ctx->open_num >= APPIF_PARKED_OPENS_MAX) {
+          return 0;
+        }
+        if (conn_open_park(ctx, kin) == 0) {
+          break;
+        }
+      }
       kout_inc += kin_conn_open(app, ctx, kin, kout);
       break;
 
@@ -337,6 +382,14 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
       kout_inc += kin_accept_conn(app, ctx, kin, kout);
       break;
 
+    case KERNEL_APPOUT_ACCEPT_CONNS:
+      /* batch of accept requests, stays queued with the slots not handled
+       * yet if kout fills up */
+      if (kin_accept_conns(app, ctx, kin, kout) != 0) {
+        return 0;
+      }
+      break;
+
     case KERNEL_APPOUT_FORK:
       /* handle application forking */
       kout_inc += kin_fork(app, ctx, kin, kout);
@@ -377,14 +430,65 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
 
 static int kin_conn_open(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  return conn_open(app, ctx, kin->data.conn_open.opaque,
+      kin->data.conn_open.remote_ip, kin->data.conn_open.remote_port, kout);
+}
+
+/* Copy a connection open request out of the queue to serve it later */
+static int conn_open_park(struct app_context *ctx,
+    volatile struct kernel_appout *kin)
+{
+  struct pending_open *po;
+
+  if ((po = malloc(sizeof(*po))) == NULL) {
+    fprintf(stderr, "conn_open_park: malloc failed\n");
+    return -1;
+  }
+
+  po->opaque = kin->data.conn_open.opaque;
+  po->remote_ip = kin->data.conn_open.remote_ip;
+  po->remote_port = kin->data.conn_open.remote_port;
+  po->next = NULL;
+
+  if (ctx->open_tail == NULL) {
+    ctx->open_head = po;
+  } else {
+    ctx->open_tail->next = po;
+  }
+  ctx->open_tail = po;
+  ctx->open_num++;
+  return 0;
+}
+
+/* Serve the oldest parked connection open request */
+static int conn_open_pending(struct application *app,
+    struct app_context *ctx, volatile struct kernel_appin *kout)
+{
+  struct pending_open *po = ctx->open_head;
+  int ret;
+
+  ctx->open_head = po->next;
+  if (ctx->open_head == NULL) {
+    ctx->open_tail = NULL;
+  }
+  ctx->open_num--;
+
+  ret = conn_open(app, ctx, po->opaque, po->remote_ip, po->remote_port, kout);
+  free(po);
+  return ret;
+}
+
+static int conn_open(struct application *app, struct app_context *ctx,
+    uint64_t opaque, uint32_t remote_ip, uint16_t remote_port,
+    volatile struct kernel_appin *kout)
 {
   struct connection *conn;
 
-  if (tcp_open(ctx, kin->data.conn_open.opaque,
-      kin->data.conn_open.remote_ip,
-      kin->data.conn_open.remote_port, ctx->doorbell->id, &conn) != 0)
+  if (tcp_open(ctx, opaque, remote_ip, remote_port, ctx->doorbell->id,
+      &conn) != 0)
   {
-    fprintf(stderr, "kin_conn_open: tcp_open failed\n");
+    fprintf(stderr, "conn_open: tcp_open failed\n");
     goto error;
   }
 
@@ -394,7 +498,7 @@ static int kin_conn_open(struct application *app, struct app_context *ctx,
   return 0;
 
 error:
-  kout->data.conn_opened.opaque = kin->data.conn_open.opaque;
+  kout->data.conn_opened.opaque = opaque;
   kout->data.conn_opened.status = -1;
   MEM_BARRIER();
   kout->type = KERNEL_APPIN_CONN_OPENED;
@@ -567,6 +671,8 @@ static int kin_listen_open(struct application *app, struct app_context *ctx,
     goto error;
   }
 
+  listen->steer = kin->data.listen_open.flags &
+    (KERNEL_APPOUT_LISTEN_STEER_CTX | KERNEL_APPOUT_LISTEN_STEER_CORE);
   listen->app_next = app->listeners;
   app->listeners = listen;
 
@@ -601,8 +707,11 @@ static int kin_accept_conn(struct application *app, struct app_context *ctx,
     }
   }
 
+  tas_telemetry->accept.slots_posted++;
+  tas_telemetry->accept.post_entries++;
+
   if (tcp_accept(ctx, kin->data.accept_conn.conn_opaque, listen,
-        ctx->doorbell->id) != 0)
+        ctx->doorbell->id, KERNEL_APPOUT_ACCEPT_ANYCORE) != 0)
   {
     fprintf(stderr, "kin_accept_conn\n");
     goto error;
@@ -619,6 +728,71 @@ error:
   return 1;
 }
 
+static int kin_accept_conns(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  struct listener *listen;
+  uint64_t opaque;
+  uint32_t kout_pos;
+  uint8_t i, j, num = kin->data.accept_conns.num;
+
+  /* look for listen struct */
+  for (listen = app->listeners; listen != NULL; listen = listen->app_next) {
+    if (listen->port == kin->data.accept_conns.local_port &&
+        listen->opaque == kin->data.accept_conns.listen_opaque)
+    {
+      break;
+    }
+  }
+
+  if (num > KERNEL_APPOUT_ACCEPT_BATCH) {
+    num = KERNEL_APPOUT_ACCEPT_BATCH;
+  }
+
+  for (i = 0; i < num; i++) {
+    opaque = kin->data.accept_conns.conn_opaques[i];
+    if (listen != NULL &&
+        tcp_accept(ctx, opaque, listen, ctx->doorbell->id,
+          kin->data.accept_conns.core) == 0)
+    {
+      tas_telemetry->accept.slots_posted++;
+      continue;
+    }
+
+    /* the first entry was checked by the caller, but not the following. A
+     * failed slot needs a reply, or the application's accept ring stalls, so
+     * the slots from here on are kept in the entry and retried once the
+     * application has drained kout. */
+    kout = (volatile struct kernel_appin *) ctx->kout_base + ctx->kout_pos;
+    if (kout->type != KERNEL_APPIN_INVALID) {
+      for (j = i; j < num; j++) {
+        kin->data.accept_conns.conn_opaques[j - i] =
+          kin->data.accept_conns.conn_opaques[j];
+      }
+      kin->data.accept_conns.num = num - i;
+      return -1;
+    }
+
+    fprintf(stderr, "kin_accept_conns: accept failed\n");
+    tas_telemetry->accept.slots_posted++;
+
+    kout->data.accept_connection.opaque = opaque;
+    kout->data.accept_connection.status = -1;
+    MEM_BARRIER();
+    kout->type = KERNEL_APPIN_ACCEPTED_CONN;
+    appif_ctx_kick(ctx);
+
+    kout_pos = ctx->kout_pos + 1;
+    if (kout_pos >= ctx->kout_len) {
+      kout_pos = 0;
+    }
+    ctx->kout_pos = kout_pos;
+  }
+
+  tas_telemetry->accept.post_entries++;
+  return 0;
+}
+
 static int kin_fork(struct application *app, struct app_context *ctx,
   volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
 {
@@ -23,27 +23,61 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <budget_debug.h>
+#include <kernel_appif.h>
 #include <tas.h>
 #include <utils.h>
 #include <virtuoso.h>
 
 #include "internal.h"
 
+/** Upper bound for the SLO feedback multiplier on a VM's weight */
+#define BUDGET_SLO_BOOST_MAX 16.0
+/** Per update decay of the SLO multiplier while a VM meets its target */
+#define BUDGET_SLO_DECAY 0.95
+/** Max length of a control command */
+#define BUDGET_CTL_MSG_LEN 256
+
 static void init_vm_weights(double *weights);
+static void budget_vm_shares(uint16_t vm_count, double *shares);
+static void budget_slo_feedback(uint16_t vm_count, uint64_t interval_us);
+static int budget_ctl_handle(char *msg, char *reply, size_t reply_len);
+static void budget_telemetry_start(void);
+static void budget_telemetry_report(uint64_t now_us, uint16_t vm_count);
 
 uint64_t get_budget_delta(int vmid, int ctxid);
 void boost_budget(int vmid, int ctxid, int64_t incr);
-#ifdef BUDGET_DEBUG_STATS
+uint64_t get_vm_qdelay(int vmid, uint64_t interval_us);
 int64_t tas_get_budget_raw(int vmid, int ctxid);
+void tas_get_vm_buf_stats(int vmid, uint64_t *in_use, uint64_t *backpressure,
+    uint64_t *drops);
+int tas_vm_tx_weight_set(int vmid, uint32_t weight);
 void tas_budget_debug_snapshot_core(int ctxid,
     struct budget_debug_fast_snapshot *snapshot);
+
 static struct budget_debug_window budget_debug_window;
-#endif
+/* telemetry mode at the previous update, to notice it being turned on */
+static enum config_bu_telemetry telemetry_prev = CONFIG_BU_TELEMETRY_OFF;
 
 static double vm_weights[FLEXNIC_PL_VMST_NUM];
+static double vm_min_share[FLEXNIC_PL_VMST_NUM];
+static double vm_max_share[FLEXNIC_PL_VMST_NUM];
+static uint32_t vm_slo_delay[FLEXNIC_PL_VMST_NUM];
+/* multiplier on the weight from SLO feedback, 1 while targets are met */
+static double vm_slo_boost[FLEXNIC_PL_VMST_NUM];
+/* slow path cycles charged since the last update, and in total */
+static uint64_t vm_sp_debt[FLEXNIC_PL_VMST_NUM];
+static uint64_t vm_sp_cycles[FLEXNIC_PL_VMST_NUM];
+static int budget_ctl_fd = -1;
 static uint64_t last_bu_update_ts = 0;
 static uint64_t budget_ts = 0;
 static uint64_t budget_period_tsc = 0;
@@ -56,25 +90,133 @@ void budget_init(int threads_launched)
   budget_ts = 0;
   last_bu_update_ts = 0;
   init_vm_weights(vm_weights);
+  memset(vm_sp_debt, 0, sizeof(vm_sp_debt));
+  memset(vm_sp_cycles, 0, sizeof(vm_sp_cycles));
+}
+
+void budget_sp_charge(uint16_t vmid, uint64_t cycles)
+{
+  if (vmid >= FLEXNIC_PL_VMST_NUM) {
+    return;
+  }
+
+  vm_sp_debt[vmid] += cycles;
+  vm_sp_cycles[vmid] += cycles;
+}
+
+/* A VM may start new slow path work while its fast path balance summed over
+ * all cores covers the slow path cycles it has not paid for yet. */
+int budget_vm_admit(uint16_t vmid)
+{
+  int ctxid;
+  int64_t balance = 0;
+
+  if (vmid >= FLEXNIC_PL_VMST_NUM) {
+    return 0;
+  }
+
+  for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
+    balance += (int64_t) config.bu_max_budget -
+        (int64_t) get_budget_delta(vmid, ctxid);
+  }
+  return balance > (int64_t) vm_sp_debt[vmid];
+}
+
+uint64_t budget_vm_sp_cycles(uint16_t vmid)
+{
+  if (vmid >= FLEXNIC_PL_VMST_NUM) {
+    return 0;
+  }
+
+  return vm_sp_cycles[vmid];
+}
+
+int budget_vm_weight_set(uint16_t vmid, double weight)
+{
+  if (vmid >= FLEXNIC_PL_VMST_NUM || weight <= 0) {
+    fprintf(stderr, "budget_vm_weight_set: invalid vm %u or weight %lf\n",
+        vmid, weight);
+    return -1;
+  }
+
+  vm_weights[vmid] = weight;
+  return 0;
+}
+
+int budget_vm_share_set(uint16_t vmid, double min, double max)
+{
+  double min_sum;
+  uint16_t i;
+
+  if (vmid >= FLEXNIC_PL_VMST_NUM || min < 0 || min > max || max > 1) {
+    fprintf(stderr, "budget_vm_share_set: invalid vm %u or share %lf-%lf\n",
+        vmid, min, max);
+    return -1;
+  }
+
+  /* minimum shares are guarantees, so together they cannot exceed the whole
+   * budget (with some slack for rounding in decimal shares) */
+  min_sum = min;
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    if (i != vmid)
+      min_sum += vm_min_share[i];
+  }
+  if (min_sum > 1 + 1e-9) {
+    fprintf(stderr, "budget_vm_share_set: minimum shares would add up to "
+        "%lf\n", min_sum);
+    return -1;
+  }
+
+  vm_min_share[vmid] = min;
+  vm_max_share[vmid] = max;
+  return 0;
+}
+
+int budget_vm_slo_set(uint16_t vmid, uint32_t delay_us)
+{
+  if (vmid >= FLEXNIC_PL_VMST_NUM) {
+    fprintf(stderr, "budget_vm_slo_set: invalid vm %u\n", vmid);
+    return -1;
+  }
+
+  vm_slo_delay[vmid] = delay_us;
+  if (delay_us == 0) {
+    vm_slo_boost[vmid] = 1;
+  }
+  return 0;
+}
+
+double budget_vm_share_get(uint16_t vmid)
+{
+  uint16_t vm_count, vm_idx;
+  double shares[FLEXNIC_PL_VMST_NUM];
+
+  vm_count = tas_registered_vm_count_get();
+  budget_vm_shares(vm_count, shares);
+  for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
+    if (tas_registered_vm_ids[vm_idx] == vmid) {
+      return shares[vm_idx];
+    }
+  }
+  return 0;
 }
 
 void budget_update(uint64_t cur_tsc)
 {
   int vmid, ctxid;
   uint16_t vm_count, vm_idx;
-  int64_t incr, weighted_incr;
+  int64_t incr, weighted_incr, sp_charge;
   int64_t total_budget;
   double delta_weight;
   double deltas_sum;
-  double weights_sum = 0;
+  double shares[FLEXNIC_PL_VMST_NUM];
   double deltas[budget_threads_launched];
-#ifdef BUDGET_DEBUG_STATS
-  uint64_t now_us;
+  enum config_bu_telemetry telemetry;
+  uint64_t now_us = 0;
   struct budget_debug_fast_snapshot debug_snapshot;
-  int64_t budget_before;
+  int64_t budget_before = 0;
   int64_t budget_after;
   uint64_t applied_distribution;
-#endif
 
   if (cur_tsc - budget_ts < budget_period_tsc) {
     return;
@@ -83,41 +225,46 @@ void budget_update(uint64_t cur_tsc)
 
   total_budget = config.bu_boost * (cur_tsc - last_bu_update_ts);
   vm_count = tas_registered_vm_count_get();
-#ifdef BUDGET_DEBUG_STATS
-  now_us = util_timeout_time_us();
-#endif
+
+  telemetry = config.bu_telemetry;
+  if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+    if (telemetry_prev == CONFIG_BU_TELEMETRY_OFF) {
+      budget_telemetry_start();
+    }
+    now_us = util_timeout_time_us();
+  }
+  telemetry_prev = telemetry;
 
   if (vm_count == 0) {
-#ifdef BUDGET_DEBUG_STATS
-    budget_debug_window_clear_core_distributions(&budget_debug_window,
-        budget_threads_launched);
-    budget_debug_window_maybe_print(&budget_debug_window, stderr, now_us,
-        budget_threads_launched, tas_registered_vm_ids, vm_count);
-#endif
+    if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+      budget_debug_window_clear_core_distributions(&budget_debug_window,
+          budget_threads_launched);
+      budget_telemetry_report(now_us, vm_count);
+    }
     last_bu_update_ts = cur_tsc;
     return;
   }
 
-#ifdef BUDGET_DEBUG_STATS
-  budget_debug_window_begin(&budget_debug_window, now_us,
-      budget_threads_launched);
-  for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
-    tas_budget_debug_snapshot_core(ctxid, &debug_snapshot);
-    budget_debug_record_core_interval(&budget_debug_window, ctxid,
-        &debug_snapshot, tas_registered_vm_ids, vm_count,
-        config.bu_max_budget, cur_tsc - last_bu_update_ts);
+  if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+    budget_debug_window_begin(&budget_debug_window, now_us,
+        budget_threads_launched);
+    for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
+      tas_budget_debug_snapshot_core(ctxid, &debug_snapshot);
+      budget_debug_record_core_interval(&budget_debug_window, ctxid,
+          &debug_snapshot, tas_registered_vm_ids, vm_count,
+          config.bu_max_budget, cur_tsc - last_bu_update_ts);
+    }
   }
-#endif
 
-  for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
-    vmid = tas_registered_vm_ids[vm_idx];
-    weights_sum += vm_weights[vmid];
+  if (last_bu_update_ts != 0) {
+    budget_slo_feedback(vm_count,
+        (cur_tsc - last_bu_update_ts) / util_timeout_tsc_per_us());
   }
+  budget_vm_shares(vm_count, shares);
 
   for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
     vmid = tas_registered_vm_ids[vm_idx];
-    incr = ((total_budget * vm_weights[vmid]) / weights_sum) *
-        budget_threads_launched;
+    incr = (total_budget * shares[vm_idx]) * budget_threads_launched;
 
     deltas_sum = 0;
     for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
@@ -135,34 +282,79 @@ void budget_update(uint64_t cur_tsc)
       weighted_incr = incr * delta_weight;
       assert(weighted_incr >= 0);
       assert(delta_weight >= 0 && delta_weight <= 1);
-#ifdef BUDGET_DEBUG_STATS
-      budget_before = tas_get_budget_raw(vmid, ctxid);
-#endif
+      if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+        budget_before = tas_get_budget_raw(vmid, ctxid);
+      }
       boost_budget(vmid, ctxid, weighted_incr);
-#ifdef BUDGET_DEBUG_STATS
-      budget_after = tas_get_budget_raw(vmid, ctxid);
-      if (budget_after > budget_before) {
-        applied_distribution = (uint64_t) (budget_after - budget_before);
-      } else {
-        applied_distribution = 0;
+      if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+        budget_after = tas_get_budget_raw(vmid, ctxid);
+        if (budget_after > budget_before) {
+          applied_distribution = (uint64_t) (budget_after - budget_before);
+        } else {
+          applied_distribution = 0;
+        }
+        budget_debug_record_vm_distribution(&budget_debug_window, ctxid,
+            vmid, budget_before, budget_after, applied_distribution,
+            config.bu_max_budget);
       }
-      budget_debug_record_vm_distribution(&budget_debug_window, ctxid, vmid,
-          budget_before, budget_after, applied_distribution,
-          config.bu_max_budget);
-#endif
+    }
+
+    /* deduct slow path work after the boost so that a VM at its cap still
+     * pays for it, spread evenly over the cores */
+    if (vm_sp_debt[vmid] > 0) {
+      for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
+        sp_charge = vm_sp_debt[vmid] / budget_threads_launched;
+        if (ctxid == 0) {
+          sp_charge += vm_sp_debt[vmid] % budget_threads_launched;
+        }
+        boost_budget(vmid, ctxid, -sp_charge);
+      }
+      vm_sp_debt[vmid] = 0;
     }
   }
 
-#ifdef BUDGET_DEBUG_STATS
+  if (telemetry != CONFIG_BU_TELEMETRY_OFF) {
+    for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
+      budget_debug_publish_core_distribution(&budget_debug_window, ctxid);
+    }
+    budget_telemetry_report(now_us, vm_count);
+  }
+
+  last_bu_update_ts = cur_tsc;
+}
+
+/* Telemetry was just turned on: drop what the cores consumed while it was
+ * off and start with an empty window. */
+static void budget_telemetry_start(void)
+{
+  int ctxid;
+  struct budget_debug_fast_snapshot debug_snapshot;
+
   for (ctxid = 0; ctxid < budget_threads_launched; ctxid++) {
-    budget_debug_publish_core_distribution(&budget_debug_window, ctxid);
+    tas_budget_debug_snapshot_core(ctxid, &debug_snapshot);
   }
+  budget_debug_window_clear_core_distributions(&budget_debug_window,
+      budget_threads_launched);
+  budget_debug_window_reset(&budget_debug_window, 0);
+}
 
-  budget_debug_window_maybe_print(&budget_debug_window, stderr, now_us,
-      budget_threads_launched, tas_registered_vm_ids, vm_count);
-#endif
+/* Publish the window once it is complete, and print it if asked to. */
+static void budget_telemetry_report(uint64_t now_us, uint16_t vm_count)
+{
+  if (!budget_debug_window_done(&budget_debug_window, now_us)) {
+    return;
+  }
 
-  last_bu_update_ts = cur_tsc;
+  if (tas_telemetry != NULL) {
+    budget_debug_window_publish(&budget_debug_window, tas_telemetry, now_us,
+        budget_threads_launched, tas_registered_vm_ids, vm_count,
+        config.bu_max_budget, vm_sp_cycles);
+  }
+  if (config.bu_telemetry == CONFIG_BU_TELEMETRY_PRINT) {
+    budget_debug_window_print(&budget_debug_window, stderr, now_us,
+        budget_threads_launched, tas_registered_vm_ids, vm_count);
+  }
+  budget_debug_window_reset(&budget_debug_window, now_us);
 }
 
 static void init_vm_weights(double *weights)
@@ -170,6 +362,232 @@ static void init_vm_weights(double *weights)
   int vmid;
 
   for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++) {
-    weights[vmid] = 1;
+    weights[vmid] = config.bu_vm_weights[vmid];
+    vm_min_share[vmid] = config.bu_vm_min_share[vmid];
+    vm_max_share[vmid] = config.bu_vm_max_share[vmid];
+    vm_slo_delay[vmid] = config.bu_vm_slo_delay[vmid];
+    vm_slo_boost[vmid] = 1;
+  }
+}
+
+/* Split the budget between registered VMs by weight, then clamp to the
+ * min/max shares and hand what was freed or taken to the unclamped VMs in
+ * proportion to their weights. */
+static void budget_vm_shares(uint16_t vm_count, double *shares)
+{
+  uint16_t vm_idx, round;
+  int vmid, changed;
+  uint8_t fixed[FLEXNIC_PL_VMST_NUM];
+  double w, free_weight, free_share, s;
+
+  memset(fixed, 0, sizeof(fixed));
+  for (round = 0; round <= vm_count; round++) {
+    free_weight = 0;
+    free_share = 1;
+    for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
+      vmid = tas_registered_vm_ids[vm_idx];
+      if (fixed[vm_idx]) {
+        free_share -= shares[vm_idx];
+      } else {
+        free_weight += vm_weights[vmid] * vm_slo_boost[vmid];
+      }
+    }
+
+    if (free_weight == 0) {
+      break;
+    }
+    if (free_share < 0) {
+      free_share = 0;
+    }
+
+    changed = 0;
+    for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
+      if (fixed[vm_idx]) {
+        continue;
+      }
+
+      vmid = tas_registered_vm_ids[vm_idx];
+      w = vm_weights[vmid] * vm_slo_boost[vmid];
+      s = free_share * w / free_weight;
+      if (s < vm_min_share[vmid]) {
+        s = vm_min_share[vmid];
+        fixed[vm_idx] = 1;
+        changed = 1;
+      } else if (s > vm_max_share[vmid]) {
+        s = vm_max_share[vmid];
+        fixed[vm_idx] = 1;
+        changed = 1;
+      }
+      shares[vm_idx] = s;
+    }
+
+    if (!changed) {
+      break;
+    }
+  }
+}
+
+/* Grow the weight multiplier of VMs whose transmit queueing delay is above
+ * their target, and let it decay back to 1 once they meet it. */
+static void budget_slo_feedback(uint16_t vm_count, uint64_t interval_us)
+{
+  uint16_t vm_idx;
+  int vmid;
+  uint64_t delay;
+
+  for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
+    vmid = tas_registered_vm_ids[vm_idx];
+    if (vm_slo_delay[vmid] == 0) {
+      continue;
+    }
+
+    delay = get_vm_qdelay(vmid, interval_us);
+    if (delay > vm_slo_delay[vmid]) {
+      vm_slo_boost[vmid] *= config.bu_slo_gain;
+      if (vm_slo_boost[vmid] > BUDGET_SLO_BOOST_MAX) {
+        vm_slo_boost[vmid] = BUDGET_SLO_BOOST_MAX;
+      }
+    } else {
+      vm_slo_boost[vmid] *= BUDGET_SLO_DECAY;
+      if (vm_slo_boost[vmid] < 1) {
+        vm_slo_boost[vmid] = 1;
+      }
+    }
+  }
+}
+
+/*****************************************************************************/
+/* Runtime control socket */
+
+int budget_ctl_init(void)
+{
+  int fd, flags;
+  struct sockaddr_un saun;
+
+  if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+    perror("budget_ctl_init: socket failed");
+    return -1;
+  }
+
+  memset(&saun, 0, sizeof(saun));
+  saun.sun_family = AF_UNIX;
+  memcpy(saun.sun_path, KERNEL_SOCKET_PATH_BUDGET,
+      sizeof(KERNEL_SOCKET_PATH_BUDGET));
+
+  unlink(saun.sun_path);
+  if (bind(fd, (struct sockaddr *) &saun, sizeof(saun))) {
+    perror("budget_ctl_init: bind failed");
+    goto error_close;
+  }
+
+  if ((flags = fcntl(fd, F_GETFL, 0)) == -1 ||
+      fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+  {
+    perror("budget_ctl_init: fcntl failed");
+    goto error_close;
+  }
+
+  budget_ctl_fd = fd;
+  return 0;
+
+error_close:
+  close(fd);
+  return -1;
+}
+
+unsigned budget_ctl_poll(void)
+{
+  unsigned n = 0;
+  ssize_t len;
+  char msg[BUDGET_CTL_MSG_LEN];
+  char reply[BUDGET_CTL_MSG_LEN];
+  struct sockaddr_un from;
+  socklen_t from_len;
+
+  if (budget_ctl_fd < 0) {
+    return 0;
   }
+
+  for (;;) {
+    from_len = sizeof(from);
+    len = recvfrom(budget_ctl_fd, msg, sizeof(msg) - 1, 0,
+        (struct sockaddr *) &from, &from_len);
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("budget_ctl_poll: recvfrom failed");
+      }
+      break;
+    }
+    msg[len] = 0;
+
+    budget_ctl_handle(msg, reply, sizeof(reply));
+
+    /* only reply to senders with a bound address */
+    if (from_len > sizeof(sa_family_t)) {
+      sendto(budget_ctl_fd, reply, strlen(reply), 0,
+          (struct sockaddr *) &from, from_len);
+    }
+    n++;
+  }
+
+  return n;
+}
+
+/* Commands, one per datagram:
+ *   weight VM WEIGHT
+ *   share VM MIN MAX
+ *   slo VM DELAY_US
+ *   get VM
+ *   telemetry off|shm|print
+ * The reply is "ok" or "error", followed by the VM's current settings, the
+ * slow path cycles charged to it so far, and its buffer counters, or the
+ * telemetry mode. */
+static int budget_ctl_handle(char *msg, char *reply, size_t reply_len)
+{
+  static const char *telemetry_modes[] = { "off", "shm", "print" };
+  char cmd[16], arg[16];
+  unsigned vmid;
+  double a, b;
+  int n, mode, ret = -1;
+  uint64_t bufs, bp, drops;
+
+  if (sscanf(msg, "%15s %15s", cmd, arg) == 2 &&
+      !strcmp(cmd, "telemetry"))
+  {
+    if ((mode = config_parse_telemetry(arg)) >= 0) {
+      config.bu_telemetry = mode;
+      ret = 0;
+    }
+    snprintf(reply, reply_len, "%s telemetry=%s\n",
+        (ret == 0 ? "ok" : "error"), telemetry_modes[config.bu_telemetry]);
+    return ret;
+  }
+
+  n = sscanf(msg, "%15s %u %lf %lf", cmd, &vmid, &a, &b);
+  if (n < 2 || vmid >= FLEXNIC_PL_VMST_NUM) {
+    snprintf(reply, reply_len, "error\n");
+    return -1;
+  }
+
+  if (!strcmp(cmd, "weight") && n == 3) {
+    ret = budget_vm_weight_set(vmid, a);
+  } else if (!strcmp(cmd, "share") && n == 4) {
+    ret = budget_vm_share_set(vmid, a, b);
+  } else if (!strcmp(cmd, "txweight") && n == 3 && a >= 1 && a <= UINT16_MAX) {
+    ret = tas_vm_tx_weight_set(vmid, a);
+  } else if (!strcmp(cmd, "slo") && n == 3 && a >= 0) {
+    ret = budget_vm_slo_set(vmid, a);
+  } else if (!strcmp(cmd, "get") && n == 2) {
+    ret = 0;
+  }
+
+  tas_get_vm_buf_stats(vmid, &bufs, &bp, &drops);
+  snprintf(reply, reply_len, "%s vm=%u weight=%lf txweight=%u min=%lf "
+      "max=%lf slo=%u boost=%lf share=%lf sp=%"PRIu64" bufs=%"PRIu64
+      " bp=%"PRIu64" drops=%"PRIu64"\n", (ret == 0 ? "ok" : "error"), vmid,
+      vm_weights[vmid], config.fp_vm_weights[vmid], vm_min_share[vmid],
+      vm_max_share[vmid],
+      vm_slo_delay[vmid], vm_slo_boost[vmid], budget_vm_share_get(vmid),
+      vm_sp_cycles[vmid], bufs, bp, drops);
+  return ret;
 }
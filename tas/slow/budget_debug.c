@@ -29,10 +29,6 @@
 
 #include <budget_debug.h>
 
-#ifdef BUDGET_DEBUG_STATS
-
-static void budget_debug_reset_summaries(struct budget_debug_window *window,
-    uint64_t now_us);
 static void budget_debug_u64_add(struct budget_debug_u64_stats *stats,
     uint64_t value);
 static void budget_debug_pct_nonneg_add(
@@ -64,7 +60,7 @@ void budget_debug_window_begin(struct budget_debug_window *window,
   uint16_t i;
 
   if (window->start_us == 0) {
-    budget_debug_reset_summaries(window, now_us);
+    budget_debug_window_reset(window, now_us);
   }
 
   window->completed_intervals++;
@@ -194,7 +190,51 @@ void budget_debug_publish_core_distribution(struct budget_debug_window *window,
   }
 }
 
-void budget_debug_window_maybe_print(struct budget_debug_window *window,
+int budget_debug_window_done(const struct budget_debug_window *window,
+    uint64_t now_us)
+{
+  if (window->start_us == 0 || window->completed_intervals == 0) {
+    return 0;
+  }
+
+  return now_us - window->start_us >= BUDGET_DEBUG_WINDOW_US;
+}
+
+void budget_debug_window_publish(const struct budget_debug_window *window,
+    struct tas_telemetry *telemetry, uint64_t now_us, uint16_t num_cores,
+    const uint16_t *vm_ids, uint16_t vm_count, uint64_t max_budget,
+    const uint64_t *vm_sp_cycles)
+{
+  uint64_t seq = telemetry->seq;
+
+  if (num_cores > FLEXNIC_PL_APPST_CTX_MCS) {
+    num_cores = FLEXNIC_PL_APPST_CTX_MCS;
+  }
+
+  /* odd sequence number tells readers to wait */
+  telemetry->seq = seq + 1;
+  __sync_synchronize();
+
+  telemetry->start_us = window->start_us;
+  telemetry->end_us = now_us;
+  telemetry->intervals = window->completed_intervals;
+  telemetry->max_budget = max_budget;
+  telemetry->elapsed_cycles = window->elapsed_cycles;
+  telemetry->num_cores = num_cores;
+  telemetry->vm_count = vm_count;
+  memcpy(telemetry->vm_ids, vm_ids, vm_count * sizeof(vm_ids[0]));
+  memcpy(telemetry->vm_sp_cycles, vm_sp_cycles,
+      sizeof(telemetry->vm_sp_cycles));
+  memcpy(telemetry->cores, window->cores,
+      num_cores * sizeof(window->cores[0]));
+  memcpy(telemetry->vms, window->vms, num_cores * sizeof(window->vms[0]));
+  telemetry->windows++;
+
+  __sync_synchronize();
+  telemetry->seq = seq + 2;
+}
+
+void budget_debug_window_print(const struct budget_debug_window *window,
     FILE *out, uint64_t now_us, uint16_t num_cores, const uint16_t *vm_ids,
     uint16_t vm_count)
 {
@@ -223,14 +263,7 @@ void budget_debug_window_maybe_print(struct budget_debug_window *window,
   char budget_pre[96];
   char budget_post[96];
 
-  if (window->start_us == 0 || window->completed_intervals == 0) {
-    return;
-  }
-
   elapsed_us = now_us - window->start_us;
-  if (elapsed_us < BUDGET_DEBUG_WINDOW_US) {
-    return;
-  }
 
   fprintf(out, "\n");
   fprintf(out, "================ Budget Debug (%" PRIu64
@@ -242,7 +275,8 @@ void budget_debug_window_maybe_print(struct budget_debug_window *window,
       summary_value_label_width, "elapsed cycles", elapsed);
 
   for (core_id = 0; core_id < num_cores; core_id++) {
-    struct budget_debug_core_window *core_window = &window->cores[core_id];
+    const struct budget_debug_core_window *core_window =
+        &window->cores[core_id];
 
     if (core_window->periods == 0) {
       continue;
@@ -306,7 +340,7 @@ void budget_debug_window_maybe_print(struct budget_debug_window *window,
     fprintf(out, "\n");
 
     for (vm_idx = 0; vm_idx < vm_count; vm_idx++) {
-      struct budget_debug_vm_window *vm_window;
+      const struct budget_debug_vm_window *vm_window;
 
       vm_id = vm_ids[vm_idx];
       vm_window = &window->vms[core_id][vm_id];
@@ -362,11 +396,9 @@ void budget_debug_window_maybe_print(struct budget_debug_window *window,
   fprintf(out,
       "================================================================\n");
   fflush(out);
-
-  budget_debug_reset_summaries(window, now_us);
 }
 
-static void budget_debug_reset_summaries(struct budget_debug_window *window,
+void budget_debug_window_reset(struct budget_debug_window *window,
     uint64_t now_us)
 {
   memset(&window->elapsed_cycles, 0, sizeof(window->elapsed_cycles));
@@ -649,5 +681,3 @@ static void budget_debug_format_pct_signed(char *buf, size_t len,
   snprintf(buf, len, "%s/%s/%s/%s/%s/%s",
       avg, min, p25, p50, p75, max);
 }
-
-#endif /* BUDGET_DEBUG_STATS */
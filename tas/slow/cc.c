@@ -32,7 +32,6 @@
 #include "internal.h"
 #include "appif.h"
 
-#define CONF_MSS 1400
 
 static void cc_next_ts_vm(uint32_t cur_ts, int vmid, uint32_t *ts);
 static unsigned cc_poll_vm(int vmid, unsigned n, 
@@ -115,8 +114,9 @@ unsigned cc_poll(uint32_t cur_ts)
 {
   int i, vmid;
   uint16_t vm_count;
-  unsigned n = 0;
+  unsigned n = 0, prev_n;
   uint32_t diff_ts;
+  uint64_t s_cycs;
 
   diff_ts = cur_ts - last_ts;
   if (0 && diff_ts < config.cc_control_granularity)
@@ -136,7 +136,11 @@ unsigned cc_poll(uint32_t cur_ts)
   for(i = 0; i < vm_count && n < 128; i++)
   {
     vmid = tas_registered_vm_ids[(next_vm + i) % vm_count];
+    prev_n = n;
+    s_cycs = util_rdtsc();
     n = cc_poll_vm(vmid, n, cur_ts, diff_ts);
+    if (n != prev_n)
+      budget_sp_charge(vmid, util_rdtsc() - s_cycs);
   }
 
   last_ts = cur_ts;
@@ -341,7 +345,7 @@ static inline void dctcp_win_init(struct connection *c)
 {
   struct connection_cc_dctcp_win *cc = &c->cc.dctcp_win;
 
-  cc->window = 2 * CONF_MSS;
+  cc->window = 2 * c->tx_mss;
   c->cc_rate = window_to_rate(cc->window, config.tcp_rtt_init);
   cc->ecn_rate = 0;
   cc->slowstart = 1;
@@ -354,7 +358,7 @@ static inline void dctcp_win_update(struct connection *c,
   uint64_t ecn_rate, incr;
   uint32_t rtt = stats->rtt, win = cc->window;
 
-  assert(win >= CONF_MSS);
+  assert(win >= c->tx_mss);
 
   /* If RTT is zero, use estimate */
   if (rtt == 0) {
@@ -399,7 +403,7 @@ static inline void dctcp_win_update(struct connection *c,
       } else {
         /* additive increase */
         assert(win != 0);
-        incr = ((uint64_t) stats->c_ackb * CONF_MSS) / win;
+        incr = ((uint64_t) stats->c_ackb * c->tx_mss) / win;
         if ((uint32_t) (win + incr) > win)
           win += incr;
       }
@@ -407,8 +411,8 @@ static inline void dctcp_win_update(struct connection *c,
   }
 
   /* Ensure window is at least 1 mss */
-  if (win < CONF_MSS)
-    win = CONF_MSS;
+  if (win < c->tx_mss)
+    win = c->tx_mss;
 
   /* A window larger than the send buffer also does not make much sense */
   if (win > c->tx_len)
@@ -416,7 +420,7 @@ static inline void dctcp_win_update(struct connection *c,
 
   c->cc_rtt = rtt;
   c->cc_rate = window_to_rate(win, rtt);
-  assert(win >= CONF_MSS);
+  assert(win >= c->tx_mss);
   cc->window = win;
   c->cc_rexmits = 0;
 }
@@ -50,6 +50,19 @@ extern int kernel_notifyfd;
 
 void budget_init(int threads_launched);
 void budget_update(uint64_t cur_tsc);
+int budget_vm_weight_set(uint16_t vmid, double weight);
+int budget_vm_share_set(uint16_t vmid, double min, double max);
+int budget_vm_slo_set(uint16_t vmid, uint32_t delay_us);
+/* Current fraction of the total budget for a registered VM */
+double budget_vm_share_get(uint16_t vmid);
+/* Charge slow path cycles spent on behalf of a VM to its budget */
+void budget_sp_charge(uint16_t vmid, uint64_t cycles);
+/* Whether a VM has budget left to start new slow path work */
+int budget_vm_admit(uint16_t vmid);
+/* Slow path cycles charged to a VM since startup */
+uint64_t budget_vm_sp_cycles(uint16_t vmid);
+int budget_ctl_init(void);
+unsigned budget_ctl_poll(void);
 
 struct nicif_completion {
   struct nbqueue_el el;
@@ -131,6 +144,8 @@ int nicif_appctx_add(uint16_t vmid, uint16_t appid, uint32_t db,
 enum nicif_connection_flags {
   /** Enable ECN for connection. */
   NICIF_CONN_ECN        = (1 <<  2),
+  /** Window scaling negotiated for connection. */
+  NICIF_CONN_WSCALE     = (1 <<  3),
 };
 
 /**
@@ -152,6 +167,9 @@ enum nicif_connection_flags {
  * @param app_opaque  Opaque value to pass in notificaitions
  * @param flags       See #nicif_connection_flags.
  * @param rate        Congestion rate to set [Kbps]
+ * @param rx_wscale   Shift for windows advertised to the remote host
+ * @param tx_wscale   Shift for windows received from the remote host
+ * @param tx_mss      Maximum payload bytes per transmitted segment
  * @param fn_core     FlexNIC emulator core for the connection
  * @param flow_group  Flow group
  * @param pf_id       Pointer to location where flow id should be stored
@@ -162,8 +180,9 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
     uint64_t mac_remote, uint32_t ip_local, uint16_t port_local,
     uint32_t ip_remote, uint16_t port_remote, uint64_t rx_base, uint32_t rx_len,
     uint64_t tx_base, uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
-    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint32_t fn_core,
-    uint16_t flow_group, uint32_t *pf_id);
+    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint8_t rx_wscale,
+    uint8_t tx_wscale, uint16_t tx_mss, uint32_t fn_core, uint16_t flow_group,
+    uint32_t *pf_id);
 
 /**
  * Register flow (must be called from poll thread).
@@ -186,6 +205,9 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
  * @param app_opaque    Opaque value to pass in notificaitions
  * @param flags         See #nicif_connection_flags.
  * @param rate          Congestion rate to set [Kbps]
+ * @param rx_wscale     Shift for windows advertised to the remote host
+ * @param tx_wscale     Shift for windows received from the remote host
+ * @param tx_mss        Maximum payload bytes per transmitted segment
  * @param fn_core       FlexNIC emulator core for the connection
  * @param flow_group    Flow group
  * @param pf_id         Pointer to location where flow id should be stored
@@ -198,8 +220,9 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
     uint32_t in_ip_local, uint16_t port_local,
     uint32_t in_ip_remote, uint16_t port_remote, uint64_t rx_base, uint32_t rx_len,
     uint64_t tx_base, uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
-    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint32_t fn_core,
-    uint16_t flow_group, uint32_t *pf_id);
+    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint8_t rx_wscale,
+    uint8_t tx_wscale, uint16_t tx_mss, uint32_t fn_core, uint16_t flow_group,
+    uint32_t *pf_id);
 
 /**
  * Disable connection fast path (mark as sp'd and remove from hash table).
@@ -366,6 +389,26 @@ int packetmem_init(void);
 int packetmem_alloc(size_t length, uintptr_t *off,
     struct packetmem_handle **handle, int vmid);
 
+/**
+ * Allocate packet memory of specified length, preferably on a NUMA node.
+ * Falls back to other nodes if the preferred node has no space left.
+ *
+ * @param length  Required number of bytes
+ * @param off     Pointer to location where offset in DMA region should be
+ *                stored
+ * @param handle  Pointer to location where handle for memory region should be
+ *                stored
+ * @param vmid    Id of the vm for the memory region to be allocated
+ * @param node    Preferred NUMA node, or -1 for any
+ *
+ * @return 0 on success, <0 else
+ */
+int packetmem_alloc_node(size_t length, uintptr_t *off,
+    struct packetmem_handle **handle, int vmid, int node);
+
+/** NUMA node of the packet memory at the specified offset. */
+int packetmem_off_node(uintptr_t off);
+
 /**
  * Free packet memory region.
  *
@@ -587,6 +630,23 @@ struct connection {
     uint32_t local_seq;
     /** Timestamp received with SYN/SYN-ACK packet */
     uint32_t syn_ts;
+    /** Time in us the SYN was queued on the listener (accepted
+     * connections). */
+    uint32_t syn_queued_us;
+    /** Fast path core the accept was posted for, or
+     * KERNEL_APPOUT_ACCEPT_ANYCORE. */
+    uint16_t accept_core;
+    /** Steering policy of the listener (accepted connections). */
+    uint8_t accept_steer;
+    /** Window scale shift for windows we advertise. */
+    uint8_t rx_wscale;
+    /** Window scale shift for windows the peer advertises. */
+    uint8_t tx_wscale;
+    /** Maximum segment size negotiated in handshake. */
+    uint16_t mss;
+    /** Payload bytes per transmitted segment: mss minus the timestamp
+     * option. */
+    uint16_t tx_mss;
   /**@}*/
 
   /**
@@ -704,6 +764,8 @@ struct listener {
     uint32_t *backlog_cores;
     /** Backlog flow group array */
     uint16_t *backlog_fgs;
+    /** Backlog array of times in us when the SYNs were queued */
+    uint32_t *backlog_us;
   /**@}*/
 
   /** List of waiting connections from accept calls (head) */
@@ -715,6 +777,8 @@ struct listener {
   uint16_t port;
   /** Flags: see #nicif_connection_flags */
   uint32_t flags;
+  /** Steering policy: KERNEL_APPOUT_LISTEN_STEER_* flags */
+  uint8_t steer;
 };
 
 /** List of tcp connections */
@@ -770,11 +834,13 @@ int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
  * @param opaque  Opaque value passed from application
  * @param listen  Listener
  * @param db_id   Doorbell ID
+ * @param core    Fast path core the accept is for, or
+ *                KERNEL_APPOUT_ACCEPT_ANYCORE
  *
  * @return 0 on success, <0 else
  */
 int tcp_accept(struct app_context *ctx, uint64_t opaque,
-        struct listener *listen, uint32_t db_id);
+        struct listener *listen, uint32_t db_id, uint16_t core);
 
 /**
  * RX processing for a TCP packet.
@@ -789,6 +855,38 @@ int tcp_accept(struct app_context *ctx, uint64_t opaque,
 int tcp_packet(const void *pkt, uint16_t len, uint32_t fn_core,
     uint16_t flow_group);
 
+/**
+ * Prefetch the connection hash bucket for a TCP packet that will be passed to
+ * tcp_packet() shortly. Used to overlap lookups for a batch of packets, with
+ * tcp_conn_prefetch() on the returned bucket as the second stage.
+ *
+ * @param pkt Pointer to packet
+ * @param len Length of packet
+ *
+ * @return Hash bucket index, or -1 if the packet is not TCP.
+ */
+int tcp_packet_prefetch(const void *pkt, uint16_t len);
+
+/**
+ * Prefetch the first connection in a hash bucket returned by
+ * tcp_packet_prefetch() or gre_packet_prefetch(), once the bucket itself has
+ * had time to arrive.
+ *
+ * @param bucket Hash bucket index
+ */
+void tcp_conn_prefetch(int bucket);
+
+/**
+ * Prefetch the connection hash bucket for an encapsulated TCP packet that will
+ * be passed to gre_packet() shortly.
+ *
+ * @param pkt Pointer to packet
+ * @param len Length of packet
+ *
+ * @return Hash bucket index, or -1 if the packet is not IP.
+ */
+int gre_packet_prefetch(const void *pkt, uint16_t len);
+
 /**
  * RX processing for an encapsulated TCP packet.
  *
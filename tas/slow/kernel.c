@@ -100,6 +100,11 @@ int slowpath_main(int threads_launched)
     return EXIT_FAILURE;
   }
   budget_init(threads_launched);
+  if (budget_ctl_init())
+  {
+    fprintf(stderr, "budget_ctl_init failed\n");
+    return EXIT_FAILURE;
+  }
 
   /* initialize kni */
   if (kni_init())
@@ -150,7 +155,7 @@ int slowpath_main(int threads_launched)
 
   signal_tas_ready();
 
-  notify_canblock_reset(&nbs);
+  notify_canblock_init(&nbs, config.fp_doorbells ? &tas_doorbells->sp : NULL);
   while (exited == 0)
   {
     unsigned n = 0;
@@ -166,6 +171,7 @@ int slowpath_main(int threads_launched)
     budget_check_tsc = util_rdtsc();
     budget_update(budget_check_tsc);
     n += appif_poll();
+    n += budget_ctl_poll();
     budget_check_tsc = util_rdtsc();
     budget_update(budget_check_tsc);
     n += kni_poll();
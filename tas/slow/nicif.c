@@ -40,7 +40,13 @@
 #include <rte_config.h>
 #include <rte_hash_crc.h>
 
+/** Minimum size of slow path packet buffers */
 #define PKTBUF_SIZE 1536
+/** Maximum number of rx queue entries handled per core in one poll */
+#define RXQ_BATCH_SIZE 16
+/** Maximum number of rx queue entries handled per nicif_poll call, so
+ * timeouts and application queues are not starved under load */
+#define RXQ_POLL_MAX 512
 
 struct flow_id_item
 {
@@ -51,7 +57,7 @@ struct flow_id_item
 static int adminq_init();
 static int adminq_init_core(uint16_t core);
 static int adminq_init_ovs();
-static inline int rxq_poll(void);
+static inline int rxq_poll(unsigned max);
 static inline int ovsrxq_poll(void);
 static inline int ovstxq_poll(void);
 static inline void process_packet(const void *buf, uint16_t len,
@@ -73,14 +79,15 @@ static inline uint32_t flow_hash_gre(beui16_t lp, beui16_t rp, beui32_t tid);
 static inline int flow_slot_alloc(uint32_t h, uint32_t *i, uint32_t *d);
 static inline int flow_slot_clear(uint32_t f_id, ip_addr_t lip, beui16_t lp,
     ip_addr_t rip, beui16_t rp, beui32_t tunnel_id);
-static void flow_id_alloc_init(void);
+static int flow_id_alloc_init(void);
 static int flow_id_alloc(uint32_t *fid);
 static void flow_id_free(uint32_t flow_id);
 
-struct flow_id_item flow_id_items[FLEXNIC_PL_FLOWST_NUM];
+struct flow_id_item *flow_id_items;
 struct flow_id_item *flow_id_freelist;
 
 static uint32_t fn_cores;
+static uint32_t pktbuf_size;
 
 static struct nic_buffer **rxq_bufs;
 static volatile struct flextcp_pl_krx **rxq_base;
@@ -132,7 +139,11 @@ int nicif_init(void)
   }
 
   /* prepare flow_id allocator */
-  flow_id_alloc_init();
+  if (flow_id_alloc_init())
+  {
+    fprintf(stderr, "nicif_init: flow_id_alloc_init failed\n");
+    return -1;
+  }
 
   if (adminq_init())
   {
@@ -145,23 +156,27 @@ int nicif_init(void)
 
 unsigned nicif_poll(void)
 {
-  unsigned i, ret = 0; /*, nonsuc = 0*/
+  unsigned i, ret = 0, nonsuc = 0;
   int x;
 
-  for (i = 0; i < 512; i++)
+  for (i = 0; i < 512 && ret < RXQ_POLL_MAX; i++)
   {
     if (UNLIKELY((i & (BUDGET_INNER_UPDATE_STRIDE - 1)) ==
         (BUDGET_INNER_UPDATE_STRIDE - 1))) {
       budget_update(util_rdtsc());
     }
 
-    x = rxq_poll();
-    // if (x == -1 && ++nonsuc > 2 * fn_cores)
-    //   break;
-    // else if (x != -1)
-    //   nonsuc = 0;
+    x = rxq_poll(RXQ_POLL_MAX - ret);
 
-    ret += (x == -1 ? 0 : 1);
+    /* stop once a full round over the cores found nothing */
+    if (x == -1) {
+      if (++nonsuc >= fn_cores)
+        break;
+      continue;
+    }
+
+    nonsuc = 0;
+    ret += x;
   }
 
   return ret;
@@ -217,7 +232,7 @@ int nicif_appctx_add(uint16_t vmid, uint16_t appid, uint32_t db,
 
   for (i = 0; i < tas_info->cores_num; i++)
   {
-    actx = &fp_state->appctx[i][vmid][db];
+    actx = &fp_cores[i].appctx[vmid][db];
     actx->vm_id = vmid;
     actx->rx_base = rxq_base[i];
     actx->tx_base = txq_base[i];
@@ -229,7 +244,7 @@ int nicif_appctx_add(uint16_t vmid, uint16_t appid, uint32_t db,
 
   for (i = 0; i < tas_info->cores_num; i++)
   {
-    actx = &fp_state->appctx[i][vmid][db];
+    actx = &fp_cores[i].appctx[vmid][db];
     actx->tx_len = txq_len;
     actx->rx_len = rxq_len;
   }
@@ -248,14 +263,15 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
     uint64_t mac_remote, uint32_t ip_local, uint16_t port_local,
     uint32_t ip_remote, uint16_t port_remote, uint64_t rx_base, uint32_t rx_len,
     uint64_t tx_base, uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
-    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint32_t fn_core,
-    uint16_t flow_group, uint32_t *pf_id)
+    uint64_t app_opaque, uint32_t flags, uint32_t rate, uint8_t rx_wscale,
+    uint8_t tx_wscale, uint16_t tx_mss, uint32_t fn_core, uint16_t flow_group,
+    uint32_t *pf_id)
 {
   struct flextcp_pl_flowst *fs;
   beui32_t lip = t_beui32(ip_local), rip = t_beui32(ip_remote);
   beui16_t lp = t_beui16(port_local), rp = t_beui16(port_remote);
   uint32_t i, d, f_id, hash;
-  struct flextcp_pl_flowhte *hte = fp_state->flowht;
+  struct flextcp_pl_flowhte *hte = fp_flowht;
 
   /* allocate flow id */
   if (flow_id_alloc(&f_id) != 0) {
@@ -270,14 +286,14 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
     fprintf(stderr, "nicif_connection_add: allocating slot failed\n");
     return -1;
   }
-  assert(i < FLEXNIC_PL_FLOWHT_ENTRIES);
+  assert(i <= fp_flowht_mask);
   assert(d < FLEXNIC_PL_FLOWHT_NBSZ);
 
   if ((flags & NICIF_CONN_ECN) == NICIF_CONN_ECN) {
     rx_base |= FLEXNIC_PL_FLOWST_ECN;
   }
 
-  fs = &fp_state->flowst[f_id];
+  fs = &fp_flowst[f_id];
   fs->opaque = app_opaque;
   fs->rx_base_sp = rx_base;
   fs->tx_base = tx_base;
@@ -296,6 +312,9 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
   fs->flow_group = flow_group;
   fs->lock = 0;
   fs->bump_seq = 0;
+  fs->rx_wscale = rx_wscale;
+  fs->tx_wscale = tx_wscale;
+  fs->tx_mss = tx_mss;
 
   fs->rx_avail = rx_len;
   fs->rx_next_pos = 0;
@@ -309,6 +328,10 @@ int nicif_connection_add(uint32_t db, uint16_t vm_id, uint16_t app_id,
   fs->tx_next_ts = 0;
   fs->tx_rate = rate;
   fs->rtt_est = 0;
+  fs->numa_node = packetmem_off_node(rx_base & FLEXNIC_PL_FLOWST_RX_MASK);
+  fs->st_tx_sent = 0;
+  fs->st_tx_next_seq = local_seq;
+  fs->st_tx_avail = 0;
 
   /* write to empty entry first */
   MEM_BARRIER();
@@ -328,8 +351,9 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
                          uint32_t in_ip_local, uint16_t port_local,
                          uint32_t in_ip_remote, uint16_t port_remote, uint64_t rx_base, uint32_t rx_len,
                          uint64_t tx_base, uint32_t tx_len, uint32_t remote_seq, uint32_t local_seq,
-                         uint64_t app_opaque, uint32_t flags, uint32_t rate, uint32_t fn_core,
-                         uint16_t flow_group, uint32_t *pf_id)
+                         uint64_t app_opaque, uint32_t flags, uint32_t rate, uint8_t rx_wscale,
+                         uint8_t tx_wscale, uint16_t tx_mss, uint32_t fn_core, uint16_t flow_group,
+                         uint32_t *pf_id)
 {
   struct flextcp_pl_flowst *fs;
   beui32_t tid = t_beui32(tunnel_id);
@@ -337,7 +361,7 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
   beui32_t o_lip = t_beui32(out_ip_local), o_rip = t_beui32(out_ip_remote);
   beui16_t lp = t_beui16(port_local), rp = t_beui16(port_remote);
   uint32_t i, d, f_id, hash;
-  struct flextcp_pl_flowhte *hte = fp_state->flowht;
+  struct flextcp_pl_flowhte *hte = fp_flowht;
 
   /* allocate flow id */
   if (flow_id_alloc(&f_id) != 0)
@@ -354,7 +378,7 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
     fprintf(stderr, "nicif_connection_add: allocating slot failed\n");
     return -1;
   }
-  assert(i < FLEXNIC_PL_FLOWHT_ENTRIES);
+  assert(i <= fp_flowht_mask);
   assert(d < FLEXNIC_PL_FLOWHT_NBSZ);
 
   if ((flags & NICIF_CONN_ECN) == NICIF_CONN_ECN)
@@ -362,7 +386,7 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
     rx_base |= FLEXNIC_PL_FLOWST_ECN;
   }
 
-  fs = &fp_state->flowst[f_id];
+  fs = &fp_flowst[f_id];
   fs->opaque = app_opaque;
   fs->rx_base_sp = rx_base;
   fs->tx_base = tx_base;
@@ -384,6 +408,9 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
   fs->flow_group = flow_group;
   fs->lock = 0;
   fs->bump_seq = 0;
+  fs->rx_wscale = rx_wscale;
+  fs->tx_wscale = tx_wscale;
+  fs->tx_mss = tx_mss;
 
   fs->rx_avail = rx_len;
   fs->rx_next_pos = 0;
@@ -397,6 +424,10 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
   fs->tx_next_ts = 0;
   fs->tx_rate = rate;
   fs->rtt_est = 0;
+  fs->numa_node = packetmem_off_node(rx_base & FLEXNIC_PL_FLOWST_RX_MASK);
+  fs->st_tx_sent = 0;
+  fs->st_tx_next_seq = local_seq;
+  fs->st_tx_avail = 0;
 
   /* write to empty entry first */
   MEM_BARRIER();
@@ -412,7 +443,7 @@ int nicif_connection_add_gre(uint32_t db, uint16_t vm_id, uint16_t app_id,
 int nicif_connection_disable(uint32_t f_id, uint32_t *tx_seq, uint32_t *rx_seq,
                              int *tx_closed, int *rx_closed)
 {
-  struct flextcp_pl_flowst *fs = &fp_state->flowst[f_id];
+  struct flextcp_pl_flowst *fs = &fp_flowst[f_id];
 
   util_spin_lock(&fs->lock);
 
@@ -439,7 +470,7 @@ void nicif_connection_free(uint32_t f_id)
 /** Move flow to new db */
 int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
 {
-  fp_state->flowst[f_id].db_id = dst_db;
+  fp_flowst[f_id].db_id = dst_db;
   return 0;
 }
 
@@ -449,21 +480,21 @@ int nicif_connection_stats(uint32_t f_id,
 {
   struct flextcp_pl_flowst *fs;
 
-  if (f_id >= FLEXNIC_PL_FLOWST_NUM)
+  if (f_id >= fp_flowst_num)
   {
     fprintf(stderr, "nicif_connection_stats: bad flow id\n");
     return -1;
   }
 
-  fs = &fp_state->flowst[f_id];
+  fs = &fp_flowst[f_id];
   p_stats->c_drops = fs->cnt_tx_drops;
   p_stats->c_acks = fs->cnt_rx_acks;
   p_stats->c_ackb = fs->cnt_rx_ack_bytes;
   p_stats->c_ecnb = fs->cnt_rx_ecn_bytes;
-  p_stats->txp = fs->tx_sent != 0;
+  p_stats->txp = fs->st_tx_sent != 0;
   p_stats->rtt = fs->rtt_est;
-  p_stats->c_tx_next_seq = fs->tx_next_seq;
-  p_stats->c_tx_avail = fs->tx_avail;
+  p_stats->c_tx_next_seq = fs->st_tx_next_seq;
+  p_stats->c_tx_avail = fs->st_tx_avail;
 
   return 0;
 }
@@ -480,13 +511,13 @@ int nicif_connection_setrate(uint32_t f_id, uint32_t rate)
 {
   struct flextcp_pl_flowst *fs;
 
-  if (f_id >= FLEXNIC_PL_FLOWST_NUM)
+  if (f_id >= fp_flowst_num)
   {
     fprintf(stderr, "nicif_connection_stats: bad flow id\n");
     return -1;
   }
 
-  fs = &fp_state->flowst[f_id];
+  fs = &fp_flowst[f_id];
   fs->tx_rate = rate;
 
   return 0;
@@ -595,6 +626,13 @@ static int adminq_init()
 {
   uint32_t i;
 
+  /* buffers need to fit a full frame (incl. VLAN tag) at the link MTU */
+  pktbuf_size = (config.ip_mtu + sizeof(struct eth_hdr) + 4 + 63) & ~63;
+  if (pktbuf_size < PKTBUF_SIZE)
+  {
+    pktbuf_size = PKTBUF_SIZE;
+  }
+
   rxq_len = config.nic_rx_len;
   txq_len = config.nic_tx_len;
   tasovs_rx_len = rxq_len;
@@ -638,6 +676,7 @@ static int adminq_init_core(uint16_t core)
   struct packetmem_handle *pm_bufs, *pm_rx, *pm_tx;
   uintptr_t off_bufs, off_rx, off_tx;
   size_t i, sz_bufs, sz_rx, sz_tx;
+  int node = shm_numa_core_node(core);
 
   if ((rxq_bufs[core] = calloc(config.nic_rx_len, sizeof(**rxq_bufs))) == NULL)
   {
@@ -651,8 +690,8 @@ static int adminq_init_core(uint16_t core)
     return -1;
   }
 
-  sz_bufs = ((config.nic_rx_len + config.nic_tx_len) * PKTBUF_SIZE + 0xfff) & ~0xfffULL;
-  if (packetmem_alloc(sz_bufs, &off_bufs, &pm_bufs, SP_MEM_ID) != 0)
+  sz_bufs = ((config.nic_rx_len + config.nic_tx_len) * pktbuf_size + 0xfff) & ~0xfffULL;
+  if (packetmem_alloc_node(sz_bufs, &off_bufs, &pm_bufs, SP_MEM_ID, node) != 0)
   {
     fprintf(stderr, "adminq_init: packetmem_alloc bufs failed\n");
     free(txq_bufs[core]);
@@ -661,7 +700,7 @@ static int adminq_init_core(uint16_t core)
   }
 
   sz_rx = config.nic_rx_len * sizeof(struct flextcp_pl_krx);
-  if (packetmem_alloc(sz_rx, &off_rx, &pm_rx, SP_MEM_ID) != 0)
+  if (packetmem_alloc_node(sz_rx, &off_rx, &pm_rx, SP_MEM_ID, node) != 0)
   {
     fprintf(stderr, "adminq_init: packetmem_alloc tx failed\n");
     packetmem_free(pm_bufs, SP_MEM_ID);
@@ -670,7 +709,7 @@ static int adminq_init_core(uint16_t core)
     return -1;
   }
   sz_tx = config.nic_tx_len * sizeof(struct flextcp_pl_ktx);
-  if (packetmem_alloc(sz_tx, &off_tx, &pm_tx, SP_MEM_ID) != 0)
+  if (packetmem_alloc_node(sz_tx, &off_tx, &pm_tx, SP_MEM_ID, node) != 0)
   {
     fprintf(stderr, "adminq_init: packetmem_alloc tx failed\n");
     packetmem_free(pm_rx, SP_MEM_ID);
@@ -691,20 +730,20 @@ static int adminq_init_core(uint16_t core)
     rxq_bufs[core][i].addr = off_bufs;
     rxq_bufs[core][i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
     rxq_base[core][i].addr = off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
   for (i = 0; i < txq_len; i++)
   {
     txq_bufs[core][i].addr = off_bufs;
     txq_bufs[core][i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
 
-  fp_state->kctx[core].rx_base = off_rx;
-  fp_state->kctx[core].tx_base = off_tx;
+  fp_cores[core].kctx.rx_base = off_rx;
+  fp_cores[core].kctx.tx_base = off_tx;
   MEM_BARRIER();
-  fp_state->kctx[core].tx_len = sz_tx;
-  fp_state->kctx[core].rx_len = sz_rx;
+  fp_cores[core].kctx.tx_len = sz_tx;
+  fp_cores[core].kctx.rx_len = sz_rx;
 
   return 0;
 }
@@ -755,7 +794,7 @@ static int adminq_init_ovs()
     return -1;
   }
 
-  sz_bufs = (2 * (config.nic_rx_len + config.nic_tx_len) * PKTBUF_SIZE
+  sz_bufs = (2 * (config.nic_rx_len + config.nic_tx_len) * pktbuf_size
       + 0xfff) & ~0xfffULL;
   if (packetmem_alloc(sz_bufs, &off_bufs, &pm_bufs, SP_MEM_ID) != 0)
   {
@@ -844,7 +883,7 @@ static int adminq_init_ovs()
     tasovs_rx_bufs[i].addr = off_bufs;
     tasovs_rx_bufs[i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
     tasovs_rx_base[i].addr = off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
 
   for (i = 0; i < txq_len; i++)
@@ -852,7 +891,7 @@ static int adminq_init_ovs()
     tasovs_tx_bufs[i].addr = off_bufs;
     tasovs_tx_bufs[i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
     tasovs_tx_base[i].addr = off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
 
   for (i = 0; i < rxq_len; i++)
@@ -860,7 +899,7 @@ static int adminq_init_ovs()
     ovstas_rx_bufs[i].addr = off_bufs;
     ovstas_rx_bufs[i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
     ovstas_rx_base[i].addr = off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
 
   for (i = 0; i < txq_len; i++)
@@ -868,7 +907,7 @@ static int adminq_init_ovs()
     ovstas_tx_bufs[i].addr = off_bufs;
     ovstas_tx_bufs[i].buf = (uint8_t *)vm_shm[SP_MEM_ID] + off_bufs;
     ovstas_tx_base[i].addr = off_bufs;
-    off_bufs += PKTBUF_SIZE;
+    off_bufs += pktbuf_size;
   }
 
   fp_state->tasovs.rx_base = off_tasovs_rx;
@@ -890,57 +929,98 @@ static int adminq_init_ovs()
   return 0;
 }
 
-static inline int rxq_poll(void)
+/* Handles up to max (and at most RXQ_BATCH_SIZE) entries from the next
+ * core's queue. Only the buffer and connection lookup prefetches are done for
+ * the whole batch; the packets are then handed to tcp_packet/arp_packet one at
+ * a time, as protocol processing is per connection. */
+static inline int rxq_poll(unsigned max)
 {
   uint32_t old_tail, tail, core;
-  volatile struct flextcp_pl_krx *krx;
-  struct nic_buffer *buf;
+  volatile struct flextcp_pl_krx *krx[RXQ_BATCH_SIZE];
+  struct nic_buffer *buf[RXQ_BATCH_SIZE];
+  int bucket[RXQ_BATCH_SIZE];
   uint8_t type;
-  int ret = 0;
+  unsigned i, n;
 
   core = rxq_next;
   old_tail = tail = rxq_tail[core];
-  krx = &rxq_base[core][tail];
-  buf = &rxq_bufs[core][tail];
   rxq_next = (core + 1) % fn_cores;
 
+  /* collect ready queue entries and prefetch packet buffers */
+  for (n = 0; n < RXQ_BATCH_SIZE && n < max; n++)
+  {
+    krx[n] = &rxq_base[core][tail];
+    if (krx[n]->type == FLEXTCP_PL_KRX_INVALID)
+    {
+      break;
+    }
+
+    buf[n] = &rxq_bufs[core][tail];
+    util_prefetch0(buf[n]->buf);
+
+    tail = tail + 1;
+    if (tail == rxq_len)
+    {
+      tail -= rxq_len;
+    }
+  }
+
   /* no queue entry here */
-  type = krx->type;
-  if (type == FLEXTCP_PL_KRX_INVALID)
+  if (n == 0)
   {
     return -1;
   }
 
-  /* update tail */
-  tail = tail + 1;
-  if (tail == rxq_len)
+  /* prefetch connection lookup state for the whole batch: hash buckets
+   * first, then the connections they point to */
+  for (i = 0; i < n; i++)
   {
-    tail -= rxq_len;
+    bucket[i] = -1;
+    if (krx[i]->type == FLEXTCP_PL_KRX_PACKET)
+    {
+      #if VIRTUOSO_GRE
+        bucket[i] = gre_packet_prefetch(buf[i]->buf, krx[i]->msg.packet.len);
+      #else
+        bucket[i] = tcp_packet_prefetch(buf[i]->buf, krx[i]->msg.packet.len);
+      #endif
+    }
+  }
+  for (i = 0; i < n; i++)
+  {
+    if (bucket[i] >= 0)
+    {
+      tcp_conn_prefetch(bucket[i]);
+    }
   }
 
   /* handle based on queue entry type */
-  type = krx->type;
-
-  switch (type)
+  for (i = 0; i < n; i++)
   {
-  case FLEXTCP_PL_KRX_PACKET:
-    #if VIRTUOSO_GRE
-      process_packet_gre(buf->buf, krx);
-    #else
-      process_packet(buf->buf, krx->msg.packet.len, krx->msg.packet.fn_core,
-                    krx->msg.packet.flow_group);
-    #endif
-    break;
+    type = krx[i]->type;
 
-  default:
-    fprintf(stderr, "rxq_poll: unknown rx type 0x%x old %x len %x\n", type,
-            old_tail, rxq_len);
+    switch (type)
+    {
+    case FLEXTCP_PL_KRX_PACKET:
+      #if VIRTUOSO_GRE
+        process_packet_gre(buf[i]->buf, krx[i]);
+      #else
+        process_packet(buf[i]->buf, krx[i]->msg.packet.len,
+                      krx[i]->msg.packet.fn_core,
+                      krx[i]->msg.packet.flow_group);
+      #endif
+      break;
+
+    default:
+      fprintf(stderr, "rxq_poll: unknown rx type 0x%x old %x len %x\n", type,
+              (old_tail + i) % rxq_len, rxq_len);
+    }
+
+    krx[i]->type = 0;
   }
 
-  krx->type = 0;
   rxq_tail[core] = tail;
 
-  return ret;
+  return n;
 }
 
 static inline int ovsrxq_poll(void)
@@ -1316,15 +1396,15 @@ static inline uint32_t flow_hash_gre(beui16_t lp, beui16_t rp, beui32_t tid)
 static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
 {
   uint32_t j, i, l, k, d;
-  struct flextcp_pl_flowhte *hte = fp_state->flowht;
+  struct flextcp_pl_flowhte *hte = fp_flowht;
 
   /* find slot */
-  j = h % FLEXNIC_PL_FLOWHT_ENTRIES;
-  l = (j + FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
+  j = h & fp_flowht_mask;
+  l = (j + FLEXNIC_PL_FLOWHT_NBSZ) & fp_flowht_mask;
 
   /* look for empty slot */
   d = 0;
-  for (i = j; i != l; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES)
+  for (i = j; i != l; i = (i + 1) & fp_flowht_mask)
   {
     if ((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) == 0)
     {
@@ -1336,9 +1416,9 @@ static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
   }
 
   /* no free slot, try to clear up on */
-  k = (l + 4 * FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
+  k = (l + 4 * FLEXNIC_PL_FLOWHT_NBSZ) & fp_flowht_mask;
   /* looking for candidate empty slot to move back */
-  for (; i != k; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES)
+  for (; i != k; i = (i + 1) & fp_flowht_mask)
   {
     if ((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) == 0)
     {
@@ -1361,8 +1441,8 @@ static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
     k = i;
 
     /* look for element to swap */
-    i = (k - FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
-    for (; i != k; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES)
+    i = (k - FLEXNIC_PL_FLOWHT_NBSZ) & fp_flowht_mask;
+    for (; i != k; i = (i + 1) & fp_flowht_mask)
     {
       assert((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) != 0);
 
@@ -1372,7 +1452,7 @@ static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
       d = FLEXNIC_PL_FLOWHT_NBSZ - 1 - d;
 
       /* check whether element can be moved */
-      if ((k - i) % FLEXNIC_PL_FLOWHT_ENTRIES <= d)
+      if (((k - i) & fp_flowht_mask) <= d)
       {
         break;
       }
@@ -1404,7 +1484,7 @@ static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
   }
 
   *pi = i;
-  *pd = (i - j) % FLEXNIC_PL_FLOWHT_ENTRIES;
+  *pd = (i - j) & fp_flowht_mask;
   return 0;
 }
 
@@ -1422,8 +1502,8 @@ static inline int flow_slot_clear(uint32_t f_id, ip_addr_t lip, beui16_t lp,
 
   for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++)
   {
-    k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-    e = &fp_state->flowht[k];
+    k = (h + j) & fp_flowht_mask;
+    e = &fp_flowht[k];
 
     ffid = e->flow_id;
     MEM_BARRIER();
@@ -1445,11 +1525,18 @@ static inline int flow_slot_clear(uint32_t f_id, ip_addr_t lip, beui16_t lp,
   return -1;
 }
 
-static void flow_id_alloc_init(void)
+static int flow_id_alloc_init(void)
 {
   size_t i;
   struct flow_id_item *it, *prev = NULL;
-  for (i = 0; i < FLEXNIC_PL_FLOWST_NUM; i++)
+
+  if ((flow_id_items = calloc(fp_flowst_num, sizeof(*flow_id_items))) == NULL)
+  {
+    fprintf(stderr, "flow_id_alloc_init: calloc failed\n");
+    return -1;
+  }
+
+  for (i = 0; i < fp_flowst_num; i++)
   {
     it = &flow_id_items[i];
     it->flow_id = i;
@@ -1465,6 +1552,8 @@ static void flow_id_alloc_init(void)
     }
     prev = it;
   }
+
+  return 0;
 }
 
 static int flow_id_alloc(uint32_t *fid)
@@ -28,34 +28,67 @@
 #include <tas.h>
 #include "internal.h"
 
+/* maximum number of NUMA nodes packet memory is split across */
+#define PACKETMEM_MAX_NODES 8
+/* alignment of per-node arenas, so they can be placed with huge pages */
+#define PACKETMEM_NODE_ALIGN (2 * 1024 * 1024)
+
 struct packetmem_handle {
   uintptr_t base;
   size_t len;
+  int node;
 
   struct packetmem_handle *next;
 };
 
 static inline struct packetmem_handle *ph_alloc(void);
 static inline void ph_free(struct packetmem_handle *ph);
-static inline void merge_items(struct packetmem_handle *ph_prev, int vmid);
+static inline void merge_items(struct packetmem_handle *ph_prev, int vmid,
+    int node);
+static int arena_alloc(size_t length, uintptr_t *off,
+    struct packetmem_handle **handle, int vmid, int node);
 
-static struct packetmem_handle *freelist[FLEXNIC_PL_VMST_NUM + 1];
+static struct packetmem_handle *freelist[FLEXNIC_PL_VMST_NUM + 1]
+    [PACKETMEM_MAX_NODES];
+static unsigned num_nodes;
+static size_t node_len;
 
 int packetmem_init(void)
 {
   struct packetmem_handle *ph;
+  uintptr_t base, end;
+  unsigned n;
+
+  /* split each region into one contiguous arena per NUMA node */
+  num_nodes = TAS_MIN(shm_numa_nodes(), PACKETMEM_MAX_NODES);
+  base = config.data_mem_off;
+  end = tas_info->dma_mem_size;
+  node_len = ((end - base) / num_nodes) & ~(PACKETMEM_NODE_ALIGN - 1);
+  if (node_len == 0) {
+    num_nodes = 1;
+  }
 
   for (int i = 0; i < FLEXNIC_PL_VMST_NUM + 1; i++)
   {
-    if ((ph = ph_alloc()) == NULL) {
-      fprintf(stderr, "packetmem_init: ph_alloc vm=%d failed\n", i);
-      return -1;
-    }
+    for (n = 0; n < num_nodes; n++) {
+      if ((ph = ph_alloc()) == NULL) {
+        fprintf(stderr, "packetmem_init: ph_alloc vm=%d failed\n", i);
+        return -1;
+      }
+
+      ph->base = base + n * node_len;
+      ph->len = (n == num_nodes - 1 ? end - ph->base : node_len);
+      ph->node = n;
+      ph->next = NULL;
+      freelist[i][n] = ph;
 
-    ph->base = config.data_mem_off;
-    ph->len = tas_info->dma_mem_size - config.data_mem_off;
-    ph->next = NULL;
-    freelist[i] = ph;
+      if (num_nodes > 1 && shm_numa_place((uint8_t *) vm_shm[i] + ph->base,
+            ph->len, n) != 0)
+      {
+        fprintf(stderr, "packetmem_init: placing vm=%d node=%u failed\n", i,
+            n);
+      }
+    }
   }
 
   return 0;
@@ -63,12 +96,53 @@ int packetmem_init(void)
 
 int packetmem_alloc(size_t length, uintptr_t *off,
     struct packetmem_handle **handle, int vmid)
+{
+  return packetmem_alloc_node(length, off, handle, vmid, -1);
+}
+
+int packetmem_alloc_node(size_t length, uintptr_t *off,
+    struct packetmem_handle **handle, int vmid, int node)
+{
+  unsigned n;
+
+  /* try preferred node first */
+  if (node >= 0 && node < num_nodes &&
+      arena_alloc(length, off, handle, vmid, node) == 0)
+  {
+    return 0;
+  }
+
+  /* fall back to remote memory rather than failing */
+  for (n = 0; n < num_nodes; n++) {
+    if ((int) n != node && arena_alloc(length, off, handle, vmid, n) == 0) {
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "didn't find a fit\n");
+  return -1;
+}
+
+int packetmem_off_node(uintptr_t off)
+{
+  unsigned n;
+
+  if (num_nodes <= 1 || off < config.data_mem_off) {
+    return 0;
+  }
+
+  n = (off - config.data_mem_off) / node_len;
+  return TAS_MIN(n, num_nodes - 1);
+}
+
+static int arena_alloc(size_t length, uintptr_t *off,
+    struct packetmem_handle **handle, int vmid, int node)
 {
   struct packetmem_handle *ph, *ph_prev, *ph_new;
 
   /* look for first fit */
   ph_prev = NULL;
-  ph = freelist[vmid];
+  ph = freelist[vmid][node];
   while (ph != NULL && ph->len < length) {
     ph_prev = ph;
     ph = ph->next;
@@ -76,7 +150,6 @@ int packetmem_alloc(size_t length, uintptr_t *off,
 
   /* didn't find a fit */
   if (ph == NULL) {
-    fprintf(stderr, "didn't find a fit\n");
     return -1;
   }
 
@@ -85,7 +158,7 @@ int packetmem_alloc(size_t length, uintptr_t *off,
 
     /* pointer to previous next pointer for removal */
     if (ph_prev == NULL) {
-      freelist[vmid] = ph->next;
+      freelist[vmid][node] = ph->next;
     } else {
       ph_prev->next = ph->next;
     }
@@ -102,6 +175,7 @@ int packetmem_alloc(size_t length, uintptr_t *off,
 
     ph_new->base = ph->base;
     ph_new->len = length;
+    ph_new->node = node;
     ph_new->next = NULL;
 
     ph->base += length;
@@ -117,10 +191,11 @@ int packetmem_alloc(size_t length, uintptr_t *off,
 void packetmem_free(struct packetmem_handle *handle, int vmid)
 {
   struct packetmem_handle *ph, *ph_prev;
+  int node = handle->node;
 
   /* look for first successor */
   ph_prev = NULL;
-  ph = freelist[vmid];
+  ph = freelist[vmid][node];
   while (ph != NULL && ph->next != NULL && ph->next->base < handle->base) {
     ph_prev = ph;
     ph = ph->next;
@@ -128,21 +203,22 @@ void packetmem_free(struct packetmem_handle *handle, int vmid)
 
   /* add to list */
   if (ph_prev == NULL) {
-    handle->next = freelist[vmid];
-    freelist[vmid] = handle;
+    handle->next = freelist[vmid][node];
+    freelist[vmid][node] = handle;
   } else {
     handle->next = ph_prev->next;
     ph_prev->next = handle;
   }
 
   /* merge items if necessary */
-  merge_items(ph_prev, vmid);
+  merge_items(ph_prev, vmid, node);
 }
 
 /** Merge handles around newly inserted item (pointer to predecessor or NULL
  * passed).
  */
-static inline void merge_items(struct packetmem_handle *ph_prev, int vmid)
+static inline void merge_items(struct packetmem_handle *ph_prev, int vmid,
+    int node)
 {
   struct packetmem_handle *ph, *ph_next;
 
@@ -157,7 +233,7 @@ static inline void merge_items(struct packetmem_handle *ph_prev, int vmid)
       ph = ph_prev;
     }
   } else {
-    ph = freelist[vmid];
+    ph = freelist[vmid][node];
   }
 
   /* try to merge with successor if there is one */
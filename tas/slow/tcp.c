@@ -37,10 +37,16 @@
 #include <packet_defs.h>
 #include <utils.h>
 #include <utils_rng.h>
+#include <tas_telemetry.h>
 #include "internal.h"
 #include "appif.h"
 
-#define TCP_MSS 1412
+/** MSS assumed if peer does not send the option (RFC 9293) */
+#define TCP_MSS_DEFAULT 536
+/** Smallest peer MSS accepted */
+#define TCP_MSS_MIN 88
+/** Bytes taken by the timestamp option in every fast path segment */
+#define TCP_TS_OPTLEN ((sizeof(struct tcp_timestamp_opt) + 3) & ~3)
 #define TCP_HTSIZE 4096
 
 #define PORT_MAX ((1u << 16) - 1)
@@ -72,6 +78,7 @@ struct backlog_slot {
 
 struct tcp_opts {
   struct tcp_mss_opt *mss;
+  struct tcp_ws_opt *ws;
   struct tcp_timestamp_opt *ts;
 };
 
@@ -81,7 +88,17 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
 static void conn_packet_gre(struct connection *c, const struct pkt_gre *p,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group);
 static inline struct connection *conn_alloc(int vmid);
+static void conn_bufs_place(struct connection *c);
 static inline void conn_free(struct connection *conn);
+static inline uint8_t conn_wscale(uint32_t rx_len);
+static inline void conn_wscale_negotiate(struct connection *c,
+    const struct tcp_opts *opts);
+static inline void conn_mss_negotiate(struct connection *c,
+    const struct tcp_opts *opts);
+static inline uint32_t conn_hash(uint32_t l_ip, uint32_t r_ip, uint16_t l_po,
+    uint16_t r_po);
+static inline uint32_t conn_hash_gre(uint32_t t_id, uint16_t l_po,
+    uint16_t r_po);
 static void conn_register(struct connection *conn);
 static void conn_unregister(struct connection *conn);
 static struct connection *conn_lookup(const struct pkt_tcp *p);
@@ -103,13 +120,19 @@ static void listener_packet(struct listener *l, const struct pkt_tcp *p,
 static void listener_packet_gre(struct listener *l, const struct pkt_gre *p,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group);
 static void listener_accept(struct listener *l);
+static inline void accept_stats_syn(struct listener *l);
+static inline struct connection *listener_wait_pick(struct listener *l,
+    uint32_t fn_core, struct connection **prev);
+static inline void listener_wait_remove(struct listener *l,
+    struct connection *c, struct connection *prev);
+static inline void accept_stats_done(struct connection *c);
 static void listener_accept_gre(struct listener *l);
 
 static inline uint16_t port_alloc(void);
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt);
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int ws_opt);
 static inline int send_control_gre(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt);
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int ws_opt);
 static inline int send_reset(const struct pkt_tcp *p,
     const struct tcp_opts *opts);
 static inline int send_reset_gre(const struct pkt_gre *p,
@@ -130,6 +153,8 @@ static uintptr_t ports[PORT_MAX + 1];
 static uint16_t port_eph_hint = PORT_FIRST_EPH;
 static struct nbqueue conn_async_q;
 struct connection **tcp_hashtable = NULL;
+/** MSS advertised in SYN and SYN-ACK, derived from the link MTU */
+static uint16_t tcp_mss;
 static struct utils_rng rng;
 
 int tcp_init(void)
@@ -138,6 +163,13 @@ int tcp_init(void)
   utils_rng_init(&rng, util_timeout_time_us());
 
   port_eph_hint = utils_rng_gen32(&rng) % ((1 << 16) - 1 - PORT_FIRST_EPH);
+
+  #if VIRTUOSO_GRE
+    tcp_mss = config.ip_mtu - (sizeof(struct pkt_gre) - sizeof(struct eth_hdr));
+  #else
+    tcp_mss = config.ip_mtu - (sizeof(struct pkt_tcp) - sizeof(struct eth_hdr));
+  #endif
+
   if ((tcp_hashtable = calloc(TCP_HTSIZE, sizeof(*tcp_hashtable))) == NULL) {
     return -1;
   }
@@ -229,7 +261,7 @@ int tcp_open(struct app_context *ctx,
   #if VIRTUOSO_GRE
     uint16_t vmid = ctx->app->vm_id;
     ret = send_ovs_fake_packet(remote_ip, remote_port, local_port, vmid, conn,
-        TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, TCP_MSS);
+        TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, tcp_mss);
 
     if (ret < 0)
     {
@@ -364,10 +396,20 @@ int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
     free(lm_new);
     return -1;
   }
+  if ((lst->backlog_us = calloc(backlog, sizeof(*lst->backlog_us))) == NULL) {
+    fprintf(stderr, "tcp_listen: malloc backlog_us failed\n");
+    free(lst->backlog_fgs);
+    free(lst->backlog_cores);
+    free(lst->backlog_ptrs);
+    free(lst);
+    free(lm_new);
+    return -1;
+  }
 
   /* allocate backlog buffers */
   if ((bls = malloc(sizeof(*bls) * backlog)) == NULL) {
     fprintf(stderr, "tcp_listen: malloc backlog bufs failed\n");
+    free(lst->backlog_us);
     free(lst->backlog_fgs);
     free(lst->backlog_cores);
     free(lst->backlog_ptrs);
@@ -408,7 +450,7 @@ int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
 }
 
 int tcp_accept(struct app_context *ctx, uint64_t opaque,
-    struct listener *listen, uint32_t db_id)
+    struct listener *listen, uint32_t db_id, uint16_t core)
 {
   struct connection *conn;
 
@@ -425,6 +467,8 @@ int tcp_accept(struct app_context *ctx, uint64_t opaque,
   conn->db_id = db_id;
   conn->flags = listen->flags;
   conn->cnt_tx_pending = 0;
+  conn->accept_core = core;
+  conn->accept_steer = listen->steer;
 
   conn->ht_next = NULL;
   if (listen->wait_conns == NULL) {
@@ -453,6 +497,8 @@ int tcp_packet(const void *pkt, uint16_t len, uint32_t fn_core,
   const struct pkt_tcp *p = pkt;
   struct tcp_opts opts;
   int ret = 0;
+  uint16_t vmid;
+  uint64_t s_cycs = util_rdtsc();
 
   if (len < sizeof(*p)) {
     fprintf(stderr, "tcp_packet: incomplete TCP receive (%u received, "
@@ -472,9 +518,13 @@ int tcp_packet(const void *pkt, uint16_t len, uint32_t fn_core,
   }
 
   if ((c = conn_lookup(p)) != NULL) {
+    vmid = c->ctx->app->vm_id;
     conn_packet(c, p, &opts, fn_core, flow_group);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
   } else if ((l = listener_lookup(p)) != NULL) {
+    vmid = l->ctx->app->vm_id;
     listener_packet(l, p, &opts, fn_core, flow_group);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
   } else {
     ret = -1;
 
@@ -487,6 +537,51 @@ int tcp_packet(const void *pkt, uint16_t len, uint32_t fn_core,
   return ret;
 }
 
+int tcp_packet_prefetch(const void *pkt, uint16_t len)
+{
+  const struct pkt_tcp *p = pkt;
+  uint32_t h;
+
+  if (len < sizeof(*p) || f_beui16(p->eth.type) != ETH_TYPE_IP ||
+      p->ip.proto != IP_PROTO_TCP)
+  {
+    return -1;
+  }
+
+  h = conn_hash(f_beui32(p->ip.dest), f_beui32(p->ip.src),
+      f_beui16(p->tcp.dest), f_beui16(p->tcp.src)) % TCP_HTSIZE;
+  util_prefetch0(&tcp_hashtable[h]);
+  return h;
+}
+
+int gre_packet_prefetch(const void *pkt, uint16_t len)
+{
+  const struct pkt_gre *p = pkt;
+  uint32_t h;
+
+  if (len < sizeof(*p) || f_beui16(p->eth.type) != ETH_TYPE_IP) {
+    return -1;
+  }
+
+  h = conn_hash_gre(f_beui32(p->gre.key),
+      f_beui16(p->tcp.dest), f_beui16(p->tcp.src)) % TCP_HTSIZE;
+  util_prefetch0(&tcp_hashtable[h]);
+  return h;
+}
+
+void tcp_conn_prefetch(int bucket)
+{
+  struct connection *c = tcp_hashtable[bucket];
+
+  if (c == NULL) {
+    return;
+  }
+
+  /* lines read by conn_lookup: the address fields and the chain pointer */
+  util_prefetch0(&c->tunnel_id);
+  util_prefetch0(&c->ht_next);
+}
+
 int gre_packet(const void *pkt, uint16_t len, uint32_t fn_core,
     uint16_t flow_group)
 {
@@ -495,6 +590,8 @@ int gre_packet(const void *pkt, uint16_t len, uint32_t fn_core,
   const struct pkt_gre *p = pkt;
   struct tcp_opts opts;
   int ret = 0;
+  uint16_t vmid;
+  uint64_t s_cycs = util_rdtsc();
 
   if (len < sizeof(*p)) {
     fprintf(stderr, "gre_packet: incomplete TCP receive (%u received, "
@@ -514,9 +611,13 @@ int gre_packet(const void *pkt, uint16_t len, uint32_t fn_core,
   }
 
   if ((c = conn_lookup_gre(p)) != NULL) {
+    vmid = c->ctx->app->vm_id;
     conn_packet_gre(c, p, &opts, fn_core, flow_group);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
   } else if ((l = listener_lookup_gre(p)) != NULL) {
+    vmid = l->ctx->app->vm_id;
     listener_packet_gre(l, p, &opts, fn_core, flow_group);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
   } else {
     ret = -1;
     /* send reset if the packet received wasn't a reset */
@@ -551,9 +652,9 @@ int tcp_close(struct connection *conn)
 
   if (!tx_c || !rx_c) {
     #if VIRTUOSO_GRE
-      send_control_gre(conn, TAS_TCP_RST, 0, 0, 0);
+      send_control_gre(conn, TAS_TCP_RST, 0, 0, 0, 0);
     #else
-      send_control(conn, TAS_TCP_RST, 0, 0, 0);
+      send_control(conn, TAS_TCP_RST, 0, 0, 0, 0);
     #endif
   }
 
@@ -578,6 +679,8 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
 {
   struct connection *c = (struct connection *)
     ((uintptr_t) to - offsetof(struct connection, to));
+  uint16_t vmid = c->ctx->app->vm_id;
+  uint64_t s_cycs = util_rdtsc();
 
   assert(c->to_armed);
   c->to_armed = 0;
@@ -585,6 +688,7 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
   /* validate type and connection state */
   if (type == TO_TCP_CLOSED) {
     conn_close_timeout(c);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
     return;
   } else if (type != TO_TCP_HANDSHAKE) {
     fprintf(stderr, "tcp_timeout: unexpected timeout type (%u)\n", type);
@@ -599,6 +703,7 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
   if (++c->to_attempts > config.tcp_handshake_retries) {
     fprintf(stderr, "tcp_timeout: giving up because of too many retries\n");
     conn_failed(c, -1);
+    budget_sp_charge(vmid, util_rdtsc() - s_cycs);
     return;
   }
 
@@ -608,10 +713,12 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
 
   /* re-send SYN packet */
   #if VIRTUOSO_GRE
-    send_control_gre(c, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, TCP_MSS);
+    send_control_gre(c, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, tcp_mss,
+        1);
   #else
-    send_control(c, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, TCP_MSS);
+    send_control(c, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, tcp_mss, 1);
   #endif
+  budget_sp_charge(vmid, util_rdtsc() - s_cycs);
 }
 
 static void conn_packet(struct connection *c, const struct pkt_tcp *p,
@@ -646,7 +753,8 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
     }
 
     send_control(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1,
-        f_beui32(opts->ts->ts_val), TCP_MSS);
+        f_beui32(opts->ts->ts_val), tcp_mss,
+        (c->flags & NICIF_CONN_WSCALE) == NICIF_CONN_WSCALE);
   } else if (c->status == CONN_OPEN &&
       (TCPH_FLAGS(&p->tcp) & TAS_TCP_SYN) == TAS_TCP_SYN)
   {
@@ -656,7 +764,7 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
   {
    /* silently ignore a FIN for an already closed connection: TODO figure out
     * why necessary*/
-    send_control(c, TAS_TCP_ACK, 1, 0, 0);
+    send_control(c, TAS_TCP_ACK, 1, 0, 0, 0);
   } else {
     fprintf(stderr, "tcp_packet: unexpected connection state %u\n", c->status);
   }
@@ -693,7 +801,8 @@ static void conn_packet_gre(struct connection *c, const struct pkt_gre *p,
       ecn_flags = TAS_TCP_ECE;
     }
     send_control_gre(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1,
-        f_beui32(opts->ts->ts_val), TCP_MSS);
+        f_beui32(opts->ts->ts_val), tcp_mss,
+        (c->flags & NICIF_CONN_WSCALE) == NICIF_CONN_WSCALE);
   } else if (c->status == CONN_OPEN &&
       (TCPH_FLAGS(&p->tcp) & TAS_TCP_SYN) == TAS_TCP_SYN)
   {
@@ -703,7 +812,7 @@ static void conn_packet_gre(struct connection *c, const struct pkt_gre *p,
   {
    /* silently ignore a FIN for an already closed connection: TODO figure out
     * why necessary*/
-    send_control_gre(c, TAS_TCP_ACK, 1, 0, 0);
+    send_control_gre(c, TAS_TCP_ACK, 1, 0, 0, 0);
   } else {
     fprintf(stderr, "gre_packet: unexpected connection state %u\n", c->status);
   }
@@ -721,9 +830,11 @@ static int conn_arp_done(struct connection *conn)
 
   /* send SYN */
   #if VIRTUOSO_GRE
-    send_control_gre(conn, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, TCP_MSS);
+    send_control_gre(conn, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0,
+        tcp_mss, 1);
   #else
-    send_control(conn, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, TCP_MSS);
+    send_control(conn, TAS_TCP_SYN | TAS_TCP_ECE | TAS_TCP_CWR, 1, 0, tcp_mss,
+        1);
   #endif
 
   CONN_DEBUG0(conn, "SYN SENT\n");
@@ -754,6 +865,8 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->remote_seq = f_beui32(p->tcp.seqno) + 1;
   c->local_seq = f_beui32(p->tcp.ackno);
   c->syn_ts = f_beui32(opts->ts->ts_val);
+  conn_wscale_negotiate(c, opts);
+  conn_mss_negotiate(c, opts);
 
   /* enable ECN if SYN-ACK confirms */
   if (ecn_flags == TAS_TCP_ECE) {
@@ -766,12 +879,14 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->comp.notify_fd = -1;
   c->comp.status = 0;
 
+  conn_bufs_place(c);
   if (nicif_connection_add(c->db_id, c->ctx->app->vm_id, c->ctx->app->id,
         c->remote_mac, c->out_local_ip, c->local_port,
         c->out_remote_ip, c->remote_port, c->rx_buf - (uint8_t *) vm_shm[vmid],
         c->rx_len, c->tx_buf - (uint8_t *) vm_shm[vmid], c->tx_len,
         c->remote_seq, c->local_seq, c->opaque, c->flags, c->cc_rate,
-        c->fn_core, c->flow_group, &c->flow_id)
+        c->rx_wscale, c->tx_wscale, c->tx_mss, c->fn_core,
+        c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "conn_syn_sent_packet: nicif_connection_add failed\n");
@@ -783,7 +898,7 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->status = CONN_OPEN;
 
   /* send ACK */
-  send_control(c, TAS_TCP_ACK, 1, c->syn_ts, 0);
+  send_control(c, TAS_TCP_ACK, 1, c->syn_ts, 0, 0);
 
   CONN_DEBUG0(c, "conn_syn_sent_packet: ACK sent\n");
 
@@ -816,6 +931,8 @@ static int conn_syn_sent_packet_gre(struct connection *c,
   c->remote_seq = f_beui32(p->tcp.seqno) + 1;
   c->local_seq = f_beui32(p->tcp.ackno);
   c->syn_ts = f_beui32(opts->ts->ts_val);
+  conn_wscale_negotiate(c, opts);
+  conn_mss_negotiate(c, opts);
 
   /* enable ECN if SYN-ACK confirms */
   if (ecn_flags == TAS_TCP_ECE) {
@@ -828,6 +945,7 @@ static int conn_syn_sent_packet_gre(struct connection *c,
   c->comp.notify_fd = -1;
   c->comp.status = 0;
 
+  conn_bufs_place(c);
   if (nicif_connection_add_gre(c->db_id, c->ctx->app->vm_id, c->ctx->app->id,
         c->tunnel_id, c->remote_mac,
         c->out_local_ip, c->out_remote_ip,
@@ -835,7 +953,8 @@ static int conn_syn_sent_packet_gre(struct connection *c,
         c->in_remote_ip, c->remote_port, c->rx_buf - (uint8_t *) vm_shm[vmid],
         c->rx_len, c->tx_buf - (uint8_t *) vm_shm[vmid], c->tx_len,
         c->remote_seq, c->local_seq, c->opaque, c->flags, c->cc_rate,
-        c->fn_core, c->flow_group, &c->flow_id)
+        c->rx_wscale, c->tx_wscale, c->tx_mss, c->fn_core,
+        c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "conn_syn_sent_packet_gre: nicif_connection_add failed\n");
@@ -847,7 +966,7 @@ static int conn_syn_sent_packet_gre(struct connection *c,
   c->status = CONN_OPEN;
 
   /* send ACK */
-  send_control_gre(c, TAS_TCP_ACK, 1, c->syn_ts, 0);
+  send_control_gre(c, TAS_TCP_ACK, 1, c->syn_ts, 0, 0);
 
   CONN_DEBUG0(c, "conn_syn_sent_packet_gre: ACK sent\n");
 
@@ -868,11 +987,14 @@ static int conn_reg_synack(struct connection *c)
 
   /* send ACK */
   #if VIRTUOSO_GRE
-    send_control_gre(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1, c->syn_ts, TCP_MSS);
+    send_control_gre(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1, c->syn_ts,
+        tcp_mss, (c->flags & NICIF_CONN_WSCALE) == NICIF_CONN_WSCALE);
   #else
-    send_control(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1, c->syn_ts, TCP_MSS);
+    send_control(c, TAS_TCP_SYN | TAS_TCP_ACK | ecn_flags, 1, c->syn_ts,
+        tcp_mss, (c->flags & NICIF_CONN_WSCALE) == NICIF_CONN_WSCALE);
   #endif
 
+  accept_stats_done(c);
   appif_accept_conn(c, 0);
 
   return 0;
@@ -925,6 +1047,7 @@ static inline struct connection *conn_alloc(int vmid)
 
   conn->rx_buf = (uint8_t *) vm_shm[vmid] + off_rx;
   conn->rx_len = config.tcp_rxbuf_len;
+  conn->rx_wscale = conn_wscale(conn->rx_len);
   conn->tx_buf = (uint8_t *) vm_shm[vmid] + off_tx;
   conn->tx_len = config.tcp_txbuf_len;
   conn->to_armed = 0;
@@ -932,6 +1055,50 @@ static inline struct connection *conn_alloc(int vmid)
   return conn;
 }
 
+/* Move connection buffers to the NUMA node of the core that owns the flow.
+ * Only called before the flow is registered, when neither the application nor
+ * the fast path have seen the buffers yet. Keeps the old buffers on failure. */
+static void conn_bufs_place(struct connection *c)
+{
+  struct packetmem_handle *rx_handle, *tx_handle;
+  uintptr_t off_rx, off_tx;
+  int vmid = c->ctx->app->vm_id;
+  int node;
+
+  if (shm_numa_nodes() <= 1) {
+    return;
+  }
+
+  node = shm_numa_core_node(fp_state->flow_group_steering[c->flow_group]);
+  off_rx = c->rx_buf - (uint8_t *) vm_shm[vmid];
+  if (node < 0 || packetmem_off_node(off_rx) == node) {
+    return;
+  }
+
+  if (packetmem_alloc_node(c->rx_len, &off_rx, &rx_handle, vmid, node) != 0) {
+    return;
+  }
+  if (packetmem_alloc_node(c->tx_len, &off_tx, &tx_handle, vmid, node) != 0) {
+    packetmem_free(rx_handle, vmid);
+    return;
+  }
+
+  /* node is full, allocation fell back to some other node */
+  if (packetmem_off_node(off_rx) != node || packetmem_off_node(off_tx) != node)
+  {
+    packetmem_free(tx_handle, vmid);
+    packetmem_free(rx_handle, vmid);
+    return;
+  }
+
+  packetmem_free(c->tx_handle, vmid);
+  packetmem_free(c->rx_handle, vmid);
+  c->rx_handle = rx_handle;
+  c->tx_handle = tx_handle;
+  c->rx_buf = (uint8_t *) vm_shm[vmid] + off_rx;
+  c->tx_buf = (uint8_t *) vm_shm[vmid] + off_tx;
+}
+
 static inline void conn_free(struct connection *conn)
 {
   packetmem_free(conn->tx_handle, conn->ctx->app->vm_id);
@@ -939,6 +1106,48 @@ static inline void conn_free(struct connection *conn)
   free(conn);
 }
 
+/* smallest shift that lets the receive buffer fit in the 16-bit window */
+static inline uint8_t conn_wscale(uint32_t rx_len)
+{
+  uint8_t shift = 0;
+
+  while (shift < TCP_WSCALE_MAX && (rx_len >> shift) > 0xFFFF) {
+    shift++;
+  }
+  return shift;
+}
+
+/* window scaling is only used if both SYN and SYN-ACK carry the option */
+static inline void conn_wscale_negotiate(struct connection *c,
+    const struct tcp_opts *opts)
+{
+  if (opts->ws == NULL) {
+    c->flags &= ~NICIF_CONN_WSCALE;
+    c->rx_wscale = 0;
+    c->tx_wscale = 0;
+    return;
+  }
+
+  c->flags |= NICIF_CONN_WSCALE;
+  c->tx_wscale = TAS_MIN(opts->ws->shift, TCP_WSCALE_MAX);
+}
+
+/* use the smaller of our and the peer's MSS */
+static inline void conn_mss_negotiate(struct connection *c,
+    const struct tcp_opts *opts)
+{
+  uint16_t mss = TCP_MSS_DEFAULT;
+
+  if (opts->mss != NULL) {
+    mss = TAS_MIN(f_beui16(opts->mss->mss), tcp_mss);
+  }
+  if (mss < TCP_MSS_MIN) {
+    mss = TCP_MSS_MIN;
+  }
+  c->mss = mss;
+  c->tx_mss = mss - TCP_TS_OPTLEN;
+}
+
 static inline uint32_t conn_hash(uint32_t l_ip, uint32_t r_ip, uint16_t l_po,
     uint16_t r_po)
 {
@@ -1209,6 +1418,8 @@ static void listener_packet(struct listener *l, const struct pkt_tcp *p,
   /* copy packet into backlog buffer */
   l->backlog_cores[bp] = fn_core;
   l->backlog_fgs[bp] = flow_group;
+  l->backlog_us[bp] = util_timeout_time_us();
+  accept_stats_syn(l);
   bls = l->backlog_ptrs[bp];
   memcpy(bls->buf, p, len);
   bls->len = len;
@@ -1278,6 +1489,8 @@ static void listener_packet_gre(struct listener *l, const struct pkt_gre *p,
   /* copy packet into backlog buffer */
   l->backlog_cores[bp] = fn_core;
   l->backlog_fgs[bp] = flow_group;
+  l->backlog_us[bp] = util_timeout_time_us();
+  accept_stats_syn(l);
   bls = l->backlog_ptrs[bp];
   memcpy(bls->buf, p, len);
   bls->len = len;
@@ -1296,7 +1509,7 @@ static void listener_packet_gre(struct listener *l, const struct pkt_gre *p,
 static void listener_accept(struct listener *l)
 {
   int vmid;
-  struct connection *c = l->wait_conns;
+  struct connection *c, *c_prev;
   struct backlog_slot *bls;
   const struct pkt_tcp *p;
   struct tcp_opts opts;
@@ -1304,12 +1517,14 @@ static void listener_accept(struct listener *l)
   uint16_t flow_group;
   int ret = 0;
 
-  assert(c != NULL);
+  assert(l->wait_conns != NULL);
   assert(l->backlog_used > 0);
 
   bls = l->backlog_ptrs[l->backlog_pos];
   fn_core = l->backlog_cores[l->backlog_pos];
+  c = listener_wait_pick(l, fn_core, &c_prev);
   flow_group = l->backlog_fgs[l->backlog_pos];
+  c->syn_queued_us = l->backlog_us[l->backlog_pos];
   p = (const struct pkt_tcp *) bls->buf;
   ret = parse_options(p, bls->len, &opts);
   if (ret != 0 || opts.ts == NULL) {
@@ -1330,6 +1545,8 @@ static void listener_accept(struct listener *l)
   c->remote_seq = f_beui32(p->tcp.seqno) + 1;
   c->local_seq = 1; /* TODO: generate random */
   c->syn_ts = f_beui32(opts.ts->ts_val);
+  conn_wscale_negotiate(c, &opts);
+  conn_mss_negotiate(c, &opts);
 
   /* check if ECN is offered */
   ecn_flags = TCPH_FLAGS(&p->tcp) & (TAS_TCP_ECE | TAS_TCP_CWR);
@@ -1347,22 +1564,21 @@ static void listener_accept(struct listener *l)
 
   vmid = c->ctx->app->vm_id;
 
+  conn_bufs_place(c);
   if (nicif_connection_add(c->db_id, c->ctx->app->vm_id, c->ctx->app->id,
         c->remote_mac, c->out_local_ip, c->local_port,
         c->out_remote_ip, c->remote_port, c->rx_buf - (uint8_t *) vm_shm[vmid],
         c->rx_len, c->tx_buf - (uint8_t *) vm_shm[vmid], c->tx_len,
         c->remote_seq, c->local_seq + 1, c->opaque, c->flags, c->cc_rate,
-        c->fn_core, c->flow_group, &c->flow_id)
+        c->rx_wscale, c->tx_wscale, c->tx_mss, c->fn_core,
+        c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "listener_packet: nicif_connection_add failed\n");
     goto out;
   }
 
-  l->wait_conns = c->ht_next;
-  if (l->wait_conns == NULL) {
-    l->wait_conns_last = NULL;
-  }
+  listener_wait_remove(l, c, c_prev);
   conn_register(c);
   nbqueue_enq(&conn_async_q, &c->comp.el);
 
@@ -1377,7 +1593,7 @@ out:
 static void listener_accept_gre(struct listener *l)
 {
   int vmid;
-  struct connection *c = l->wait_conns;
+  struct connection *c, *c_prev;
   struct backlog_slot *bls;
   const struct pkt_gre *p;
   struct tcp_opts opts;
@@ -1385,12 +1601,14 @@ static void listener_accept_gre(struct listener *l)
   uint16_t flow_group;
   int ret = 0;
 
-  assert(c != NULL);
+  assert(l->wait_conns != NULL);
   assert(l->backlog_used > 0);
 
   bls = l->backlog_ptrs[l->backlog_pos];
   fn_core = l->backlog_cores[l->backlog_pos];
+  c = listener_wait_pick(l, fn_core, &c_prev);
   flow_group = l->backlog_fgs[l->backlog_pos];
+  c->syn_queued_us = l->backlog_us[l->backlog_pos];
   p = (const struct pkt_gre *) bls->buf;
   ret = parse_options_gre(p, bls->len, &opts);
   if (ret != 0 || opts.ts == NULL) {
@@ -1414,6 +1632,8 @@ static void listener_accept_gre(struct listener *l)
   c->remote_seq = f_beui32(p->tcp.seqno) + 1;
   c->local_seq = 1; /* TODO: generate random */
   c->syn_ts = f_beui32(opts.ts->ts_val);
+  conn_wscale_negotiate(c, &opts);
+  conn_mss_negotiate(c, &opts);
 
   /* check if ECN is offered */
   ecn_flags = TCPH_FLAGS(&p->tcp) & (TAS_TCP_ECE | TAS_TCP_CWR);
@@ -1431,6 +1651,7 @@ static void listener_accept_gre(struct listener *l)
 
   vmid = c->ctx->app->vm_id;
 
+  conn_bufs_place(c);
   if (nicif_connection_add_gre(c->db_id, c->ctx->app->vm_id, c->ctx->app->id,
         c->tunnel_id, c->remote_mac,
         c->out_local_ip, c->out_remote_ip,
@@ -1438,17 +1659,15 @@ static void listener_accept_gre(struct listener *l)
         c->in_remote_ip, c->remote_port, c->rx_buf - (uint8_t *) vm_shm[vmid],
         c->rx_len, c->tx_buf - (uint8_t *) vm_shm[vmid], c->tx_len,
         c->remote_seq, c->local_seq + 1, c->opaque, c->flags, c->cc_rate,
-        c->fn_core, c->flow_group, &c->flow_id)
+        c->rx_wscale, c->tx_wscale, c->tx_mss, c->fn_core,
+        c->flow_group, &c->flow_id)
       != 0)
   {
     fprintf(stderr, "listener_packet_gre: nicif_connection_add failed\n");
     goto out;
   }
 
-  l->wait_conns = c->ht_next;
-  if (l->wait_conns == NULL) {
-    l->wait_conns_last = NULL;
-  }
+  listener_wait_remove(l, c, c_prev);
   conn_register(c);
   nbqueue_enq(&conn_async_q, &c->comp.el);
 
@@ -1463,19 +1682,22 @@ out:
 static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
     uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
     uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
-    uint16_t mss_opt)
+    uint16_t mss_opt, int ws_opt, uint8_t ws_shift)
 {
   uint32_t new_tail;
   struct pkt_tcp *p;
   struct tcp_mss_opt *opt_mss;
+  struct tcp_ws_opt *opt_ws;
   struct tcp_timestamp_opt *opt_ts;
   uint8_t optlen;
-  uint16_t len, off_ts, off_mss;
+  uint16_t len, off_ts, off_mss, off_ws;
 
   /* calculate header length depending on options */
   optlen = 0;
   off_mss = optlen;
   optlen += (mss_opt ? sizeof(*opt_mss) : 0);
+  off_ws = optlen;
+  optlen += (ws_opt ? 1 + sizeof(*opt_ws) : 0);
   off_ts = optlen;
   optlen += (ts_opt ? sizeof(*opt_ts) : 0);
   optlen = (optlen + 3) & ~3;
@@ -1514,6 +1736,9 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
+  /* clear options area including padding */
+  memset(p + 1, 0, optlen);
+
   /* if requested: add mss option */
   if (mss_opt) {
     opt_mss = (struct tcp_mss_opt *) ((uint8_t *) (p + 1) + off_mss);
@@ -1522,10 +1747,18 @@ static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
     opt_mss->mss = t_beui16(mss_opt);
   }
 
+  /* if requested: add window scale option (NOP-aligned) */
+  if (ws_opt) {
+    *((uint8_t *) (p + 1) + off_ws) = TCP_OPT_NO_OP;
+    opt_ws = (struct tcp_ws_opt *) ((uint8_t *) (p + 1) + off_ws + 1);
+    opt_ws->kind = TCP_OPT_WINDOW_SCALE;
+    opt_ws->length = sizeof(*opt_ws);
+    opt_ws->shift = ws_shift;
+  }
+
   /* if requested: add timestamp option */
   if (ts_opt) {
     opt_ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + off_ts);
-    memset(opt_ts, 0, optlen);
     opt_ts->kind = TCP_OPT_TIMESTAMP;
     opt_ts->length = sizeof(*opt_ts);
     opt_ts->ts_val = t_beui32(0);
@@ -1546,19 +1779,22 @@ static inline int send_control_raw_gre(uint64_t remote_mac,
     uint32_t in_local_ip, uint32_t in_remote_ip,
     uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
     uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
-    uint16_t mss_opt)
+    uint16_t mss_opt, int ws_opt, uint8_t ws_shift)
 {
   uint32_t new_tail;
   struct pkt_gre *p;
   struct tcp_mss_opt *opt_mss;
+  struct tcp_ws_opt *opt_ws;
   struct tcp_timestamp_opt *opt_ts;
   uint8_t optlen;
-  uint16_t len, off_ts, off_mss;
+  uint16_t len, off_ts, off_mss, off_ws;
 
   /* calculate header length depending on options */
   optlen = 0;
   off_mss = optlen;
   optlen += (mss_opt ? sizeof(*opt_mss) : 0);
+  off_ws = optlen;
+  optlen += (ws_opt ? 1 + sizeof(*opt_ws) : 0);
   off_ts = optlen;
   optlen += (ts_opt ? sizeof(*opt_ts) : 0);
   optlen = (optlen + 3) & ~3;
@@ -1613,6 +1849,9 @@ static inline int send_control_raw_gre(uint64_t remote_mac,
   p->tcp.chksum = 0;
   p->tcp.urgp = t_beui16(0);
 
+  /* clear options area including padding */
+  memset(p + 1, 0, optlen);
+
   /* if requested: add mss option */
   if (mss_opt) {
     opt_mss = (struct tcp_mss_opt *) ((uint8_t *) (p + 1) + off_mss);
@@ -1621,10 +1860,18 @@ static inline int send_control_raw_gre(uint64_t remote_mac,
     opt_mss->mss = t_beui16(mss_opt);
   }
 
+  /* if requested: add window scale option (NOP-aligned) */
+  if (ws_opt) {
+    *((uint8_t *) (p + 1) + off_ws) = TCP_OPT_NO_OP;
+    opt_ws = (struct tcp_ws_opt *) ((uint8_t *) (p + 1) + off_ws + 1);
+    opt_ws->kind = TCP_OPT_WINDOW_SCALE;
+    opt_ws->length = sizeof(*opt_ws);
+    opt_ws->shift = ws_shift;
+  }
+
   /* if requested: add timestamp option */
   if (ts_opt) {
     opt_ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + off_ts);
-    memset(opt_ts, 0, optlen);
     opt_ts->kind = TCP_OPT_TIMESTAMP;
     opt_ts->length = sizeof(*opt_ts);
     opt_ts->ts_val = t_beui32(0);
@@ -1642,22 +1889,22 @@ static inline int send_control_raw_gre(uint64_t remote_mac,
 }
 
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt)
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int ws_opt)
 {
   return send_control_raw(conn->remote_mac, conn->out_remote_ip,
       conn->remote_port, conn->local_port, conn->local_seq, conn->remote_seq,
-      flags, ts_opt, ts_echo, mss_opt);
+      flags, ts_opt, ts_echo, mss_opt, ws_opt, conn->rx_wscale);
 }
 
 static inline int send_control_gre(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt)
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int ws_opt)
 {
   return send_control_raw_gre(conn->remote_mac,
       conn->tunnel_id, conn->out_remote_ip,
       conn->in_local_ip, conn->in_remote_ip,
       conn->remote_port,
       conn->local_port, conn->local_seq, conn->remote_seq, flags, ts_opt,
-      ts_echo, mss_opt);
+      ts_echo, mss_opt, ws_opt, conn->rx_wscale);
 }
 
 static inline int send_reset(const struct pkt_tcp *p,
@@ -1675,7 +1922,7 @@ static inline int send_reset(const struct pkt_tcp *p,
   memcpy(&remote_mac, &p->eth.src, ETH_ADDR_LEN);
   return send_control_raw(remote_mac, f_beui32(p->ip.src), f_beui16(p->tcp.src),
       f_beui16(p->tcp.dest), f_beui32(p->tcp.ackno), f_beui32(p->tcp.seqno) + 1,
-      TAS_TCP_RST | TAS_TCP_ACK, ts_opt, ts_val, 0);
+      TAS_TCP_RST | TAS_TCP_ACK, ts_opt, ts_val, 0, 0, 0);
 }
 
 static inline int send_reset_gre(const struct pkt_gre *p,
@@ -1696,7 +1943,7 @@ static inline int send_reset_gre(const struct pkt_gre *p,
       f_beui32(p->in_ip.dest), f_beui32(p->out_ip.dest),
       f_beui16(p->tcp.src), f_beui16(p->tcp.dest),
       f_beui32(p->tcp.ackno), f_beui32(p->tcp.seqno) + 1,
-      TAS_TCP_RST | TAS_TCP_ACK, ts_opt, ts_val, 0);
+      TAS_TCP_RST | TAS_TCP_ACK, ts_opt, ts_val, 0, 0, 0);
 }
 
 static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
@@ -1709,6 +1956,7 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
 
   opts->ts = NULL;
   opts->mss = NULL;
+  opts->ws = NULL;
 
   /* whole header not in buf */
   if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
@@ -1738,6 +1986,14 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
         }
 
         opts->mss = (struct tcp_mss_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_WINDOW_SCALE) {
+        if (opt_len != sizeof(struct tcp_ws_opt)) {
+          fprintf(stderr, "parse_options: window scale option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_ws_opt), opt_len);
+          return -1;
+        }
+
+        opts->ws = (struct tcp_ws_opt *) (opt + off);
       } else if (opt_kind == TCP_OPT_TIMESTAMP) {
         if (opt_len != sizeof(struct tcp_timestamp_opt)) {
           fprintf(stderr, "parse_options: opt_len=%u so=%zu\n", opt_len, sizeof(struct tcp_timestamp_opt));
@@ -1763,6 +2019,7 @@ static inline int parse_options_gre(const struct pkt_gre *p, uint16_t len,
 
   opts->ts = NULL;
   opts->mss = NULL;
+  opts->ws = NULL;
 
   /* whole header not in buf */
   if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
@@ -1792,6 +2049,14 @@ static inline int parse_options_gre(const struct pkt_gre *p, uint16_t len,
         }
 
         opts->mss = (struct tcp_mss_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_WINDOW_SCALE) {
+        if (opt_len != sizeof(struct tcp_ws_opt)) {
+          fprintf(stderr, "parse_options_gre: window scale option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_ws_opt), opt_len);
+          return -1;
+        }
+
+        opts->ws = (struct tcp_ws_opt *) (opt + off);
       } else if (opt_kind == TCP_OPT_TIMESTAMP) {
         if (opt_len != sizeof(struct tcp_timestamp_opt)) {
           fprintf(stderr, "parse_options_gre: opt_len=%u so=%zu\n", opt_len, sizeof(struct tcp_timestamp_opt));
@@ -1913,3 +2178,66 @@ static inline int send_ovs_fake_packet(uint32_t in_remote_ip,
 
   return 0;
 }
+
+/* count a SYN queued on listener l, before it is accepted */
+static inline void accept_stats_syn(struct listener *l)
+{
+  struct tas_telemetry_accept *st = &tas_telemetry->accept;
+
+  st->syns++;
+  if (l->wait_conns == NULL) {
+    st->slot_waits++;
+  }
+}
+
+/* count a connection completed into an accept slot */
+static inline void accept_stats_done(struct connection *c)
+{
+  struct tas_telemetry_accept *st = &tas_telemetry->accept;
+  uint32_t lat = util_timeout_time_us() - c->syn_queued_us;
+  unsigned bin = 0;
+
+  while (bin < TAS_TELEMETRY_ACCEPT_BINS - 1 && lat >= (1U << bin)) {
+    bin++;
+  }
+
+  st->accepted++;
+  st->latency_sum_us += lat;
+  st->latency_bins[bin]++;
+}
+
+/* pick the waiting accept for a SYN handled by fast path core fn_core: the
+ * first one posted for that core if the listener steers by core, otherwise
+ * the oldest one */
+static inline struct connection *listener_wait_pick(struct listener *l,
+    uint32_t fn_core, struct connection **prev)
+{
+  struct connection *c, *c_prev = NULL;
+
+  if ((l->steer & KERNEL_APPOUT_LISTEN_STEER_CORE) != 0) {
+    for (c = l->wait_conns; c != NULL; c_prev = c, c = c->ht_next) {
+      if (c->accept_core == fn_core) {
+        *prev = c_prev;
+        return c;
+      }
+    }
+  }
+
+  *prev = NULL;
+  return l->wait_conns;
+}
+
+/* remove c, which follows prev, from the waiting accepts */
+static inline void listener_wait_remove(struct listener *l,
+    struct connection *c, struct connection *prev)
+{
+  if (prev == NULL) {
+    l->wait_conns = c->ht_next;
+  } else {
+    prev->ht_next = c->ht_next;
+  }
+
+  if (l->wait_conns_last == c) {
+    l->wait_conns_last = prev;
+  }
+}
@@ -36,6 +36,7 @@
 #include <rte_launch.h>
 #include <rte_cycles.h>
 #include <rte_malloc.h>
+#include <rte_mempool.h>
 
 #include <tas_memif.h>
 #include <utils_timeout.h>
@@ -296,6 +297,11 @@ static int start_threads(void)
   /* start common threads */
   RTE_LCORE_FOREACH_WORKER(core) {
     if (threads_launched < fp_cores_max) {
+      if (shm_numa_core(threads_launched, rte_lcore_to_socket_id(core)) != 0) {
+        fprintf(stderr, "start_threads: placing core %u state failed\n",
+            threads_launched);
+      }
+
       arg = (void *) (uintptr_t) threads_launched;
       if (rte_eal_remote_launch(common_thread, arg, core) != 0) {
 	fprintf(stderr, "ERROR\n");
@@ -344,7 +350,7 @@ struct budget_statistics get_budget_stats(int vmid, int ctxid)
   struct budget_statistics stats;
 
   /* Get stats for this logging round */
-  stats.budget = ctxs[ctxid]->budgets[vmid].budget;
+  stats.budget = vm_budget_balance(&ctxs[ctxid]->budgets[vmid]);
   stats.cycles_poll = ctxs[ctxid]->budgets[vmid].cycles_poll;
   stats.cycles_tx = ctxs[ctxid]->budgets[vmid].cycles_tx;
   stats.cycles_rx = ctxs[ctxid]->budgets[vmid].cycles_rx;
@@ -374,57 +380,130 @@ void print_budget() {
     for (int ctxid = 0; ctxid < threads_launched; ctxid++)
     {
       fprintf(stderr, "vmid=%d ctxid=%d budget=%ld\n",
-          vmid, ctxid, ctxs[ctxid]->budgets[vmid].budget);
+          vmid, ctxid, vm_budget_balance(&ctxs[ctxid]->budgets[vmid]));
     }
   }
 }
 
 uint64_t get_budget_delta(int vmid, int ctxid)
 {
-  int64_t budget = __sync_fetch_and_add(&ctxs[ctxid]->budgets[vmid].budget, 0);
-  return config.bu_max_budget - budget;
+  return config.bu_max_budget - vm_budget_balance(&ctxs[ctxid]->budgets[vmid]);
 }
 
 uint64_t tas_get_budget(int vmid, int ctxid)
 {
-  return __sync_fetch_and_add(&ctxs[ctxid]->budgets[vmid].budget, 0);
+  return vm_budget_balance(&ctxs[ctxid]->budgets[vmid]);
 }
 
-#ifdef BUDGET_DEBUG_STATS
 int64_t tas_get_budget_raw(int vmid, int ctxid)
 {
-  return __sync_fetch_and_add(&ctxs[ctxid]->budgets[vmid].budget, 0);
+  return vm_budget_balance(&ctxs[ctxid]->budgets[vmid]);
 }
 
+/* Cycles a core charged to each VM since the previous call, from the
+ * cumulative counters the core maintains anyway. */
 void tas_budget_debug_snapshot_core(int ctxid,
     struct budget_debug_fast_snapshot *snapshot)
 {
+  static uint64_t last_consumed[FLEXNIC_PL_APPST_CTX_MCS][FLEXNIC_PL_VMST_NUM];
+  static uint64_t last_wc[FLEXNIC_PL_APPST_CTX_MCS][FLEXNIC_PL_VMST_NUM];
   int vmid;
+  uint64_t consumed, wc;
   struct dataplane_context *ctx = ctxs[ctxid];
 
-  snapshot->consumed_total = __sync_lock_test_and_set(
-      &ctx->budget_debug_consumed_total, 0);
+  snapshot->consumed_total = 0;
   for (vmid = 0; vmid < FLEXNIC_PL_VMST_NUM; vmid++) {
-    snapshot->consumed_vm[vmid] = __sync_lock_test_and_set(
-        &ctx->budget_debug_consumed_vm[vmid], 0);
-    snapshot->work_conserving_vm[vmid] = __sync_lock_test_and_set(
-        &ctx->budget_debug_work_conserving_cycles[vmid], 0);
+    consumed = ctx->budgets[vmid].consumed;
+    wc = ctx->budgets[vmid].wc_consumed;
+
+    snapshot->consumed_vm[vmid] = consumed - last_consumed[ctxid][vmid];
+    snapshot->work_conserving_vm[vmid] = wc - last_wc[ctxid][vmid];
+    snapshot->consumed_total += snapshot->consumed_vm[vmid];
+
+    last_consumed[ctxid][vmid] = consumed;
+    last_wc[ctxid][vmid] = wc;
   }
 }
-#endif
 
+/* Buffer counters of a VM summed over all cores: transmit buffers taken from
+ * its quota pools, segments deferred at the quota, and dropped packets. */
+void tas_get_vm_buf_stats(int vmid, uint64_t *in_use, uint64_t *backpressure,
+    uint64_t *drops)
+{
+  int ctxid;
+  struct dataplane_context *ctx;
+
+  *in_use = *backpressure = *drops = 0;
+  for (ctxid = 0; ctxid < threads_launched; ctxid++) {
+    ctx = ctxs[ctxid];
+    if (ctx->net.vm_pools[vmid] != NULL)
+      *in_use += rte_mempool_in_use_count(ctx->net.vm_pools[vmid]);
+    *backpressure += ctx->vm_buf_backpressure[vmid];
+    *drops += ctx->vm_rx_drops[vmid];
+  }
+}
+
+/* Estimated transmit queueing delay of a VM in us: bytes queued in the queue
+ * managers divided by the bytes sent per us since the previous call. */
+uint64_t get_vm_qdelay(int vmid, uint64_t interval_us)
+{
+  static uint64_t last_tx_bytes[FLEXNIC_PL_VMST_NUM];
+  uint64_t backlog = 0, tx_bytes = 0, sent;
+  int ctxid;
+
+  for (ctxid = 0; ctxid < threads_launched; ctxid++) {
+    backlog += qman_vm_get_avail(ctxs[ctxid], vmid);
+    tx_bytes += ctxs[ctxid]->budgets[vmid].tx_bytes;
+  }
+
+  sent = tx_bytes - last_tx_bytes[vmid];
+  last_tx_bytes[vmid] = tx_bytes;
+
+  if (backlog == 0) {
+    return 0;
+  } else if (sent == 0) {
+    /* nothing drained in this interval: at least the whole interval */
+    return interval_us;
+  }
+  return backlog * interval_us / sent;
+}
+
+/* Change the deficit round robin weight of a VM on all cores. The quantum is
+ * a single word the cores only read, the new value takes effect on the next
+ * turn of the VM. */
+int tas_vm_tx_weight_set(int vmid, uint32_t weight)
+{
+  int ctxid;
+
+  if (weight == 0) {
+    return -1;
+  }
+
+  config.fp_vm_weights[vmid] = weight;
+  for (ctxid = 0; ctxid < threads_launched; ctxid++) {
+    if (tas_qman_vm_weight(&ctxs[ctxid]->qman, vmid, weight) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Only called from the slow path thread, which is the sole writer of the
+ * granted counters. The balance is computed from a snapshot of the consumed
+ * counter; cycles the core charges concurrently just show up next time. */
 void boost_budget(int vmid, int ctxid, int64_t incr)
 {
-  int64_t old_budget, new_budget, max_budget;
-  old_budget = __sync_fetch_and_add(&ctxs[ctxid]->budgets[vmid].budget, 0);
-  new_budget = old_budget + incr;
-  max_budget = config.bu_max_budget;  
+  struct vm_budget *b = &ctxs[ctxid]->budgets[vmid];
+  int64_t old_budget, max_budget;
+
+  old_budget = vm_budget_balance(b);
+  max_budget = config.bu_max_budget;
 
-  if (new_budget > max_budget)
+  if (old_budget + incr > max_budget)
   {
     incr = max_budget - old_budget;
   }
-  __sync_fetch_and_add(&ctxs[ctxid]->budgets[vmid].budget, incr);
+  b->granted += incr;
 }
 
 void flexnic_loadmon(uint32_t ts)
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Echo server on TAS sockets for comparing the POSIX path (epoll_wait plus
+ * recv/send per connection) with batched submission and completion. Each
+ * thread runs its own listener with SO_REUSEPORT. Reports echoed messages,
+ * bytes, and library calls per second for each thread.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+#include <tas_batch.h>
+
+enum bench_mode {
+  MODE_EPOLL,
+  MODE_BATCH,
+};
+
+static uint32_t max_flows = 4096;
+static uint32_t max_bytes = 1024;
+static uint16_t max_events = 64;
+static uint16_t listen_port;
+static enum bench_mode mode;
+
+struct connection {
+  int fd;
+  int sending;
+  int closing;
+  uint8_t *buf;
+};
+
+struct core {
+  int cn;
+  int listenfd;
+  uint64_t msgs;
+  uint64_t bytes;
+  uint64_t calls;
+} __attribute__((aligned((64))));
+
+static inline uint64_t read_cnt(uint64_t *p)
+{
+  uint64_t v = *p;
+  __sync_fetch_and_sub(p, v);
+  return v;
+}
+
+static void open_listener(struct core *co)
+{
+  struct sockaddr_in addr;
+  int one = 1;
+
+  if ((co->listenfd = tas_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    fprintf(stderr, "[%d] tas_socket failed\n", co->cn);
+    abort();
+  }
+
+  if (tas_setsockopt(co->listenfd, SOL_SOCKET, SO_REUSEPORT, &one,
+        sizeof(one)) != 0)
+  {
+    fprintf(stderr, "[%d] tas_setsockopt SO_REUSEPORT failed\n", co->cn);
+    abort();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if (tas_bind(co->listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "[%d] tas_bind failed\n", co->cn);
+    abort();
+  }
+
+  if (tas_listen(co->listenfd, max_flows) != 0) {
+    fprintf(stderr, "[%d] tas_listen failed\n", co->cn);
+    abort();
+  }
+}
+
+static struct connection *conn_alloc(struct core *co, int fd)
+{
+  struct connection *c;
+
+  if ((c = calloc(1, sizeof(*c))) == NULL ||
+      (c->buf = malloc(max_bytes)) == NULL)
+  {
+    fprintf(stderr, "[%d] allocating connection failed\n", co->cn);
+    abort();
+  }
+  c->fd = fd;
+  return c;
+}
+
+static void conn_free(struct connection *c)
+{
+  free(c->buf);
+  free(c);
+}
+
+static void run_epoll(struct core *co)
+{
+  struct epoll_event ev, *evs;
+  struct connection *c;
+  int epfd, fd, i, n;
+  ssize_t ret;
+
+  if ((evs = calloc(max_events, sizeof(*evs))) == NULL) {
+    fprintf(stderr, "[%d] allocating event buffer failed\n", co->cn);
+    abort();
+  }
+
+  if ((epfd = tas_epoll_create1(0)) < 0) {
+    fprintf(stderr, "[%d] tas_epoll_create1 failed\n", co->cn);
+    abort();
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, co->listenfd, &ev) != 0) {
+    fprintf(stderr, "[%d] tas_epoll_ctl listener failed\n", co->cn);
+    abort();
+  }
+
+  while (1) {
+    n = tas_epoll_wait(epfd, evs, max_events, -1);
+    co->calls++;
+    if (n < 0) {
+      fprintf(stderr, "[%d] tas_epoll_wait failed\n", co->cn);
+      abort();
+    }
+
+    for (i = 0; i < n; i++) {
+      c = evs[i].data.ptr;
+
+      if (c == NULL) {
+        /* accept all pending connections */
+        while ((fd = tas_accept4(co->listenfd, NULL, NULL, SOCK_NONBLOCK))
+            >= 0)
+        {
+          co->calls++;
+          c = conn_alloc(co, fd);
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            fprintf(stderr, "[%d] tas_epoll_ctl conn failed\n", co->cn);
+            abort();
+          }
+          co->calls++;
+        }
+        co->calls++;
+        continue;
+      }
+
+      ret = tas_recv(c->fd, c->buf, max_bytes, 0);
+      co->calls++;
+      if (ret < 0 && errno == EAGAIN) {
+        continue;
+      } else if (ret <= 0) {
+        tas_close(c->fd);
+        co->calls++;
+        conn_free(c);
+        continue;
+      }
+
+      if (tas_send(c->fd, c->buf, ret, 0) != ret) {
+        fprintf(stderr, "[%d] tas_send failed\n", co->cn);
+        abort();
+      }
+      co->calls++;
+      co->msgs++;
+      co->bytes += ret;
+    }
+  }
+}
+
+static void submit_op(struct core *co, struct tas_batch *b, uint8_t opcode,
+    int fd, void *buf, size_t len, void *ud)
+{
+  struct tas_batch_sqe *sqe;
+
+  if ((sqe = tas_batch_get_sqe(b)) == NULL) {
+    fprintf(stderr, "[%d] tas_batch_get_sqe failed\n", co->cn);
+    abort();
+  }
+  tas_batch_prep(sqe, opcode, fd, buf, len, (uintptr_t) ud);
+}
+
+static void run_batch(struct core *co)
+{
+  struct tas_batch_cqe *cqes;
+  struct tas_batch *b;
+  struct connection *c;
+  int i, n;
+
+  if ((cqes = calloc(max_events, sizeof(*cqes))) == NULL) {
+    fprintf(stderr, "[%d] allocating completion buffer failed\n", co->cn);
+    abort();
+  }
+
+  /* one operation per connection, plus the accept */
+  if (tas_batch_init(&b, max_flows + 1) != 0) {
+    fprintf(stderr, "[%d] tas_batch_init failed\n", co->cn);
+    abort();
+  }
+
+  submit_op(co, b, TAS_BATCH_OP_ACCEPT, co->listenfd, NULL, 0, NULL);
+
+  while (1) {
+    tas_batch_submit(b);
+    n = tas_batch_reap(b, cqes, max_events, -1);
+    co->calls += 2;
+
+    for (i = 0; i < n; i++) {
+      c = (struct connection *) (uintptr_t) cqes[i].user_data;
+
+      if (c == NULL) {
+        /* accepted a connection, start receiving and accept the next */
+        if (cqes[i].res < 0) {
+          fprintf(stderr, "[%d] accept failed: %zd\n", co->cn, cqes[i].res);
+          abort();
+        }
+        c = conn_alloc(co, cqes[i].res);
+        submit_op(co, b, TAS_BATCH_OP_RECV, c->fd, c->buf, max_bytes, c);
+        submit_op(co, b, TAS_BATCH_OP_ACCEPT, co->listenfd, NULL, 0, NULL);
+      } else if (c->closing) {
+        conn_free(c);
+      } else if (cqes[i].res <= 0) {
+        /* end of stream or error */
+        c->closing = 1;
+        submit_op(co, b, TAS_BATCH_OP_CLOSE, c->fd, NULL, 0, c);
+      } else if (!c->sending) {
+        /* received a request, echo it */
+        c->sending = 1;
+        submit_op(co, b, TAS_BATCH_OP_SEND, c->fd, c->buf, cqes[i].res, c);
+      } else {
+        /* response is out, wait for the next request */
+        c->sending = 0;
+        submit_op(co, b, TAS_BATCH_OP_RECV, c->fd, c->buf, max_bytes, c);
+        co->msgs++;
+        co->bytes += cqes[i].res;
+      }
+    }
+  }
+}
+
+static void *thread_run(void *arg)
+{
+  struct core *co = arg;
+
+  open_listener(co);
+
+  printf("[%d] Starting event loop\n", co->cn);
+  fflush(stdout);
+  if (mode == MODE_BATCH)
+    run_batch(co);
+  else
+    run_epoll(co);
+
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned num_threads, i;
+  struct core *cs;
+  pthread_t *pts;
+  uint64_t msgs, bytes, calls;
+
+  if (argc < 4 || argc > 6) {
+    fprintf(stderr, "Usage: ./bench_sockets_echo PORT epoll|batch THREADS "
+        "[MAX-FLOWS] [MAX-BYTES]\n");
+    return EXIT_FAILURE;
+  }
+
+  listen_port = atoi(argv[1]);
+  if (strcmp(argv[2], "epoll") == 0) {
+    mode = MODE_EPOLL;
+  } else if (strcmp(argv[2], "batch") == 0) {
+    mode = MODE_BATCH;
+  } else {
+    fprintf(stderr, "unknown mode: %s\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  num_threads = atoi(argv[3]);
+  if (argc >= 5) {
+    max_flows = atoi(argv[4]);
+  }
+  if (argc >= 6) {
+    max_bytes = atoi(argv[5]);
+  }
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  pts = calloc(num_threads, sizeof(*pts));
+  cs = calloc(num_threads, sizeof(*cs));
+  if (pts == NULL || cs == NULL) {
+    fprintf(stderr, "allocating thread handles failed\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    cs[i].cn = i;
+    if (pthread_create(pts + i, NULL, thread_run, cs + i)) {
+      fprintf(stderr, "pthread_create failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  sleep(2);
+  while (1) {
+    sleep(1);
+    for (i = 0; i < num_threads; i++) {
+      msgs = read_cnt(&cs[i].msgs);
+      bytes = read_cnt(&cs[i].bytes);
+      calls = read_cnt(&cs[i].calls);
+
+      printf("    core %2d: %s msgs=%"PRIu64" bytes=%"PRIu64" calls=%"PRIu64
+          " calls/msg=%.2f\n", i, argv[2], msgs, bytes, calls,
+          msgs > 0 ? (double) calls / msgs : 0.0);
+    }
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
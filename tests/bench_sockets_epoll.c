@@ -0,0 +1,290 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Epoll scalability benchmark on TAS sockets: echo server where all threads
+ * share one listener, each with its own epoll holding the connections it
+ * accepted. The listener is registered in every epoll either plainly, so that
+ * each new connection wakes all threads, or with EPOLLEXCLUSIVE. Connections
+ * are level- or edge-triggered. Run it against many mostly idle connections
+ * to see the cost of epoll_wait with large sets. Reports per thread and second
+ * echoed messages, accepted connections, accept wakeups that found nothing,
+ * epoll_wait calls, and the average time spent in epoll_wait per event.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+
+static uint32_t max_bytes = 1024;
+static uint16_t max_events = 64;
+static uint16_t listen_port;
+static uint32_t listen_events = EPOLLIN;
+static uint32_t conn_events = EPOLLIN;
+static int listenfd;
+
+struct connection {
+  int fd;
+  uint8_t *buf;
+};
+
+struct core {
+  int cn;
+  uint64_t msgs;
+  uint64_t accepts;
+  uint64_t empty_accepts;
+  uint64_t waits;
+  uint64_t events;
+  uint64_t wait_ns;
+} __attribute__((aligned((64))));
+
+static inline uint64_t read_cnt(uint64_t *p)
+{
+  uint64_t v = *p;
+  __sync_fetch_and_sub(p, v);
+  return v;
+}
+
+static inline uint64_t get_nanos(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void open_listener(void)
+{
+  struct sockaddr_in addr;
+
+  if ((listenfd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    fprintf(stderr, "tas_socket failed\n");
+    abort();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if (tas_bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "tas_bind failed\n");
+    abort();
+  }
+
+  if (tas_listen(listenfd, 1024) != 0) {
+    fprintf(stderr, "tas_listen failed\n");
+    abort();
+  }
+}
+
+static void accept_conns(struct core *co, int epfd)
+{
+  struct epoll_event ev;
+  struct connection *c;
+  int fd, n = 0;
+
+  while ((fd = tas_accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    if ((c = calloc(1, sizeof(*c))) == NULL ||
+        (c->buf = malloc(max_bytes)) == NULL)
+    {
+      fprintf(stderr, "[%d] allocating connection failed\n", co->cn);
+      abort();
+    }
+    c->fd = fd;
+
+    ev.events = conn_events;
+    ev.data.ptr = c;
+    if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      fprintf(stderr, "[%d] tas_epoll_ctl conn failed\n", co->cn);
+      abort();
+    }
+    n++;
+  }
+
+  co->accepts += n;
+  if (n == 0)
+    co->empty_accepts++;
+}
+
+/* echo received data, returns -1 if the connection is closed */
+static int conn_echo(struct core *co, struct connection *c)
+{
+  ssize_t ret;
+
+  /* edge-triggered connections have to be drained */
+  do {
+    ret = tas_recv(c->fd, c->buf, max_bytes, 0);
+    if (ret < 0 && errno == EAGAIN) {
+      return 0;
+    } else if (ret <= 0) {
+      return -1;
+    }
+
+    if (tas_send(c->fd, c->buf, ret, 0) != ret) {
+      fprintf(stderr, "[%d] tas_send failed\n", co->cn);
+      abort();
+    }
+    co->msgs++;
+  } while ((conn_events & EPOLLET) != 0);
+
+  return 0;
+}
+
+static void *thread_run(void *arg)
+{
+  struct core *co = arg;
+  struct epoll_event ev, *evs;
+  struct connection *c;
+  uint64_t start;
+  int epfd, i, n;
+
+  if ((evs = calloc(max_events, sizeof(*evs))) == NULL) {
+    fprintf(stderr, "[%d] allocating event buffer failed\n", co->cn);
+    abort();
+  }
+
+  if ((epfd = tas_epoll_create1(0)) < 0) {
+    fprintf(stderr, "[%d] tas_epoll_create1 failed\n", co->cn);
+    abort();
+  }
+
+  ev.events = listen_events;
+  ev.data.ptr = NULL;
+  if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) != 0) {
+    fprintf(stderr, "[%d] tas_epoll_ctl listener failed\n", co->cn);
+    abort();
+  }
+
+  printf("[%d] Starting event loop\n", co->cn);
+  fflush(stdout);
+  while (1) {
+    start = get_nanos();
+    n = tas_epoll_wait(epfd, evs, max_events, -1);
+    co->wait_ns += get_nanos() - start;
+    co->waits++;
+    if (n < 0) {
+      fprintf(stderr, "[%d] tas_epoll_wait failed\n", co->cn);
+      abort();
+    }
+    co->events += n;
+
+    for (i = 0; i < n; i++) {
+      c = evs[i].data.ptr;
+      if (c == NULL) {
+        accept_conns(co, epfd);
+      } else if (conn_echo(co, c) != 0) {
+        tas_close(c->fd);
+        free(c->buf);
+        free(c);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned num_threads, i;
+  struct core *cs;
+  pthread_t *pts;
+  uint64_t msgs, accepts, empty, waits, events, wait_ns;
+
+  if (argc < 5 || argc > 6) {
+    fprintf(stderr, "Usage: ./bench_sockets_epoll PORT THREADS lt|et "
+        "shared|exclusive [MAX-BYTES]\n");
+    return EXIT_FAILURE;
+  }
+
+  listen_port = atoi(argv[1]);
+  num_threads = atoi(argv[2]);
+  if (strcmp(argv[3], "et") == 0) {
+    conn_events |= EPOLLET;
+  } else if (strcmp(argv[3], "lt") != 0) {
+    fprintf(stderr, "unknown trigger mode: %s\n", argv[3]);
+    return EXIT_FAILURE;
+  }
+  if (strcmp(argv[4], "exclusive") == 0) {
+    listen_events |= EPOLLEXCLUSIVE;
+  } else if (strcmp(argv[4], "shared") != 0) {
+    fprintf(stderr, "unknown listener mode: %s\n", argv[4]);
+    return EXIT_FAILURE;
+  }
+  if (argc >= 6) {
+    max_bytes = atoi(argv[5]);
+  }
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  open_listener();
+
+  pts = calloc(num_threads, sizeof(*pts));
+  cs = calloc(num_threads, sizeof(*cs));
+  if (pts == NULL || cs == NULL) {
+    fprintf(stderr, "allocating thread handles failed\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    cs[i].cn = i;
+    if (pthread_create(pts + i, NULL, thread_run, cs + i)) {
+      fprintf(stderr, "pthread_create failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  sleep(2);
+  while (1) {
+    sleep(1);
+    for (i = 0; i < num_threads; i++) {
+      msgs = read_cnt(&cs[i].msgs);
+      accepts = read_cnt(&cs[i].accepts);
+      empty = read_cnt(&cs[i].empty_accepts);
+      waits = read_cnt(&cs[i].waits);
+      events = read_cnt(&cs[i].events);
+      wait_ns = read_cnt(&cs[i].wait_ns);
+
+      printf("    core %2d: msgs=%"PRIu64" accepts=%"PRIu64" empty_accepts=%"
+          PRIu64" waits=%"PRIu64" events=%"PRIu64" ns/event=%.1f\n", i, msgs,
+          accepts, empty, waits, events,
+          events > 0 ? (double) wait_ns / events : 0.0);
+    }
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
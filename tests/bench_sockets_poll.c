@@ -0,0 +1,182 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * poll() scalability benchmark on TAS sockets: single threaded echo server
+ * that polls the listener and all connections with one pollfd array, as
+ * legacy event loops do. Optionally adds idle linux fds to the set to take
+ * the mixed TAS/linux path. Run it against many mostly idle connections to
+ * see how the cost per poll call grows with the size of the set. Reports per
+ * second echoed messages, poll calls, fds per call, and time per call.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+
+static uint32_t max_flows = 16384;
+static uint32_t max_bytes = 1024;
+
+static inline uint64_t get_nanos(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int open_listener(uint16_t port)
+{
+  struct sockaddr_in addr;
+  int fd;
+
+  if ((fd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    fprintf(stderr, "tas_socket failed\n");
+    abort();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (tas_bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "tas_bind failed\n");
+    abort();
+  }
+
+  if (tas_listen(fd, 1024) != 0) {
+    fprintf(stderr, "tas_listen failed\n");
+    abort();
+  }
+  return fd;
+}
+
+int main(int argc, char *argv[])
+{
+  struct pollfd *pfds;
+  uint8_t *buf;
+  unsigned num_linux = 0, nfds, i, n;
+  uint64_t msgs = 0, calls = 0, fds_polled = 0, poll_ns = 0;
+  uint64_t start, last_print;
+  ssize_t ret;
+  int fd;
+
+  if (argc < 2 || argc > 5) {
+    fprintf(stderr, "Usage: ./bench_sockets_poll PORT [LINUX-FDS] "
+        "[MAX-FLOWS] [MAX-BYTES]\n");
+    return EXIT_FAILURE;
+  }
+  if (argc >= 3) {
+    num_linux = atoi(argv[2]);
+  }
+  if (argc >= 4) {
+    max_flows = atoi(argv[3]);
+  }
+  if (argc >= 5) {
+    max_bytes = atoi(argv[4]);
+  }
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  pfds = calloc(1 + num_linux + max_flows, sizeof(*pfds));
+  buf = malloc(max_bytes);
+  if (pfds == NULL || buf == NULL) {
+    fprintf(stderr, "allocating buffers failed\n");
+    return EXIT_FAILURE;
+  }
+
+  /* listener, then idle linux fds, then connections */
+  pfds[0].fd = open_listener(atoi(argv[1]));
+  pfds[0].events = POLLIN;
+  for (i = 1; i <= num_linux; i++) {
+    if ((pfds[i].fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+      perror("eventfd failed");
+      return EXIT_FAILURE;
+    }
+    pfds[i].events = POLLIN;
+  }
+  nfds = 1 + num_linux;
+
+  last_print = get_nanos();
+  while (1) {
+    start = get_nanos();
+    n = tas_poll(pfds, nfds, 1000);
+    poll_ns += get_nanos() - start;
+    calls++;
+    fds_polled += nfds;
+
+    if (n > 0 && (pfds[0].revents & POLLIN) != 0) {
+      while (nfds < 1 + num_linux + max_flows &&
+          (fd = tas_accept4(pfds[0].fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+      {
+        pfds[nfds].fd = fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds].revents = 0;
+        nfds++;
+      }
+    }
+
+    for (i = 1 + num_linux; n > 0 && i < nfds; i++) {
+      if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+        continue;
+
+      ret = tas_recv(pfds[i].fd, buf, max_bytes, 0);
+      if (ret < 0 && errno == EAGAIN)
+        continue;
+
+      if (ret <= 0 || tas_send(pfds[i].fd, buf, ret, 0) != ret) {
+        /* closed, move the last connection into this slot */
+        tas_close(pfds[i].fd);
+        pfds[i--] = pfds[--nfds];
+        continue;
+      }
+      msgs++;
+    }
+
+    if (start - last_print >= 1000000000ULL) {
+      printf("msgs=%"PRIu64" polls=%"PRIu64" fds/poll=%.1f ns/poll=%.1f "
+          "conns=%u\n", msgs, calls, calls > 0 ? (double) fds_polled / calls :
+          0.0, calls > 0 ? (double) poll_ns / calls : 0.0,
+          nfds - 1 - num_linux);
+      fflush(stdout);
+      msgs = calls = fds_polled = poll_ns = 0;
+      last_print = start;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
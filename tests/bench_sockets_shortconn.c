@@ -0,0 +1,282 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Short connection benchmark on TAS sockets: HTTP/1.0 style server where
+ * every connection carries one request and is closed after the response, so
+ * throughput is bound by accepting and closing connections. All threads share
+ * one listener registered with EPOLLEXCLUSIVE in each thread's epoll. Drive it
+ * with any HTTP/1.0 load generator, e.g. ab without -k. Reports per thread
+ * and second completed connections, accepted connections, accept calls that
+ * found nothing, and the average time from accept to close. The slow path
+ * side of accepts (slot waits and SYN to accept latency) is exported by
+ * tools/telemetrytool.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+
+#define MAX_EVENTS 64
+#define REQ_MAX 2048
+
+static uint16_t listen_port;
+static int listenfd;
+static char *response;
+static size_t response_len;
+
+struct connection {
+  int fd;
+  size_t req_len;
+  uint64_t accept_ns;
+  char req[REQ_MAX];
+};
+
+struct core {
+  int cn;
+  uint64_t conns;
+  uint64_t accepts;
+  uint64_t empty_accepts;
+  uint64_t conn_ns;
+} __attribute__((aligned((64))));
+
+static inline uint64_t read_cnt(uint64_t *p)
+{
+  uint64_t v = *p;
+  __sync_fetch_and_sub(p, v);
+  return v;
+}
+
+static inline uint64_t get_nanos(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void open_listener(void)
+{
+  struct sockaddr_in addr;
+
+  if ((listenfd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    fprintf(stderr, "tas_socket failed\n");
+    abort();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if (tas_bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "tas_bind failed\n");
+    abort();
+  }
+
+  if (tas_listen(listenfd, 1024) != 0) {
+    fprintf(stderr, "tas_listen failed\n");
+    abort();
+  }
+}
+
+static void accept_conns(struct core *co, int epfd)
+{
+  struct epoll_event ev;
+  struct connection *c;
+  int fd, n = 0;
+
+  while ((fd = tas_accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    if ((c = malloc(sizeof(*c))) == NULL) {
+      fprintf(stderr, "[%d] allocating connection failed\n", co->cn);
+      abort();
+    }
+    c->fd = fd;
+    c->req_len = 0;
+    c->accept_ns = get_nanos();
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      fprintf(stderr, "[%d] tas_epoll_ctl conn failed\n", co->cn);
+      abort();
+    }
+    n++;
+  }
+
+  co->accepts += n;
+  if (n == 0)
+    co->empty_accepts++;
+}
+
+/* read the request, returns 1 once the connection is done */
+static int conn_request(struct core *co, struct connection *c)
+{
+  ssize_t ret;
+
+  ret = tas_recv(c->fd, c->req + c->req_len, REQ_MAX - 1 - c->req_len, 0);
+  if (ret < 0 && errno == EAGAIN) {
+    return 0;
+  } else if (ret <= 0) {
+    return 1;
+  }
+  c->req_len += ret;
+  c->req[c->req_len] = 0;
+
+  /* wait for the end of the header, unless the buffer is full */
+  if (strstr(c->req, "\r\n\r\n") == NULL && c->req_len < REQ_MAX - 1) {
+    return 0;
+  }
+
+  if (tas_send(c->fd, response, response_len, 0) != (ssize_t) response_len) {
+    fprintf(stderr, "[%d] tas_send failed\n", co->cn);
+    abort();
+  }
+
+  co->conns++;
+  co->conn_ns += get_nanos() - c->accept_ns;
+  return 1;
+}
+
+static void *thread_run(void *arg)
+{
+  struct core *co = arg;
+  struct epoll_event ev, evs[MAX_EVENTS];
+  struct connection *c;
+  int epfd, i, n;
+
+  if ((epfd = tas_epoll_create1(0)) < 0) {
+    fprintf(stderr, "[%d] tas_epoll_create1 failed\n", co->cn);
+    abort();
+  }
+
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.ptr = NULL;
+  if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) != 0) {
+    fprintf(stderr, "[%d] tas_epoll_ctl listener failed\n", co->cn);
+    abort();
+  }
+
+  printf("[%d] Starting event loop\n", co->cn);
+  fflush(stdout);
+  while (1) {
+    if ((n = tas_epoll_wait(epfd, evs, MAX_EVENTS, -1)) < 0) {
+      fprintf(stderr, "[%d] tas_epoll_wait failed\n", co->cn);
+      abort();
+    }
+
+    for (i = 0; i < n; i++) {
+      c = evs[i].data.ptr;
+      if (c == NULL) {
+        accept_conns(co, epfd);
+      } else if (conn_request(co, c) != 0) {
+        tas_close(c->fd);
+        free(c);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned num_threads, i;
+  struct core *cs;
+  pthread_t *pts;
+  size_t body_len = 128;
+  int hdr_len;
+  uint64_t conns, accepts, empty, conn_ns;
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: ./bench_sockets_shortconn PORT THREADS "
+        "[RESPONSE-BYTES]\n");
+    return EXIT_FAILURE;
+  }
+
+  listen_port = atoi(argv[1]);
+  num_threads = atoi(argv[2]);
+  if (argc >= 4) {
+    body_len = atoi(argv[3]);
+  }
+
+  /* response header followed by body_len bytes of body */
+  if ((response = malloc(body_len + 128)) == NULL) {
+    fprintf(stderr, "allocating response failed\n");
+    return EXIT_FAILURE;
+  }
+  hdr_len = snprintf(response, 128, "HTTP/1.0 200 OK\r\nContent-Length: %zu"
+      "\r\nConnection: close\r\n\r\n", body_len);
+  memset(response + hdr_len, 'x', body_len);
+  response_len = hdr_len + body_len;
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  open_listener();
+
+  pts = calloc(num_threads, sizeof(*pts));
+  cs = calloc(num_threads, sizeof(*cs));
+  if (pts == NULL || cs == NULL) {
+    fprintf(stderr, "allocating thread handles failed\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    cs[i].cn = i;
+    if (pthread_create(pts + i, NULL, thread_run, cs + i)) {
+      fprintf(stderr, "pthread_create failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  sleep(2);
+  while (1) {
+    sleep(1);
+    for (i = 0; i < num_threads; i++) {
+      conns = read_cnt(&cs[i].conns);
+      accepts = read_cnt(&cs[i].accepts);
+      empty = read_cnt(&cs[i].empty_accepts);
+      conn_ns = read_cnt(&cs[i].conn_ns);
+
+      printf("    core %2d: conns/s=%"PRIu64" accepts=%"PRIu64" empty_accepts=%"
+          PRIu64" us/conn=%.1f\n", i, conns, accepts, empty,
+          conns > 0 ? (double) conn_ns / conns / 1000 : 0.0);
+    }
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
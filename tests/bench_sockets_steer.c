@@ -0,0 +1,253 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Connection steering benchmark on TAS sockets: multi-threaded echo server
+ * where all threads share one listener registered with EPOLLEXCLUSIVE in
+ * each thread's epoll, and the listener steers connections as selected with
+ * TAS_SO_STEER (none, thread, or core). Drive it with any echo load
+ * generator, with short or long connections. Reports per thread and second
+ * accepted connections and echoed messages, along with the cross-core
+ * accesses of the sockets emulation from tas_sock_stats(): connections moved
+ * to the thread's context (a slow path round trip each), and connections
+ * taken from another thread's accept slots.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+
+#define MAX_EVENTS 64
+#define BUF_SIZE 2048
+
+static uint16_t listen_port;
+static int listenfd;
+
+struct core {
+  int cn;
+  uint64_t accepts;
+  uint64_t msgs;
+  uint64_t closes;
+  uint64_t conn_moves;
+  uint64_t accept_steals;
+} __attribute__((aligned((64))));
+
+static inline uint64_t read_cnt(uint64_t *p)
+{
+  uint64_t v = *p;
+  __sync_fetch_and_sub(p, v);
+  return v;
+}
+
+static void open_listener(int steer)
+{
+  struct sockaddr_in addr;
+
+  if ((listenfd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+    fprintf(stderr, "tas_socket failed\n");
+    abort();
+  }
+
+  if (tas_setsockopt(listenfd, SOL_SOCKET, TAS_SO_STEER, &steer,
+        sizeof(steer)) != 0)
+  {
+    fprintf(stderr, "tas_setsockopt TAS_SO_STEER failed\n");
+    abort();
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if (tas_bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "tas_bind failed\n");
+    abort();
+  }
+
+  if (tas_listen(listenfd, 1024) != 0) {
+    fprintf(stderr, "tas_listen failed\n");
+    abort();
+  }
+}
+
+static void accept_conns(struct core *co, int epfd)
+{
+  struct epoll_event ev;
+  int fd;
+
+  while ((fd = tas_accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      fprintf(stderr, "[%d] tas_epoll_ctl conn failed\n", co->cn);
+      abort();
+    }
+    co->accepts++;
+  }
+}
+
+/* echo what is there, returns 1 once the connection is closed */
+static int conn_echo(struct core *co, int fd, char *buf)
+{
+  ssize_t ret;
+
+  ret = tas_recv(fd, buf, BUF_SIZE, 0);
+  if (ret < 0 && errno == EAGAIN) {
+    return 0;
+  } else if (ret <= 0) {
+    return 1;
+  }
+
+  if (tas_send(fd, buf, ret, 0) != ret) {
+    fprintf(stderr, "[%d] tas_send failed\n", co->cn);
+    abort();
+  }
+
+  co->msgs++;
+  return 0;
+}
+
+static void *thread_run(void *arg)
+{
+  struct core *co = arg;
+  struct epoll_event ev, evs[MAX_EVENTS];
+  struct tas_sock_stats st;
+  char buf[BUF_SIZE];
+  int epfd, i, n;
+
+  if ((epfd = tas_epoll_create1(0)) < 0) {
+    fprintf(stderr, "[%d] tas_epoll_create1 failed\n", co->cn);
+    abort();
+  }
+
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.fd = listenfd;
+  if (tas_epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) != 0) {
+    fprintf(stderr, "[%d] tas_epoll_ctl listener failed\n", co->cn);
+    abort();
+  }
+
+  printf("[%d] Starting event loop\n", co->cn);
+  fflush(stdout);
+  while (1) {
+    if ((n = tas_epoll_wait(epfd, evs, MAX_EVENTS, -1)) < 0) {
+      fprintf(stderr, "[%d] tas_epoll_wait failed\n", co->cn);
+      abort();
+    }
+
+    for (i = 0; i < n; i++) {
+      if (evs[i].data.fd == listenfd) {
+        accept_conns(co, epfd);
+      } else if (conn_echo(co, evs[i].data.fd, buf) != 0) {
+        tas_close(evs[i].data.fd);
+        co->closes++;
+      }
+    }
+
+    /* counters are per thread, collect them here */
+    tas_sock_stats(&st);
+    co->conn_moves += st.conn_moves;
+    co->accept_steals += st.accept_steals;
+  }
+
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned num_threads, i;
+  struct core *cs;
+  pthread_t *pts;
+  int steer;
+  uint64_t accepts, msgs, closes, moves, steals;
+
+  if (argc != 4) {
+    fprintf(stderr, "Usage: ./bench_sockets_steer PORT THREADS "
+        "none|thread|core\n");
+    return EXIT_FAILURE;
+  }
+
+  listen_port = atoi(argv[1]);
+  num_threads = atoi(argv[2]);
+  if (!strcmp(argv[3], "none")) {
+    steer = TAS_STEER_NONE;
+  } else if (!strcmp(argv[3], "thread")) {
+    steer = TAS_STEER_THREAD;
+  } else if (!strcmp(argv[3], "core")) {
+    steer = TAS_STEER_CORE;
+  } else {
+    fprintf(stderr, "unknown steering mode: %s\n", argv[3]);
+    return EXIT_FAILURE;
+  }
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  open_listener(steer);
+
+  pts = calloc(num_threads, sizeof(*pts));
+  cs = calloc(num_threads, sizeof(*cs));
+  if (pts == NULL || cs == NULL) {
+    fprintf(stderr, "allocating thread handles failed\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    cs[i].cn = i;
+    if (pthread_create(pts + i, NULL, thread_run, cs + i)) {
+      fprintf(stderr, "pthread_create failed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  sleep(2);
+  while (1) {
+    sleep(1);
+    for (i = 0; i < num_threads; i++) {
+      accepts = read_cnt(&cs[i].accepts);
+      msgs = read_cnt(&cs[i].msgs);
+      closes = read_cnt(&cs[i].closes);
+      moves = read_cnt(&cs[i].conn_moves);
+      steals = read_cnt(&cs[i].accept_steals);
+
+      printf("    core %2d: accepts=%"PRIu64" msgs=%"PRIu64" closes=%"PRIu64
+          " conn_moves=%"PRIu64" accept_steals=%"PRIu64"\n", i, accepts, msgs,
+          closes, moves, steals);
+    }
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Large-response server on TAS sockets for comparing regular sends with
+ * zero-copy sends. For every request received on a connection the server
+ * generates a response of RESP-BYTES, either into a private buffer that is
+ * then passed to tas_send(), or directly into transmit buffer space reserved
+ * with tas_zc_reservev() and committed with tas_zc_commit(). Reports response
+ * throughput every second.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <tas_sockets.h>
+
+#define MAX_CONNS 1024
+
+static uint16_t listen_port;
+static size_t resp_bytes = 64 * 1024;
+static int zero_copy;
+static uint64_t tx_bytes;
+static uint64_t responses;
+
+/* stands in for the application building its response */
+static void fill_response(void *buf, size_t len, size_t off)
+{
+  uint8_t *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    p[i] = (uint8_t) (off + i);
+}
+
+static int send_copy(int fd, uint8_t *buf)
+{
+  size_t off;
+  ssize_t ret;
+
+  fill_response(buf, resp_bytes, 0);
+  for (off = 0; off < resp_bytes; off += ret) {
+    if ((ret = tas_send(fd, buf + off, resp_bytes - off, 0)) <= 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int send_zc(int fd)
+{
+  struct iovec iov[2];
+  size_t off, done;
+  ssize_t ret;
+  int i, iovcnt;
+
+  for (off = 0; off < resp_bytes; off += ret) {
+    iovcnt = 2;
+    if ((ret = tas_zc_reservev(fd, iov, &iovcnt, resp_bytes - off)) <= 0)
+      return -1;
+
+    for (i = 0, done = off; i < iovcnt; i++) {
+      fill_response(iov[i].iov_base, iov[i].iov_len, done);
+      done += iov[i].iov_len;
+    }
+
+    if (tas_zc_commit(fd, ret) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+static void *conn_run(void *arg)
+{
+  int fd = (uintptr_t) arg;
+  uint8_t req[64], *buf = NULL;
+  ssize_t ret;
+
+  if (!zero_copy && (buf = malloc(resp_bytes)) == NULL) {
+    fprintf(stderr, "allocating response buffer failed\n");
+    abort();
+  }
+
+  while ((ret = tas_recv(fd, req, sizeof(req), 0)) > 0) {
+    if ((zero_copy ? send_zc(fd) : send_copy(fd, buf)) != 0) {
+      perror("sending response failed");
+      break;
+    }
+    __sync_fetch_and_add(&tx_bytes, resp_bytes);
+    __sync_fetch_and_add(&responses, 1);
+  }
+
+  tas_close(fd);
+  free(buf);
+  return NULL;
+}
+
+static void *stats_run(void *arg)
+{
+  uint64_t b, r;
+
+  while (1) {
+    sleep(1);
+    b = __sync_fetch_and_and(&tx_bytes, 0);
+    r = __sync_fetch_and_and(&responses, 0);
+    printf("%s: responses=%"PRIu64" tx=%.2f Gbit/s\n",
+        zero_copy ? "zero-copy" : "copy", r, b * 8 / 1e9);
+    fflush(stdout);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  struct sockaddr_in addr;
+  pthread_t pt;
+  int listenfd, fd;
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: ./bench_sockets_zc PORT copy|zc [RESP-BYTES]\n");
+    return EXIT_FAILURE;
+  }
+
+  listen_port = atoi(argv[1]);
+  if (strcmp(argv[2], "copy") == 0) {
+    zero_copy = 0;
+  } else if (strcmp(argv[2], "zc") == 0) {
+    zero_copy = 1;
+  } else {
+    fprintf(stderr, "unknown mode: %s\n", argv[2]);
+    return EXIT_FAILURE;
+  }
+  if (argc >= 4) {
+    resp_bytes = atol(argv[3]);
+  }
+
+  if (tas_init() != 0) {
+    fprintf(stderr, "tas_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  if ((listenfd = tas_socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    perror("tas_socket failed");
+    return EXIT_FAILURE;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if (tas_bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+    perror("tas_bind failed");
+    return EXIT_FAILURE;
+  }
+
+  if (tas_listen(listenfd, MAX_CONNS) != 0) {
+    perror("tas_listen failed");
+    return EXIT_FAILURE;
+  }
+
+  if (pthread_create(&pt, NULL, stats_run, NULL) != 0) {
+    fprintf(stderr, "pthread_create failed\n");
+    return EXIT_FAILURE;
+  }
+
+  /* one thread per connection */
+  while ((fd = tas_accept(listenfd, NULL, NULL)) >= 0) {
+    if (pthread_create(&pt, NULL, conn_run, (void *) (uintptr_t) fd) != 0) {
+      fprintf(stderr, "pthread_create failed\n");
+      return EXIT_FAILURE;
+    }
+    pthread_detach(pt);
+  }
+
+  perror("tas_accept failed");
+  return EXIT_FAILURE;
+}
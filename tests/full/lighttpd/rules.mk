@@ -62,10 +62,34 @@ run-tests-full-lighttpd-client: tests-full-lighttpd test-full-wrapdeps
 		-p '$(ft_lighttpd_client) -t2 -c100 -d10s -R2000 \
 		    http://$$LINUX_IP:8000/lighttpd.conf'
 
+###################################
+# Static file throughput, lighttpd sending with sendfile or with write
+
+ft_lighttpd_bench_config := $(d)/lighttpd-bench.conf
+ft_lighttpd_www := $(ft_lighttpd_parentdir)/www
+ft_lighttpd_file := $(ft_lighttpd_www)/file-1m.bin
+
+$(ft_lighttpd_file):
+	mkdir -p $(dir $@)
+	head -c 1048576 /dev/urandom > $@
+
+run-tests-full-lighttpd-bench-%: tests-full-lighttpd test-full-wrapdeps \
+    $(ft_lighttpd_file)
+	FT_LIGHTTPD_BACKEND=$* FT_LIGHTTPD_WWW=$(abspath $(ft_lighttpd_www)) \
+	$(FTWRAP) -d 500 \
+		-P '$(ft_lighttpd_server) -D -m $(ft_lighttpd_build)/src/.libs/\
+		    -f $(ft_lighttpd_bench_config)' \
+		-c '$(ft_lighttpd_client) -t2 -c32 -d10s -R1000 \
+		    http://$$TAS_IP:8000/file-1m.bin'
+
+run-tests-full-lighttpd-bench: run-tests-full-lighttpd-bench-sendfile \
+    run-tests-full-lighttpd-bench-write
+
 run-tests-full-lighttpd: run-tests-full-lighttpd-server run-tests-full-lighttpd-client
 run-tests-full: run-tests-full-lighttpd
 
 .PHONY: tests-full-lighttpd run-tests-full-lighttpd \
-    run-tests-full-lighttpd-server run-tests-full-lighttpd-client
+    run-tests-full-lighttpd-server run-tests-full-lighttpd-client \
+    run-tests-full-lighttpd-bench
 
 include mk/subdir_post.mk
@@ -81,6 +81,16 @@ run-tests-full-nodejs-client: tests-full-nodejs test-full-wrapdeps
 run-tests-full-nodejs: run-tests-full-nodejs-server run-tests-full-nodejs-client
 #run-tests-full: run-tests-full-nodejs
 
-.PHONY: tests-full-nodejs run-tests-full-nodejs run-tests-full-nodejs-server run-tests-full-nodejs-client
+# Compare requests/s of nodejs in TAS with and without single threaded sockets
+bench-tests-full-nodejs: tests-full-nodejs test-full-wrapdeps
+	$(FTWRAP) -d 1000 \
+		-P '$(ft_nodejs_server) $(ft_nodejs_config)' \
+		-c '$(ft_nodejs_client) -t2 -c100 -d10s -R100000 http://$$TAS_IP:3000'
+	TAS_SINGLE_THREAD=1 $(FTWRAP) -d 1000 \
+		-P '$(ft_nodejs_server) $(ft_nodejs_config)' \
+		-c '$(ft_nodejs_client) -t2 -c100 -d10s -R100000 http://$$TAS_IP:3000'
+
+.PHONY: tests-full-nodejs run-tests-full-nodejs run-tests-full-nodejs-server run-tests-full-nodejs-client \
+  bench-tests-full-nodejs
 
 include mk/subdir_post.mk
@@ -60,6 +60,16 @@ run-tests-full-redis-client: tests-full-redis test-full-wrapdeps
 run-tests-full-redis: run-tests-full-redis-server run-tests-full-redis-client
 run-tests-full: run-tests-full-redis
 
-.PHONY: tests-full-redis run-tests-full-redis run-tests-full-redis-server run-tests-full-redis-client
+# Compare requests/s of redis in TAS with and without single threaded sockets
+bench-tests-full-redis: tests-full-redis test-full-wrapdeps
+	$(FTWRAP) -d 1000 \
+		-P '$(ft_redis_server) $(ft_redis_config)' \
+		-c '$(ft_redis_client) -h $$TAS_IP -n 100000 -c 50 -t get,set -q'
+	TAS_SINGLE_THREAD=1 $(FTWRAP) -d 1000 \
+		-P '$(ft_redis_server) $(ft_redis_config)' \
+		-c '$(ft_redis_client) -h $$TAS_IP -n 100000 -c 50 -t get,set -q'
+
+.PHONY: tests-full-redis run-tests-full-redis run-tests-full-redis-server run-tests-full-redis-client \
+  bench-tests-full-redis
 
 include mk/subdir_post.mk
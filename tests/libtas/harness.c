@@ -164,6 +164,50 @@ int harness_aout_pull_connopen_op(size_t ctxid, uint64_t *opaque,
   }
 }
 
+int harness_aout_pull_listenopen(size_t ctxid, uint64_t opaque,
+    uint16_t local_port, uint8_t flags)
+{
+  struct kernel_appout *pao;
+  struct kernel_appout_listen_open *alo;
+
+  if (harness_aout_peek(&pao, ctxid) != 0)
+    return -1;
+
+  alo = &pao->data.listen_open;
+  if (pao->type == KERNEL_APPOUT_LISTEN_OPEN &&
+      alo->opaque == opaque &&
+      alo->local_port == local_port &&
+      alo->flags == flags)
+  {
+    return harness_aout_pop(ctxid);
+  } else {
+    return 1;
+  }
+}
+
+int harness_aout_pull_acceptconns_op(size_t ctxid, uint64_t listen_opaque,
+    uint64_t *conn_opaques, uint8_t *num, uint16_t *core)
+{
+  struct kernel_appout *pao;
+  struct kernel_appout_accept_conns *aac;
+
+  if (harness_aout_peek(&pao, ctxid) != 0)
+    return -1;
+
+  aac = &pao->data.accept_conns;
+  if (pao->type == KERNEL_APPOUT_ACCEPT_CONNS &&
+      aac->listen_opaque == listen_opaque &&
+      aac->num > 0 && aac->num <= KERNEL_APPOUT_ACCEPT_BATCH)
+  {
+    memcpy(conn_opaques, aac->conn_opaques, aac->num * sizeof(uint64_t));
+    *num = aac->num;
+    *core = aac->core;
+    return harness_aout_pop(ctxid);
+  } else {
+    return 1;
+  }
+}
+
 int harness_ain_push(size_t ctxid, struct kernel_appin *ai)
 {
   struct harness_ctx *hc = &harness.ctxs[ctxid];
@@ -188,6 +232,7 @@ int harness_ain_push_connopened(size_t ctxid, uint64_t opaque, uint32_t rx_len,
   struct kernel_appin ai;
   struct kernel_appin_conn_opened *aico;
 
+  memset(&ai, 0, sizeof(ai));
   ai.type = KERNEL_APPIN_CONN_OPENED;
   aico = &ai.data.conn_opened;
   aico->opaque = opaque;
@@ -199,9 +244,10 @@ int harness_ain_push_connopened(size_t ctxid, uint64_t opaque, uint32_t rx_len,
   aico->seq_rx = 2;
   aico->seq_tx = 2;
   aico->flow_id = flow_id;
-  aico->local_ip = local_ip;
+  aico->in_local_ip = local_ip;
   aico->local_port = local_port;
   aico->fn_core = core;
+  aico->mss = 1448;
 
   return harness_ain_push(ctxid, &ai);
 }
@@ -221,6 +267,59 @@ int harness_ain_push_connopen_failed(size_t ctxid, uint64_t opaque,
   return harness_ain_push(ctxid, &ai);
 }
 
+int harness_ain_push_listenopen_status(size_t ctxid, uint64_t opaque,
+    int32_t status)
+{
+  struct kernel_appin ai;
+
+  memset(&ai, 0, sizeof(ai));
+  ai.type = KERNEL_APPIN_STATUS_LISTEN_OPEN;
+  ai.data.status.opaque = opaque;
+  ai.data.status.status = status;
+
+  return harness_ain_push(ctxid, &ai);
+}
+
+int harness_ain_push_accepted(size_t ctxid, uint64_t opaque, uint32_t rx_len,
+    void *rx_buf, uint32_t tx_len, void *tx_buf, uint32_t flow_id,
+    uint32_t remote_ip, uint16_t remote_port, uint32_t core)
+{
+  struct kernel_appin ai;
+  struct kernel_appin_accept_conn *aiac;
+
+  memset(&ai, 0, sizeof(ai));
+  ai.type = KERNEL_APPIN_ACCEPTED_CONN;
+  aiac = &ai.data.accept_connection;
+  aiac->opaque = opaque;
+  aiac->rx_len = rx_len;
+  aiac->rx_off = (uintptr_t) rx_buf;
+  aiac->tx_len = tx_len;
+  aiac->tx_off = (uintptr_t) tx_buf;
+  aiac->status = 0;
+  aiac->seq_rx = 2;
+  aiac->seq_tx = 2;
+  aiac->flow_id = flow_id;
+  aiac->in_remote_ip = remote_ip;
+  aiac->remote_port = remote_port;
+  aiac->fn_core = core;
+  aiac->mss = 1448;
+
+  return harness_ain_push(ctxid, &ai);
+}
+
+int harness_ain_push_accept_failed(size_t ctxid, uint64_t opaque,
+    int32_t status)
+{
+  struct kernel_appin ai;
+
+  memset(&ai, 0, sizeof(ai));
+  ai.type = KERNEL_APPIN_ACCEPTED_CONN;
+  ai.data.accept_connection.opaque = opaque;
+  ai.data.accept_connection.status = status;
+
+  return harness_ain_push(ctxid, &ai);
+}
+
 int harness_atx_pull(size_t ctxid, size_t qid, uint32_t rx_bump,
     uint32_t tx_bump, uint32_t flow_id, uint16_t bump_seq, uint8_t flags)
 {
@@ -276,8 +375,9 @@ int harness_arx_push(size_t ctxid, size_t qid, uint64_t opaque,
 
 }
 
-int flextcp_kernel_connect(void)
+int flextcp_kernel_connect(int *shmfd, int groupid)
 {
+  *shmfd = -1;
   return 0;
 }
 
@@ -291,10 +391,14 @@ int flexnic_driver_internal(void **int_mem_start)
   return -1;
 }
 
-int flexnic_driver_connect(struct flexnic_info **p_info, void **p_mem_start)
+int flexnic_driver_connect(struct flexnic_info **p_info, void **p_mem_start,
+    int shmfd)
 {
   static struct flexnic_info info;
   memset(&info, 0, sizeof(info));
+  /* no fast path cores to kick, and applications poll without blocking */
+  info.poll_cycle_tas = UINT64_MAX;
+  info.poll_cycle_app = UINT64_MAX;
 
   *p_info = &info;
   /* hack: set mem start to 0 so we can just use pointers as offsets */
@@ -302,10 +406,15 @@ int flexnic_driver_connect(struct flexnic_info **p_info, void **p_mem_start)
   return 0;
 }
 
-int flextcp_kernel_newctx(struct flextcp_context *ctx)
+int flextcp_kernel_newctx(struct flextcp_context *ctx,
+    uint8_t *presp, ssize_t *presp_sz)
 {
   size_t i;
   struct harness_ctx *hc = &harness.ctxs[harness.next_ctx];
+  if (presp != NULL) {
+    printf("flextcp_kernel_newctx: forking not supported\n");
+    return -1;
+  }
   if (harness.next_ctx >= harness.num_ctxs) {
     printf("flextcp_kernel_newctx: not enough contexts\n");
     return -1;
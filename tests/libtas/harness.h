@@ -24,6 +24,10 @@ int harness_aout_pull_connopen(size_t ctxid, uint64_t opaque, uint32_t remote_ip
     uint16_t remote_port, uint8_t flags);
 int harness_aout_pull_connopen_op(size_t ctxid, uint64_t *opaque,
     uint32_t remote_ip, uint16_t remote_port, uint8_t flags);
+int harness_aout_pull_listenopen(size_t ctxid, uint64_t opaque,
+    uint16_t local_port, uint8_t flags);
+int harness_aout_pull_acceptconns_op(size_t ctxid, uint64_t listen_opaque,
+    uint64_t *conn_opaques, uint8_t *num, uint16_t *core);
 
 int harness_ain_push(size_t ctxid, struct kernel_appin *ai);
 int harness_ain_push_connopened(size_t ctxid, uint64_t opaque, uint32_t rx_len,
@@ -31,6 +35,13 @@ int harness_ain_push_connopened(size_t ctxid, uint64_t opaque, uint32_t rx_len,
     uint32_t local_ip, uint16_t local_port, uint32_t core);
 int harness_ain_push_connopen_failed(size_t ctxid, uint64_t opaque,
     int32_t status);
+int harness_ain_push_listenopen_status(size_t ctxid, uint64_t opaque,
+    int32_t status);
+int harness_ain_push_accepted(size_t ctxid, uint64_t opaque, uint32_t rx_len,
+    void *rx_buf, uint32_t tx_len, void *tx_buf, uint32_t flow_id,
+    uint32_t remote_ip, uint16_t remote_port, uint32_t core);
+int harness_ain_push_accept_failed(size_t ctxid, uint64_t opaque,
+    int32_t status);
 
 int harness_atx_pull(size_t ctxid, size_t qid, uint32_t rx_bump,
     uint32_t tx_bump, uint32_t flow_id, uint16_t bump_seq, uint8_t flags);
@@ -340,6 +340,79 @@ static void test_full_txbuf(void *p)
   test_assert("txev_conn", evs[0].ev.conn_sendbuf.conn == &conn);
 }
 
+static void test_tx_release(void *p)
+{
+  struct flextcp_context ctx;
+  struct flextcp_connection conn;
+  struct flextcp_event evs[4];
+  ssize_t res;
+  int num;
+  int n;
+  void *rxbuf, *txbuf, *buf;
+
+  if (flextcp_init(0) != 0)
+    test_error("flextcp_init failed");
+
+  test_randinit(&ctx, sizeof(ctx));
+  if (flextcp_context_create(&ctx, NULL, NULL) != 0)
+    test_error("flextcp_context_create failed");
+
+  /* initiate connect */
+  test_randinit(&conn, sizeof(conn));
+  if (flextcp_connection_open(&ctx, &conn, TEST_IP, TEST_PORT) != 0)
+    test_error("flextcp_connection_open failed");
+
+  n = harness_aout_pull_connopen(0, (uintptr_t) &conn, TEST_IP, TEST_PORT, 0);
+  test_assert("pulling conn open request off aout", n == 0);
+
+  rxbuf = test_zalloc(1024);
+  txbuf = test_zalloc(1024);
+  n = harness_ain_push_connopened(0, (uintptr_t) &conn, 1024, rxbuf, 1024,
+      txbuf, 1, TEST_LIP, TEST_LPORT, 0);
+  test_assert("harness_ain_push_connopened success", n == 0);
+
+  num = flextcp_context_poll(&ctx, 4, evs);
+  test_assert("success 1 event", num == 1);
+  test_assert("ctxev_type", evs[0].event_type == FLEXTCP_EV_CONN_OPEN);
+
+  /* give back the tail of an allocation */
+  res = flextcp_connection_tx_alloc(&conn, 600, &buf);
+  test_assert("tx alloc len", res == 600);
+  test_assert("tx alloc buf", buf == txbuf);
+
+  n = flextcp_connection_tx_release(&conn, 200);
+  test_assert("tx release success", n == 0);
+
+  /* released bytes are allocated again */
+  res = flextcp_connection_tx_alloc(&conn, 100, &buf);
+  test_assert("tx alloc 2 len", res == 100);
+  test_assert("tx alloc 2 buf", buf == (uint8_t *) txbuf + 400);
+
+  n = flextcp_connection_tx_release(&conn, 501);
+  test_assert("tx release more than allocated fails", n != 0);
+
+  n = flextcp_connection_tx_release(&conn, 100);
+  test_assert("tx release 2 success", n == 0);
+
+  /* only the bytes kept are sent */
+  n = flextcp_connection_tx_send(&ctx, &conn, 400);
+  test_assert("flextcp_connection_tx_send success", n == 0);
+
+  n = flextcp_connection_tx_send(&ctx, &conn, 1);
+  test_assert("released bytes not sendable", n != 0);
+
+  num = flextcp_context_poll(&ctx, 4, evs);
+  test_assert("no events", num == 0);
+
+  n = harness_atx_pull(0, 0, 0, 400, 1, 0, 0);
+  test_assert("harness_atx_pull success", n == 0);
+
+  /* the rest of the buffer is available */
+  res = flextcp_connection_tx_alloc(&conn, 1024, &buf);
+  test_assert("tx alloc 3 len", res == 624);
+  test_assert("tx alloc 3 buf", buf == (uint8_t *) txbuf + 400);
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -371,5 +444,8 @@ int main(int argc, char *argv[])
   if (test_subcase("full txbuf", test_full_txbuf, NULL))
     ret = 1;
 
+  if (test_subcase("tx release", test_tx_release, NULL))
+    ret = 1;
+
   return ret;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -5,12 +6,21 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
 #include <sys/socket.h>
-
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include <tas_sockets.h>
+#include <tas_batch.h>
 
 #include "../testutils.h"
+#include "../../lib/sockets/internal.h"
 #include "harness.h"
 
 #define TEST_IP   0x0a010203
@@ -99,13 +109,817 @@ static void test_connect_fail(void *p)
   test_assert("tas_getsockopt status done", status == ECONNREFUSED);
 }
 
+/* opens a non-blocking connection and completes the handshake */
+static int conn_setup(uint64_t *opaque, uint8_t **rxbuf, uint8_t **txbuf)
+{
+  int fd, ret, status;
+  struct sockaddr_in addr;
+  socklen_t slen;
+
+  fd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  test_assert("socket connect", fd > 0);
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(TEST_IP);
+  addr.sin_port = htons(TEST_PORT);
+  ret = tas_connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+  test_assert("tas_connect success", ret < 0 && errno == EINPROGRESS);
+
+  ret = harness_aout_pull_connopen_op(0, opaque, TEST_IP, TEST_PORT, 0);
+  test_assert("pulling conn open request off aout", ret == 0);
+
+  *rxbuf = test_zalloc(1024);
+  *txbuf = test_zalloc(1024);
+  ret = harness_ain_push_connopened(0, *opaque, 1024, *rxbuf, 1024,
+      *txbuf, 1, TEST_LIP, TEST_LPORT, 0);
+  test_assert("harness_ain_push_connopened success", ret == 0);
+
+  /* polls the context, so the connection is marked as open */
+  slen = sizeof(status);
+  ret = tas_getsockopt(fd, SOL_SOCKET, SO_ERROR, &status, &slen);
+  test_assert("tas_getsockopt status done", ret == 0 && status == 0);
+  return fd;
+}
+
+static void test_sendfile(void *p)
+{
+  uint8_t *rxbuf, *txbuf, data[300];
+  char path[] = "/tmp/tas_sendfile_XXXXXX";
+  uint64_t opaque;
+  ssize_t res;
+  off_t off;
+  int fd, file, pfd[2], i;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+
+  file = mkstemp(path);
+  test_assert("temp file", file >= 0);
+  unlink(path);
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = i * 7;
+  test_assert("file written", write(file, data, sizeof(data)) == sizeof(data));
+
+  /* explicit offset, clamped to the end of the file */
+  off = 10;
+  res = tas_sendfile(fd, file, &off, 1000);
+  test_assert("sendfile to end", res == 290 && off == 300);
+  test_assert("sendfile data", memcmp(txbuf, data + 10, 290) == 0);
+  test_assert("file position kept", lseek(file, 0, SEEK_CUR) == 300);
+
+  /* file position is used and advanced without offset */
+  lseek(file, 100, SEEK_SET);
+  res = tas_sendfile(fd, file, NULL, 50);
+  test_assert("sendfile from position", res == 50);
+  test_assert("sendfile position data",
+      memcmp(txbuf + 290, data + 100, 50) == 0);
+  test_assert("file position advanced", lseek(file, 0, SEEK_CUR) == 150);
+
+  /* shrinking the file only shortens the send */
+  test_assert("truncate", ftruncate(file, 120) == 0);
+  off = 100;
+  res = tas_sendfile(fd, file, &off, 100);
+  test_assert("sendfile truncated", res == 20 && off == 120);
+
+  off = 200;
+  res = tas_sendfile(fd, file, &off, 100);
+  test_assert("sendfile past end", res == 0 && off == 200);
+
+  /* only regular files can be sent */
+  test_assert("pipe", pipe(pfd) == 0);
+  res = tas_sendfile(fd, pfd[0], NULL, 100);
+  test_assert("sendfile from pipe", res == -1 && errno == EINVAL);
+
+  /* TAS sockets are rejected without taking their lock */
+  res = tas_sendfile(fd, fd, NULL, 100);
+  test_assert("sendfile from itself", res == -1 && errno == EINVAL);
+
+  test_assert("flush", tas_flush() == 0);
+  test_assert("360 bytes sent", harness_atx_pull(0, 0, 0, 360, 1, 0, 0) == 0);
+  close(file);
+}
+
+static int epoll_add(int fd, uint32_t events)
+{
+  struct epoll_event ev;
+  int epfd;
+
+  epfd = tas_epoll_create1(0);
+  test_assert("epoll create", epfd >= 0);
+
+  ev.events = events;
+  ev.data.fd = fd;
+  test_assert("epoll add", tas_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+  return epfd;
+}
+
+static void test_epoll_et(void *p)
+{
+  uint8_t *rxbuf, *txbuf, buf[64];
+  struct epoll_event evs[4];
+  uint64_t opaque;
+  int fd, ep_et, ep_lt, ret;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  ep_et = epoll_add(fd, EPOLLIN | EPOLLET);
+  ep_lt = epoll_add(fd, EPOLLIN);
+
+  test_assert("et nothing pending", tas_epoll_wait(ep_et, evs, 4, 0) == 0);
+  test_assert("lt nothing pending", tas_epoll_wait(ep_lt, evs, 4, 0) == 0);
+
+  ret = harness_arx_push(0, 0, opaque, 32, 0, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+
+  /* edge-triggered reports data once, level-triggered until it is read */
+  ret = tas_epoll_wait(ep_et, evs, 4, 0);
+  test_assert("et reports data", ret == 1 && evs[0].events == EPOLLIN &&
+      evs[0].data.fd == fd);
+  test_assert("et reports once", tas_epoll_wait(ep_et, evs, 4, 0) == 0);
+  test_assert("lt reports data", tas_epoll_wait(ep_lt, evs, 4, 0) == 1);
+  test_assert("lt reports again", tas_epoll_wait(ep_lt, evs, 4, 0) == 1);
+
+  /* more data is a new edge, even though data was pending already */
+  ret = harness_arx_push(0, 0, opaque, 16, 32, 0, 0);
+  test_assert("harness_arx_push 2 success", ret == 0);
+  ret = tas_epoll_wait(ep_et, evs, 4, 0);
+  test_assert("et reports new data", ret == 1 && evs[0].events == EPOLLIN);
+  test_assert("et reports new data once",
+      tas_epoll_wait(ep_et, evs, 4, 0) == 0);
+
+  /* nothing left after reading */
+  test_assert("read all", tas_recv(fd, buf, sizeof(buf), 0) == 48);
+  test_assert("et nothing after read", tas_epoll_wait(ep_et, evs, 4, 0) == 0);
+  test_assert("lt nothing after read", tas_epoll_wait(ep_lt, evs, 4, 0) == 0);
+
+  /* closing the socket removes it from both epolls */
+  tas_close(fd);
+  test_assert("close et epoll", tas_close(ep_et) == 0);
+  test_assert("close lt epoll", tas_close(ep_lt) == 0);
+}
+
+static void test_epoll_exclusive(void *p)
+{
+  uint8_t *rxbuf, *txbuf, buf[64];
+  struct epoll_event evs[4], ev;
+  struct epoll *ep;
+  uint64_t opaque;
+  int fd, epfd[2], got[2], prev = -1, ret, i, round;
+
+  /* edge-triggered, so an epoll woken earlier does not report the pending
+   * data again */
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  epfd[0] = epoll_add(fd, EPOLLIN | EPOLLET | EPOLLEXCLUSIVE);
+  epfd[1] = epoll_add(fd, EPOLLIN | EPOLLET | EPOLLEXCLUSIVE);
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  ret = tas_epoll_ctl(epfd[0], EPOLL_CTL_MOD, fd, &ev);
+  test_assert("exclusive cannot be modified", ret == -1 && errno == EINVAL);
+
+  /* pretend a thread is blocked on the second epoll, the first one has the
+   * polling thread as its waiter during tas_epoll_wait */
+  test_assert("epoll lookup", flextcp_fd_elookup(epfd[1], &ep) == 0);
+  ep->waiters++;
+  flextcp_fd_erelease(epfd[1], ep);
+
+  /* each event wakes only one of the epolls, in turn */
+  for (round = 0; round < 4; round++) {
+    ret = harness_arx_push(0, 0, opaque, 8, round * 8, 0, 0);
+    test_assert("harness_arx_push success", ret == 0);
+
+    for (i = 0; i < 2; i++) {
+      got[i] = tas_epoll_wait(epfd[i], evs, 4, 0);
+      test_assert("at most one event", got[i] == 0 || got[i] == 1);
+    }
+    test_assert("exactly one epoll woken", got[0] + got[1] == 1);
+    test_assert("epolls take turns", got[0] != prev);
+    prev = got[0];
+
+    test_assert("read event data", tas_recv(fd, buf, sizeof(buf), 0) == 8);
+  }
+
+  /* destroying the epolls unbinds the socket that is still open */
+  test_assert("close epoll 1", tas_close(epfd[0]) == 0);
+  test_assert("close epoll 2", tas_close(epfd[1]) == 0);
+  test_assert("close socket", tas_close(fd) == 0);
+}
+
+static void test_poll_select(void *p)
+{
+  uint8_t *rxbuf, *txbuf;
+  struct pollfd pfds[2];
+  uint64_t opaque;
+  struct timeval tv = { 0, 0 };
+  fd_set rfds, wfds;
+  struct socket *s;
+  uint64_t bit;
+  int fd, pfd[2], ret, nfds;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  test_assert("pipe", pipe(pfd) == 0);
+
+  /* mixed TAS and linux fds */
+  pfds[0].fd = fd;
+  pfds[0].events = POLLIN | POLLOUT;
+  pfds[1].fd = pfd[0];
+  pfds[1].events = POLLIN;
+  ret = tas_poll(pfds, 2, 0);
+  test_assert("poll writable", ret == 1 && pfds[0].revents == POLLOUT &&
+      pfds[1].revents == 0);
+
+  ret = harness_arx_push(0, 0, opaque, 16, 0, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  test_assert("pipe write", write(pfd[1], "x", 1) == 1);
+  ret = tas_poll(pfds, 2, 0);
+  test_assert("poll readable", ret == 2 &&
+      pfds[0].revents == (POLLIN | POLLOUT) && pfds[1].revents == POLLIN);
+
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+  FD_SET(fd, &rfds);
+  FD_SET(fd, &wfds);
+  FD_SET(pfd[0], &rfds);
+  FD_SET(pfd[1], &wfds);
+  nfds = TAS_MAX(fd, TAS_MAX(pfd[0], pfd[1])) + 1;
+  ret = tas_select(nfds, &rfds, &wfds, NULL, &tv);
+  test_assert("select", ret > 0);
+  test_assert("select socket", FD_ISSET(fd, &rfds) && FD_ISSET(fd, &wfds));
+  test_assert("select pipe", FD_ISSET(pfd[0], &rfds) &&
+      FD_ISSET(pfd[1], &wfds));
+
+  /* nothing left to read */
+  test_assert("read socket", tas_recv(fd, rxbuf, 64, 0) == 16);
+  FD_ZERO(&rfds);
+  FD_SET(fd, &rfds);
+  ret = tas_select(fd + 1, &rfds, NULL, NULL, &tv);
+  test_assert("select nothing", ret == 0 && !FD_ISSET(fd, &rfds));
+
+  /* the socket stays writable, only its readable bit follows the data */
+  s = flextcp_fd_speek(fd);
+  bit = 1ULL << (s->id % 64);
+  test_assert("readable bit clear",
+      (flextcp_sock_ready[s->id / 64][0] & bit) == 0);
+  test_assert("writable bit set",
+      (flextcp_sock_ready[s->id / 64][1] & bit) != 0);
+
+  pfds[0].events = POLLIN;
+  pfds[0].revents = POLLOUT;
+  ret = tas_poll(pfds, 1, 0);
+  test_assert("poll not readable", ret == 0 && pfds[0].revents == 0);
+
+  ret = harness_arx_push(0, 0, opaque, 8, 16, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  ret = tas_poll(pfds, 1, 0);
+  test_assert("poll readable again", ret == 1 && pfds[0].revents == POLLIN);
+  test_assert("readable bit set",
+      (flextcp_sock_ready[s->id / 64][0] & bit) != 0);
+}
+
+static int poll_dup_fds[2];
+
+static void *poll_dup_thread(void *arg)
+{
+  usleep(20000);
+  tas_dup2(poll_dup_fds[1], poll_dup_fds[0]);
+  return NULL;
+}
+
+static void test_poll_dup(void *p)
+{
+  uint8_t *rxbuf, *txbuf, *rxbuf2, *txbuf2;
+  struct pollfd pfds[1];
+  uint64_t opaque, opaque2, start;
+  pthread_t t;
+  int fd, fd2, ret;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  fd2 = conn_setup(&opaque2, &rxbuf2, &txbuf2);
+
+  /* only the second socket has data */
+  ret = harness_arx_push(0, 0, opaque2, 16, 0, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  pfds[0].fd = fd2;
+  pfds[0].events = POLLIN;
+  test_assert("second readable", tas_poll(pfds, 1, 0) == 1);
+  pfds[0].fd = fd;
+  test_assert("first not readable", tas_poll(pfds, 1, 0) == 0);
+
+  /* the fd is replaced while polling, so the socket cached for it must not
+   * be used anymore */
+  poll_dup_fds[0] = fd;
+  poll_dup_fds[1] = fd2;
+  ret = pthread_create(&t, NULL, poll_dup_thread, NULL);
+  test_assert("thread created", ret == 0);
+  start = get_msecs();
+  ret = tas_poll(pfds, 1, 2000);
+  pthread_join(t, NULL);
+  test_assert("poll sees the new socket", ret == 1 &&
+      pfds[0].revents == POLLIN);
+  test_assert("poll returned early", get_msecs() - start < 1000);
+}
+
+static int fds_open(void)
+{
+  DIR *d;
+  int n = 0;
+
+  d = opendir("/proc/self/fd");
+  test_assert("opendir", d != NULL);
+  while (readdir(d) != NULL)
+    n++;
+  closedir(d);
+  return n;
+}
+
+static void test_fd_pool(void *p)
+{
+  struct stat st_pipe, st;
+  int fds[256], pfd[2], fd, n_before, i;
+
+  /* closed socket fds are kept for reuse, but only a few of them */
+  n_before = fds_open();
+  for (i = 0; i < 256; i++) {
+    fds[i] = tas_socket(AF_INET, SOCK_STREAM, 0);
+    test_assert("socket", fds[i] >= 0);
+  }
+  for (i = 0; i < 256; i++)
+    test_assert("close", tas_close(fds[i]) == 0);
+  printf("  %d fds kept\n", fds_open() - n_before);
+  test_assert("pool bounded", fds_open() - n_before <= 64 + 1);
+
+  /* replace a pooled fd without going through TAS */
+  fd = tas_socket(AF_INET, SOCK_STREAM, 0);
+  test_assert("socket", fd >= 0);
+  test_assert("close", tas_close(fd) == 0);
+  test_assert("pipe", pipe(pfd) == 0);
+  test_assert("dup2 behind tas", syscall(SYS_dup2, pfd[0], fd) == fd);
+
+  for (i = 0; i < 8; i++) {
+    fds[i] = tas_socket(AF_INET, SOCK_STREAM, 0);
+    test_assert("replaced fd not handed out", fds[i] >= 0 && fds[i] != fd);
+  }
+  test_assert("fstat pipe", fstat(pfd[0], &st_pipe) == 0);
+  test_assert("fstat replaced", fstat(fd, &st) == 0);
+  test_assert("replaced fd untouched", st.st_ino == st_pipe.st_ino);
+
+  /* the kernel fd is close-on-exec only if the socket asked for it */
+  test_assert("no cloexec", fcntl(fds[0], F_GETFD) == 0);
+  fd = tas_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  test_assert("socket cloexec", fd >= 0);
+  test_assert("cloexec", fcntl(fd, F_GETFD) == FD_CLOEXEC);
+  test_assert("setfd", tas_fcntl(fd, F_SETFD, 0) == 0);
+  test_assert("cloexec cleared", fcntl(fd, F_GETFD) == 0 &&
+      tas_fcntl(fd, F_GETFD) == 0);
+  test_assert("close", tas_close(fd) == 0);
+  test_assert("pooled fd cloexec", fcntl(fd, F_GETFD) == FD_CLOEXEC);
+}
+
+/* pulls the two accept batches for a backlog of 8 posted from context ctxid,
+ * contexts are paired with fast path core ctxid */
+static void accepts_pull(size_t ctxid, uint64_t opaque, uint64_t conns[8])
+{
+  uint16_t core;
+  uint8_t num;
+  int ret;
+
+  ret = harness_aout_pull_acceptconns_op(ctxid, opaque, conns, &num, &core);
+  test_assert("first accept batch", ret == 0 &&
+      num == FLEXTCP_LISTEN_ACCEPT_BATCH && core == ctxid);
+  ret = harness_aout_pull_acceptconns_op(ctxid, opaque,
+      conns + FLEXTCP_LISTEN_ACCEPT_BATCH, &num, &core);
+  test_assert("second accept batch", ret == 0 &&
+      num == 8 - FLEXTCP_LISTEN_ACCEPT_BATCH && core == ctxid);
+  test_assert("no more accepts", harness_aout_pull_acceptconns_op(ctxid,
+        opaque, conns, &num, &core) < 0);
+}
+
+/* opens a non-blocking listener with a backlog of 8 and steering policy steer,
+ * and pulls the two accept batches posted from context 0 */
+static int listen_setup(uint64_t *opaque, uint64_t conns[8], int steer)
+{
+  struct sockaddr_in addr;
+  struct socket *s;
+  uint8_t flags = 0;
+  int fd, ret;
+
+  fd = tas_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  test_assert("socket listen", fd > 0);
+
+  if (steer != TAS_STEER_NONE) {
+    ret = tas_setsockopt(fd, SOL_SOCKET, TAS_SO_STEER, &steer, sizeof(steer));
+    test_assert("set steering", ret == 0);
+    flags = KERNEL_APPOUT_LISTEN_STEER_CTX;
+  }
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(TEST_LIP);
+  addr.sin_port = htons(TEST_LPORT);
+  ret = tas_bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  test_assert("tas_bind success", ret == 0);
+
+  /* tas_listen waits for the status, so it has to be there already */
+  test_assert("lookup", flextcp_fd_slookup(fd, &s) == 0);
+  *opaque = (uintptr_t) &s->data.listener.l;
+  flextcp_fd_srelease(fd, s);
+  ret = harness_ain_push_listenopen_status(0, *opaque, 0);
+  test_assert("harness_ain_push_listenopen_status success", ret == 0);
+
+  test_assert("tas_listen success", tas_listen(fd, 8) == 0);
+  ret = harness_aout_pull_listenopen(0, *opaque, TEST_LPORT, flags);
+  test_assert("pulling listen open off aout", ret == 0);
+
+  accepts_pull(0, *opaque, conns);
+  return fd;
+}
+
+static void test_accept(void *p)
+{
+  uint8_t *rxbuf, *txbuf, buf[16];
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  uint64_t lopaque, conns[8];
+  socklen_t slen;
+  ssize_t res;
+  int lfd, fd, epfd, ret;
+
+  lfd = listen_setup(&lopaque, conns, TAS_STEER_NONE);
+  epfd = epoll_add(lfd, EPOLLIN);
+
+  ret = tas_accept(lfd, NULL, NULL);
+  test_assert("nothing to accept", ret == -1 && errno == EAGAIN);
+
+  /* a failed slot does not make the listener readable */
+  ret = harness_ain_push_accept_failed(0, conns[0], -1);
+  test_assert("harness_ain_push_accept_failed success", ret == 0);
+  test_assert("not readable", tas_epoll_wait(epfd, &ev, 1, 0) == 0);
+  ret = tas_accept(lfd, NULL, NULL);
+  test_assert("failed slot skipped", ret == -1 && errno == EAGAIN);
+
+  /* the next slot is accepted after the failed one */
+  rxbuf = test_zalloc(1024);
+  txbuf = test_zalloc(1024);
+  ret = harness_ain_push_accepted(0, conns[1], 1024, rxbuf, 1024, txbuf, 2,
+      TEST_IP, TEST_PORT, 0);
+  test_assert("harness_ain_push_accepted success", ret == 0);
+  test_assert("readable", tas_epoll_wait(epfd, &ev, 1, 0) == 1 &&
+      ev.events == EPOLLIN);
+
+  slen = sizeof(addr);
+  fd = tas_accept(lfd, (struct sockaddr *) &addr, &slen);
+  test_assert("accepted", fd >= 0);
+  test_assert("accepted no cloexec", fcntl(fd, F_GETFD) == 0);
+  test_assert("peer address", addr.sin_addr.s_addr == htonl(TEST_IP) &&
+      addr.sin_port == htons(TEST_PORT));
+  ret = tas_accept(lfd, NULL, NULL);
+  test_assert("only one accepted", ret == -1 && errno == EAGAIN);
+
+  /* the accepted connection is usable */
+  memset(rxbuf, 0x5a, 16);
+  ret = harness_arx_push(0, 0, conns[1], 16, 0, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  res = tas_recv(fd, buf, sizeof(buf), 0);
+  test_assert("recv", res == 16 && buf[0] == 0x5a && buf[15] == 0x5a);
+}
+
+struct steer_args {
+  int lfd;
+  uint64_t lopaque;
+  pthread_barrier_t step;
+};
+
+/* runs on context 1, next to the main thread on context 0 */
+static void *steer_thread(void *arg)
+{
+  struct steer_args *sa = arg;
+  struct tas_sock_stats st;
+  struct epoll_event ev;
+  uint64_t conns[8];
+  uint8_t *rxbuf, *txbuf;
+  int fd, epfd, ret;
+
+  /* the first accept posts this thread's own slots */
+  ret = tas_accept(sa->lfd, NULL, NULL);
+  test_assert("thread nothing to accept", ret == -1 && errno == EAGAIN);
+  accepts_pull(1, sa->lopaque, conns);
+
+  /* connections completing into own slots are taken without a steal */
+  rxbuf = test_zalloc(1024);
+  txbuf = test_zalloc(1024);
+  ret = harness_ain_push_accepted(1, conns[0], 1024, rxbuf, 1024, txbuf, 3,
+      TEST_IP, TEST_PORT, 1);
+  test_assert("harness_ain_push_accepted success", ret == 0);
+  epfd = epoll_add(sa->lfd, EPOLLIN);
+  test_assert("thread readable", tas_epoll_wait(epfd, &ev, 1, 0) == 1);
+  fd = tas_accept(sa->lfd, NULL, NULL);
+  test_assert("thread accepted own", fd >= 0);
+  tas_sock_stats(&st);
+  test_assert("no steal", st.accept_steals == 0 && st.conn_moves == 0);
+
+  /* with nothing in its own slots, the thread takes the main thread's */
+  pthread_barrier_wait(&sa->step);
+  pthread_barrier_wait(&sa->step);
+  fd = tas_accept(sa->lfd, NULL, NULL);
+  test_assert("thread accepted other", fd >= 0);
+  tas_sock_stats(&st);
+  test_assert("one steal", st.accept_steals == 1);
+  ret = tas_accept(sa->lfd, NULL, NULL);
+  test_assert("thread nothing left", ret == -1 && errno == EAGAIN);
+  return NULL;
+}
+
+static void test_accept_steer(void *p)
+{
+  struct steer_args sa;
+  struct epoll_event ev;
+  uint64_t conns[8];
+  uint8_t *rxbuf, *txbuf;
+  socklen_t slen;
+  pthread_t t;
+  int epfd, ret, steer;
+
+  sa.lfd = listen_setup(&sa.lopaque, conns, TAS_STEER_THREAD);
+  slen = sizeof(steer);
+  ret = tas_getsockopt(sa.lfd, SOL_SOCKET, TAS_SO_STEER, &steer, &slen);
+  test_assert("get steering", ret == 0 && steer == TAS_STEER_THREAD);
+  epfd = epoll_add(sa.lfd, EPOLLIN);
+
+  pthread_barrier_init(&sa.step, NULL, 2);
+  test_assert("thread created",
+      pthread_create(&t, NULL, steer_thread, &sa) == 0);
+  pthread_barrier_wait(&sa.step);
+
+  /* completes into a slot posted from context 0, seen by its next poll */
+  rxbuf = test_zalloc(1024);
+  txbuf = test_zalloc(1024);
+  ret = harness_ain_push_accepted(0, conns[0], 1024, rxbuf, 1024, txbuf, 4,
+      TEST_IP, TEST_PORT + 1, 0);
+  test_assert("harness_ain_push_accepted success", ret == 0);
+  test_assert("listener readable", tas_epoll_wait(epfd, &ev, 1, 0) == 1);
+
+  pthread_barrier_wait(&sa.step);
+  pthread_join(t, NULL);
+
+  ret = tas_accept(sa.lfd, NULL, NULL);
+  test_assert("taken by the thread", ret == -1 && errno == EAGAIN);
+}
+
+static void test_batch_ops(void *p)
+{
+  struct tas_batch *b;
+  struct tas_batch_cqe cqes[4];
+  uint8_t *rxbuf, *txbuf, buf[64];
+  uint64_t opaque;
+  int fd, ret, i;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  test_assert("batch init", tas_batch_init(&b, 4) == 0);
+
+  /* nop, unknown opcodes, and closed fds complete right away */
+  tas_batch_prep(tas_batch_get_sqe(b), TAS_BATCH_OP_NOP, fd, NULL, 0, 1);
+  tas_batch_prep(tas_batch_get_sqe(b), 37, fd, NULL, 0, 2);
+  tas_batch_prep(tas_batch_get_sqe(b), 200, fd, NULL, 0, 3);
+  tas_batch_prep_recv(tas_batch_get_sqe(b), 1000, buf, sizeof(buf), 4);
+  test_assert("batch full", tas_batch_get_sqe(b) == NULL);
+  test_assert("submit 4", tas_batch_submit(b) == 4);
+
+  ret = tas_batch_reap(b, cqes, 4, 0);
+  test_assert("reap 4", ret == 4);
+  test_assert("nop result", cqes[0].user_data == 1 && cqes[0].res == 0);
+  test_assert("opcode 37 rejected",
+      cqes[1].user_data == 2 && cqes[1].res == -EINVAL);
+  test_assert("opcode 200 rejected",
+      cqes[2].user_data == 3 && cqes[2].res == -EINVAL);
+  test_assert("bad fd", cqes[3].user_data == 4 && cqes[3].res == -EBADF);
+
+  /* receive waits for data, send completes right away */
+  tas_batch_prep_recv(tas_batch_get_sqe(b), fd, buf, sizeof(buf), 5);
+  for (i = 0; i < 64; i++)
+    buf[i] = i;
+  tas_batch_prep_send(tas_batch_get_sqe(b), fd, buf, 48, 6);
+  test_assert("submit 2", tas_batch_submit(b) == 2);
+
+  ret = tas_batch_reap(b, cqes, 4, 0);
+  test_assert("send completes", ret == 1 && cqes[0].user_data == 6 &&
+      cqes[0].res == 48);
+  test_assert("send data", memcmp(txbuf, buf, 48) == 0);
+  test_assert("no more completions", tas_batch_reap(b, cqes, 4, 0) == 0);
+
+  memset(rxbuf, 0xab, 32);
+  ret = harness_arx_push(0, 0, opaque, 32, 0, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+
+  ret = tas_batch_reap(b, cqes, 4, 0);
+  test_assert("recv completes", ret == 1 && cqes[0].user_data == 5 &&
+      cqes[0].res == 32);
+  test_assert("recv data", buf[0] == 0xab && buf[31] == 0xab);
+
+  tas_batch_destroy(b);
+}
+
+static void *batch_close_thread(void *arg)
+{
+  intptr_t ret = tas_close(*(int *) arg);
+  return (void *) ret;
+}
+
+static void test_batch_close(void *p)
+{
+  struct tas_batch *b;
+  struct tas_batch_cqe cqes[4];
+  uint8_t *rxbuf, *txbuf, buf[64];
+  uint64_t opaque;
+  pthread_t t;
+  void *tret;
+  int fd, ret;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  test_assert("batch init", tas_batch_init(&b, 4) == 0);
+
+  /* close in the batch cancels pending receives */
+  tas_batch_prep_recv(tas_batch_get_sqe(b), fd, buf, sizeof(buf), 1);
+  tas_batch_prep_recv(tas_batch_get_sqe(b), fd, buf, sizeof(buf), 2);
+  tas_batch_prep_close(tas_batch_get_sqe(b), fd, 3);
+  test_assert("submit 3", tas_batch_submit(b) == 3);
+
+  ret = tas_batch_reap(b, cqes, 4, 0);
+  test_assert("reap 3", ret == 3);
+  test_assert("recv 1 cancelled",
+      cqes[0].user_data == 1 && cqes[0].res == -ECANCELED);
+  test_assert("recv 2 cancelled",
+      cqes[1].user_data == 2 && cqes[1].res == -ECANCELED);
+  test_assert("close done", cqes[2].user_data == 3 && cqes[2].res == 0);
+
+  /* close from another thread completes into this batch */
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+  tas_batch_prep_recv(tas_batch_get_sqe(b), fd, buf, sizeof(buf), 4);
+  test_assert("submit 1", tas_batch_submit(b) == 1);
+  test_assert("recv pending", tas_batch_reap(b, cqes, 4, 0) == 0);
+
+  ret = pthread_create(&t, NULL, batch_close_thread, &fd);
+  test_assert("thread created", ret == 0);
+  pthread_join(t, &tret);
+  test_assert("close in thread", tret == NULL);
+
+  ret = tas_batch_reap(b, cqes, 4, 0);
+  test_assert("recv cancelled by other thread", ret == 1 &&
+      cqes[0].user_data == 4 && cqes[0].res == -ECANCELED);
+  test_assert("fd closed", tas_close(fd) == -1 && errno == EBADF);
+
+  tas_batch_destroy(b);
+}
+
+static void test_zc_send(void *p)
+{
+  uint8_t *rxbuf, *txbuf, rbuf[8];
+  struct iovec iov[2];
+  uint64_t opaque;
+  void *buf;
+  ssize_t res;
+  int fd, ret, iovcnt;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+
+  /* reservation starts at the head of the transmit buffer */
+  res = tas_zc_reserve(fd, &buf, 100);
+  test_assert("reserve 100", res == 100 && buf == txbuf);
+  memset(buf, 'a', 100);
+
+  res = tas_send(fd, "x", 1, 0);
+  test_assert("send busy while reserved", res == -1 && errno == EBUSY);
+
+  ret = tas_zc_commit(fd, 101);
+  test_assert("commit more than reserved", ret == -1 && errno == EINVAL);
+
+  /* commit part, the rest is given back */
+  ret = tas_zc_commit(fd, 40);
+  test_assert("commit 40", ret == 0);
+
+  res = tas_zc_reserve(fd, &buf, 10);
+  test_assert("reserve after commit", res == 10 &&
+      buf == (uint8_t *) txbuf + 40);
+  ret = tas_zc_commit(fd, 0);
+  test_assert("commit nothing", ret == 0);
+
+  test_assert("flush", tas_flush() == 0);
+  ret = harness_atx_pull(0, 0, 0, 40, 1, 0, 0);
+  test_assert("40 bytes sent", ret == 0);
+
+  /* free the sent bytes so the next reservation wraps around */
+  ret = harness_arx_push(0, 0, opaque, 0, 0, 40, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  res = tas_recv(fd, rbuf, sizeof(rbuf), 0);
+  test_assert("recv polls", res == -1 && errno == EAGAIN);
+
+  iovcnt = 2;
+  res = tas_zc_reservev(fd, iov, &iovcnt, 1000);
+  test_assert("reservev wraps", res == 1000 && iovcnt == 2);
+  test_assert("reservev first", iov[0].iov_base == txbuf + 40 &&
+      iov[0].iov_len == 984);
+  test_assert("reservev second", iov[1].iov_base == txbuf &&
+      iov[1].iov_len == 16);
+
+  ret = tas_zc_commit(fd, 1000);
+  test_assert("commit wrapped", ret == 0);
+  test_assert("flush", tas_flush() == 0);
+  ret = harness_atx_pull(0, 0, 0, 1000, 1, 1, 0);
+  test_assert("1000 bytes sent", ret == 0);
+
+  tas_close(fd);
+}
+
+static void test_mmsg(void *p)
+{
+  uint8_t *rxbuf, *txbuf, out[60], in[3][16];
+  struct mmsghdr msgs[3];
+  struct iovec iov[3];
+  uint64_t opaque;
+  int fd, ret, i;
+
+  fd = conn_setup(&opaque, &rxbuf, &txbuf);
+
+  /* all messages go out with one tx bump */
+  for (i = 0; i < 60; i++)
+    out[i] = i;
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < 3; i++) {
+    iov[i].iov_base = out + i * 10 * (i + 1) / 2;
+    iov[i].iov_len = 10 * (i + 1);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  ret = tas_sendmmsg(fd, msgs, 3, 0);
+  test_assert("sendmmsg 3", ret == 3);
+  test_assert("message lengths", msgs[0].msg_len == 10 &&
+      msgs[1].msg_len == 20 && msgs[2].msg_len == 30);
+  test_assert("send data", memcmp(txbuf, out, 60) == 0);
+  ret = harness_atx_pull(0, 0, 0, 60, 1, 0, 0);
+  test_assert("60 bytes sent in one bump", ret == 0);
+
+  /* unsupported flags are rejected */
+  ret = tas_sendmmsg(fd, msgs, 3, MSG_OOB);
+  test_assert("sendmmsg bad flag", ret == -1 && errno == EINVAL);
+
+  /* on a non-blocking socket each message only takes what is there */
+  memset(rxbuf, 0xcd, 24);
+  ret = harness_arx_push(0, 0, opaque, 24, 0, 60, 0);
+  test_assert("harness_arx_push success", ret == 0);
+
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < 3; i++) {
+    iov[i].iov_base = in[i];
+    iov[i].iov_len = sizeof(in[i]);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  ret = tas_recvmmsg(fd, msgs, 3, 0, NULL);
+  test_assert("recvmmsg 2", ret == 2);
+  test_assert("received lengths", msgs[0].msg_len == 16 &&
+      msgs[1].msg_len == 8);
+  test_assert("recv data", in[0][0] == 0xcd && in[1][7] == 0xcd);
+
+  ret = tas_recvmmsg(fd, msgs, 3, 0, NULL);
+  test_assert("recvmmsg empty", ret == -1 && errno == EAGAIN);
+  ret = tas_recvmmsg(fd, msgs, 3, MSG_PEEK, NULL);
+  test_assert("recvmmsg bad flag", ret == -1 && errno == EINVAL);
+
+  /* on a blocking socket MSG_DONTWAIT does not wait */
+  ret = tas_fcntl(fd, F_SETFL, 0);
+  test_assert("set blocking", ret == 0);
+  ret = tas_recvmmsg(fd, msgs, 3, MSG_DONTWAIT, NULL);
+  test_assert("recvmmsg dontwait", ret == -1 && errno == EAGAIN);
+
+  /* with MSG_WAITFORONE only the first message waits */
+  memset(rxbuf + 24, 0xef, 8);
+  ret = harness_arx_push(0, 0, opaque, 8, 24, 0, 0);
+  test_assert("harness_arx_push success", ret == 0);
+  ret = tas_recvmmsg(fd, msgs, 3, MSG_WAITFORONE, NULL);
+  test_assert("recvmmsg waitforone", ret == 1 && msgs[0].msg_len == 8 &&
+      in[0][7] == 0xef);
+
+  /* small receives are not reported, so there is nothing to flush */
+  test_assert("flush", tas_flush() == 0);
+  test_assert("no update", harness_atx_pull(0, 0, 32, 0, 1, 1, 0) < 0);
+
+  tas_close(fd);
+}
+
+/* runs a subcase as tas_init does with TAS_SINGLE_THREAD=1, checking that
+ * the socket calls go through the process-wide context */
+static void test_single(void *p)
+{
+  void (*test)(void *) = p;
+
+  flextcp_sockets_single = 1;
+  test(NULL);
+  test_assert("single context used", flextcp_sockctx_single != NULL &&
+      &flextcp_sockctx_single->ctx == flextcp_sockctx_get());
+}
 
 int main(int argc, char *argv[])
 {
   int ret = 0;
 
   struct harness_params params;
-  params.num_ctxs = 1;
+  params.num_ctxs = 2;
   params.fp_cores = 2;
   params.arx_len = 1024;
   params.atx_len = 1024;
@@ -113,6 +927,8 @@ int main(int argc, char *argv[])
   params.aout_len = 1024;
 
   harness_prepare(&params);
+  if (tas_init() != 0)
+    test_error("tas_init failed");
 
   if (test_subcase("connect success", test_connect_success, NULL))
     ret = 1;
@@ -120,5 +936,60 @@ int main(int argc, char *argv[])
   if (test_subcase("connect fail", test_connect_fail, NULL))
     ret = 1;
 
+  if (test_subcase("zero-copy send", test_zc_send, NULL))
+    ret = 1;
+
+  if (test_subcase("sendmmsg and recvmmsg", test_mmsg, NULL))
+    ret = 1;
+
+  if (test_subcase("sendfile", test_sendfile, NULL))
+    ret = 1;
+
+  if (test_subcase("epoll edge-triggered", test_epoll_et, NULL))
+    ret = 1;
+
+  if (test_subcase("epoll exclusive", test_epoll_exclusive, NULL))
+    ret = 1;
+
+  if (test_subcase("poll and select", test_poll_select, NULL))
+    ret = 1;
+
+  if (test_subcase("poll fd replaced", test_poll_dup, NULL))
+    ret = 1;
+
+  if (test_subcase("fd pool", test_fd_pool, NULL))
+    ret = 1;
+
+  if (test_subcase("accept", test_accept, NULL))
+    ret = 1;
+
+  if (test_subcase("accept steering", test_accept_steer, NULL))
+    ret = 1;
+
+  if (test_subcase("batch ops", test_batch_ops, NULL))
+    ret = 1;
+
+  if (test_subcase("batch close", test_batch_close, NULL))
+    ret = 1;
+
+  if (test_subcase("single thread connect", test_single,
+        test_connect_success))
+    ret = 1;
+
+  if (test_subcase("single thread mmsg", test_single, test_mmsg))
+    ret = 1;
+
+  if (test_subcase("single thread epoll", test_single, test_epoll_et))
+    ret = 1;
+
+  if (test_subcase("single thread poll", test_single, test_poll_select))
+    ret = 1;
+
+  if (test_subcase("single thread accept", test_single, test_accept))
+    ret = 1;
+
+  if (test_subcase("single thread batch", test_single, test_batch_ops))
+    ret = 1;
+
   return ret;
 }
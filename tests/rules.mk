@@ -19,6 +19,12 @@ TESTS_SOCKETS := \
   tests/usocket_conntx \
   tests/usocket_conntx_large \
   tests/usocket_move \
+  tests/bench_sockets_echo \
+  tests/bench_sockets_zc \
+  tests/bench_sockets_epoll \
+  tests/bench_sockets_poll \
+  tests/bench_sockets_shortconn \
+  tests/bench_sockets_steer \
 
 # automated unittests
 TESTS_AUTO := \
@@ -27,9 +33,26 @@ TESTS_AUTO := \
   tests/tas_unit/fastpath \
   tests/tas_unit/shmring \
   tests/tas_unit/qman_rr \
-  tests/tas_unit/activelist
-
-TESTS := $(TESTS_NONE) $(TESTS_LIBTAS) $(TESTS_SOCKETS) $(TESTS_AUTO)
+  tests/tas_unit/activelist \
+  tests/tas_unit/memlayout \
+  tests/tas_unit/budget \
+  tests/tas_unit/budgetspend \
+  tests/tas_unit/bufquota \
+  tests/tas_unit/pollmode \
+  tests/tas_unit/doorbell \
+  tests/tas_unit/appif_accept \
+  tests/tas_unit/appif_park
+
+# microbenchmarks for internal components
+TESTS_BENCH := \
+  tests/tas_unit/bench_qman \
+  tests/tas_unit/bench_budget \
+  tests/tas_unit/bench_doorbell \
+  tests/tas_unit/bench_flush \
+  tests/tas_unit/bench_sockalloc
+
+TESTS := $(TESTS_NONE) $(TESTS_LIBTAS) $(TESTS_SOCKETS) $(TESTS_AUTO) \
+  $(TESTS_BENCH)
 TEST_OBJS := $(addsuffix .o, $(TESTS)) \
   tests/testutils.o tests/libtas/harness.o
 
@@ -55,7 +78,8 @@ tests/libtas/tas_ll: CPPFLAGS += -Ilib/tas/include/
 tests/libtas/tas_ll: tests/libtas/tas_ll.o tests/libtas/harness.o \
   tests/testutils.o lib/libtas.so
 
-tests/libtas/tas_sockets: CPPFLAGS += -Ilib/sockets/include/
+tests/libtas/tas_sockets: CPPFLAGS += -Ilib/sockets/include/ -Ilib/tas/include/
+tests/libtas/tas_sockets: LDLIBS += -lpthread
 tests/libtas/tas_sockets: tests/libtas/tas_sockets.o tests/libtas/harness.o \
   tests/testutils.o lib/libtas_sockets.so
 
@@ -80,6 +104,31 @@ tests/tas_unit/qman_rr: LDLIBS+= $(DPDK_LDLIBS)
 tests/tas_unit/qman_rr: tests/tas_unit/qman_rr.o tests/testutils.o \
   tas/fast/qman.o lib/utils/rng.o
 
+tests/tas_unit/bench_qman: CPPFLAGS+= -Itas/include -Ilib/tas/include/ $(DPDK_CPPFLAGS)
+tests/tas_unit/bench_qman: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/bench_qman: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/tas_unit/bench_qman: LDLIBS+= $(DPDK_LDLIBS)
+tests/tas_unit/bench_qman: tests/tas_unit/bench_qman.o \
+  tas/fast/qman.o lib/utils/rng.o
+
+tests/tas_unit/bench_budget: CPPFLAGS+= -Itas/include -Ilib/tas/include/ $(DPDK_CPPFLAGS)
+tests/tas_unit/bench_budget: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/bench_budget: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/tas_unit/bench_budget: LDLIBS+= $(DPDK_LDLIBS) -lpthread
+tests/tas_unit/bench_budget: tests/tas_unit/bench_budget.o \
+  tas/fast/fast_budget.o
+
+tests/tas_unit/bench_doorbell: LDLIBS+= -lpthread
+tests/tas_unit/bench_doorbell: tests/tas_unit/bench_doorbell.o
+
+tests/tas_unit/bench_flush: CPPFLAGS+= -Ilib/tas/include/
+tests/tas_unit/bench_flush: tests/tas_unit/bench_flush.o lib/libtas.so
+
+tests/tas_unit/bench_sockalloc: CPPFLAGS+= -Ilib/sockets/include/
+tests/tas_unit/bench_sockalloc: LDLIBS+= -lpthread
+tests/tas_unit/bench_sockalloc: tests/tas_unit/bench_sockalloc.o \
+  lib/libtas_sockets.so
+
 tests/tas_unit/activelist: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
 tests/tas_unit/activelist: CFLAGS+= $(DPDK_CFLAGS)
 tests/tas_unit/activelist: LDFLAGS+= $(DPDK_LDFLAGS)
@@ -87,6 +136,44 @@ tests/tas_unit/activelist: LDLIBS+= $(DPDK_LDLIBS)
 tests/tas_unit/activelist: tests/tas_unit/activelist.o tests/testutils.o \
   tas/fast/fast_appctx.o
 
+tests/tas_unit/memlayout: tests/tas_unit/memlayout.o tests/testutils.o
+
+tests/tas_unit/budget: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/budget: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/budget: LDLIBS+= -lm
+tests/tas_unit/budget: tests/tas_unit/budget.o tests/testutils.o \
+  tas/slow/budget.o tas/slow/budget_debug.o
+
+tests/tas_unit/budgetspend: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/budgetspend: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/budgetspend: tests/tas_unit/budgetspend.o tests/testutils.o \
+  tas/fast/fast_budget.o
+
+tests/tas_unit/bufquota: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/bufquota: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/bufquota: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/tas_unit/bufquota: LDLIBS+= $(DPDK_LDLIBS)
+tests/tas_unit/bufquota: tests/tas_unit/bufquota.o tests/testutils.o
+
+tests/tas_unit/pollmode: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/pollmode: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/pollmode: LDLIBS+= -lm
+tests/tas_unit/pollmode: tests/tas_unit/pollmode.o tests/testutils.o \
+  tas/fast/fast_pollmode.o
+
+tests/tas_unit/doorbell: LDLIBS+= -lpthread
+tests/tas_unit/doorbell: tests/tas_unit/doorbell.o tests/testutils.o
+
+tests/tas_unit/appif_accept: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/appif_accept: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/appif_accept: tests/tas_unit/appif_accept.o tests/testutils.o \
+  tas/slow/appif_ctx.o
+
+tests/tas_unit/appif_park: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/appif_park: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/appif_park: tests/tas_unit/appif_park.o tests/testutils.o \
+  tas/slow/appif_ctx.o
+
 # build tests
 tests: $(TESTS)
 
@@ -98,6 +185,14 @@ run-tests: $(TESTS_AUTO)
 	tests/tas_unit/shmring
 	tests/tas_unit/qman_rr
 	tests/tas_unit/activelist
+	tests/tas_unit/memlayout
+	tests/tas_unit/budget
+	tests/tas_unit/budgetspend
+	tests/tas_unit/bufquota
+	tests/tas_unit/pollmode
+	tests/tas_unit/doorbell
+	tests/tas_unit/appif_accept
+	tests/tas_unit/appif_park
 
 DEPS += $(TEST_OBJS:.o=.d)
 CLEAN += $(TEST_OBJS) $(TESTS)
@@ -19,6 +19,10 @@
 void **vm_shm = (void *) 0;
 struct flextcp_pl_mem state_base;
 struct flextcp_pl_mem *fp_state = &state_base;
+static struct flextcp_pl_corest test_cores[1];
+struct flextcp_pl_corest *fp_cores = test_cores;
+struct flextcp_pl_flowst *fp_flowst;
+uint32_t fp_flowst_num;
 struct configuration config;
 
 int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
@@ -0,0 +1,226 @@
+/*
+ * Slow path accept batch test: feeds KERNEL_APPOUT_ACCEPT_CONNS entries to
+ * appif_ctx_poll and checks that every slot the kernel cannot accept into gets
+ * a reply in order, and that a batch that runs out of kout space stays queued
+ * with the remaining slots until the application has drained kout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <tas.h>
+#include <tas_telemetry.h>
+
+#include "../testutils.h"
+#include "../../tas/slow/internal.h"
+#include "../../tas/slow/appif.h"
+
+#define KIN_LEN 4
+#define KOUT_LEN 4
+#define LISTEN_PORT 1234
+#define LISTEN_OPAQUE 0x1000
+
+/* Redefined so tests compile properly */
+/***************************************************************************/
+struct configuration config;
+struct tas_telemetry *tas_telemetry;
+void **vm_shm;
+
+int budget_vm_admit(uint16_t vmid)
+{
+  return 1;
+}
+
+int flexnic_scale_to(uint32_t cores)
+{
+  return -1;
+}
+
+int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
+{
+  return -1;
+}
+
+int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
+    uint16_t remote_port, uint32_t db_id, struct connection **conn)
+{
+  return -1;
+}
+
+int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
+    uint32_t backlog, int reuseport, struct listener **listen)
+{
+  return -1;
+}
+
+int tcp_close(struct connection *conn)
+{
+  return -1;
+}
+
+void tcp_destroy(struct connection *conn)
+{
+}
+
+/* Simulated kernel: slots with odd opaques cannot be accepted into */
+/***************************************************************************/
+static unsigned kicks;
+static unsigned accepted;
+
+void notify_app_core(uint16_t vmid, uint16_t dbid, int appfd,
+    uint64_t *last_tsc)
+{
+  kicks++;
+}
+
+int tcp_accept(struct app_context *ctx, uint64_t opaque,
+    struct listener *listen, uint32_t db_id, uint16_t core)
+{
+  if ((opaque & 1) != 0)
+    return -1;
+  accepted++;
+  return 0;
+}
+
+static struct application app;
+static struct app_context *ctx;
+static struct kernel_appout kin[KIN_LEN];
+static struct kernel_appin kout[KOUT_LEN];
+static struct listener listener;
+static struct app_doorbell db;
+static uint32_t kout_read;
+
+static void setup(void)
+{
+  memset(&app, 0, sizeof(app));
+  memset(kin, 0, sizeof(kin));
+  memset(kout, 0, sizeof(kout));
+  memset(&listener, 0, sizeof(listener));
+  kicks = accepted = kout_read = 0;
+
+  tas_telemetry = test_zalloc(sizeof(*tas_telemetry));
+  ctx = test_zalloc(sizeof(*ctx));
+  ctx->app = &app;
+  ctx->kin_base = kin;
+  ctx->kin_len = KIN_LEN;
+  ctx->kout_base = kout;
+  ctx->kout_len = KOUT_LEN;
+  ctx->doorbell = &db;
+  ctx->evfd = 1;
+
+  listener.opaque = LISTEN_OPAQUE;
+  listener.port = LISTEN_PORT;
+  app.listeners = &listener;
+}
+
+static void post_accepts(unsigned kin_pos, const uint64_t *opaques,
+    uint8_t num)
+{
+  struct kernel_appout *ko = &kin[kin_pos];
+
+  ko->data.accept_conns.listen_opaque = LISTEN_OPAQUE;
+  ko->data.accept_conns.local_port = LISTEN_PORT;
+  ko->data.accept_conns.core = KERNEL_APPOUT_ACCEPT_ANYCORE;
+  ko->data.accept_conns.num = num;
+  memcpy(ko->data.accept_conns.conn_opaques, opaques, num * sizeof(*opaques));
+  ko->type = KERNEL_APPOUT_ACCEPT_CONNS;
+}
+
+/* application side: takes the next failed accept reply off kout */
+static int pull_failed(uint64_t opaque)
+{
+  struct kernel_appin *ki = &kout[kout_read];
+
+  if (ki->type != KERNEL_APPIN_ACCEPTED_CONN ||
+      ki->data.accept_connection.opaque != opaque ||
+      ki->data.accept_connection.status == 0)
+  {
+    return -1;
+  }
+
+  ki->type = KERNEL_APPIN_INVALID;
+  kout_read = (kout_read + 1) % KOUT_LEN;
+  return 0;
+}
+
+void test_replies(void *arg)
+{
+  uint64_t opaques[] = { 2, 3, 4, 5, 6, 8 };
+
+  setup();
+  post_accepts(0, opaques, 6);
+  test_assert("batch handled", appif_ctx_poll(&app, ctx) == 1);
+  test_assert("kin entry consumed", kin[0].type == KERNEL_APPOUT_INVALID &&
+      ctx->kin_pos == 1);
+  test_assert("four slots posted", accepted == 4);
+  test_assert("failed slot 3", pull_failed(3) == 0);
+  test_assert("failed slot 5", pull_failed(5) == 0);
+  test_assert("no other replies", kout[kout_read].type == KERNEL_APPIN_INVALID);
+  test_assert("kicked per reply", kicks == 2);
+  test_assert("slots counted", tas_telemetry->accept.slots_posted == 6 &&
+      tas_telemetry->accept.post_entries == 1);
+}
+
+void test_kout_full(void *arg)
+{
+  uint64_t opaques[] = { 1, 3, 5, 7, 8, 9 };
+
+  setup();
+  post_accepts(0, opaques, 6);
+
+  /* four replies fit, slot 8 is posted, the batch stays queued with slot 9 */
+  test_assert("nothing consumed", appif_ctx_poll(&app, ctx) == 0);
+  test_assert("kin entry kept", kin[0].type == KERNEL_APPOUT_ACCEPT_CONNS &&
+      ctx->kin_pos == 0);
+  test_assert("one slot left", kin[0].data.accept_conns.num == 1 &&
+      kin[0].data.accept_conns.conn_opaques[0] == 9);
+  test_assert("slot 8 posted", accepted == 1);
+  test_assert("kout full", kout[ctx->kout_pos].type != KERNEL_APPIN_INVALID);
+
+  /* no progress until the application drains kout */
+  test_assert("still blocked", appif_ctx_poll(&app, ctx) == 0);
+  test_assert("failed slot 1", pull_failed(1) == 0);
+  test_assert("failed slot 3", pull_failed(3) == 0);
+  test_assert("failed slot 5", pull_failed(5) == 0);
+  test_assert("failed slot 7", pull_failed(7) == 0);
+
+  test_assert("retried", appif_ctx_poll(&app, ctx) == 1);
+  test_assert("kin entry consumed", kin[0].type == KERNEL_APPOUT_INVALID &&
+      ctx->kin_pos == 1);
+  test_assert("slot 8 not posted again", accepted == 1);
+  test_assert("failed slot 9", pull_failed(9) == 0);
+  test_assert("no other replies", kout[kout_read].type == KERNEL_APPIN_INVALID);
+  test_assert("slots counted once", tas_telemetry->accept.slots_posted == 6 &&
+      tas_telemetry->accept.post_entries == 1);
+}
+
+void test_unknown_listener(void *arg)
+{
+  uint64_t opaques[] = { 2, 4 };
+
+  setup();
+  post_accepts(0, opaques, 2);
+  kin[0].data.accept_conns.local_port = LISTEN_PORT + 1;
+
+  test_assert("batch handled", appif_ctx_poll(&app, ctx) == 1);
+  test_assert("nothing posted", accepted == 0);
+  test_assert("failed slot 2", pull_failed(2) == 0);
+  test_assert("failed slot 4", pull_failed(4) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("failed slots replied", test_replies, NULL))
+    ret = 1;
+
+  if (test_subcase("kout full", test_kout_full, NULL))
+    ret = 1;
+
+  if (test_subcase("unknown listener", test_unknown_listener, NULL))
+    ret = 1;
+
+  return ret;
+}
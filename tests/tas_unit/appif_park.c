@@ -0,0 +1,171 @@
+/*
+ * Slow path connection open parking test: feeds KERNEL_APPOUT_CONN_OPEN
+ * entries to appif_ctx_poll while the VM is over budget and checks that at
+ * most APPIF_PARKED_OPENS_MAX opens are parked per context, that further
+ * opens stay queued, and that parked opens are served in order once the VM
+ * has budget again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <tas.h>
+#include <tas_telemetry.h>
+
+#include "../testutils.h"
+#include "../../tas/slow/internal.h"
+#include "../../tas/slow/appif.h"
+
+#define KIN_LEN (2 * APPIF_PARKED_OPENS_MAX)
+#define KOUT_LEN (2 * APPIF_PARKED_OPENS_MAX)
+
+/* Redefined so tests compile properly */
+/***************************************************************************/
+struct configuration config;
+struct tas_telemetry *tas_telemetry;
+void **vm_shm;
+
+int flexnic_scale_to(uint32_t cores)
+{
+  return -1;
+}
+
+int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
+{
+  return -1;
+}
+
+int tcp_listen(struct app_context *ctx, uint64_t opaque, uint16_t local_port,
+    uint32_t backlog, int reuseport, struct listener **listen)
+{
+  return -1;
+}
+
+int tcp_accept(struct app_context *ctx, uint64_t opaque,
+    struct listener *listen, uint32_t db_id, uint16_t core)
+{
+  return -1;
+}
+
+int tcp_close(struct connection *conn)
+{
+  return -1;
+}
+
+void tcp_destroy(struct connection *conn)
+{
+}
+
+void notify_app_core(uint16_t vmid, uint16_t dbid, int appfd,
+    uint64_t *last_tsc)
+{
+}
+
+/* Simulated kernel: budget toggled by the test, opens recorded in order */
+/***************************************************************************/
+static int admit;
+static unsigned opens;
+static uint64_t opened[KIN_LEN];
+static struct connection conns[KIN_LEN];
+
+int budget_vm_admit(uint16_t vmid)
+{
+  return admit;
+}
+
+int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
+    uint16_t remote_port, uint32_t db_id, struct connection **conn)
+{
+  opened[opens] = opaque;
+  *conn = &conns[opens++];
+  return 0;
+}
+
+static struct application app;
+static struct app_context *ctx;
+static struct kernel_appout kin[KIN_LEN];
+static struct kernel_appin kout[KOUT_LEN];
+static struct app_doorbell db;
+
+static void setup(void)
+{
+  memset(&app, 0, sizeof(app));
+  memset(kin, 0, sizeof(kin));
+  memset(kout, 0, sizeof(kout));
+  admit = 0;
+  opens = 0;
+
+  tas_telemetry = test_zalloc(sizeof(*tas_telemetry));
+  ctx = test_zalloc(sizeof(*ctx));
+  ctx->app = &app;
+  ctx->kin_base = kin;
+  ctx->kin_len = KIN_LEN;
+  ctx->kout_base = kout;
+  ctx->kout_len = KOUT_LEN;
+  ctx->doorbell = &db;
+  ctx->evfd = 1;
+}
+
+static void post_open(unsigned kin_pos, uint64_t opaque)
+{
+  struct kernel_appout *ko = &kin[kin_pos];
+
+  ko->data.conn_open.opaque = opaque;
+  ko->data.conn_open.remote_ip = 0x0a010203;
+  ko->data.conn_open.remote_port = 1234;
+  ko->type = KERNEL_APPOUT_CONN_OPEN;
+}
+
+void test_park_cap(void *arg)
+{
+  unsigned i;
+  int ok;
+
+  setup();
+  for (i = 0; i <= APPIF_PARKED_OPENS_MAX; i++) {
+    post_open(i, i);
+  }
+
+  /* over budget: opens are parked up to the cap, the next one stays queued */
+  ok = 1;
+  for (i = 0; i < APPIF_PARKED_OPENS_MAX; i++) {
+    ok = ok && appif_ctx_poll(&app, ctx) == 1;
+  }
+  test_assert("parked up to cap", ok && ctx->open_num == APPIF_PARKED_OPENS_MAX
+      && ctx->kin_pos == APPIF_PARKED_OPENS_MAX);
+  test_assert("no opens over budget", opens == 0);
+  test_assert("next open stays queued", appif_ctx_poll(&app, ctx) == 0 &&
+      ctx->kin_pos == APPIF_PARKED_OPENS_MAX &&
+      kin[APPIF_PARKED_OPENS_MAX].type == KERNEL_APPOUT_CONN_OPEN);
+  test_assert("not parked", ctx->open_num == APPIF_PARKED_OPENS_MAX);
+
+  /* with budget, the parked opens are served in order, then the queued one */
+  admit = 1;
+  ok = 1;
+  for (i = 0; i < APPIF_PARKED_OPENS_MAX; i++) {
+    ok = ok && appif_ctx_poll(&app, ctx) == 1;
+  }
+  test_assert("parked served", ok && ctx->open_num == 0 &&
+      ctx->open_head == NULL && ctx->open_tail == NULL &&
+      opens == APPIF_PARKED_OPENS_MAX);
+  test_assert("queued open served", appif_ctx_poll(&app, ctx) == 1 &&
+      ctx->kin_pos == APPIF_PARKED_OPENS_MAX + 1 &&
+      opens == APPIF_PARKED_OPENS_MAX + 1);
+
+  ok = 1;
+  for (i = 0; i <= APPIF_PARKED_OPENS_MAX; i++) {
+    ok = ok && opened[i] == i;
+  }
+  test_assert("opened in request order", ok);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("parked opens capped", test_park_cap, NULL))
+    ret = 1;
+
+  return ret;
+}
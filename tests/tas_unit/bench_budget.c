@@ -0,0 +1,180 @@
+/*
+ * Budget accounting microbenchmark: runs the accounting part of the
+ * dataplane loop (four phases, each charged to the VMs that had work in it)
+ * and reports loop iterations per second. The previous accounting with
+ * floating point ratios and atomic updates of a shared balance is included
+ * for comparison. A second thread plays the slow path and hands out budget
+ * every 100us, as budget_update does.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+
+#include <tas.h>
+#include <config.h>
+#include <fastpath.h>
+
+#include "../../tas/fast/internal.h"
+#include "../../tas/fast/fastemu.h"
+#include "../../include/tas_memif.h"
+
+#define BENCH_PHASES 4
+#define BENCH_MSS 1448
+#define BENCH_DURATION_MS 200
+#define BENCH_BOOST_US 100
+
+/* Redefined so benchmark compiles properly */
+struct configuration config;
+_Atomic uint16_t tas_registered_vm_count;
+uint16_t tas_registered_vm_ids[FLEXNIC_PL_VMST_NUM];
+
+static struct dataplane_context *bench_ctx;
+static volatile int64_t legacy_budget[FLEXNIC_PL_VMST_NUM];
+static volatile int bench_stop;
+static int bench_legacy;
+
+/** Accounting as done before: double ratios, atomic shared balance */
+static void legacy_spend(struct dataplane_context *ctx, uint64_t cycles)
+{
+  int vmid;
+  uint16_t vm_count, vm_idx;
+  double counter, ratio;
+  uint64_t vm_cycles;
+
+  if (ctx->counters_total == 0)
+    return;
+
+  vm_count = tas_registered_vm_count_get();
+  for (vm_idx = 0; vm_idx < vm_count; vm_idx++)
+  {
+    vmid = tas_registered_vm_ids[vm_idx];
+    counter = ctx->vm_counters[vmid];
+    ratio = counter / ctx->counters_total;
+    vm_cycles = cycles * ratio;
+    __sync_fetch_and_sub(&legacy_budget[vmid], vm_cycles);
+    ctx->vm_counters[vmid] = 0;
+  }
+  ctx->counters_total = 0;
+}
+
+static void *slowpath_thread(void *arg)
+{
+  struct timespec ts = { .tv_sec = 0, .tv_nsec = BENCH_BOOST_US * 1000 };
+  struct vm_budget *b;
+  uint16_t vm_idx, vmid;
+
+  while (!bench_stop) {
+    for (vm_idx = 0; vm_idx < tas_registered_vm_count_get(); vm_idx++) {
+      vmid = tas_registered_vm_ids[vm_idx];
+      if (bench_legacy) {
+        __sync_fetch_and_add(&legacy_budget[vmid],
+            config.bu_max_budget - __sync_fetch_and_add(&legacy_budget[vmid],
+              0));
+      } else {
+        b = &bench_ctx->budgets[vmid];
+        b->granted += config.bu_max_budget - vm_budget_balance(b);
+      }
+    }
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+static void bench_run(int legacy, unsigned vms)
+{
+  struct dataplane_context *ctx = bench_ctx;
+  pthread_t slowpath;
+  unsigned i, p;
+  uint64_t s_cycs, e_cycs, tsc_end, iters, charged;
+
+  memset(ctx, 0, sizeof(*ctx));
+  for (i = 0; i < vms; i++) {
+    tas_registered_vm_ids[i] = i;
+    ctx->budgets[i].granted = config.bu_max_budget;
+    legacy_budget[i] = config.bu_max_budget;
+  }
+  tas_registered_vm_count = vms;
+  bench_legacy = legacy;
+  bench_stop = 0;
+
+  if (pthread_create(&slowpath, NULL, slowpath_thread, NULL) != 0) {
+    fprintf(stderr, "bench_run: pthread_create failed\n");
+    abort();
+  }
+
+  iters = charged = 0;
+  tsc_end = rte_get_tsc_cycles() + rte_get_tsc_hz() / 1000 * BENCH_DURATION_MS;
+  do {
+    for (p = 0; p < BENCH_PHASES; p++) {
+      s_cycs = rte_get_tsc_cycles();
+      /* every VM had some work in this phase */
+      for (i = 0; i < vms; i++) {
+        ctx->vm_counters[i] += BENCH_MSS;
+        ctx->counters_total += BENCH_MSS;
+      }
+      e_cycs = rte_get_tsc_cycles();
+      charged += e_cycs - s_cycs;
+
+      if (legacy)
+        legacy_spend(ctx, e_cycs - s_cycs);
+      else
+        fast_budget_spend(ctx, e_cycs - s_cycs);
+    }
+    iters++;
+  } while (e_cycs < tsc_end);
+
+  bench_stop = 1;
+  pthread_join(slowpath, NULL);
+
+  if (!legacy) {
+    for (i = 0; i < vms; i++)
+      charged -= ctx->budgets[i].consumed;
+  }
+
+  printf("%-12s %3u %14.2f %10s\n", legacy ? "atomic/fp" : "single/fixed",
+      vms, (double) iters / (BENCH_DURATION_MS * 1000.0),
+      legacy ? "-" : (charged == 0 ? "yes" : "no"));
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned vm_counts[] = { 1, FLEXNIC_PL_VMST_NUM };
+  unsigned i;
+  char *dpdk_args[3];
+
+  // Create dpdk args to disable eal logging
+  dpdk_args[0] = argv[0];
+  dpdk_args[1] = "--log-level";
+  dpdk_args[2] = "lib.eal:error";
+
+  if (rte_eal_init(3, dpdk_args) < 0) {
+    fprintf(stderr, "rte_eal_init failed\n");
+    return 1;
+  }
+
+  bench_ctx = calloc(1, sizeof(*bench_ctx));
+  if (bench_ctx == NULL) {
+    fprintf(stderr, "calloc failed\n");
+    return 1;
+  }
+  config.bu_max_budget = 1000000000;
+
+  printf("%u phases per iteration, %u ms per run\n", BENCH_PHASES,
+      BENCH_DURATION_MS);
+  printf("%-12s %3s %14s %10s\n", "accounting", "vms", "Miter/s", "exact");
+
+  for (i = 0; i < sizeof(vm_counts) / sizeof(vm_counts[0]); i++) {
+    bench_run(1, vm_counts[i]);
+    bench_run(0, vm_counts[i]);
+  }
+
+  free(bench_ctx);
+  return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Wakeup microbenchmark: two threads ping-pong a message and wait for the
+ * reply the way TAS cores and application contexts do, polling for a while
+ * and then sleeping. Compares kicking the eventfd whenever the peer has not
+ * been kicked for a poll interval with shared memory doorbells, where the
+ * sleeper either blocks on its eventfd (TAS cores) or on the doorbell futex
+ * (flextcp_context_wait). The think time between messages sets the load, with
+ * long think times both sides sleep before every message. Reports round trip
+ * latencies and wakeup system calls per message.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <utils_doorbell.h>
+
+#define BENCH_MSGS 5000
+#define BENCH_SPIN_NS 20000ULL
+#define BENCH_TIMEOUT_MS 100
+
+enum bench_mode {
+  MODE_EVENTFD,
+  MODE_DB_FD,
+  MODE_DB_FUTEX,
+};
+
+static const char *mode_names[] = {
+  [MODE_EVENTFD] = "eventfd",
+  [MODE_DB_FD] = "doorbell/fd",
+  [MODE_DB_FUTEX] = "doorbell/futex",
+};
+
+struct endpoint {
+  struct util_doorbell db;
+  /* messages delivered to this endpoint */
+  volatile uint64_t seq;
+  uint64_t seen;
+  uint64_t spin_ns;
+  int evfd;
+  /* sender side state for kicking this endpoint */
+  uint64_t last_kick;
+  uint64_t kicks;
+} __attribute__((aligned(64)));
+
+static struct endpoint eps[2];
+static enum bench_mode mode;
+static volatile int bench_stop;
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void kick_fd(struct endpoint *ep)
+{
+  uint64_t val = 1;
+
+  if (write(ep->evfd, &val, sizeof(val)) != sizeof(val)) {
+    perror("kick_fd: write failed");
+    abort();
+  }
+}
+
+static void ep_send(struct endpoint *ep)
+{
+  uint64_t now;
+  uint32_t prev;
+
+  __atomic_store_n(&ep->seq, ep->seq + 1, __ATOMIC_RELEASE);
+
+  if (mode == MODE_EVENTFD) {
+    /* as notify_core() without doorbells */
+    now = now_ns();
+    if (now - ep->last_kick > BENCH_SPIN_NS) {
+      kick_fd(ep);
+      ep->kicks++;
+    }
+    ep->last_kick = now;
+    return;
+  }
+
+  prev = util_doorbell_ring(&ep->db);
+  if (prev == UTIL_DOORBELL_SLEEP_FD)
+    kick_fd(ep);
+  if (prev != UTIL_DOORBELL_AWAKE)
+    ep->kicks++;
+}
+
+static inline int ep_check(struct endpoint *ep)
+{
+  uint64_t seq = __atomic_load_n(&ep->seq, __ATOMIC_ACQUIRE);
+
+  if (seq == ep->seen)
+    return 0;
+  ep->seen = seq;
+  return 1;
+}
+
+static void ep_sleep_fd(struct endpoint *ep)
+{
+  struct pollfd pfd = { .fd = ep->evfd, .events = POLLIN };
+  uint64_t val;
+
+  if (poll(&pfd, 1, BENCH_TIMEOUT_MS) < 0) {
+    perror("ep_sleep_fd: poll failed");
+    abort();
+  }
+  if (read(ep->evfd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+    perror("ep_sleep_fd: read failed");
+    abort();
+  }
+}
+
+static void ep_wait(struct endpoint *ep)
+{
+  uint64_t start, slept;
+
+  start = now_ns();
+  while (!ep_check(ep)) {
+    if (bench_stop)
+      return;
+    if (now_ns() - start < ep->spin_ns) {
+      __builtin_ia32_pause();
+      continue;
+    }
+
+    if (mode == MODE_EVENTFD) {
+      ep_sleep_fd(ep);
+      start = now_ns();
+      continue;
+    }
+
+    /* mark the doorbell, then check once more before sleeping */
+    util_doorbell_prepare(&ep->db, mode == MODE_DB_FD ?
+        UTIL_DOORBELL_SLEEP_FD : UTIL_DOORBELL_SLEEP_FUTEX);
+    if (ep_check(ep)) {
+      util_doorbell_cancel(&ep->db);
+      return;
+    }
+
+    slept = now_ns();
+    if (mode == MODE_DB_FD)
+      ep_sleep_fd(ep);
+    else
+      util_doorbell_wait(&ep->db, BENCH_TIMEOUT_MS);
+    util_doorbell_cancel(&ep->db);
+
+    start = now_ns();
+    util_doorbell_adapt(&ep->spin_ns, BENCH_SPIN_NS, start - slept);
+  }
+}
+
+static void *server_thread(void *arg)
+{
+  while (1) {
+    ep_wait(&eps[0]);
+    if (bench_stop)
+      break;
+    ep_send(&eps[1]);
+  }
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void bench_run(enum bench_mode m, unsigned think_us, uint64_t *rtts)
+{
+  struct timespec think = { .tv_sec = 0, .tv_nsec = think_us * 1000L };
+  pthread_t server;
+  uint64_t t;
+  unsigned i;
+
+  for (i = 0; i < 2; i++) {
+    memset(&eps[i].db, 0, sizeof(eps[i].db));
+    eps[i].seq = eps[i].seen = 0;
+    eps[i].spin_ns = BENCH_SPIN_NS;
+    eps[i].last_kick = eps[i].kicks = 0;
+  }
+  mode = m;
+  bench_stop = 0;
+
+  if (pthread_create(&server, NULL, server_thread, NULL) != 0) {
+    fprintf(stderr, "bench_run: pthread_create failed\n");
+    abort();
+  }
+
+  for (i = 0; i < BENCH_MSGS; i++) {
+    if (think_us > 0)
+      nanosleep(&think, NULL);
+
+    t = now_ns();
+    ep_send(&eps[0]);
+    ep_wait(&eps[1]);
+    rtts[i] = now_ns() - t;
+  }
+
+  bench_stop = 1;
+  ep_send(&eps[0]);
+  pthread_join(server, NULL);
+
+  qsort(rtts, BENCH_MSGS, sizeof(*rtts), cmp_u64);
+  printf("%-15s %6u %10.2f %10.2f %10.2f %10.3f\n", mode_names[m], think_us,
+      rtts[BENCH_MSGS / 2] / 1000.0, rtts[BENCH_MSGS * 99 / 100] / 1000.0,
+      rtts[BENCH_MSGS - 1] / 1000.0,
+      (double) (eps[0].kicks + eps[1].kicks) / (2 * BENCH_MSGS));
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned think_us[] = { 0, 50, 500 };
+  uint64_t *rtts;
+  unsigned i, m;
+
+  for (i = 0; i < 2; i++) {
+    eps[i].evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eps[i].evfd < 0) {
+      perror("eventfd failed");
+      return 1;
+    }
+  }
+
+  rtts = calloc(BENCH_MSGS, sizeof(*rtts));
+  if (rtts == NULL) {
+    fprintf(stderr, "calloc failed\n");
+    return 1;
+  }
+
+  printf("%u messages per run, poll %llu us before sleeping\n", BENCH_MSGS,
+      BENCH_SPIN_NS / 1000);
+  printf("%-15s %6s %10s %10s %10s %10s\n", "wakeup", "think", "p50 us",
+      "p99 us", "max us", "kicks/msg");
+
+  for (i = 0; i < sizeof(think_us) / sizeof(think_us[0]); i++) {
+    for (m = MODE_EVENTFD; m <= MODE_DB_FUTEX; m++)
+      bench_run(m, think_us[i], rtts);
+  }
+
+  free(rtts);
+  return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Transmit doorbell microbenchmark: an application context sends small
+ * messages on connections spread over several fast path cores. Compares
+ * pushing every message to the fast path right away, as a send followed by a
+ * context poll does, with sending a batch of messages (as sendmmsg or a loop
+ * of sends followed by tas_flush) and pushing them with one flush. The fast
+ * path is emulated by draining the context queues, eventfd counters count the
+ * doorbells. Reports doorbells (eventfd kicks) and cycles per message.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <tas_ll.h>
+#include <utils.h>
+
+#include "../../lib/tas/internal.h"
+
+#define BENCH_MSGS 1000000
+#define BENCH_MSG_LEN 64
+#define BENCH_CORES 4
+#define BENCH_CONNS 64
+#define BENCH_TXB_LEN (64 * 1024)
+
+static struct flextcp_context ctx;
+static struct flextcp_connection conns[BENCH_CONNS];
+static struct flexnic_info info;
+
+/* emulate the fast path consuming all queue entries and data */
+static void fastpath_drain(void)
+{
+  unsigned i;
+
+  for (i = 0; i < BENCH_CORES; i++) {
+    memset(ctx.queues[i].txq_base, 0, ctx.txq_len);
+    ctx.queues[i].txq_tail = 0;
+    ctx.queues[i].txq_avail = ctx.txq_len;
+  }
+  for (i = 0; i < BENCH_CONNS; i++)
+    conns[i].txb_sent = 0;
+}
+
+static uint64_t kicks_read(void)
+{
+  uint64_t val, sum = 0;
+  unsigned i;
+
+  for (i = 0; i < BENCH_CORES; i++) {
+    if (read(flexnic_evfd[i], &val, sizeof(val)) == sizeof(val))
+      sum += val;
+  }
+  return sum;
+}
+
+static void msg_send(unsigned n)
+{
+  struct flextcp_connection *c = &conns[n % BENCH_CONNS];
+  void *buf;
+
+  if (flextcp_connection_tx_alloc(c, BENCH_MSG_LEN, &buf) != BENCH_MSG_LEN ||
+      flextcp_connection_tx_send(&ctx, c, BENCH_MSG_LEN) != 0)
+  {
+    fprintf(stderr, "msg_send: sending failed\n");
+    abort();
+  }
+  memset(buf, n, BENCH_MSG_LEN);
+}
+
+static void bench_run(unsigned batch)
+{
+  uint64_t start, cycles, kicks;
+  unsigned i, j;
+
+  kicks_read();
+  start = util_rdtsc();
+  for (i = 0; i < BENCH_MSGS; i += batch) {
+    for (j = 0; j < batch; j++)
+      msg_send(i + j);
+
+    if (flextcp_context_flush(&ctx) != 0) {
+      fprintf(stderr, "bench_run: flush incomplete\n");
+      abort();
+    }
+    fastpath_drain();
+  }
+  cycles = util_rdtsc() - start;
+  kicks = kicks_read();
+
+  printf("%8u %12.3f %12.1f\n", batch, (double) kicks / BENCH_MSGS,
+      (double) cycles / BENCH_MSGS);
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned batches[] = { 1, 4, 16, 64 };
+  unsigned i;
+
+  /* always kick cores, there is no doorbell page to check */
+  info.poll_cycle_tas = 0;
+  flexnic_info = &info;
+  flexnic_db = NULL;
+
+  ctx.txq_len = BENCH_CONNS * sizeof(struct flextcp_pl_atx);
+  ctx.num_queues = BENCH_CORES;
+  for (i = 0; i < BENCH_CORES; i++) {
+    flexnic_evfd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ctx.queues[i].txq_base = calloc(1, ctx.txq_len);
+    if (flexnic_evfd[i] < 0 || ctx.queues[i].txq_base == NULL) {
+      perror("allocating queues failed");
+      return 1;
+    }
+  }
+
+  for (i = 0; i < BENCH_CONNS; i++) {
+    conns[i].status = CONN_OPEN;
+    conns[i].flow_id = i;
+    conns[i].fn_core = i % BENCH_CORES;
+    conns[i].txb_len = BENCH_TXB_LEN;
+    conns[i].txb_base = calloc(1, BENCH_TXB_LEN);
+    if (conns[i].txb_base == NULL) {
+      perror("allocating buffers failed");
+      return 1;
+    }
+  }
+  fastpath_drain();
+
+  printf("%u messages of %u bytes on %u connections over %u cores\n",
+      BENCH_MSGS, BENCH_MSG_LEN, BENCH_CONNS, BENCH_CORES);
+  printf("%8s %12s %12s\n", "batch", "kicks/msg", "cycles/msg");
+  for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+    bench_run(batches[i]);
+
+  return 0;
+}
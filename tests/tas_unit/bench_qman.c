@@ -0,0 +1,128 @@
+/*
+ * Queue manager microbenchmark: compares the skiplist and timing wheel
+ * schedulers for rate-limited flows. All flows belong to one VM and share a
+ * fixed aggregate rate. Every dequeued chunk is immediately re-added to its
+ * flow, as the fast path does when applications keep the tx buffer full, so
+ * the measured cost per dequeue includes the re-insert.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+
+#include <tas.h>
+#include <config.h>
+#include <fastpath.h>
+
+#include "../../tas/fast/internal.h"
+#include "../../include/tas_memif.h"
+
+#define BENCH_VM 0
+#define BENCH_MSS 1448
+#define BENCH_BATCH 32
+/** Aggregate rate over all flows in kbps */
+#define BENCH_RATE_KBPS (40ULL * 1000 * 1000)
+#define BENCH_DURATION_MS 200
+
+/* Redefined so benchmark compiles properly */
+struct configuration config;
+uint32_t fp_flowst_num = FLEXNIC_PL_FLOWST_NUM_DEFAULT;
+
+static void bench_run(enum config_qman_algorithm alg, const char *name,
+    unsigned flows)
+{
+  struct dataplane_context *ctx;
+  struct qman_thread *t;
+  unsigned i, n, vm_ids[BENCH_BATCH], q_ids[BENCH_BATCH];
+  uint16_t q_bytes[BENCH_BATCH];
+  uint32_t rate;
+  uint64_t start, end, tsc_end, set_cyc, poll_cyc, polls, dequeues;
+
+  ctx = calloc(1, sizeof(*ctx));
+  if (ctx == NULL) {
+    fprintf(stderr, "bench_run: calloc failed\n");
+    abort();
+  }
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    ctx->budgets[i].granted = INT64_MAX;
+  }
+
+  config.fp_qman = alg;
+  if (tas_qman_thread_init(ctx) != 0) {
+    fprintf(stderr, "bench_run: tas_qman_thread_init failed\n");
+    abort();
+  }
+  t = &ctx->qman;
+
+  rate = BENCH_RATE_KBPS / flows;
+  if (rate == 0)
+    rate = 1;
+
+  /* activate all flows */
+  start = rte_get_tsc_cycles();
+  for (i = 0; i < flows; i++) {
+    tas_qman_set(t, BENCH_VM, i, rate, 4 * BENCH_MSS, BENCH_MSS,
+        QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL);
+  }
+  set_cyc = rte_get_tsc_cycles() - start;
+
+  /* poll for fixed time, re-adding each dequeued chunk */
+  polls = dequeues = poll_cyc = 0;
+  tsc_end = rte_get_tsc_cycles() + rte_get_tsc_hz() / 1000 * BENCH_DURATION_MS;
+  do {
+    start = rte_get_tsc_cycles();
+    n = tas_qman_poll(ctx, BENCH_BATCH, vm_ids, q_ids, q_bytes);
+    for (i = 0; i < n; i++) {
+      tas_qman_set(t, vm_ids[i], q_ids[i], 0, q_bytes[i], 0, QMAN_ADD_AVAIL);
+    }
+    end = rte_get_tsc_cycles();
+
+    if (n > 0) {
+      poll_cyc += end - start;
+      dequeues += n;
+      polls++;
+    }
+  } while (end < tsc_end);
+
+  printf("%-9s %7u %12.1f %14.1f %12.2f %10.2f\n", name, flows,
+      (double) set_cyc / flows,
+      (dequeues > 0 ? (double) poll_cyc / dequeues : 0.0),
+      (double) dequeues / (BENCH_DURATION_MS * 1000.0),
+      (polls > 0 ? (double) dequeues / polls : 0.0));
+
+  qman_free_vm_cont(ctx);
+  free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned flow_counts[] = { 1000, 10000, 100000 };
+  unsigned i;
+  char *dpdk_args[3];
+
+  // Create dpdk args to disable eal logging
+  dpdk_args[0] = argv[0];
+  dpdk_args[1] = "--log-level";
+  dpdk_args[2] = "lib.eal:error";
+
+  if (rte_eal_init(3, dpdk_args) < 0) {
+    fprintf(stderr, "rte_eal_init failed\n");
+    return 1;
+  }
+
+  printf("aggregate rate %"PRIu64" Mbps, batch %u, %u ms per run\n",
+      (uint64_t) BENCH_RATE_KBPS / 1000, BENCH_BATCH, BENCH_DURATION_MS);
+  printf("%-9s %7s %12s %14s %12s %10s\n", "scheduler", "flows",
+      "cyc/insert", "cyc/dequeue", "Mdeq/s", "deq/poll");
+
+  for (i = 0; i < sizeof(flow_counts) / sizeof(flow_counts[0]); i++) {
+    bench_run(CONFIG_QMAN_SKIPLIST, "skiplist", flow_counts[i]);
+    bench_run(CONFIG_QMAN_WHEEL, "wheel", flow_counts[i]);
+  }
+
+  return 0;
+}
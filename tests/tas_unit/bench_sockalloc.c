@@ -0,0 +1,132 @@
+/*
+ * Socket allocation microbenchmark: threads open and close TAS sockets in a
+ * loop, as a connection per request server does for every accept and close.
+ * The fd and socket allocation in the sockets library is compared with the
+ * way it was done before, an eventfd to reserve the fd number plus a calloc'd
+ * socket, closed and freed again. Reports nanoseconds per open/close pair.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <tas_sockets.h>
+
+#define BENCH_OPS 200000
+/* sockets each thread keeps open, to churn a realistic fd range */
+#define BENCH_OPEN 64
+/* size of struct socket is not visible here, close enough */
+#define BENCH_SOCK_SIZE 512
+
+enum bench_mode {
+  MODE_EVENTFD,
+  MODE_TAS,
+};
+
+static const char *mode_names[] = {
+  [MODE_EVENTFD] = "eventfd+calloc",
+  [MODE_TAS] = "tas_socket",
+};
+
+static enum bench_mode mode;
+
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sock_open(void **obj)
+{
+  if (mode == MODE_TAS)
+    return tas_socket(AF_INET, SOCK_STREAM, 0);
+
+  *obj = calloc(1, BENCH_SOCK_SIZE);
+  return eventfd(0, 0);
+}
+
+static void sock_close(int fd, void *obj)
+{
+  if (mode == MODE_TAS) {
+    tas_close(fd);
+    return;
+  }
+
+  close(fd);
+  free(obj);
+}
+
+static void *thread_run(void *arg)
+{
+  int fds[BENCH_OPEN];
+  void *objs[BENCH_OPEN];
+  unsigned i, j;
+
+  for (j = 0; j < BENCH_OPEN; j++) {
+    if ((fds[j] = sock_open(&objs[j])) < 0) {
+      perror("thread_run: open failed");
+      abort();
+    }
+  }
+
+  for (i = 0; i < BENCH_OPS; i++) {
+    j = i % BENCH_OPEN;
+    sock_close(fds[j], objs[j]);
+    if ((fds[j] = sock_open(&objs[j])) < 0) {
+      perror("thread_run: open failed");
+      abort();
+    }
+  }
+
+  for (j = 0; j < BENCH_OPEN; j++)
+    sock_close(fds[j], objs[j]);
+
+  return NULL;
+}
+
+static void bench_run(enum bench_mode m, unsigned threads)
+{
+  pthread_t pts[threads];
+  uint64_t start, ns;
+  unsigned i;
+
+  mode = m;
+  start = now_ns();
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&pts[i], NULL, thread_run, NULL) != 0) {
+      fprintf(stderr, "bench_run: pthread_create failed\n");
+      abort();
+    }
+  }
+  for (i = 0; i < threads; i++)
+    pthread_join(pts[i], NULL);
+  ns = now_ns() - start;
+
+  /* wall time per pair as seen by each thread */
+  printf("%-15s %8u %12.1f\n", mode_names[m], threads,
+      (double) ns / BENCH_OPS);
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned threads[] = { 1, 4 };
+  unsigned i, m;
+
+  printf("%u open/close pairs per thread, %u sockets open per thread\n",
+      BENCH_OPS, BENCH_OPEN);
+  printf("%-15s %8s %12s\n", "alloc", "threads", "ns/pair");
+
+  for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+    for (m = MODE_EVENTFD; m <= MODE_TAS; m++)
+      bench_run(m, threads[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,408 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <tas.h>
+#include <tas_telemetry.h>
+#include <budget_debug.h>
+
+#include "../testutils.h"
+#include "../../tas/slow/internal.h"
+
+#define SIM_CORES 2
+#define SIM_PERIOD 1000
+#define SIM_MAX_BUDGET 1000000000LL
+#define SIM_SATURATED INT64_MAX
+#define SIM_OPEN_COST 100
+
+/* Redefined so tests compile properly */
+/***************************************************************************/
+struct configuration config;
+struct tas_telemetry *tas_telemetry;
+_Atomic uint16_t tas_registered_vm_count;
+uint16_t tas_registered_vm_ids[FLEXNIC_PL_VMST_NUM];
+
+int config_parse_telemetry(const char *s)
+{
+  return -1;
+}
+
+/* Simulated fast path state */
+/***************************************************************************/
+static int64_t sim_budget[FLEXNIC_PL_VMST_NUM][SIM_CORES];
+static uint64_t sim_granted[FLEXNIC_PL_VMST_NUM];
+static uint64_t sim_consumed[FLEXNIC_PL_VMST_NUM];
+static uint64_t sim_qdelay[FLEXNIC_PL_VMST_NUM];
+static uint64_t sim_sp_used[FLEXNIC_PL_VMST_NUM];
+/* per core consumption since the last telemetry snapshot */
+static uint64_t sim_used[FLEXNIC_PL_VMST_NUM][SIM_CORES];
+static uint64_t sim_tsc;
+
+uint64_t util_timeout_tsc_per_us(void)
+{
+  return 1;
+}
+
+uint32_t util_timeout_time_us(void)
+{
+  return sim_tsc;
+}
+
+uint64_t get_budget_delta(int vmid, int ctxid)
+{
+  return config.bu_max_budget - sim_budget[vmid][ctxid];
+}
+
+void boost_budget(int vmid, int ctxid, int64_t incr)
+{
+  if (sim_budget[vmid][ctxid] + incr > (int64_t) config.bu_max_budget)
+    incr = config.bu_max_budget - sim_budget[vmid][ctxid];
+  sim_budget[vmid][ctxid] += incr;
+  sim_granted[vmid] += incr;
+}
+
+uint64_t get_vm_qdelay(int vmid, uint64_t interval_us)
+{
+  return sim_qdelay[vmid];
+}
+
+int64_t tas_get_budget_raw(int vmid, int ctxid)
+{
+  return sim_budget[vmid][ctxid];
+}
+
+void tas_get_vm_buf_stats(int vmid, uint64_t *in_use, uint64_t *backpressure,
+    uint64_t *drops)
+{
+  *in_use = *backpressure = *drops = 0;
+}
+
+int tas_vm_tx_weight_set(int vmid, uint32_t weight)
+{
+  config.fp_vm_weights[vmid] = weight;
+  return 0;
+}
+
+void tas_budget_debug_snapshot_core(int ctxid,
+    struct budget_debug_fast_snapshot *snapshot)
+{
+  unsigned vm;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  for (vm = 0; vm < FLEXNIC_PL_VMST_NUM; vm++) {
+    snapshot->consumed_vm[vm] = sim_used[vm][ctxid];
+    snapshot->consumed_total += sim_used[vm][ctxid];
+    sim_used[vm][ctxid] = 0;
+  }
+}
+
+static void sim_init(unsigned vms)
+{
+  unsigned i;
+
+  memset(&config, 0, sizeof(config));
+  config.bu_max_budget = SIM_MAX_BUDGET;
+  config.bu_update_freq = SIM_PERIOD;
+  config.bu_boost = 1;
+  config.bu_slo_gain = 1.5;
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    config.bu_vm_weights[i] = 1;
+    config.bu_vm_max_share[i] = 1;
+  }
+
+  memset(sim_budget, 0, sizeof(sim_budget));
+  memset(sim_qdelay, 0, sizeof(sim_qdelay));
+  memset(sim_used, 0, sizeof(sim_used));
+  for (i = 0; i < vms; i++) {
+    tas_registered_vm_ids[i] = i;
+  }
+  tas_registered_vm_count = vms;
+  sim_tsc = 0;
+
+  budget_init(SIM_CORES);
+}
+
+/** Run update periods where each VM consumes up to demand[vm] per core */
+static void sim_run(unsigned vms, unsigned periods, const int64_t *demand)
+{
+  unsigned p, vm, c;
+  int64_t use;
+
+  memset(sim_granted, 0, sizeof(sim_granted));
+  memset(sim_consumed, 0, sizeof(sim_consumed));
+
+  for (p = 0; p < periods; p++) {
+    sim_tsc += SIM_PERIOD;
+    budget_update(sim_tsc);
+
+    for (vm = 0; vm < vms; vm++) {
+      for (c = 0; c < SIM_CORES; c++) {
+        use = sim_budget[vm][c] < demand[vm] ? sim_budget[vm][c] : demand[vm];
+        if (use < 0)
+          use = 0;
+        sim_budget[vm][c] -= use;
+        sim_consumed[vm] += use;
+        sim_used[vm][c] += use;
+      }
+    }
+  }
+}
+
+/** Like sim_run, but before the fast path runs, VMs first issue up to
+ * opens[vm] connection requests of SIM_OPEN_COST slow path cycles each. With
+ * charge set, requests go through admission control and are charged to the
+ * VM, otherwise the slow path serves them for free. */
+static void sim_run_churn(unsigned vms, unsigned periods,
+    const int64_t *demand, const unsigned *opens, int charge)
+{
+  unsigned p, vm, c, i;
+  int64_t use;
+
+  memset(sim_consumed, 0, sizeof(sim_consumed));
+  memset(sim_sp_used, 0, sizeof(sim_sp_used));
+
+  for (p = 0; p < periods; p++) {
+    sim_tsc += SIM_PERIOD;
+    budget_update(sim_tsc);
+
+    for (vm = 0; vm < vms; vm++) {
+      for (i = 0; i < opens[vm]; i++) {
+        if (charge && !budget_vm_admit(vm))
+          break;
+        sim_sp_used[vm] += SIM_OPEN_COST;
+        if (charge)
+          budget_sp_charge(vm, SIM_OPEN_COST);
+      }
+    }
+
+    for (vm = 0; vm < vms; vm++) {
+      for (c = 0; c < SIM_CORES; c++) {
+        use = sim_budget[vm][c] < demand[vm] ? sim_budget[vm][c] : demand[vm];
+        if (use < 0)
+          use = 0;
+        sim_budget[vm][c] -= use;
+        sim_consumed[vm] += use;
+        sim_used[vm][c] += use;
+      }
+    }
+  }
+}
+
+/** Fraction of fast and slow path cycles used by vm */
+static double total_frac(unsigned vm, unsigned vms)
+{
+  unsigned i;
+  uint64_t total = 0;
+
+  for (i = 0; i < vms; i++)
+    total += sim_consumed[i] + sim_sp_used[i];
+  return (double) (sim_consumed[vm] + sim_sp_used[vm]) / total;
+}
+
+static double consumed_frac(unsigned vm, unsigned vms)
+{
+  unsigned i;
+  uint64_t total = 0;
+
+  for (i = 0; i < vms; i++)
+    total += sim_consumed[i];
+  return (double) sim_consumed[vm] / total;
+}
+
+void test_weights(void *arg)
+{
+  const int64_t demand[2] = { SIM_SATURATED, SIM_SATURATED };
+
+  sim_init(2);
+  config.bu_vm_weights[0] = 3;
+  budget_init(SIM_CORES);
+
+  sim_run(2, 100, demand);
+  test_assert("weighted share vm 0", fabs(consumed_frac(0, 2) - 0.75) < 0.01);
+  test_assert("weighted share vm 1", fabs(consumed_frac(1, 2) - 0.25) < 0.01);
+
+  // runtime change through the same path as the control socket
+  test_assert("set weight", budget_vm_weight_set(1, 3) == 0);
+  sim_run(2, 100, demand);
+  test_assert("equal share after update",
+      fabs(consumed_frac(0, 2) - 0.5) < 0.01);
+
+  test_assert("reject zero weight", budget_vm_weight_set(1, 0) != 0);
+  test_assert("reject bad vm",
+      budget_vm_weight_set(FLEXNIC_PL_VMST_NUM, 1) != 0);
+}
+
+void test_shares(void *arg)
+{
+  const int64_t demand[3] = { SIM_SATURATED, SIM_SATURATED, SIM_SATURATED };
+
+  // minimum share for vm 2 comes out of the other two equally
+  sim_init(3);
+  test_assert("set min share", budget_vm_share_set(2, 0.5, 1) == 0);
+  sim_run(3, 100, demand);
+  test_assert("min share vm 2", fabs(consumed_frac(2, 3) - 0.5) < 0.01);
+  test_assert("rest vm 0", fabs(consumed_frac(0, 3) - 0.25) < 0.01);
+  test_assert("rest vm 1", fabs(consumed_frac(1, 3) - 0.25) < 0.01);
+
+  // maximum share caps a heavy weight
+  sim_init(3);
+  config.bu_vm_weights[0] = 10;
+  budget_init(SIM_CORES);
+  test_assert("set max share", budget_vm_share_set(0, 0, 0.2) == 0);
+  test_assert("max share vm 0", fabs(budget_vm_share_get(0) - 0.2) < 1e-9);
+  test_assert("rest vm 1", fabs(budget_vm_share_get(1) - 0.4) < 1e-9);
+  test_assert("rest vm 2", fabs(budget_vm_share_get(2) - 0.4) < 1e-9);
+
+  test_assert("reject min > max", budget_vm_share_set(0, 0.5, 0.4) != 0);
+  test_assert("reject max > 1", budget_vm_share_set(0, 0, 1.5) != 0);
+
+  // minimum shares cannot over-commit the budget
+  test_assert("min share vm 1", budget_vm_share_set(1, 0.6, 1) == 0);
+  test_assert("reject min sum > 1", budget_vm_share_set(2, 0.5, 1) != 0);
+  test_assert("min sum of 1", budget_vm_share_set(2, 0.4, 1) == 0);
+  test_assert("replacing own min", budget_vm_share_set(1, 0.6, 0.8) == 0);
+}
+
+void test_idle_capped(void *arg)
+{
+  const int64_t demand[2] = { SIM_SATURATED, 0 };
+  unsigned c;
+
+  // idle vm accumulates at most the max budget, busy vm keeps its share
+  sim_init(2);
+  config.bu_max_budget = 10 * SIM_PERIOD;
+  sim_run(2, 1000, demand);
+  for (c = 0; c < SIM_CORES; c++) {
+    test_assert("idle budget capped",
+        sim_budget[1][c] <= (int64_t) config.bu_max_budget);
+  }
+  test_assert("busy vm consumed share",
+      sim_consumed[0] >= 1000 * SIM_PERIOD * SIM_CORES / 2 * 0.99);
+}
+
+void test_slo_feedback(void *arg)
+{
+  const int64_t demand[2] = { SIM_SATURATED, SIM_SATURATED };
+  double prev, cur;
+  unsigned i;
+  int grows = 1;
+
+  sim_init(2);
+  test_assert("set slo", budget_vm_slo_set(0, 100) == 0);
+
+  // meeting target: equal split
+  sim_run(2, 10, demand);
+  test_assert("share while meeting slo",
+      fabs(budget_vm_share_get(0) - 0.5) < 1e-9);
+
+  // missing target: share grows every period up to the boost limit
+  sim_qdelay[0] = 500;
+  prev = budget_vm_share_get(0);
+  for (i = 0; i < 5; i++) {
+    sim_run(2, 1, demand);
+    cur = budget_vm_share_get(0);
+    grows = grows && cur > prev;
+    prev = cur;
+  }
+  test_assert("share grows while missing slo", grows);
+  sim_run(2, 100, demand);
+  test_assert("boost limited", budget_vm_share_get(0) < 0.95);
+  test_assert("boosted vm consumed more", consumed_frac(0, 2) > 0.9);
+
+  // target met again: back to the configured split
+  sim_qdelay[0] = 50;
+  sim_run(2, 500, demand);
+  test_assert("share back after meeting slo",
+      fabs(budget_vm_share_get(0) - 0.5) < 1e-9);
+
+  // vm without target is not affected by its delay
+  sim_qdelay[1] = 1000;
+  sim_run(2, 10, demand);
+  test_assert("no slo no boost", fabs(budget_vm_share_get(1) - 0.5) < 1e-9);
+}
+
+void test_sp_churn(void *arg)
+{
+  const int64_t demand[2] = { SIM_SATURATED, SIM_SATURATED };
+  const unsigned opens[2] = { 0, 2 * SIM_CORES * SIM_PERIOD / SIM_OPEN_COST };
+  double free_frac;
+
+  // vm 1 opens connections worth twice the fast path capacity per period
+  sim_init(2);
+  config.bu_max_budget = 10 * SIM_PERIOD;
+  sim_run_churn(2, 100, demand, opens, 0);
+  free_frac = total_frac(0, 2);
+  test_assert("free slow path hurts vm 0", free_frac < 0.3);
+
+  sim_init(2);
+  config.bu_max_budget = 10 * SIM_PERIOD;
+  sim_run_churn(2, 1000, demand, opens, 1);
+  test_assert("charged slow path isolates vm 0",
+      fabs(total_frac(0, 2) - 0.5) < 0.05);
+  test_assert("churn throttled",
+      sim_sp_used[1] < 1000 * SIM_CORES * SIM_PERIOD / 2 * 1.05);
+  test_assert("charged cycles reported",
+      budget_vm_sp_cycles(1) == sim_sp_used[1]);
+  test_assert("vm 0 not charged", budget_vm_sp_cycles(0) == 0);
+}
+
+void test_telemetry(void *arg)
+{
+  const int64_t demand[2] = { SIM_SATURATED, 0 };
+  const unsigned window = BUDGET_DEBUG_WINDOW_US / SIM_PERIOD;
+  struct tas_telemetry *t;
+
+  sim_init(2);
+  t = calloc(1, sizeof(*t));
+  tas_telemetry = t;
+
+  sim_run(2, 2 * window, demand);
+  test_assert("nothing published while off", t->seq == 0 && t->windows == 0);
+
+  config.bu_telemetry = CONFIG_BU_TELEMETRY_SHM;
+  sim_run(2, window + 2, demand);
+  test_assert("one window published", t->windows == 1 && t->seq == 2);
+  test_assert("window length", t->end_us - t->start_us >= BUDGET_DEBUG_WINDOW_US);
+  test_assert("cores", t->num_cores == SIM_CORES);
+  test_assert("vms", t->vm_count == 2 && t->vm_ids[1] == 1);
+  test_assert("one sample per update",
+      t->vms[1][0].consumed.count == t->intervals && t->intervals >= window);
+  test_assert("busy vm consumed", t->vms[0][0].consumed.sum > 0);
+  test_assert("idle vm consumed nothing", t->vms[0][1].consumed.sum == 0);
+  test_assert("busy vm uses what it gets",
+      t->vms[0][0].distributed_used.min_tenths >= 990);
+
+  config.bu_telemetry = CONFIG_BU_TELEMETRY_OFF;
+  sim_run(2, 2 * window, demand);
+  test_assert("nothing published after off", t->windows == 1);
+
+  tas_telemetry = NULL;
+  free(t);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("weights", test_weights, NULL))
+    ret = 1;
+
+  if (test_subcase("min/max shares", test_shares, NULL))
+    ret = 1;
+
+  if (test_subcase("idle vm capped", test_idle_capped, NULL))
+    ret = 1;
+
+  if (test_subcase("slo feedback", test_slo_feedback, NULL))
+    ret = 1;
+
+  if (test_subcase("slow path churn", test_sp_churn, NULL))
+    ret = 1;
+
+  if (test_subcase("telemetry", test_telemetry, NULL))
+    ret = 1;
+
+  return ret;
+}
@@ -0,0 +1,130 @@
+/*
+ * Fast path budget accounting test: charges loop phases to VMs with
+ * fast_budget_spend and checks that cycles are split by the phase counters,
+ * that no cycles are lost to rounding, and that the remainder rotates
+ * between the charged VMs.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tas.h>
+#include <fastpath.h>
+
+#include "../testutils.h"
+#include "../../tas/fast/internal.h"
+#include "../../tas/fast/fastemu.h"
+
+/* Redefined so tests compile properly */
+struct configuration config;
+_Atomic uint16_t tas_registered_vm_count;
+uint16_t tas_registered_vm_ids[FLEXNIC_PL_VMST_NUM];
+
+static struct dataplane_context *ctx_init(unsigned vms)
+{
+  struct dataplane_context *ctx;
+  unsigned i;
+
+  ctx = test_zalloc(sizeof(*ctx));
+  for (i = 0; i < vms; i++) {
+    tas_registered_vm_ids[i] = i + 1;
+  }
+  tas_registered_vm_count = vms;
+  return ctx;
+}
+
+static void charge(struct dataplane_context *ctx, int vmid, int n)
+{
+  ctx->vm_counters[vmid] += n;
+  ctx->counters_total += n;
+}
+
+void test_layout(void *arg)
+{
+  test_assert("granted and consumed on separate lines",
+      offsetof(struct vm_budget, consumed) -
+      offsetof(struct vm_budget, granted) >= 64);
+  test_assert("consumed line aligned",
+      offsetof(struct vm_budget, consumed) % 64 == 0);
+  test_assert("budgets do not share lines", sizeof(struct vm_budget) % 64 == 0);
+  test_assert("budget array aligned",
+      offsetof(struct dataplane_context, budgets) % 64 == 0);
+}
+
+void test_split(void *arg)
+{
+  struct dataplane_context *ctx = ctx_init(3);
+
+  // 1:2:1 split of 4000 cycles
+  charge(ctx, 1, 1);
+  charge(ctx, 2, 2);
+  charge(ctx, 3, 1);
+  fast_budget_spend(ctx, 4000);
+
+  test_assert("vm 1 share", ctx->budgets[1].consumed == 1000);
+  test_assert("vm 2 share", ctx->budgets[2].consumed == 2000);
+  test_assert("vm 3 share", ctx->budgets[3].consumed == 1000);
+  test_assert("counters reset", ctx->counters_total == 0 &&
+      ctx->vm_counters[1] == 0 && ctx->vm_counters[2] == 0);
+
+  // VMs without work in the phase pay nothing
+  charge(ctx, 2, 5);
+  fast_budget_spend(ctx, 300);
+  test_assert("only vm 2 charged", ctx->budgets[1].consumed == 1000 &&
+      ctx->budgets[2].consumed == 2300 && ctx->budgets[3].consumed == 1000);
+
+  // work without budget only counts as work conserving
+  ctx->wc_counters[3] = 1;
+  ctx->wc_counters_total = 1;
+  fast_budget_spend(ctx, 50);
+  test_assert("wc not charged", ctx->budgets[3].consumed == 1000);
+  test_assert("wc counted", ctx->budgets[3].wc_consumed == 50);
+  free(ctx);
+}
+
+void test_remainder(void *arg)
+{
+  struct dataplane_context *ctx = ctx_init(3);
+  int64_t sum, got[3];
+  unsigned i, round;
+
+  // 100 cycles in thirds leaves a remainder in every phase
+  for (round = 0; round < 300; round++) {
+    charge(ctx, 1, 1);
+    charge(ctx, 2, 1);
+    charge(ctx, 3, 1);
+    fast_budget_spend(ctx, 100);
+
+    sum = 0;
+    for (i = 0; i < 3; i++) {
+      sum += ctx->budgets[i + 1].consumed;
+    }
+    test_assert("no cycles lost", sum == 100 * (round + 1));
+  }
+
+  // each VM got the remainder equally often
+  for (i = 0; i < 3; i++) {
+    got[i] = ctx->budgets[i + 1].consumed;
+    printf("  vm %u: %ld cycles\n", i + 1, (long) got[i]);
+  }
+  test_assert("remainder spread", got[0] == 10000 && got[1] == 10000 &&
+      got[2] == 10000);
+  free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("budget layout", test_layout, NULL))
+    ret = 1;
+
+  if (test_subcase("split by counters", test_split, NULL))
+    ret = 1;
+
+  if (test_subcase("rounding remainder", test_remainder, NULL))
+    ret = 1;
+
+  return ret;
+}
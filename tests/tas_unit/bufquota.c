@@ -0,0 +1,190 @@
+/*
+ * Overload test for per-VM transmit buffer quotas. One core's buffers are
+ * simulated with real mbuf pools: an aggressive VM tries to transmit far more
+ * than the NIC drains, while a second VM sends and receives at a low rate.
+ * Without quotas the aggressive VM's in-flight segments take the whole shared
+ * pool, so the NIC cannot refill its receive ring and the other VM's packets
+ * are dropped. With quotas both VMs transmit from their own pools and the
+ * shared pool stays available for receiving.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_eal.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include <tas.h>
+#include <fastpath.h>
+
+#include "../testutils.h"
+#include "../../tas/fast/network.h"
+
+#define SIM_ROUNDS 10000
+#define SIM_SHARED_MBUFS 256
+#define SIM_VM_MBUFS 64
+/* segments the NIC transmits and frees per round */
+#define SIM_NIC_DRAIN 16
+#define SIM_NIC_QUEUE (2 * SIM_SHARED_MBUFS + 2 * SIM_VM_MBUFS)
+#define SIM_AGGR_TX 48
+#define SIM_VICTIM_TX 4
+#define SIM_VICTIM_RX 8
+
+#define VM_AGGR 0
+#define VM_VICTIM 1
+
+/* Redefined so tests compile properly */
+struct configuration config;
+uint8_t net_port_id;
+uint16_t rss_reta_size;
+
+struct sim_result {
+  uint64_t tx[2];
+  uint64_t backpressure[2];
+  uint64_t rx;
+  uint64_t rx_drops;
+};
+
+/* segments handed to the NIC but not transmitted yet, in order */
+static struct network_buf_handle *nic_queue[SIM_NIC_QUEUE];
+static unsigned nic_head, nic_num;
+
+static void nic_drain(unsigned num)
+{
+  for (; num > 0 && nic_num > 0; num--, nic_num--) {
+    network_free(1, &nic_queue[nic_head]);
+    nic_head = (nic_head + 1) % SIM_NIC_QUEUE;
+  }
+}
+
+/* allocate a transmit buffer the way poll_qman does, and queue it */
+static void sim_tx(struct network_thread *t, uint16_t vmid,
+    struct sim_result *res)
+{
+  struct network_buf_handle *bh;
+  int n;
+
+  if (t->vm_pools[vmid] != NULL)
+    n = network_buf_alloc_vm(t, vmid, 1, &bh);
+  else
+    n = network_buf_alloc(t, 1, &bh);
+
+  if (n != 1) {
+    res->backpressure[vmid]++;
+    return;
+  }
+
+  test_assert("nic queue overflow", nic_num < SIM_NIC_QUEUE);
+  nic_queue[(nic_head + nic_num) % SIM_NIC_QUEUE] = bh;
+  nic_num++;
+  res->tx[vmid]++;
+}
+
+static void sim_run(int quotas, struct sim_result *res)
+{
+  struct network_thread t;
+  struct network_buf_handle *bh;
+  unsigned r, i;
+
+  memset(&t, 0, sizeof(t));
+  memset(res, 0, sizeof(*res));
+  nic_head = nic_num = 0;
+
+  t.pool = rte_pktmbuf_pool_create("shared", SIM_SHARED_MBUFS, 0, 0,
+      RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+  test_assert("shared pool", t.pool != NULL);
+  if (quotas) {
+    t.vm_pools[VM_AGGR] = rte_pktmbuf_pool_create("vm0", SIM_VM_MBUFS, 0, 0,
+        RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+    t.vm_pools[VM_VICTIM] = rte_pktmbuf_pool_create("vm1", SIM_VM_MBUFS, 0,
+        0, RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+    test_assert("vm pools", t.vm_pools[VM_AGGR] != NULL &&
+        t.vm_pools[VM_VICTIM] != NULL);
+  }
+
+  for (r = 0; r < SIM_ROUNDS; r++) {
+    nic_drain(SIM_NIC_DRAIN);
+
+    /* the queue manager interleaves the two VMs */
+    for (i = 0; i < SIM_AGGR_TX; i++) {
+      sim_tx(&t, VM_AGGR, res);
+      if (i < SIM_VICTIM_TX)
+        sim_tx(&t, VM_VICTIM, res);
+    }
+
+    /* NIC refills its receive ring for the victim's packets */
+    for (i = 0; i < SIM_VICTIM_RX; i++) {
+      if (network_buf_alloc(&t, 1, &bh) != 1) {
+        res->rx_drops++;
+        continue;
+      }
+      res->rx++;
+      network_free(1, &bh);
+    }
+  }
+
+  /* all buffers go back to the pool they came from */
+  nic_drain(nic_num);
+  test_assert("shared pool complete",
+      rte_mempool_avail_count(t.pool) == SIM_SHARED_MBUFS);
+  if (quotas) {
+    test_assert("vm pools complete",
+        rte_mempool_avail_count(t.vm_pools[VM_AGGR]) == SIM_VM_MBUFS &&
+        rte_mempool_avail_count(t.vm_pools[VM_VICTIM]) == SIM_VM_MBUFS);
+  }
+
+  printf("  %s: aggressive tx=%"PRIu64" bp=%"PRIu64", victim tx=%"PRIu64
+      " bp=%"PRIu64" rx=%"PRIu64" drops=%"PRIu64"\n",
+      quotas ? "quotas" : "shared",
+      res->tx[VM_AGGR], res->backpressure[VM_AGGR], res->tx[VM_VICTIM],
+      res->backpressure[VM_VICTIM], res->rx, res->rx_drops);
+}
+
+void test_shared(void *arg)
+{
+  struct sim_result res;
+
+  test_assert("rte_eal_init", rte_eal_init(3, arg) > -1);
+  sim_run(0, &res);
+
+  /* confirms the scenario overloads the shared pool */
+  test_assert("victim loses most receives", res.rx < res.rx_drops);
+}
+
+void test_quotas(void *arg)
+{
+  struct sim_result res;
+  const uint64_t victim_tx = (uint64_t) SIM_ROUNDS * SIM_VICTIM_TX;
+  const uint64_t victim_rx = (uint64_t) SIM_ROUNDS * SIM_VICTIM_RX;
+
+  test_assert("rte_eal_init", rte_eal_init(3, arg) > -1);
+  sim_run(1, &res);
+
+  test_assert("no receive drops", res.rx_drops == 0 && res.rx == victim_rx);
+  test_assert("victim tx holds", res.tx[VM_VICTIM] >= victim_tx * 95 / 100);
+  test_assert("aggressive vm backpressured", res.backpressure[VM_AGGR] > 0);
+  test_assert("nic saturated", res.tx[VM_AGGR] + res.tx[VM_VICTIM] >=
+      (uint64_t) SIM_ROUNDS * SIM_NIC_DRAIN * 95 / 100);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+  char *dpdk_args[3];
+
+  // Create dpdk args to disable eal logging
+  dpdk_args[0] = argv[0];
+  dpdk_args[1] = "--log-level";
+  dpdk_args[2] = "lib.eal:error";
+
+  if (test_subcase("shared pool", test_shared, dpdk_args))
+    ret = 1;
+
+  if (test_subcase("vm quotas", test_quotas, dpdk_args))
+    ret = 1;
+
+  return ret;
+}
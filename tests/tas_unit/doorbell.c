@@ -0,0 +1,156 @@
+/*
+ * Shared memory doorbell test: checks that writers only see the sleeping
+ * state once per sleep, that an owner rung before switching to the futex
+ * does not sleep, that futex sleepers are woken by a ring from another
+ * thread, and the bounds of the adaptive spin interval.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils_doorbell.h>
+
+#include "../testutils.h"
+
+static struct util_doorbell db;
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void test_ring_once(void *arg)
+{
+  memset(&db, 0, sizeof(db));
+  test_assert("awake owner needs no wakeup",
+      util_doorbell_ring(&db) == UTIL_DOORBELL_AWAKE);
+
+  util_doorbell_prepare(&db, UTIL_DOORBELL_SLEEP_FD);
+  test_assert("first writer sees fd sleeper",
+      util_doorbell_ring(&db) == UTIL_DOORBELL_SLEEP_FD);
+  test_assert("second writer sees owner awake",
+      util_doorbell_ring(&db) == UTIL_DOORBELL_AWAKE);
+  test_assert("ring leaves owner awake", db.state == UTIL_DOORBELL_AWAKE);
+
+  // owner found work itself after preparing
+  util_doorbell_prepare(&db, UTIL_DOORBELL_SLEEP_FD);
+  util_doorbell_cancel(&db);
+  test_assert("cancelled sleep needs no wakeup",
+      util_doorbell_ring(&db) == UTIL_DOORBELL_AWAKE);
+}
+
+void test_rung_before_futex(void *arg)
+{
+  uint64_t start;
+
+  memset(&db, 0, sizeof(db));
+  util_doorbell_prepare(&db, UTIL_DOORBELL_SLEEP_FD);
+  util_doorbell_ring(&db);
+  test_assert("switch to futex fails after ring",
+      util_doorbell_prepare_futex(&db) == 0);
+
+  // not prepared for the futex, so wait returns right away
+  start = now_ms();
+  util_doorbell_wait(&db, -1);
+  test_assert("no sleep after ring", now_ms() - start < 1000);
+}
+
+void test_timeout(void *arg)
+{
+  uint64_t start;
+
+  memset(&db, 0, sizeof(db));
+  util_doorbell_prepare(&db, UTIL_DOORBELL_SLEEP_FD);
+  test_assert("switch to futex", util_doorbell_prepare_futex(&db) == 1);
+
+  start = now_ms();
+  util_doorbell_wait(&db, 20);
+  test_assert("timeout expired", now_ms() - start >= 10);
+  test_assert("still marked sleeping", db.state == UTIL_DOORBELL_SLEEP_FUTEX);
+
+  util_doorbell_cancel(&db);
+  test_assert("cancel after timeout", db.state == UTIL_DOORBELL_AWAKE);
+}
+
+static void *ring_thread(void *arg)
+{
+  uint32_t *prev = arg;
+
+  while (db.state != UTIL_DOORBELL_SLEEP_FUTEX);
+  usleep(10000);
+  *prev = util_doorbell_ring(&db);
+  return NULL;
+}
+
+void test_futex_wakeup(void *arg)
+{
+  pthread_t t;
+  uint32_t prev = UTIL_DOORBELL_AWAKE;
+
+  memset(&db, 0, sizeof(db));
+  test_assert("start ringer", pthread_create(&t, NULL, ring_thread, &prev) == 0);
+
+  util_doorbell_prepare(&db, UTIL_DOORBELL_SLEEP_FD);
+  test_assert("switch to futex", util_doorbell_prepare_futex(&db) == 1);
+  util_doorbell_wait(&db, -1);
+
+  pthread_join(t, NULL);
+  test_assert("writer saw futex sleeper", prev == UTIL_DOORBELL_SLEEP_FUTEX);
+  test_assert("woken owner awake", db.state == UTIL_DOORBELL_AWAKE);
+}
+
+void test_adapt(void *arg)
+{
+  uint64_t base = 100, spin = base;
+  unsigned i;
+
+  // short sleeps double the interval up to the cap
+  util_doorbell_adapt(&spin, base, 50);
+  test_assert("short sleep doubles", spin == 200);
+  for (i = 0; i < 10; i++) {
+    util_doorbell_adapt(&spin, base, 1);
+  }
+  test_assert("capped", spin == base * UTIL_DOORBELL_SPIN_MAX_FACTOR);
+
+  // sleeps of about the interval keep it
+  util_doorbell_adapt(&spin, base, spin * 2);
+  test_assert("medium sleep keeps", spin == base * UTIL_DOORBELL_SPIN_MAX_FACTOR);
+
+  // long sleeps halve it, but not below the base
+  util_doorbell_adapt(&spin, base, 1000000);
+  test_assert("long sleep halves",
+      spin == base * UTIL_DOORBELL_SPIN_MAX_FACTOR / 2);
+  for (i = 0; i < 10; i++) {
+    util_doorbell_adapt(&spin, base, 1000000);
+  }
+  test_assert("not below base", spin == base);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("ring once per sleep", test_ring_once, NULL))
+    ret = 1;
+
+  if (test_subcase("rung before futex", test_rung_before_futex, NULL))
+    ret = 1;
+
+  if (test_subcase("futex timeout", test_timeout, NULL))
+    ret = 1;
+
+  if (test_subcase("futex wakeup", test_futex_wakeup, NULL))
+    ret = 1;
+
+  if (test_subcase("adaptive spin", test_adapt, NULL))
+    ret = 1;
+
+  return ret;
+}
@@ -33,6 +33,9 @@ void **vm_shm = (void *) 0;
 
 struct flextcp_pl_mem state_base;
 struct flextcp_pl_mem *fp_state = &state_base;
+static struct flextcp_pl_flowst test_flowst[16];
+struct flextcp_pl_flowst *fp_flowst = test_flowst;
+uint32_t fp_flowst_num = 16;
 
 struct dataplane_context **ctxs = NULL;
 struct configuration config;
@@ -70,7 +73,7 @@ void notify_fastpath_core(unsigned core)
 /* initialize basic flow state */
 static void flow_init(uint32_t fid, uint32_t rxlen, uint32_t txlen, uint64_t opaque)
 {
-  struct flextcp_pl_flowst *fs = &state_base.flowst[fid];
+  struct flextcp_pl_flowst *fs = &fp_flowst[fid];
   void *rxbuf = mmap(NULL, rxlen, PROT_READ | PROT_WRITE,
       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
   void *txbuf = mmap(NULL, rxlen, PROT_READ | PROT_WRITE,
@@ -104,7 +107,7 @@ static struct rte_mbuf *mbuf_alloc(void)
 void test_txbump_small(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -128,7 +131,7 @@ void test_txbump_small(void *arg)
 void test_txbump_full(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -152,7 +155,7 @@ void test_txbump_full(void *arg)
 void test_txbump_toolong(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -169,7 +172,7 @@ void test_txbump_toolong(void *arg)
 void test_rxbump_toolong(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -192,7 +195,7 @@ void test_rxbump_toolong(void *arg)
 void test_rxbump_fc_reopen_notx(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -218,7 +221,7 @@ void test_rxbump_fc_reopen_notx(void *arg)
 void test_rxbump_fc_reopen_tx(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -242,7 +245,7 @@ void test_rxbump_fc_reopen_tx(void *arg)
 void test_rxbump_fc_reopen_deadlock(void *arg)
 {
   int ret;
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -265,7 +268,7 @@ void test_rxbump_fc_reopen_deadlock(void *arg)
 
 void test_retransmit(void *arg)
 {
-  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowst *fs = &fp_flowst[0];
   struct dataplane_context ctx;
   memset(&ctx, 0, sizeof(ctx));
 
@@ -298,6 +301,7 @@ int main(int argc, char *argv[])
   int ret = 0;
 
   memset(&state_base, 0, sizeof(state_base));
+  memset(test_flowst, 0, sizeof(test_flowst));
 
   if (test_subcase("tx bump small", test_txbump_small, NULL))
     ret = 1;
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../testutils.h"
+#include "../../include/tas_memif.h"
+
+struct layout_params {
+  uint32_t flows;
+  uint32_t cores;
+};
+
+void test_layout(void *arg)
+{
+  struct layout_params *p = arg;
+  struct flexnic_info info;
+  uint64_t total;
+
+  memset(&info, 0, sizeof(info));
+  total = flexnic_info_layout(&info, p->flows, p->cores);
+
+  test_assert("flow count recorded", info.flowst_num == p->flows);
+  test_assert("core count recorded", info.corest_num == p->cores);
+  test_assert("ht entries power of two",
+      (info.flowht_entries & (info.flowht_entries - 1)) == 0);
+  test_assert("ht at least two entries per flow",
+      info.flowht_entries >= 2 * (uint64_t) p->flows);
+  test_assert("ht at least one bucket neighborhood",
+      info.flowht_entries >= FLEXNIC_PL_FLOWHT_NBSZ);
+
+  test_assert("core state page aligned", (info.corest_off & 4095) == 0);
+  test_assert("core state after shared state",
+      info.corest_off >= sizeof(struct flextcp_pl_mem));
+  test_assert("flow state after core state", info.flowst_off >=
+      info.corest_off + p->cores * sizeof(struct flextcp_pl_corest));
+  test_assert("flow state cache line aligned", (info.flowst_off & 63) == 0);
+  test_assert("ht after flow state", info.flowht_off >=
+      info.flowst_off + p->flows * sizeof(struct flextcp_pl_flowst));
+  test_assert("total covers ht", total >= info.flowht_off +
+      info.flowht_entries * sizeof(struct flextcp_pl_flowhte));
+
+  test_assert("limits recorded", flexnic_info_limits_check(&info) == 0);
+}
+
+#define GUARD_BYTES 4096
+
+static int region_check(const uint8_t *p, uint64_t len, uint8_t pat)
+{
+  uint64_t i;
+  for (i = 0; i < len; i++) {
+    if (p[i] != pat)
+      return 0;
+  }
+  return 1;
+}
+
+/* lay out a real internal memory region the way tas/shm.c does, write
+ * every part through the structs TAS uses, and make sure the parts neither
+ * overlap nor run past the end */
+void test_regions(void *arg)
+{
+  struct layout_params *p = arg;
+  struct flexnic_info info;
+  struct flextcp_pl_mem *plm;
+  struct flextcp_pl_corest *cores;
+  struct flextcp_pl_flowst *flows;
+  struct flextcp_pl_flowhte *ht;
+  uint64_t total, corest_len, flowst_len, flowht_len;
+  uint8_t *mem;
+
+  memset(&info, 0, sizeof(info));
+  total = flexnic_info_layout(&info, p->flows, p->cores);
+
+  mem = malloc(total + GUARD_BYTES);
+  test_assert("alloc memory", mem != NULL);
+  memset(mem, 0xff, total + GUARD_BYTES);
+
+  plm = (struct flextcp_pl_mem *) mem;
+  cores = (struct flextcp_pl_corest *) (mem + info.corest_off);
+  flows = (struct flextcp_pl_flowst *) (mem + info.flowst_off);
+  ht = (struct flextcp_pl_flowhte *) (mem + info.flowht_off);
+  corest_len = (uint64_t) info.corest_num * sizeof(*cores);
+  flowst_len = (uint64_t) info.flowst_num * sizeof(*flows);
+  flowht_len = (uint64_t) info.flowht_entries * sizeof(*ht);
+
+  memset(plm, 0x11, sizeof(*plm));
+  memset(cores, 0x22, corest_len);
+  memset(flows, 0x33, flowst_len);
+  memset(ht, 0x44, flowht_len);
+
+  /* last elements are addressable through the structs */
+  cores[info.corest_num - 1].appctx[FLEXNIC_PL_VMST_NUM - 1]
+      [FLEXNIC_PL_APPCTX_NUM - 1].rx_len = 0x22222222;
+  flows[info.flowst_num - 1].rx_len = 0x33333333;
+  ht[info.flowht_entries - 1].flow_hash = 0x44444444;
+
+  test_assert("shared state intact", region_check(mem, sizeof(*plm), 0x11));
+  test_assert("core state intact",
+      region_check((uint8_t *) cores, corest_len, 0x22));
+  test_assert("flow state intact",
+      region_check((uint8_t *) flows, flowst_len, 0x33));
+  test_assert("lookup table intact",
+      region_check((uint8_t *) ht, flowht_len, 0x44));
+  test_assert("guard intact", region_check(mem + total, GUARD_BYTES, 0xff));
+
+  free(mem);
+}
+
+void test_limits(void *arg)
+{
+  struct flexnic_info info;
+
+  memset(&info, 0, sizeof(info));
+  flexnic_info_layout(&info, 1, 1);
+  test_assert("vm limit recorded", info.vmst_num == FLEXNIC_PL_VMST_NUM);
+  test_assert("ctx limit recorded", info.appctx_num == FLEXNIC_PL_APPCTX_NUM);
+  test_assert("matching limits accepted",
+      flexnic_info_limits_check(&info) == 0);
+
+  info.vmst_num++;
+  test_assert("vm mismatch rejected", flexnic_info_limits_check(&info) != 0);
+  info.vmst_num--;
+  info.appctx_num--;
+  test_assert("ctx mismatch rejected", flexnic_info_limits_check(&info) != 0);
+  info.appctx_num++;
+  info.appst_ctx_mcs++;
+  test_assert("core limit mismatch rejected",
+      flexnic_info_limits_check(&info) != 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+  struct layout_params small = { .flows = 1, .cores = 1 };
+  struct layout_params odd = { .flows = 1000, .cores = 3 };
+  struct layout_params dflt = { .flows = FLEXNIC_PL_FLOWST_NUM_DEFAULT,
+    .cores = 32 };
+  struct layout_params large = { .flows = 1024 * 1024, .cores = 8 };
+
+  if (test_subcase("single flow", test_layout, &small))
+    ret = 1;
+
+  if (test_subcase("odd sizes", test_layout, &odd))
+    ret = 1;
+
+  if (test_subcase("default flows", test_layout, &dflt))
+    ret = 1;
+
+  if (test_subcase("1M flows", test_layout, &large))
+    ret = 1;
+
+  if (test_subcase("regions single flow", test_regions, &small))
+    ret = 1;
+
+  if (test_subcase("regions odd sizes", test_regions, &odd))
+    ret = 1;
+
+  if (test_subcase("regions default flows", test_regions, &dflt))
+    ret = 1;
+
+  if (test_subcase("build-time limits", test_limits, NULL))
+    ret = 1;
+
+  return ret;
+}
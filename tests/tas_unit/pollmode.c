@@ -0,0 +1,183 @@
+/*
+ * Adaptive polling policy test. A simulated core with a virtual clock runs
+ * the dataplane loop against Poisson arrivals at several offered loads, once
+ * busy polling, once with the plain interrupt mode (poll for a while, then
+ * block until the next arrival's interrupt), and once with adaptive polling.
+ * Reports the fraction of time spent spinning, paused, and asleep as a proxy
+ * for power, and the delay until arrivals are picked up.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tas.h>
+#include <fastpath.h>
+
+#include "../testutils.h"
+#include "../../tas/fast/internal.h"
+#include "../../tas/fast/fastemu.h"
+
+/* the virtual clock runs at one cycle per ns */
+#define SIM_ITEMS 5000
+#define SIM_ITER_NS 200
+#define SIM_ITEM_NS 500
+/* poll interval before blocking and interrupt wakeup latency */
+#define SIM_POLL_NS 50000
+#define SIM_WAKE_NS 30000
+#define SIM_BACKOFF_NS 5000
+#define SIM_SLEEP_NS 100000
+
+enum sim_policy {
+  POLICY_BUSY,
+  POLICY_INTERRUPT,
+  POLICY_ADAPTIVE,
+};
+
+static const char *policy_names[] = {
+  [POLICY_BUSY] = "busy",
+  [POLICY_INTERRUPT] = "interrupt",
+  [POLICY_ADAPTIVE] = "adaptive",
+};
+
+struct sim_result {
+  double spin;
+  double pause;
+  double sleep;
+  uint64_t lat_p50;
+  uint64_t lat_p99;
+};
+
+static uint64_t lat[SIM_ITEMS];
+static uint64_t rng_state;
+
+static uint64_t sim_expo(uint64_t mean)
+{
+  double u;
+
+  rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  u = ((rng_state >> 11) + 1) / (double) (1ULL << 53);
+  return -log(u) * mean;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void sim_run(enum sim_policy policy, uint64_t gap,
+    struct sim_result *res)
+{
+  struct dataplane_pollmode pm;
+  uint64_t now = 0, start, next_arr, idle_since = 0, wake, p;
+  uint64_t spin = 0, pause = 0, sleep = 0;
+  unsigned items = 0, n;
+  int can_sleep;
+
+  rng_state = 42;
+  next_arr = sim_expo(gap);
+  fast_pollmode_init(&pm, 0, POLLMODE_WINDOW_US * 1000, SIM_BACKOFF_NS,
+      SIM_SLEEP_NS);
+
+  while (items < SIM_ITEMS) {
+    /* one loop iteration, processing everything that arrived */
+    start = now;
+    now += SIM_ITER_NS;
+    for (n = 0; next_arr <= now && items < SIM_ITEMS; n++) {
+      lat[items++] = now - next_arr;
+      next_arr += sim_expo(gap);
+    }
+    now += n * SIM_ITEM_NS;
+    spin += now - start;
+
+    can_sleep = (policy != POLICY_BUSY);
+    if (policy == POLICY_ADAPTIVE) {
+      fast_pollmode_update(&pm, n, now);
+      p = fast_pollmode_backoff(&pm, n == 0);
+      now += p;
+      pause += p;
+      can_sleep = (pm.mode == POLLMODE_SLEEP);
+    }
+
+    if (n != 0 || !can_sleep) {
+      idle_since = now;
+    } else if (now - idle_since > SIM_POLL_NS) {
+      /* block until the next arrival raises an interrupt */
+      if (next_arr > now) {
+        wake = next_arr + SIM_WAKE_NS;
+        sleep += wake - now;
+        now = wake;
+      }
+      idle_since = now;
+    }
+  }
+
+  qsort(lat, SIM_ITEMS, sizeof(lat[0]), cmp_u64);
+  res->spin = (double) spin / now;
+  res->pause = (double) pause / now;
+  res->sleep = (double) sleep / now;
+  res->lat_p50 = lat[SIM_ITEMS / 2];
+  res->lat_p99 = lat[SIM_ITEMS * 99 / 100];
+
+  printf("  gap %7.1fus %-10s spin %5.1f%% pause %5.1f%% sleep %5.1f%% "
+      "delay p50 %6.2fus p99 %6.2fus\n", gap / 1000.0, policy_names[policy],
+      res->spin * 100, res->pause * 100, res->sleep * 100,
+      res->lat_p50 / 1000.0, res->lat_p99 / 1000.0);
+}
+
+void test_dense(void *arg)
+{
+  struct sim_result busy, adaptive;
+
+  sim_run(POLICY_BUSY, 2000, &busy);
+  sim_run(POLICY_ADAPTIVE, 2000, &adaptive);
+
+  test_assert("adaptive never sleeps", adaptive.sleep == 0);
+  test_assert("adaptive delay close to busy polling",
+      adaptive.lat_p99 <= busy.lat_p99 + SIM_BACKOFF_NS);
+}
+
+void test_medium(void *arg)
+{
+  struct sim_result busy, intr, adaptive;
+
+  sim_run(POLICY_BUSY, 20000, &busy);
+  sim_run(POLICY_INTERRUPT, 20000, &intr);
+  sim_run(POLICY_ADAPTIVE, 20000, &adaptive);
+
+  test_assert("adaptive never sleeps", adaptive.sleep == 0);
+  test_assert("adaptive backs off", adaptive.pause > 0.5);
+  test_assert("adaptive delay bounded by back-off target",
+      adaptive.lat_p99 <= busy.lat_p99 + SIM_BACKOFF_NS + SIM_ITER_NS);
+  test_assert("interrupts add wakeup delay", intr.lat_p99 > adaptive.lat_p99);
+}
+
+void test_sparse(void *arg)
+{
+  struct sim_result busy, intr, adaptive;
+
+  sim_run(POLICY_BUSY, 2000000, &busy);
+  sim_run(POLICY_INTERRUPT, 2000000, &intr);
+  sim_run(POLICY_ADAPTIVE, 2000000, &adaptive);
+
+  test_assert("adaptive sleeps", adaptive.sleep > 0.9);
+  test_assert("adaptive spins less", adaptive.spin <= intr.spin);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("dense arrivals", test_dense, NULL))
+    ret = 1;
+
+  if (test_subcase("medium arrivals", test_medium, NULL))
+    ret = 1;
+
+  if (test_subcase("sparse arrivals", test_sparse, NULL))
+    ret = 1;
+
+  return ret;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include <rte_malloc.h>
+#include <rte_cycles.h>
 
 #include <tas.h>
 #include <fastpath.h>
@@ -14,6 +15,16 @@
 
 #define TEST_TCP_MSS 64
 #define TEST_BATCH_SIZE 4
+#define TEST_DRR_QUANTUM 1500
+#define TEST_DRR_ROUNDS 4096
+#define TEST_DRR_VMS 3
+#define TEST_WHEEL_CHUNK 1000
+#define TEST_WHEEL_FLOWS 3
+#define TEST_WHEEL_RUN_NS 200000000ULL
+
+/* Redefined so tests compile properly */
+struct configuration config;
+uint32_t fp_flowst_num = FLEXNIC_PL_FLOWST_NUM_DEFAULT;
 
 
 void test_qman_rr_base(void *arg) 
@@ -30,7 +41,7 @@ void test_qman_rr_base(void *arg)
   test_assert("rte_eal_init", ret > -1);
 
   // Allocate memory for one context in 1 core
-  ctx = rte_calloc("context", 1, sizeof(ctx), 0);
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
 
   ret = tas_qman_thread_init(ctx);
   test_assert("init qman thread", ret > -1);
@@ -99,7 +110,7 @@ void test_qman_rr_full_loop(void *arg)
   test_assert("rte_eal_init", ret > -1);
 
   // Allocate memory for one context in 1 core
-  ctx = rte_calloc("context", 1, sizeof(ctx), 0);
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
 
   ret = tas_qman_thread_init(ctx);
   test_assert("init qman thread", ret > -1);
@@ -203,7 +214,7 @@ void test_qman_rr_mix_round(void *arg) {
   test_assert("rte_eal_init", ret > -1);
 
   // Allocate memory for one context in 1 core
-  ctx = rte_calloc("context", 1, sizeof(ctx), 0);
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
 
   ret = tas_qman_thread_init(ctx);
   test_assert("init qman thread", ret > -1);
@@ -274,6 +285,329 @@ void test_qman_rr_mix_round(void *arg) {
   rte_free(ctx);
 }
 
+/** Jain's fairness index over per-VM bytes normalized by weight */
+static double drr_fairness(uint64_t *bytes, uint32_t *weights, unsigned n)
+{
+  unsigned i;
+  double x, sum = 0, sum_sq = 0;
+
+  for (i = 0; i < n; i++) {
+    x = (double) bytes[i] / weights[i];
+    sum += x;
+    sum_sq += x * x;
+  }
+
+  return (sum * sum) / (n * sum_sq);
+}
+
+/** Keep 3 VMs with different segment sizes backlogged, return bytes sent */
+static void drr_run(uint32_t quantum, uint32_t *weights, uint64_t *bytes)
+{
+  static const uint16_t chunks[TEST_DRR_VMS] = { 64, 8192, 1448 };
+  static const unsigned flows[TEST_DRR_VMS] = { 4, 4, 2 };
+  struct qman_thread *t;
+  struct dataplane_context *ctx;
+  uint16_t q_bytes[TEST_BATCH_SIZE];
+  unsigned vm_ids[TEST_BATCH_SIZE], q_ids[TEST_BATCH_SIZE];
+  unsigned i, j, n, round;
+  int ret;
+
+  config.fp_vm_quantum = quantum;
+  for (i = 0; i < TEST_DRR_VMS; i++) {
+    config.fp_vm_weights[i + 1] = weights[i];
+    bytes[i] = 0;
+  }
+
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    ctx->budgets[i].granted = 1;
+  }
+
+  ret = tas_qman_thread_init(ctx);
+  test_assert("init qman thread", ret > -1);
+  t = &ctx->qman;
+
+  for (i = 0; i < TEST_DRR_VMS; i++) {
+    for (j = 0; j < flows[i]; j++) {
+      tas_qman_set(t, i + 1, j, 0, 4 * chunks[i], chunks[i],
+          QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+    }
+  }
+
+  // Poll and immediately refill, so every VM stays backlogged
+  for (round = 0; round < TEST_DRR_ROUNDS; round++) {
+    n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+    for (i = 0; i < n; i++) {
+      bytes[vm_ids[i] - 1] += q_bytes[i];
+      tas_qman_set(t, vm_ids[i], q_ids[i], 0, q_bytes[i], 0, QMAN_ADD_AVAIL);
+    }
+  }
+
+  qman_free_vm_cont(ctx);
+  rte_free(ctx);
+}
+
+void test_qman_drr_fairness(void *arg)
+{
+  uint32_t equal[TEST_DRR_VMS] = { 1, 1, 1 };
+  uint32_t weighted[TEST_DRR_VMS] = { 1, 1, 2 };
+  uint64_t rr_bytes[TEST_DRR_VMS], drr_bytes[TEST_DRR_VMS];
+  double rr_idx, drr_idx, ratio;
+  int ret;
+
+  ret = rte_eal_init(3, arg);
+  test_assert("rte_eal_init", ret > -1);
+
+  // Plain round robin: VM with large segments gets most of the bytes
+  drr_run(0, equal, rr_bytes);
+  rr_idx = drr_fairness(rr_bytes, equal, TEST_DRR_VMS);
+
+  // DRR with equal weights
+  drr_run(TEST_DRR_QUANTUM, equal, drr_bytes);
+  drr_idx = drr_fairness(drr_bytes, equal, TEST_DRR_VMS);
+  printf("  fairness index: round robin %.3f drr %.3f\n", rr_idx, drr_idx);
+  test_assert("drr fairness index", drr_idx > 0.99);
+  test_assert("drr fairer than round robin", drr_idx > rr_idx);
+
+  // DRR with weight 2 for the third VM
+  drr_run(TEST_DRR_QUANTUM, weighted, drr_bytes);
+  drr_idx = drr_fairness(drr_bytes, weighted, TEST_DRR_VMS);
+  ratio = (double) drr_bytes[2] / drr_bytes[0];
+  test_assert("weighted drr fairness index", drr_idx > 0.99);
+  test_assert("weighted drr share", ratio > 1.9 && ratio < 2.1);
+}
+
+void test_qman_requeue(void *arg)
+{
+  struct dataplane_context *ctx;
+  struct qman_thread *t;
+  uint16_t q_bytes[TEST_BATCH_SIZE];
+  unsigned vm_ids[TEST_BATCH_SIZE], q_ids[TEST_BATCH_SIZE];
+  unsigned i;
+  int n, ret;
+
+  ret = rte_eal_init(3, arg);
+  test_assert("rte_eal_init", ret > -1);
+
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    ctx->budgets[i].granted = 1;
+  }
+  ret = tas_qman_thread_init(ctx);
+  test_assert("init qman thread", ret > -1);
+  t = &ctx->qman;
+
+  tas_qman_set(t, 1, 0, 0, 2 * 64, TEST_TCP_MSS,
+      QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  n = tas_qman_poll(ctx, 1, vm_ids, q_ids, q_bytes);
+  test_assert("one chunk polled", n == 1 && q_bytes[0] == 64);
+  test_assert("chunk billed", ctx->vm_counters[1] == 64 &&
+      ctx->counters_total == 64 && ctx->budgets[1].tx_bytes == 64);
+
+  // Chunk could not be sent: back in the queue and no longer billed
+  ret = tas_qman_requeue(ctx, vm_ids[0], q_ids[0], q_bytes[0]);
+  test_assert("requeue", ret == 0);
+  test_assert("requeued avail", qman_vm_get_avail(ctx, 1) == 2 * 64);
+  test_assert("unbilled", ctx->vm_counters[1] == 0 &&
+      ctx->counters_total == 0 && ctx->budgets[1].tx_bytes == 0);
+
+  // Retries are billed once each
+  n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+  test_assert("both chunks polled", n == 2);
+  test_assert("billed once", ctx->counters_total == 2 * 64 &&
+      ctx->budgets[1].tx_bytes == 2 * 64);
+
+  qman_free_vm_cont(ctx);
+  rte_free(ctx);
+}
+
+void test_qman_requeue_refund(void *arg)
+{
+  struct dataplane_context *ctx;
+  struct qman_thread *t;
+  uint16_t q_bytes[TEST_BATCH_SIZE];
+  unsigned vm_ids[TEST_BATCH_SIZE], q_ids[TEST_BATCH_SIZE];
+  unsigned i;
+  int n, ret;
+
+  ret = rte_eal_init(3, arg);
+  test_assert("rte_eal_init", ret > -1);
+
+  config.fp_vm_quantum = 2 * 64;
+  config.fp_vm_weights[1] = config.fp_vm_weights[2] = 1;
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    ctx->budgets[i].granted = 1;
+  }
+  ret = tas_qman_thread_init(ctx);
+  test_assert("init qman thread", ret > -1);
+  t = &ctx->qman;
+
+  tas_qman_set(t, 1, 0, 0, 8 * 64, 64, QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  tas_qman_set(t, 2, 1, 0, 8 * 64, 64, QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  n = tas_qman_poll(ctx, 1, vm_ids, q_ids, q_bytes);
+  test_assert("one chunk polled", n == 1 && vm_ids[0] == 1);
+
+  // The requeued chunk is refunded, so VM 1 gets a full turn again
+  ret = tas_qman_requeue(ctx, vm_ids[0], q_ids[0], q_bytes[0]);
+  test_assert("requeue", ret == 0);
+  n = tas_qman_poll(ctx, 3, vm_ids, q_ids, q_bytes);
+  test_assert("full turn after requeue", n == 3 && vm_ids[0] == 1 &&
+      vm_ids[1] == 1 && vm_ids[2] == 2);
+  qman_free_vm_cont(ctx);
+
+  // A rate limited flow may resend a requeued chunk right away
+  config.fp_vm_quantum = 0;
+  ret = tas_qman_thread_init(ctx);
+  test_assert("init qman thread", ret > -1);
+  tas_qman_set(t, 1, 0, 1000, 2 * 64, 64,
+      QMAN_SET_RATE | QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+  test_assert("rate limited chunk polled", n == 1);
+  ret = tas_qman_requeue(ctx, vm_ids[0], q_ids[0], q_bytes[0]);
+  test_assert("requeue rate limited", ret == 0);
+  n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+  test_assert("resent without delay", n == 1 && q_ids[0] == 0);
+
+  qman_free_vm_cont(ctx);
+  rte_free(ctx);
+}
+
+static uint64_t now_ns(void)
+{
+  return rte_get_tsc_cycles() * 1000000000ULL / rte_get_tsc_hz();
+}
+
+static struct dataplane_context *wheel_ctx(void)
+{
+  struct dataplane_context *ctx;
+  unsigned i;
+  int ret;
+
+  config.fp_qman = CONFIG_QMAN_WHEEL;
+
+  ctx = rte_calloc("context", 1, sizeof(*ctx), 0);
+  for (i = 0; i < FLEXNIC_PL_VMST_NUM; i++) {
+    ctx->budgets[i].granted = 1;
+  }
+
+  ret = tas_qman_thread_init(ctx);
+  test_assert("init qman thread", ret > -1);
+  return ctx;
+}
+
+void test_qman_wheel_order(void *arg)
+{
+  struct dataplane_context *ctx;
+  struct qman_thread *t;
+  uint16_t q_bytes[TEST_BATCH_SIZE];
+  unsigned vm_ids[TEST_BATCH_SIZE], q_ids[TEST_BATCH_SIZE];
+  unsigned order[2], fired = 0, checked = 0, i, n;
+  uint64_t start, elapsed, fire_ts[2] = { 0, 0 };
+  uint32_t wait;
+  int ret;
+
+  ret = rte_eal_init(3, arg);
+  test_assert("rte_eal_init", ret > -1);
+  ctx = wheel_ctx();
+  t = &ctx->qman;
+
+  // Flow 0 at 1 Mbps, flow 1 at 4 Mbps, two chunks each: second chunks are
+  // due after 8ms and 2ms
+  tas_qman_set(t, 1, 0, 1000, 2 * TEST_WHEEL_CHUNK, TEST_WHEEL_CHUNK,
+      QMAN_SET_RATE | QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  tas_qman_set(t, 1, 1, 4000, 2 * TEST_WHEEL_CHUNK, TEST_WHEEL_CHUNK,
+      QMAN_SET_RATE | QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+
+  n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+  start = now_ns();
+  test_assert("first chunks due immediately", n == 2);
+  test_assert("first chunk sizes",
+      q_bytes[0] == TEST_WHEEL_CHUNK && q_bytes[1] == TEST_WHEEL_CHUNK);
+
+  // Flow 1 is due next, within the current wheel rotation
+  wait = tas_qman_next_ts(t, 0);
+  test_assert("next timestamp flow 1", wait > 1000 && wait <= 2000);
+
+  while (fired < 2 && now_ns() - start < 4 * TEST_WHEEL_RUN_NS) {
+    n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+    for (i = 0; i < n; i++) {
+      test_assert("vm id", vm_ids[i] == 1);
+      test_assert("flow id", q_ids[i] < 2);
+      fire_ts[q_ids[i]] = now_ns() - start;
+      order[fired++] = q_ids[i];
+    }
+
+    // Only flow 0 left, due after the end of the current wheel rotation:
+    // the wakeup must not be reported early
+    if (fired == 1 && !checked) {
+      wait = tas_qman_next_ts(t, 0);
+      elapsed = (now_ns() - start) / 1000;
+      test_assert("next timestamp flow 0 not early",
+          wait + elapsed >= 7000);
+      test_assert("next timestamp flow 0", wait + elapsed <= 8100);
+      checked = 1;
+    }
+  }
+
+  test_assert("both second chunks sent", fired == 2);
+  test_assert("faster flow first", order[0] == 1 && order[1] == 0);
+  test_assert("flow 1 not early", fire_ts[1] >= 1000000);
+  test_assert("flow 0 not early", fire_ts[0] >= 7000000);
+
+  // Everything sent
+  test_assert("nothing left", tas_qman_next_ts(t, 0) == (uint32_t) -1 ||
+      tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes) == 0);
+
+  qman_free_vm_cont(ctx);
+  rte_free(ctx);
+}
+
+void test_qman_wheel_rates(void *arg)
+{
+  static const uint32_t rates[TEST_WHEEL_FLOWS] = { 8000, 16000, 32000 };
+  struct dataplane_context *ctx;
+  struct qman_thread *t;
+  uint16_t q_bytes[TEST_BATCH_SIZE];
+  unsigned vm_ids[TEST_BATCH_SIZE], q_ids[TEST_BATCH_SIZE];
+  uint64_t bytes[TEST_WHEEL_FLOWS] = { 0, 0, 0 }, start, expect;
+  unsigned i, n;
+  int ret;
+
+  ret = rte_eal_init(3, arg);
+  test_assert("rte_eal_init", ret > -1);
+  ctx = wheel_ctx();
+  t = &ctx->qman;
+
+  for (i = 0; i < TEST_WHEEL_FLOWS; i++) {
+    tas_qman_set(t, 1, i, rates[i], 4 * TEST_WHEEL_CHUNK, TEST_WHEEL_CHUNK,
+        QMAN_SET_RATE | QMAN_ADD_AVAIL | QMAN_SET_MAXCHUNK);
+  }
+
+  // Keep flows backlogged by refilling what was sent
+  start = now_ns();
+  while (now_ns() - start < TEST_WHEEL_RUN_NS) {
+    n = tas_qman_poll(ctx, TEST_BATCH_SIZE, vm_ids, q_ids, q_bytes);
+    for (i = 0; i < n; i++) {
+      test_assert("flow id", q_ids[i] < TEST_WHEEL_FLOWS);
+      bytes[q_ids[i]] += q_bytes[i];
+      tas_qman_set(t, vm_ids[i], q_ids[i], 0, q_bytes[i], 0, QMAN_ADD_AVAIL);
+    }
+  }
+
+  // rate in kbps, run time in ns
+  for (i = 0; i < TEST_WHEEL_FLOWS; i++) {
+    expect = rates[i] * TEST_WHEEL_RUN_NS / 8000000ULL;
+    printf("  flow %u: %lu bytes, expected %lu\n", i, bytes[i], expect);
+    test_assert("rate not exceeded", bytes[i] <= expect * 11 / 10 +
+        TEST_WHEEL_CHUNK);
+    test_assert("rate reached", bytes[i] >= expect * 9 / 10);
+  }
+
+  qman_free_vm_cont(ctx);
+  rte_free(ctx);
+}
+
 int main(int argc, char *argv[])
 {
   int ret;
@@ -301,5 +635,34 @@ int main(int argc, char *argv[])
     ret = 1;
   }
 
+  if (test_subcase("test_qman_drr_fairness", test_qman_drr_fairness,
+      dpdk_args))
+  {
+    ret = 1;
+  }
+
+  if (test_subcase("test_qman_requeue", test_qman_requeue, dpdk_args))
+  {
+    ret = 1;
+  }
+
+  if (test_subcase("test_qman_requeue_refund", test_qman_requeue_refund,
+      dpdk_args))
+  {
+    ret = 1;
+  }
+
+  if (test_subcase("test_qman_wheel_order", test_qman_wheel_order,
+      dpdk_args))
+  {
+    ret = 1;
+  }
+
+  if (test_subcase("test_qman_wheel_rates", test_qman_wheel_rates,
+      dpdk_args))
+  {
+    ret = 1;
+  }
+
   return ret;
 }
\ No newline at end of file
@@ -31,6 +31,8 @@
 #include <tas_memif.h>
 
 struct flextcp_pl_mem *plm;
+struct flextcp_pl_flowst *flowst;
+uint32_t flowst_num;
 
 /** connect to flexnic shared memory regions */
 static int connect_flexnic(void)
@@ -51,12 +53,18 @@ static int connect_flexnic(void)
   }
   plm = int_mem_start;
 
-  if (info->internal_mem_size < sizeof(*plm)) 
+  if (info->internal_mem_size < info->flowht_off +
+      (uint64_t) info->flowht_entries * sizeof(struct flextcp_pl_flowhte))
   {
     fprintf(stderr, "internal memory smaller than expected\n");
     return -1;
   }
 
+  /* flow state is sized at startup, find it through the info offsets */
+  flowst = (struct flextcp_pl_flowst *) ((uint8_t *) int_mem_start +
+      info->flowst_off);
+  flowst_num = info->flowst_num;
+
   return 0;
 }
 
@@ -108,12 +116,12 @@ static int dump_flow(uint32_t flow_id)
   struct flextcp_pl_flowst *fs;
   uint64_t mac = 0;
 
-  if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
+  if (flow_id >= flowst_num) {
     fprintf(stderr, "dump_appctx: invalid doorbell id %u\n", flow_id);
     return -1;
   }
 
-  fs = &plm->flowst[flow_id];
+  fs = &flowst[flow_id];
 
   /* skip flows without receive and transmit buffers */
   if (fs->rx_len == 0 && fs->tx_len == 0) {
@@ -203,7 +211,7 @@ int main(int argc, char *argv[])
   for (i = 0; i < FLEXNIC_PL_APPCTX_NUM; i++) {
     dump_appctx(i);
   }
-  for (i = 0; i < FLEXNIC_PL_FLOWST_NUM; i++) {
+  for (i = 0; i < flowst_num; i++) {
     dump_flow(i);
   }
 
@@ -0,0 +1,420 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Reads the last budget telemetry window published by TAS (see
+ * tas_telemetry.h) and the accept statistics, and prints them in Prometheus
+ * text format, or as JSON with -j.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <tas_telemetry.h>
+
+#define PREFIX "tas_budget_"
+#define ACCEPT_PREFIX "tas_accept_"
+
+/* Histogram bucket bounds for Prometheus output in percent, the bins in the
+ * shm region are much finer than what is useful to scrape. */
+static const int nonneg_les[] = { 10, 20, 30, 40, 50, 60, 70, 80, 90, 100,
+    200, 500, 1000 };
+static const int signed_les[] = { -1000, -500, -200, -100, -50, 0, 25, 50, 75,
+    100 };
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+
+/** map telemetry region and take a consistent copy of it */
+static int telemetry_read(struct tas_telemetry *t)
+{
+  int fd;
+  uint64_t seq;
+  struct tas_telemetry *shm;
+
+  if ((fd = shm_open(FLEXNIC_NAME_TELEMETRY, O_RDONLY, 0)) == -1) {
+    perror("telemetry_read: shm_open failed");
+    return -1;
+  }
+
+  shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED) {
+    perror("telemetry_read: mmap failed");
+    return -1;
+  }
+
+  if (shm->magic != TAS_TELEMETRY_MAGIC ||
+      shm->version != TAS_TELEMETRY_VERSION)
+  {
+    fprintf(stderr, "telemetry_read: unexpected magic %x or version %u\n",
+        shm->magic, shm->version);
+    munmap(shm, sizeof(*shm));
+    return -1;
+  }
+
+  do {
+    while (((seq = shm->seq) & 1) != 0)
+      sched_yield();
+    __sync_synchronize();
+    memcpy(t, shm, sizeof(*t));
+    __sync_synchronize();
+  } while (shm->seq != seq);
+
+  munmap(shm, sizeof(*shm));
+  return 0;
+}
+
+/** upper bound of a histogram bin in tenths of a percent, INT32_MAX for the
+ * overflow bin */
+static int32_t nonneg_bin_upper(unsigned i)
+{
+  if (i >= BUDGET_DEBUG_NONNEG_REGULAR_BINS)
+    return INT32_MAX;
+  return (i + 1) * BUDGET_DEBUG_PERCENT_BIN_TENTHS;
+}
+
+static int32_t signed_bin_upper(unsigned i)
+{
+  if (i > BUDGET_DEBUG_SIGNED_REGULAR_BINS)
+    return INT32_MAX;
+  return BUDGET_DEBUG_SIGNED_MIN_TENTHS + i * BUDGET_DEBUG_PERCENT_BIN_TENTHS;
+}
+
+/*****************************************************************************/
+/* Prometheus */
+
+static void prom_u64(const char *name, const char *labels,
+    const struct budget_debug_u64_stats *s)
+{
+  char lb[80] = "";
+
+  if (labels[0] != 0)
+    snprintf(lb, sizeof(lb), "{%s}", labels);
+  printf(PREFIX "%s_count%s %"PRIu64"\n", name, lb, s->count);
+  printf(PREFIX "%s_sum%s %"PRIu64"\n", name, lb, s->sum);
+  printf(PREFIX "%s_min%s %"PRIu64"\n", name, lb, s->count > 0 ? s->min : 0);
+  printf(PREFIX "%s_max%s %"PRIu64"\n", name, lb, s->max);
+}
+
+static void prom_hist(const char *name, const char *labels,
+    const uint32_t *bins, unsigned n, int32_t (*upper)(unsigned),
+    const int *les, unsigned les_n, uint64_t count, int64_t sum_tenths)
+{
+  unsigned i, b = 0;
+  uint64_t cum = 0;
+
+  for (i = 0; i < les_n; i++) {
+    for (; b < n && upper(b) <= les[i] * BUDGET_DEBUG_PERCENT_SCALE; b++)
+      cum += bins[b];
+    printf(PREFIX "%s_percent_bucket{%s,le=\"%d\"} %"PRIu64"\n", name, labels,
+        les[i], cum);
+  }
+  printf(PREFIX "%s_percent_bucket{%s,le=\"+Inf\"} %"PRIu64"\n", name, labels,
+      count);
+  printf(PREFIX "%s_percent_sum{%s} %.1f\n", name, labels,
+      (double) sum_tenths / BUDGET_DEBUG_PERCENT_SCALE);
+  printf(PREFIX "%s_percent_count{%s} %"PRIu64"\n", name, labels, count);
+}
+
+static void prom_nonneg(const char *name, const char *labels,
+    const struct budget_debug_pct_nonneg_stats *s)
+{
+  prom_hist(name, labels, s->bins, BUDGET_DEBUG_NONNEG_BIN_COUNT,
+      nonneg_bin_upper, nonneg_les, ARRAY_LEN(nonneg_les), s->count,
+      s->sum_tenths);
+}
+
+static void prom_signed(const char *name, const char *labels,
+    const struct budget_debug_pct_signed_stats *s)
+{
+  prom_hist(name, labels, s->bins, BUDGET_DEBUG_SIGNED_BIN_COUNT,
+      signed_bin_upper, signed_les, ARRAY_LEN(signed_les), s->count,
+      s->sum_tenths);
+}
+
+static void prom_accept(const struct tas_telemetry_accept *a)
+{
+  unsigned i;
+  uint64_t cum = 0;
+
+  printf(ACCEPT_PREFIX "syns %"PRIu64"\n", a->syns);
+  printf(ACCEPT_PREFIX "slot_waits %"PRIu64"\n", a->slot_waits);
+  printf(ACCEPT_PREFIX "slots_posted %"PRIu64"\n", a->slots_posted);
+  printf(ACCEPT_PREFIX "post_entries %"PRIu64"\n", a->post_entries);
+  printf(ACCEPT_PREFIX "accepted %"PRIu64"\n", a->accepted);
+
+  for (i = 0; i < TAS_TELEMETRY_ACCEPT_BINS - 1; i++) {
+    cum += a->latency_bins[i];
+    printf(ACCEPT_PREFIX "latency_us_bucket{le=\"%u\"} %"PRIu64"\n", 1U << i,
+        cum);
+  }
+  printf(ACCEPT_PREFIX "latency_us_bucket{le=\"+Inf\"} %"PRIu64"\n",
+      a->accepted);
+  printf(ACCEPT_PREFIX "latency_us_sum %"PRIu64"\n", a->latency_sum_us);
+  printf(ACCEPT_PREFIX "latency_us_count %"PRIu64"\n", a->accepted);
+}
+
+static void prom_dump(const struct tas_telemetry *t)
+{
+  unsigned c, v;
+  uint16_t vmid;
+  char labels[64];
+  const struct budget_debug_core_window *cw;
+  const struct budget_debug_vm_window *vw;
+
+  prom_accept(&t->accept);
+  if (t->windows == 0)
+    return;
+
+  printf(PREFIX "windows %"PRIu64"\n", t->windows);
+  printf(PREFIX "window_start_us %"PRIu64"\n", t->start_us);
+  printf(PREFIX "window_end_us %"PRIu64"\n", t->end_us);
+  printf(PREFIX "intervals %"PRIu64"\n", t->intervals);
+  printf(PREFIX "max_budget %"PRIu64"\n", t->max_budget);
+  prom_u64("elapsed_cycles", "", &t->elapsed_cycles);
+
+  for (v = 0; v < t->vm_count; v++) {
+    vmid = t->vm_ids[v];
+    printf(PREFIX "slowpath_cycles{vm=\"%u\"} %"PRIu64"\n", vmid,
+        t->vm_sp_cycles[vmid]);
+  }
+
+  for (c = 0; c < t->num_cores; c++) {
+    cw = &t->cores[c];
+    snprintf(labels, sizeof(labels), "core=\"%u\"", c);
+    printf(PREFIX "periods{%s} %"PRIu64"\n", labels, cw->periods);
+    printf(PREFIX "zero_dist_periods{%s} %"PRIu64"\n", labels,
+        cw->zero_dist_periods);
+    prom_u64("consumed_cycles", labels, &cw->consumed);
+    prom_u64("distributed_cycles", labels, &cw->distributed);
+    prom_u64("work_conserving_cycles", labels, &cw->work_conserving);
+    prom_u64("total_consumed_cycles", labels, &cw->total_consumed);
+    prom_nonneg("utilization", labels, &cw->utilization);
+    prom_nonneg("consumed_over_elapsed", labels, &cw->consumed_over_elapsed);
+    prom_nonneg("distributed_over_elapsed", labels,
+        &cw->distributed_over_elapsed);
+    prom_nonneg("work_conserving_utilization", labels,
+        &cw->work_conserving_utilization);
+    prom_nonneg("work_conserving_over_elapsed", labels,
+        &cw->work_conserving_over_elapsed);
+
+    for (v = 0; v < t->vm_count; v++) {
+      vmid = t->vm_ids[v];
+      vw = &t->vms[c][vmid];
+      snprintf(labels, sizeof(labels), "core=\"%u\",vm=\"%u\"", c, vmid);
+      prom_u64("vm_consumed_cycles", labels, &vw->consumed);
+      prom_u64("vm_distributed_cycles", labels, &vw->distributed);
+      prom_u64("vm_work_conserving_cycles", labels, &vw->work_conserving);
+      prom_nonneg("vm_distributed_used", labels, &vw->distributed_used);
+      prom_nonneg("vm_cap_used", labels, &vw->cap_used);
+      prom_nonneg("vm_work_conserving_used", labels,
+          &vw->work_conserving_used);
+      prom_signed("vm_budget_pre", labels, &vw->budget_pre);
+      prom_signed("vm_budget_post", labels, &vw->budget_post);
+    }
+  }
+}
+
+/*****************************************************************************/
+/* JSON */
+
+static void json_u64(const char *name, const struct budget_debug_u64_stats *s,
+    const char *sep)
+{
+  printf("\"%s\":{\"count\":%"PRIu64",\"sum\":%"PRIu64",\"min\":%"PRIu64","
+      "\"max\":%"PRIu64"}%s", name, s->count, s->sum,
+      s->count > 0 ? s->min : 0, s->max, sep);
+}
+
+/* only non-empty bins are listed, as pairs of upper bound in tenths of a
+ * percent (null for the overflow bin) and count */
+static void json_hist(const char *name, const uint32_t *bins, unsigned n,
+    int32_t (*upper)(unsigned), uint64_t count, int64_t sum_tenths,
+    int32_t min_tenths, int32_t max_tenths, const char *sep)
+{
+  unsigned i;
+  int first = 1;
+
+  printf("\"%s\":{\"count\":%"PRIu64",\"sum_tenths\":%"PRId64","
+      "\"min_tenths\":%d,\"max_tenths\":%d,\"bins\":[", name, count,
+      sum_tenths, count > 0 ? min_tenths : 0, count > 0 ? max_tenths : 0);
+  for (i = 0; i < n; i++) {
+    if (bins[i] == 0)
+      continue;
+    if (upper(i) == INT32_MAX)
+      printf("%s[null,%u]", first ? "" : ",", bins[i]);
+    else
+      printf("%s[%d,%u]", first ? "" : ",", upper(i), bins[i]);
+    first = 0;
+  }
+  printf("]}%s", sep);
+}
+
+static void json_nonneg(const char *name,
+    const struct budget_debug_pct_nonneg_stats *s, const char *sep)
+{
+  json_hist(name, s->bins, BUDGET_DEBUG_NONNEG_BIN_COUNT, nonneg_bin_upper,
+      s->count, s->sum_tenths, s->min_tenths, s->max_tenths, sep);
+}
+
+static void json_signed(const char *name,
+    const struct budget_debug_pct_signed_stats *s, const char *sep)
+{
+  json_hist(name, s->bins, BUDGET_DEBUG_SIGNED_BIN_COUNT, signed_bin_upper,
+      s->count, s->sum_tenths, s->min_tenths, s->max_tenths, sep);
+}
+
+/* latency bins as pairs of upper bound in us (null for the overflow bin)
+ * and count, only non-empty bins are listed */
+static void json_accept(const struct tas_telemetry_accept *a)
+{
+  unsigned i;
+  int first = 1;
+
+  printf("{\"syns\":%"PRIu64",\"slot_waits\":%"PRIu64",\"slots_posted\":%"
+      PRIu64",\"post_entries\":%"PRIu64",\"accepted\":%"PRIu64","
+      "\"latency_sum_us\":%"PRIu64",\"latency_bins\":[", a->syns,
+      a->slot_waits, a->slots_posted, a->post_entries, a->accepted,
+      a->latency_sum_us);
+  for (i = 0; i < TAS_TELEMETRY_ACCEPT_BINS; i++) {
+    if (a->latency_bins[i] == 0)
+      continue;
+    if (i == TAS_TELEMETRY_ACCEPT_BINS - 1)
+      printf("%s[null,%"PRIu64"]", first ? "" : ",", a->latency_bins[i]);
+    else
+      printf("%s[%u,%"PRIu64"]", first ? "" : ",", 1U << i,
+          a->latency_bins[i]);
+    first = 0;
+  }
+  printf("]}");
+}
+
+static void json_dump(const struct tas_telemetry *t)
+{
+  unsigned c, v;
+  uint16_t vmid;
+  const struct budget_debug_core_window *cw;
+  const struct budget_debug_vm_window *vw;
+
+  printf("{\"accept\":");
+  json_accept(&t->accept);
+  if (t->windows == 0) {
+    printf("}\n");
+    return;
+  }
+
+  printf(",\"windows\":%"PRIu64",\"start_us\":%"PRIu64",\"end_us\":%"PRIu64","
+      "\"intervals\":%"PRIu64",\"max_budget\":%"PRIu64",", t->windows,
+      t->start_us, t->end_us, t->intervals, t->max_budget);
+  json_u64("elapsed_cycles", &t->elapsed_cycles, ",");
+
+  printf("\"slowpath_cycles\":{");
+  for (v = 0; v < t->vm_count; v++) {
+    vmid = t->vm_ids[v];
+    printf("%s\"%u\":%"PRIu64, v == 0 ? "" : ",", vmid, t->vm_sp_cycles[vmid]);
+  }
+  printf("},\"cores\":[");
+
+  for (c = 0; c < t->num_cores; c++) {
+    cw = &t->cores[c];
+    printf("%s{\"core\":%u,\"periods\":%"PRIu64",\"zero_dist_periods\":%"PRIu64
+        ",", c == 0 ? "" : ",", c, cw->periods, cw->zero_dist_periods);
+    json_u64("consumed", &cw->consumed, ",");
+    json_u64("distributed", &cw->distributed, ",");
+    json_u64("work_conserving", &cw->work_conserving, ",");
+    json_u64("total_consumed", &cw->total_consumed, ",");
+    json_nonneg("utilization", &cw->utilization, ",");
+    json_nonneg("consumed_over_elapsed", &cw->consumed_over_elapsed, ",");
+    json_nonneg("distributed_over_elapsed", &cw->distributed_over_elapsed,
+        ",");
+    json_nonneg("work_conserving_utilization",
+        &cw->work_conserving_utilization, ",");
+    json_nonneg("work_conserving_over_elapsed",
+        &cw->work_conserving_over_elapsed, ",");
+
+    printf("\"vms\":[");
+    for (v = 0; v < t->vm_count; v++) {
+      vmid = t->vm_ids[v];
+      vw = &t->vms[c][vmid];
+      printf("%s{\"vm\":%u,", v == 0 ? "" : ",", vmid);
+      json_u64("consumed", &vw->consumed, ",");
+      json_u64("distributed", &vw->distributed, ",");
+      json_u64("work_conserving", &vw->work_conserving, ",");
+      json_nonneg("distributed_used", &vw->distributed_used, ",");
+      json_nonneg("cap_used", &vw->cap_used, ",");
+      json_nonneg("work_conserving_used", &vw->work_conserving_used, ",");
+      json_signed("budget_pre", &vw->budget_pre, ",");
+      json_signed("budget_post", &vw->budget_post, "}");
+    }
+    printf("]}");
+  }
+  printf("]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, json = 0;
+  struct tas_telemetry *t;
+
+  while ((opt = getopt(argc, argv, "j")) != -1) {
+    switch (opt) {
+      case 'j':
+        json = 1;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-j]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if ((t = malloc(sizeof(*t))) == NULL) {
+    fprintf(stderr, "malloc failed\n");
+    return EXIT_FAILURE;
+  }
+
+  if (telemetry_read(t) != 0) {
+    free(t);
+    return EXIT_FAILURE;
+  }
+
+  /* accept statistics are always there, budget windows only if enabled */
+  if (t->windows == 0) {
+    fprintf(stderr, "no budget telemetry window published, enable with "
+        "--bu-telemetry=shm\n");
+  }
+
+  if (json)
+    json_dump(t);
+  else
+    prom_dump(t);
+
+  free(t);
+  return EXIT_SUCCESS;
+}